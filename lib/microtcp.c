@@ -19,22 +19,120 @@
      */
     
     #include "microtcp.h"
+    #include "microtcp_trace.h"
+    #include "microtcp_probes.h"
+    #include "microtcp_stat.h"
+    #include "microtcp_codec.h"
+    #include "microtcp_lz.h"
     #include "../utils/crc32.h"
+    #include "../utils/siphash.h"
     #include <errno.h>
     #include <limits.h>
     #include <sys/param.h>
     #include <ctype.h>
     #include <stdio.h>
     #include <math.h>
+    #include <time.h>
+    #include <unistd.h>
+    #include <fcntl.h>
+    #include <sys/random.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
     
-    
+    static int udp_socket(void* ctx, int domain, int type, int protocol)
+    {
+        return socket(domain, type, protocol);
+    }
+
+    static int udp_bind(void* ctx, int sd, const struct sockaddr* address, socklen_t address_len)
+    {
+        return bind(sd, address, address_len);
+    }
+
+    static int udp_connect(void* ctx, int sd, const struct sockaddr* address, socklen_t address_len)
+    {
+        return connect(sd, address, address_len);
+    }
+
+    static int udp_getpeername(void* ctx, int sd, struct sockaddr* address, socklen_t* address_len)
+    {
+        return getpeername(sd, address, address_len);
+    }
+
+    static int udp_getsockname(void* ctx, int sd, struct sockaddr* address, socklen_t* address_len)
+    {
+        return getsockname(sd, address, address_len);
+    }
+
+    static ssize_t udp_send(void* ctx, int sd, const void* buffer, size_t length, int flags)
+    {
+        return send(sd, buffer, length, flags);
+    }
+
+    static ssize_t udp_recv(void* ctx, int sd, void* buffer, size_t length, int flags)
+    {
+        return recv(sd, buffer, length, flags);
+    }
+
+    static ssize_t udp_sendto(void* ctx, int sd, const void* buffer, size_t length, int flags,
+        const struct sockaddr* address, socklen_t address_len)
+    {
+        return sendto(sd, buffer, length, flags, address, address_len);
+    }
+
+    static ssize_t udp_recvfrom(void* ctx, int sd, void* buffer, size_t length, int flags,
+        struct sockaddr* address, socklen_t* address_len)
+    {
+        return recvfrom(sd, buffer, length, flags, address, address_len);
+    }
+
+    static ssize_t udp_sendmsg(void* ctx, int sd, const struct msghdr* message, int flags)
+    {
+        return sendmsg(sd, message, flags);
+    }
+
+    static int udp_set_timeout(void* ctx, int sd, uint32_t timeout_us)
+    {
+        struct timeval timeout;
+        timeout.tv_sec = timeout_us / 1000000;
+        timeout.tv_usec = timeout_us % 1000000;
+        return setsockopt(sd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(struct timeval));
+    }
+
+    static int udp_close(void* ctx, int sd)
+    {
+        return close(sd);
+    }
+
+    static const microtcp_transport_t microtcp_udp_transport = {
+        udp_socket, udp_bind, udp_connect, udp_getpeername, udp_getsockname, udp_send, udp_recv,
+        udp_sendto, udp_recvfrom, udp_sendmsg, udp_set_timeout, udp_close, NULL
+    };
+
+    static const microtcp_transport_t* microtcp_default_transport = &microtcp_udp_transport;
+    static microtcp_clock_t microtcp_clock;
+
+    void microtcp_set_transport(const microtcp_transport_t* transport)
+    {
+        microtcp_default_transport = transport ? transport : &microtcp_udp_transport;
+    }
+
+    void microtcp_set_clock(const microtcp_clock_t* clock)
+    {
+        if (clock)
+            microtcp_clock = *clock;
+        else
+            memset(&microtcp_clock, 0, sizeof(microtcp_clock));
+    }
+
     microtcp_sock_t
     microtcp_socket(int domain, int type, int protocol)
     {
         microtcp_sock_t new_sock_t;
         memset(&new_sock_t, 0, sizeof(microtcp_sock_t));
         
-        new_sock_t.sd = socket(domain, type, protocol);
+        new_sock_t.transport = microtcp_default_transport;
+        new_sock_t.sd = new_sock_t.transport->socket(new_sock_t.transport->ctx, domain, type, protocol);
     
         if (new_sock_t.sd == -1)
         {
@@ -43,6 +141,12 @@
         }
         else
             new_sock_t.state = UKNOWN;
+        new_sock_t.recvbuf_len = MICROTCP_RECVBUF_LEN;
+        new_sock_t.recvbuf_max = MICROTCP_RECVBUF_MAX;
+        new_sock_t.syncookies = getenv("MICROTCP_SYNCOOKIES") != NULL;
+        new_sock_t.fastopen = getenv("MICROTCP_FASTOPEN") != NULL;
+        new_sock_t.compact = getenv("MICROTCP_COMPACT") != NULL;
+        new_sock_t.compress = getenv("MICROTCP_COMPRESS") != NULL;
         return new_sock_t;
     }
     
@@ -50,17 +154,89 @@
     microtcp_bind(microtcp_sock_t* socket, const struct sockaddr* address,
         socklen_t address_len)
     {  
-        return bind(socket->sd, address, address_len);
+        return socket->transport->bind(socket->transport->ctx, socket->sd, address, address_len);
+    }
+
+    int microtcp_close(microtcp_sock_t* socket)
+    {
+        microtcp_free_recvbuf(socket);
+        /* Either may be NULL, which would end the list of FREE() */
+        free(socket->deflate_buf);
+        free(socket->inflate_buf);
+        socket->deflate_buf = socket->inflate_buf = NULL;
+        if (socket->state != CLOSED && socket->state != INVALID)
+            microtcp_set_state(socket, INVALID);
+        return socket->transport->close(socket->transport->ctx, socket->sd);
     }
     
-    int
-        microtcp_connect(microtcp_sock_t* clientSocket, const struct sockaddr* serverAddress,
-            socklen_t address_len)
+    /* Fast open cookies the client learned, by server address */
+    static struct {
+        in_addr_t addr;
+        uint32_t cookie;
+    } microtcp_fastopen_cache[MICROTCP_FASTOPEN_CACHE];
+    static unsigned int microtcp_fastopen_next;
+    static char microtcp_fastopen_lock;
+
+    static uint32_t microtcp_fastopen_cache_get(const struct sockaddr* server)
+    {
+        in_addr_t addr = ((const struct sockaddr_in*)server)->sin_addr.s_addr;
+        uint32_t cookie = 0;
+        int i;
+
+        while (__atomic_test_and_set(&microtcp_fastopen_lock, __ATOMIC_ACQUIRE))
+            ;
+        for (i = 0; i < MICROTCP_FASTOPEN_CACHE; i++)
+            if (microtcp_fastopen_cache[i].cookie && microtcp_fastopen_cache[i].addr == addr)
+                cookie = microtcp_fastopen_cache[i].cookie;
+        __atomic_clear(&microtcp_fastopen_lock, __ATOMIC_RELEASE);
+        return cookie;
+    }
+
+    /* A zero cookie forgets the server */
+    static void microtcp_fastopen_cache_put(const struct sockaddr* server, uint32_t cookie)
+    {
+        in_addr_t addr = ((const struct sockaddr_in*)server)->sin_addr.s_addr;
+        int i;
+
+        while (__atomic_test_and_set(&microtcp_fastopen_lock, __ATOMIC_ACQUIRE))
+            ;
+        for (i = 0; i < MICROTCP_FASTOPEN_CACHE; i++)
+            if (microtcp_fastopen_cache[i].cookie && microtcp_fastopen_cache[i].addr == addr)
+                break;
+        if (i == MICROTCP_FASTOPEN_CACHE && cookie)
+            i = microtcp_fastopen_next++ % MICROTCP_FASTOPEN_CACHE;
+        if (i < MICROTCP_FASTOPEN_CACHE) {
+            microtcp_fastopen_cache[i].addr = addr;
+            microtcp_fastopen_cache[i].cookie = cookie;
+        }
+        __atomic_clear(&microtcp_fastopen_lock, __ATOMIC_RELEASE);
+    }
+
+    static ssize_t microtcp_compact_expand(uint8_t* buffer, size_t length, ssize_t received);
+
+    /*
+     * The client side of the 3-way handshake. With fastopen the SYN asks
+     * for a cookie, or if one is cached for the server carries data, up to
+     * one MSS of it. Returns how many bytes of data the server acknowledged
+     * in the SYN/ACK, or -1.
+     */
+    static ssize_t
+    microtcp_handshake(microtcp_sock_t* clientSocket, const struct sockaddr* serverAddress,
+        socklen_t address_len, int fastopen, const void* data, size_t data_len)
     {
         void* buffer;
-        char* received_data;
-        time_t t;
-        int data_size;
+        uint8_t* received_data;
+        ssize_t data_size;
+        ssize_t expanded;
+        int compact_reply = 0;
+        int syn_ack;
+        uint16_t received_header_window;
+        uint64_t syn_stamp;
+        uint64_t syn_sent;
+        uint32_t cookie;
+        uint32_t syn_data_len;
+        ssize_t accepted;
+        int attempt;
 
         if (set_socket_timeout(clientSocket, MICROTCP_ACK_TIMEOUT_US) == -1) {
             fprintf(stderr, "Error: Error in set_socket_timeout.\n");
@@ -68,89 +244,571 @@
          }
     
     
-        srand((unsigned int)time(&t) + 15143);
-        int init_seq_num = rand() % 3000;
-        clientSocket->seq_number = init_seq_num;
+        clientSocket->seq_number = microtcp_isn(serverAddress);
         microtcp_header_t* received_header = malloc(sizeof(microtcp_header_t));
+        cookie = fastopen ? microtcp_fastopen_cache_get(serverAddress) : 0;
+        syn_data_len = cookie && data_len <= MICROTCP_MSS ? data_len : 0;
     
-        buffer = microtcp_create_packet(clientSocket->seq_number, 0, 0, 0, 1, 0, MICROTCP_WIN_SIZE, 0, (void*)0, 0, 0, 0);
-    
-    
-        if ((data_size = sendto(clientSocket->sd, buffer, sizeof(microtcp_header_t),
-            0, serverAddress, address_len)) == -1) {
-            fprintf(stderr, "Error: Something went wrong with SYN send. %s\n", strerror(errno));
-            fprintf(stdout, "sendto SYN in microtcp_connect data size: %d\n", data_size);
-            clientSocket->state = INVALID;
-            FREE(received_header, buffer);
-            return -1;
+        syn_stamp = microtcp_now_us();
+        /* The SYN or the SYN/ACK may be lost, or dropped by a flooded peer */
+        for (attempt = 0; ; attempt++) {
+            buffer = microtcp_create_packet(clientSocket->seq_number, 0, 0, 0, 1, 0, MIN(clientSocket->recvbuf_len, UINT16_MAX),
+                syn_data_len, (char*)data, cookie, 0,
+                (fastopen ? MICROTCP_OPT_FASTOPEN : 0) | (clientSocket->compact ? MICROTCP_OPT_COMPACT : 0)
+                /* Data in the SYN would go out before the peer agreed */
+                | (clientSocket->compress && !syn_data_len ? MICROTCP_OPT_COMPRESS : 0));
+            syn_sent = microtcp_now_us();
+            if ((data_size = microtcp_sock_sendto(clientSocket, buffer, sizeof(microtcp_header_t) + syn_data_len,
+                0, serverAddress, address_len)) == -1) {
+                fprintf(stderr, "Error: Something went wrong with SYN send. %s\n", strerror(errno));
+                fprintf(stdout, "sendto SYN in microtcp_connect data size: %zd\n", data_size);
+                microtcp_set_state(clientSocket, INVALID);
+                FREE(received_header, buffer);
+                return -1;
+            }
+            free(buffer);
+        
+            /* Room for a data segment, see below */
+            buffer = malloc(sizeof(microtcp_header_t) + MICROTCP_MSS);
+            if ((data_size = microtcp_sock_recvfrom(clientSocket, buffer,
+            sizeof(microtcp_header_t) + MICROTCP_MSS, 0, (struct sockaddr*)serverAddress, &address_len)) != -1)
+                break;
+            free(buffer);
+            if (errno != EAGAIN || attempt == MICROTCP_SYN_RETRIES) {
+                if(errno == EAGAIN)
+                    fprintf(stderr, "Error: timeout occured. %s\n", strerror(errno));
+                fprintf(stderr, "Error: Something went wrong with SYN/ACK receive %s\n", strerror(errno));
+                fprintf(stdout, "recvfrom SYN/ACK in microtcp_connect data size: %zd\n", data_size);
+                microtcp_set_state(clientSocket, INVALID);
+                FREE(received_header);
+                return -1;
+            }
         }
-            
-        free(buffer);
-    
-        buffer = malloc(sizeof(microtcp_header_t));
-    
-        if ((data_size = recvfrom(clientSocket->sd, buffer,
-        sizeof(microtcp_header_t), 0, serverAddress, &address_len)) == -1) {
-            if(errno == EAGAIN)
-                fprintf(stderr, "Error: timeout occured. %s\n", strerror(errno));
-            fprintf(stderr, "Error: Something went wrong with SYN/ACK receive %s\n", strerror(errno));
-            fprintf(stdout, "recvfrom SYN/ACK in microtcp_connect data size: %d\n", data_size);
-            clientSocket->state = INVALID;
-            FREE(received_header, buffer);
-            return -1;
-        };
     
-        if (!microtcp_unpack(buffer, received_header, &received_data)) {
+        /* Past the SYN/ACK a server that agreed to compact headers uses them */
+        if (clientSocket->compact) {
+            expanded = microtcp_compact_expand(buffer, sizeof(microtcp_header_t) + MICROTCP_MSS, data_size);
+            compact_reply = expanded != data_size;
+            data_size = expanded;
+        }
+        if (!microtcp_unpack_view(buffer, data_size, received_header, &received_data)) {
             fprintf(stderr,"Error: unpacking failed (at Checksum check)");
-            clientSocket->state = INVALID;
+            microtcp_set_state(clientSocket, INVALID);
             FREE(received_header, buffer);
             return -1;
         }
-        if (!(check_control(received_header, 1, 0, 1, 0) && received_header->ack_number == clientSocket->seq_number + 1)) {
+        /* The server acknowledges the SYN data only if it accepted the cookie */
+        accepted = (uint32_t)(received_header->ack_number - clientSocket->seq_number - 1);
+        syn_ack = check_control(received_header, 1, 0, 1, 0);
+        /*
+         * A server that took the data of the SYN is established once it sent
+         * the SYN/ACK. If that was lost, the retransmitted SYN gets an ACK of
+         * the data, or the server's first segment arrives instead, and either
+         * completes the handshake the same way. The segment is dropped and
+         * sent again later.
+         */
+        if (!(syn_ack && (accepted == 0 || accepted == syn_data_len))
+            && !(syn_data_len && accepted == syn_data_len
+                && (check_control(received_header, 1, 0, 0, 0) || check_control(received_header, 0, 0, 0, 0)))) {
             fprintf(stderr, "Error: ACK in microtcp_connect. Packet's flags were not corresponding to the three-way handshake.");
-            clientSocket->state = INVALID;
-            FREE(received_header, buffer, received_data);
+            microtcp_set_state(clientSocket, INVALID);
+            FREE(received_header, buffer);
             return -1;
         }   
+        /* Only a SYN/ACK says what became of the cookie */
+        if (fastopen && syn_ack)
+            microtcp_fastopen_cache_put(serverAddress,
+                received_header->control_limit & MICROTCP_OPT_FASTOPEN ? received_header->total_data_size : 0);
     
-        clientSocket->ack_number = received_header->seq_number + 1;
+        clientSocket->ack_number = received_header->seq_number + syn_ack;
         clientSocket->seq_number = received_header->ack_number;
+        received_header_window = received_header->window;
+        /* From the final ACK on */
+        clientSocket->compact_header = clientSocket->compact
+            && (syn_ack ? !!(received_header->control_limit & MICROTCP_OPT_COMPACT) : compact_reply);
+        clientSocket->compress_active = clientSocket->compress && !syn_data_len
+            && (received_header->control_limit & MICROTCP_OPT_COMPRESS);
+        /* Karn's rule, a retransmitted SYN gives no RTT sample */
+        clientSocket->rcv_rtt_us = attempt ? 0 : microtcp_now_us() - syn_sent;
     
         free(buffer);    
-        buffer = microtcp_create_packet(clientSocket->seq_number, clientSocket->ack_number, 1, 0, 0, 0, MICROTCP_WIN_SIZE, 0, (void*)0, 0, 0, 0); 
-        if ((data_size = sendto(clientSocket->sd, buffer, sizeof(microtcp_header_t), 0, serverAddress, address_len)) == -1) {
+        buffer = microtcp_create_packet(clientSocket->seq_number, clientSocket->ack_number, 1, 0, 0, 0, MIN(clientSocket->recvbuf_len, UINT16_MAX), 0, (void*)0, 0, 0, 0); 
+        if ((data_size = microtcp_sock_sendto(clientSocket, buffer, sizeof(microtcp_header_t), 0, serverAddress, address_len)) == -1) {
             fprintf(stderr, "Error: Something went wrong sendto ACK in microtcp_connect. %s\n", strerror(errno));
-            printf("sendto ACK in microtcp_connect data size: %d\n", data_size);
-            clientSocket->state = INVALID;
+            printf("sendto ACK in microtcp_connect data size: %zd\n", data_size);
+            microtcp_set_state(clientSocket, INVALID);
             FREE(received_header, buffer);
             return -1;
         }
-        FREE(buffer, received_data, received_header);
+        FREE(buffer, received_header);
 
-        if (connect(clientSocket->sd, serverAddress, address_len) == -1) {
+        if (clientSocket->transport->connect(clientSocket->transport->ctx, clientSocket->sd,
+            serverAddress, address_len) == -1) {
             fprintf(stderr, "Error: Something went wrong with connect (PEER). %s\n", strerror(errno));
-            clientSocket->state = INVALID;
+            microtcp_set_state(clientSocket, INVALID);
             return -1;
         }
        
         
-        clientSocket->state = ESTABLISHED_PEER; 
-        clientSocket->init_win_size = clientSocket->curr_win_size = MICROTCP_WIN_SIZE;
-        clientSocket->recvbuf = malloc(sizeof(uint8_t) * MICROTCP_RECVBUF_LEN);
-        clientSocket->cwnd = MICROTCP_INIT_CWND;
+        microtcp_set_state(clientSocket, ESTABLISHED_PEER);
+        if (microtcp_set_recvbuf(clientSocket, clientSocket->recvbuf_len, clientSocket->recvbuf_max) == -1) {
+            microtcp_set_state(clientSocket, INVALID);
+            return -1;
+        }
+        clientSocket->init_win_size = clientSocket->curr_win_size = MIN(clientSocket->recvbuf_len, UINT16_MAX);
+        clientSocket->peer_win_size = clientSocket->peer_max_win_size = received_header_window;
+        microtcp_set_cwnd(clientSocket, MICROTCP_INIT_CWND);
         clientSocket->ssthresh = MICROTCP_INIT_SSTHRESH;
+        clientSocket->rto = MICROTCP_ACK_TIMEOUT_US;
         clientSocket->buf_fill_level = 0;
+        if (clientSocket->rcv_rtt_us)
+            microtcp_rtt_sample(clientSocket, clientSocket->rcv_rtt_us);
+        microtcp_sndlim_enter(clientSocket, MICROTCP_SNDLIM_SENDER);
+        microtcp_hist_record(&clientSocket->latency.handshake, microtcp_now_us() - syn_stamp);
+        microtcp_stat_attach(clientSocket);
+    
+        return accepted;
+    }
+
+    int
+        microtcp_connect(microtcp_sock_t* clientSocket, const struct sockaddr* serverAddress,
+            socklen_t address_len)
+    {
+        return microtcp_handshake(clientSocket, serverAddress, address_len, 0, NULL, 0) == -1 ? -1 : 0;
+    }
+
+    ssize_t
+    microtcp_connect_fastopen(microtcp_sock_t* clientSocket, const struct sockaddr* serverAddress,
+        socklen_t address_len, const void* buffer, size_t length)
+    {
+        ssize_t accepted;
+
+        accepted = microtcp_handshake(clientSocket, serverAddress, address_len, 1, buffer, length);
+        if (accepted == -1)
+            return -1;
+        /* No cookie yet, a rejected one, or too much data for the SYN */
+        if ((size_t)accepted < length && microtcp_send(clientSocket, buffer, length, 0) == -1)
+            return -1;
+        return length;
+    }
+    
+    int set_socket_timeout(microtcp_sock_t* socket, uint32_t duration)
+    {
+        return socket->transport->set_timeout(socket->transport->ctx, socket->sd, duration);
+    }
+
+    /*
+     * Sends a classic packet in the compact encoding, a header for which
+     * there is none goes as it is. Returns the length of the classic packet
+     * for the bytes sent, as callers expect.
+     */
+    static ssize_t microtcp_compact_sendto(microtcp_sock_t* socket, const void* buffer, size_t length,
+        int flags, const struct sockaddr* address, socklen_t address_len)
+    {
+        uint8_t compact[MICROTCP_COMPACT_MAX];
+        struct iovec iov[2];
+        struct msghdr message;
+        size_t compact_len;
+        ssize_t ret;
+
+        compact_len = microtcp_compact_encode(buffer, compact);
+        memset(&message, 0, sizeof(message));
+        message.msg_name = (void*)address;
+        message.msg_namelen = address_len;
+        message.msg_iov = iov;
+        message.msg_iovlen = 2;
+        iov[0].iov_base = compact_len ? compact : (void*)buffer;
+        iov[0].iov_len = compact_len ? compact_len : sizeof(microtcp_header_t);
+        iov[1].iov_base = (uint8_t*)buffer + sizeof(microtcp_header_t);
+        iov[1].iov_len = length - sizeof(microtcp_header_t);
+        ret = socket->transport->sendmsg(socket->transport->ctx, socket->sd, &message, flags);
+        if (ret != -1)
+            ret += sizeof(microtcp_header_t) - iov[0].iov_len;
+        return ret;
+    }
+
+    /*
+     * Turns a compact packet received in buffer back into the classic one,
+     * moving the payload behind the rebuilt header. Anything else is left
+     * alone. Returns the length of the packet now in buffer.
+     */
+    static ssize_t microtcp_compact_expand(uint8_t* buffer, size_t length, ssize_t received)
+    {
+        microtcp_header_t header;
+        size_t compact_len;
+        size_t payload;
+
+        if (received == -1 || length < sizeof(microtcp_header_t)
+            || !(compact_len = microtcp_compact_decode(buffer, received, &header)))
+            return received;
+        payload = MIN(received - compact_len, length - sizeof(microtcp_header_t));
+        memmove(buffer + sizeof(microtcp_header_t), buffer + compact_len, payload);
+        memcpy(buffer, &header, sizeof(header));
+        return sizeof(microtcp_header_t) + payload;
+    }
+
+    ssize_t microtcp_sock_send(microtcp_sock_t* socket, const void* buffer, size_t length, int flags)
+    {
+        ssize_t ret;
+
+        if (socket->compact_header && length >= sizeof(microtcp_header_t))
+            ret = microtcp_compact_sendto(socket, buffer, length, flags, NULL, 0);
+        else
+            ret = socket->transport->send(socket->transport->ctx, socket->sd, buffer, length, flags);
+        if (ret != -1) {
+            socket->packets_send++;
+            socket->bytes_send += ret - MIN((size_t)ret, sizeof(microtcp_header_t));
+        }
+        return ret;
+    }
+
+    ssize_t microtcp_sock_recv(microtcp_sock_t* socket, void* buffer, size_t length, int flags)
+    {
+        ssize_t ret = socket->transport->recv(socket->transport->ctx, socket->sd, buffer, length, flags);
+        if (socket->compact_header)
+            ret = microtcp_compact_expand(buffer, length, ret);
+        if (ret != -1) {
+            socket->packets_received++;
+            socket->bytes_received += ret - MIN((size_t)ret, sizeof(microtcp_header_t));
+        }
+        return ret;
+    }
+
+    /* The first piece of message is the classic header */
+    ssize_t microtcp_sock_sendmsg(microtcp_sock_t* socket, const struct msghdr* message, int flags)
+    {
+        uint8_t compact[MICROTCP_COMPACT_MAX];
+        struct iovec iov[MICROTCP_SEGMENT_IOV + 1];
+        struct msghdr compact_message;
+        size_t compact_len = 0;
+        ssize_t ret;
+
+        if (socket->compact_header && message->msg_iovlen <= MICROTCP_SEGMENT_IOV + 1
+            && message->msg_iov[0].iov_len == sizeof(microtcp_header_t))
+            compact_len = microtcp_compact_encode(message->msg_iov[0].iov_base, compact);
+        if (compact_len) {
+            compact_message = *message;
+            memcpy(iov, message->msg_iov, message->msg_iovlen * sizeof(struct iovec));
+            iov[0].iov_base = compact;
+            iov[0].iov_len = compact_len;
+            compact_message.msg_iov = iov;
+            ret = socket->transport->sendmsg(socket->transport->ctx, socket->sd, &compact_message, flags);
+            if (ret != -1)
+                ret += sizeof(microtcp_header_t) - compact_len;
+        }
+        else
+            ret = socket->transport->sendmsg(socket->transport->ctx, socket->sd, message, flags);
+        if (ret != -1) {
+            socket->packets_send++;
+            socket->bytes_send += ret - MIN((size_t)ret, sizeof(microtcp_header_t));
+        }
+        return ret;
+    }
+
+    ssize_t microtcp_sock_sendto(microtcp_sock_t* socket, const void* buffer, size_t length, int flags,
+        const struct sockaddr* address, socklen_t address_len)
+    {
+        ssize_t ret;
+
+        if (socket->compact_header && length >= sizeof(microtcp_header_t))
+            ret = microtcp_compact_sendto(socket, buffer, length, flags, address, address_len);
+        else
+            ret = socket->transport->sendto(socket->transport->ctx, socket->sd, buffer, length, flags,
+                address, address_len);
+        if (ret != -1) {
+            socket->packets_send++;
+            socket->bytes_send += ret - MIN((size_t)ret, sizeof(microtcp_header_t));
+        }
+        return ret;
+    }
+
+    ssize_t microtcp_sock_recvfrom(microtcp_sock_t* socket, void* buffer, size_t length, int flags,
+        struct sockaddr* address, socklen_t* address_len)
+    {
+        ssize_t ret = socket->transport->recvfrom(socket->transport->ctx, socket->sd, buffer, length, flags,
+            address, address_len);
+        if (socket->compact_header)
+            ret = microtcp_compact_expand(buffer, length, ret);
+        if (ret != -1) {
+            socket->packets_received++;
+            socket->bytes_received += ret - MIN((size_t)ret, sizeof(microtcp_header_t));
+        }
+        return ret;
+    }
     
+    int microtcp_set_syncookies(microtcp_sock_t* socket, int enable)
+    {
+        if (socket->state != UKNOWN) {
+            fprintf(stderr, "Error: SYN cookies can only be set before the connection.\n");
+            return -1;
+        }
+        socket->syncookies = enable;
+        return 0;
+    }
+
+    static uint8_t microtcp_secret[16];
+    static int microtcp_secret_ready;
+    static char microtcp_secret_lock;
+
+    /* Key of the ISN and SYN cookie MACs, drawn once per process */
+    static const uint8_t* microtcp_secret_key(void)
+    {
+        int fd;
+
+        if (__atomic_load_n(&microtcp_secret_ready, __ATOMIC_ACQUIRE))
+            return microtcp_secret;
+        while (__atomic_test_and_set(&microtcp_secret_lock, __ATOMIC_ACQUIRE))
+            ;
+        if (!microtcp_secret_ready) {
+            if (getrandom(microtcp_secret, sizeof(microtcp_secret), 0) != sizeof(microtcp_secret)) {
+                fd = open("/dev/urandom", O_RDONLY);
+                if (fd == -1 || read(fd, microtcp_secret, sizeof(microtcp_secret)) != sizeof(microtcp_secret)) {
+                    fprintf(stderr, "Warning: No randomness for the ISN secret, sequence numbers are predictable.\n");
+                    uint64_t seed = microtcp_now_us() ^ ((uint64_t)getpid() << 32);
+                    memcpy(microtcp_secret, &seed, sizeof(seed));
+                }
+                if (fd != -1)
+                    close(fd);
+            }
+            __atomic_store_n(&microtcp_secret_ready, 1, __ATOMIC_RELEASE);
+        }
+        __atomic_clear(&microtcp_secret_lock, __ATOMIC_RELEASE);
+        return microtcp_secret;
+    }
+
+    void microtcp_set_secret(const uint8_t key[16])
+    {
+        while (__atomic_test_and_set(&microtcp_secret_lock, __ATOMIC_ACQUIRE))
+            ;
+        memcpy(microtcp_secret, key, sizeof(microtcp_secret));
+        __atomic_store_n(&microtcp_secret_ready, 1, __ATOMIC_RELEASE);
+        __atomic_clear(&microtcp_secret_lock, __ATOMIC_RELEASE);
+    }
+
+    /* Hashes the peer address and port followed by up to three words */
+    static uint64_t microtcp_peer_mac(const struct sockaddr* peer, uint32_t a, uint32_t b, uint32_t c)
+    {
+        const struct sockaddr_in* in = (const struct sockaddr_in*)peer;
+        uint32_t msg[5];
+
+        msg[0] = in->sin_addr.s_addr;
+        msg[1] = in->sin_port;
+        msg[2] = a;
+        msg[3] = b;
+        msg[4] = c;
+        return siphash24(microtcp_secret_key(), (const uint8_t*)msg, sizeof(msg));
+    }
+
+    uint32_t microtcp_isn(const struct sockaddr* peer)
+    {
+        return (uint32_t)microtcp_peer_mac(peer, 0, 0, 0) + (uint32_t)(microtcp_now_us() / 4);
+    }
+
+    /* Window classes a SYN cookie can encode, rounded down on encoding */
+    static const uint16_t microtcp_cookie_windows[8] = {
+        MICROTCP_MSS, 2048, 4096, 8192, 16384, 32768, 49152, UINT16_MAX
+    };
+
+    uint32_t microtcp_syn_cookie(const struct sockaddr* peer, uint32_t peer_isn, size_t window)
+    {
+        uint32_t counter = microtcp_now_us() / 1000000 / MICROTCP_SYNCOOKIE_PERIOD_S;
+        uint32_t wclass = 0;
+
+        while (wclass < 7 && microtcp_cookie_windows[wclass + 1] <= window)
+            wclass++;
+        return (counter & 0x1f) << 27 | wclass << 24
+            | (microtcp_peer_mac(peer, peer_isn, counter, wclass) & 0xffffff);
+    }
+
+    int microtcp_syn_cookie_check(const struct sockaddr* peer, uint32_t peer_isn,
+        uint32_t cookie, size_t* window)
+    {
+        uint32_t now = microtcp_now_us() / 1000000 / MICROTCP_SYNCOOKIE_PERIOD_S;
+        uint32_t age = (now - (cookie >> 27)) & 0x1f;
+        uint32_t wclass = (cookie >> 24) & 0x7;
+
+        if (age > MICROTCP_SYNCOOKIE_MAX_AGE)
+            return 0;
+        if ((microtcp_peer_mac(peer, peer_isn, now - age, wclass) & 0xffffff) != (cookie & 0xffffff))
+            return 0;
+        *window = microtcp_cookie_windows[wclass];
+        return 1;
+    }
+
+    int microtcp_set_compact(microtcp_sock_t* socket, int enable)
+    {
+        if (socket->state != UKNOWN) {
+            fprintf(stderr, "Error: The compact header can only be offered before the connection.\n");
+            return -1;
+        }
+        socket->compact = enable;
+        return 0;
+    }
+
+    int microtcp_set_compress(microtcp_sock_t* socket, int enable)
+    {
+        if (socket->state != UKNOWN) {
+            fprintf(stderr, "Error: Compression can only be offered before the connection.\n");
+            return -1;
+        }
+        socket->compress = enable;
+        return 0;
+    }
+
+    int microtcp_set_fastopen(microtcp_sock_t* socket, int enable)
+    {
+        if (socket->state != UKNOWN) {
+            fprintf(stderr, "Error: Fast open can only be set before the connection.\n");
+            return -1;
+        }
+        socket->fastopen = enable;
+        return 0;
+    }
+
+    uint32_t microtcp_fastopen_cookie(const struct sockaddr* peer)
+    {
+        struct sockaddr_in in = *(const struct sockaddr_in*)peer;
+        uint32_t cookie;
+
+        /* Any port of the client may use it */
+        in.sin_port = 0;
+        cookie = microtcp_peer_mac((struct sockaddr*)&in, MICROTCP_OPT_FASTOPEN, 0, 0);
+        return cookie ? cookie : 1;
+    }
+
+    /*
+     * Checks the fast open option of a SYN. Returns the cookie to offer in
+     * the SYN/ACK, 0 if the option is off, and sets accept_data when the SYN
+     * carries data under a valid cookie.
+     */
+    static uint32_t microtcp_fastopen_syn(microtcp_sock_t* serverSocket, const struct sockaddr* clientAddress,
+        const microtcp_header_t* syn, int* accept_data)
+    {
+        uint32_t cookie;
+
+        *accept_data = 0;
+        if (!serverSocket->fastopen || !(syn->control_limit & MICROTCP_OPT_FASTOPEN))
+            return 0;
+        cookie = microtcp_fastopen_cookie(clientAddress);
+        *accept_data = syn->data_len && syn->data_len <= serverSocket->recvbuf_len
+            && syn->total_data_size == cookie;
+        return cookie;
+    }
+
+    /* Common end of both accept paths, once the final ACK or a fast open SYN is in */
+    static int microtcp_accept_finish(microtcp_sock_t* serverSocket, struct sockaddr* clientAddress,
+        socklen_t address_len, uint64_t syn_stamp, const char* syn_data, uint32_t syn_data_len)
+    {
+        if (serverSocket->transport->connect(serverSocket->transport->ctx, serverSocket->sd,
+            clientAddress, address_len) == -1) {
+            if(errno == EINPROGRESS)
+                fprintf(stderr,"Error: A timeout occured.\n");
+                /*In case of time-out, terminate*/
+            fprintf(stderr, "Error: Something went wrong with connect (HOST). %s\n", strerror(errno));
+            microtcp_set_state(serverSocket, INVALID);
+            return -1;
+        }
+        microtcp_set_state(serverSocket, ESTABLISHED_HOST);
+        /* The cookie and fast open paths never wait with a timeout, recv needs it for its ACKs */
+        if (set_socket_timeout(serverSocket, MICROTCP_ACK_TIMEOUT_US) == -1) {
+            fprintf(stderr, "Error: Error in set_socket_timeout.\n");
+            microtcp_set_state(serverSocket, INVALID);
+            return -1;
+        }
+        if (microtcp_set_recvbuf(serverSocket, serverSocket->recvbuf_len, serverSocket->recvbuf_max) == -1) {
+            microtcp_set_state(serverSocket, INVALID);
+            return -1;
+        }
+        serverSocket->init_win_size = serverSocket->curr_win_size = MIN(serverSocket->recvbuf_len, UINT16_MAX);
+        microtcp_set_cwnd(serverSocket, MICROTCP_INIT_CWND);
+        serverSocket->ssthresh = MICROTCP_INIT_SSTHRESH;
+        serverSocket->rto = MICROTCP_ACK_TIMEOUT_US;
+        serverSocket->buf_fill_level = 0;
+        /* Without state there is no SYN/ACK timestamp, nor a handshake to time */
+        if (serverSocket->rcv_rtt_us)
+            microtcp_rtt_sample(serverSocket, serverSocket->rcv_rtt_us);
+        microtcp_sndlim_enter(serverSocket, MICROTCP_SNDLIM_SENDER);
+        if (syn_stamp)
+            microtcp_hist_record(&serverSocket->latency.handshake, microtcp_now_us() - syn_stamp);
+        /* Data of a fast open SYN waits for the first microtcp_recv() */
+        if (syn_data_len) {
+            memcpy(serverSocket->recvbuf, syn_data, syn_data_len);
+            serverSocket->buf_fill_level = syn_data_len;
+        }
+        microtcp_stat_attach(serverSocket);
         return 0;
     }
     
-    int set_socket_timeout(microtcp_sock_t* socket, int duration )
+    
+    static int
+    microtcp_accept_cookie(microtcp_sock_t* serverSocket, struct sockaddr* clientAddress,
+        socklen_t address_len)
     {
-        struct timeval timeout;
-        timeout.tv_sec = 0;
-        timeout.tv_usec = duration;
-        return setsockopt(socket->sd, SOL_SOCKET, SO_RCVTIMEO, &timeout,
-            sizeof(struct timeval));
+        uint8_t buffer[sizeof(microtcp_header_t) + MICROTCP_MSS];
+        void* reply;
+        uint8_t* received_data;
+        microtcp_header_t received_header;
+        socklen_t len;
+        size_t window;
+        uint32_t cookie;
+        uint32_t fastopen_cookie;
+        int fastopen_data = 0;
+        int data_size;
+
+        while (1) {
+            len = address_len;
+            if ((data_size = microtcp_sock_recvfrom(serverSocket, buffer,
+                sizeof(buffer), 0, clientAddress, &len)) == -1) {
+                if (errno == EAGAIN || errno == EINTR)
+                    continue;
+                fprintf(stderr, "Error: recvfrom in microtcp_accept. %s\n", strerror(errno));
+                return -1;
+            }
+            if (!microtcp_unpack_view(buffer, data_size, &received_header, &received_data))
+                continue;
+
+            /* Answer every SYN, remember nothing, unless its fast open
+             * cookie already proves the peer's address */
+            if (check_control(&received_header, 0, 0, 1, 0)) {
+                fastopen_cookie = microtcp_fastopen_syn(serverSocket, clientAddress, &received_header, &fastopen_data);
+                cookie = microtcp_syn_cookie(clientAddress, received_header.seq_number,
+                    received_header.window);
+                reply = microtcp_create_packet(cookie,
+                    received_header.seq_number + 1 + (fastopen_data ? received_header.data_len : 0), 1, 0, 1, 0,
+                    MIN(serverSocket->recvbuf_len, UINT16_MAX), 0, (void*)0, fastopen_cookie, 0,
+                    fastopen_cookie ? MICROTCP_OPT_FASTOPEN : 0);
+                if (microtcp_sock_sendto(serverSocket, reply, sizeof(microtcp_header_t), 0,
+                    clientAddress, len) == -1)
+                    fprintf(stderr, "Error: sendto SYN/ACK in microtcp_accept. %s\n", strerror(errno));
+                free(reply);
+                if (fastopen_data)
+                    break;
+                continue;
+            }
+
+            /* The final ACK, or the first data segment if the ACK was lost,
+             * both echo the cookie plus one and carry the peer's ISN plus one */
+            if ((check_control(&received_header, 1, 0, 0, 0) || check_control(&received_header, 0, 0, 0, 0))
+                && microtcp_syn_cookie_check(clientAddress, received_header.seq_number - 1,
+                    received_header.ack_number - 1, &window))
+                break;
+        }
+
+        if (fastopen_data) {
+            serverSocket->seq_number = cookie + 1;
+            serverSocket->ack_number = received_header.seq_number + 1 + received_header.data_len;
+            serverSocket->peer_win_size = serverSocket->peer_max_win_size = received_header.window;
+            serverSocket->rcv_rtt_us = 0;
+            return microtcp_accept_finish(serverSocket, clientAddress, len, 0,
+                (const char*)received_data, received_header.data_len);
+        }
+        serverSocket->seq_number = received_header.ack_number;
+        serverSocket->ack_number = received_header.seq_number;
+        if (check_control(&received_header, 1, 0, 0, 0))
+            window = received_header.window;
+        serverSocket->peer_win_size = serverSocket->peer_max_win_size = window;
+        serverSocket->rcv_rtt_us = 0;
+        return microtcp_accept_finish(serverSocket, clientAddress, len, 0, NULL, 0);
     }
     
     int
@@ -159,47 +817,62 @@
     {
         assert(serverSocket);
         assert(clientAddress);
+        uint8_t datagram[sizeof(microtcp_header_t) + MICROTCP_MSS];
         void* buffer;
-        char* received_data;
+        uint8_t* received_data;
         int data_size;
-        time_t t; 
+        uint64_t syn_stamp;
+        uint64_t syn_ack_stamp;
+        uint32_t fastopen_cookie;
+        int fastopen_data;
+        int compact;
+        int compress;
+        int ret;
         
+        if (serverSocket->syncookies)
+            return microtcp_accept_cookie(serverSocket, clientAddress, address_len);
     
-        srand((unsigned int)time(&t) + 152024);    
-        int init_seq_num = rand() % 3000;
-        serverSocket->seq_number = init_seq_num;
         microtcp_header_t* received_header = malloc(sizeof(microtcp_header_t));
     
-        buffer = malloc(sizeof(microtcp_header_t));
-       
-        if((data_size = recvfrom(serverSocket->sd, buffer, 
-            sizeof(microtcp_header_t), 0, clientAddress, &address_len)) == -1)
+        /* A fast open SYN carries up to one MSS */
+        if((data_size = microtcp_sock_recvfrom(serverSocket, datagram, 
+            sizeof(datagram), 0, clientAddress, &address_len)) == -1)
         {
             fprintf(stderr, "Error: recvfrom SYN in microtcp_accept. %s", strerror(errno));
             printf("recvfrom SYN in connect data size: %d\n", data_size);
-            FREE(received_header, buffer);
+            FREE(received_header);
             return -1;
         }
+        syn_stamp = microtcp_now_us();
     
-        if (!microtcp_unpack(buffer, received_header, &received_data)) {
+        if (!microtcp_unpack_view(datagram, data_size, received_header, &received_data)) {
             perror("Error: unpacking failed (at Checksum check).");
-            FREE(received_header, buffer);
+            FREE(received_header);
             return -1;
         }
         
         if (!(check_control(received_header, 0, 0, 1, 0))) {
     
             fprintf(stderr, "Error: packet's flags were not corresponding to the three-way handshake.");
-            FREE(received_header, buffer, received_data);
+            FREE(received_header);
             return -1;
         }
     
-        serverSocket->ack_number = received_header->seq_number + 1;    
-        free(received_data);
-        free(buffer);
+        fastopen_cookie = microtcp_fastopen_syn(serverSocket, clientAddress, received_header, &fastopen_data);
+        serverSocket->ack_number = received_header->seq_number + 1 + (fastopen_data ? received_header->data_len : 0);
+        serverSocket->seq_number = microtcp_isn(clientAddress);
+        serverSocket->peer_win_size = serverSocket->peer_max_win_size = received_header->window;
     
-        buffer = microtcp_create_packet(serverSocket->seq_number, serverSocket->ack_number, 1, 0, 1, 0, MICROTCP_WIN_SIZE, 0, (void*)0, 0, 0, 0);
-        if((data_size = sendto(serverSocket->sd, buffer, 
+        compact = serverSocket->compact && (received_header->control_limit & MICROTCP_OPT_COMPACT);
+        /* The data of a fast open SYN is already uncompressed */
+        compress = serverSocket->compress && !fastopen_data
+            && (received_header->control_limit & MICROTCP_OPT_COMPRESS);
+        buffer = microtcp_create_packet(serverSocket->seq_number, serverSocket->ack_number, 1, 0, 1, 0, MIN(serverSocket->recvbuf_len, UINT16_MAX),
+            0, (void*)0, fastopen_cookie, 0,
+            (fastopen_cookie ? MICROTCP_OPT_FASTOPEN : 0) | (compact ? MICROTCP_OPT_COMPACT : 0)
+            | (compress ? MICROTCP_OPT_COMPRESS : 0));
+        syn_ack_stamp = microtcp_now_us();
+        if((data_size = microtcp_sock_sendto(serverSocket, buffer, 
             sizeof(microtcp_header_t), 0, clientAddress, address_len)) == -1){
             fprintf(stderr, "Error: sendto SYN/ACK in microtcp_accept. %s", strerror(errno));
             fprintf(stdout, "sendto SYN/ACK in microtcp_connect data size: %d\n", data_size);
@@ -207,61 +880,65 @@
             return -1;
         }
         free(buffer);    
+        /* The client answers the SYN/ACK in the compact encoding already */
+        serverSocket->compact_header = compact;
+        serverSocket->compress_active = compress;
+
+        /* The cookie vouches for the peer, so the data goes to the application
+         * now, without waiting for the final ACK */
+        if (fastopen_data) {
+            serverSocket->seq_number++;
+            serverSocket->rcv_rtt_us = 0;
+            ret = microtcp_accept_finish(serverSocket, clientAddress, address_len, syn_stamp,
+                (const char*)received_data, received_header->data_len);
+            free(received_header);
+            return ret;
+        }
         
         if (set_socket_timeout(serverSocket, MICROTCP_ACK_TIMEOUT_US) == -1) {
             fprintf(stderr, "Error: Error in set_socket_timeout.\n");
             FREE(received_header);
             return -1;
         }
-        buffer = malloc(sizeof(microtcp_header_t));
-        if((data_size = recvfrom(serverSocket->sd, buffer, 
-            sizeof(microtcp_header_t), 0, clientAddress, &address_len)) == -1){
+        /* Room for a data segment, which may arrive before the ACK */
+        if((data_size = microtcp_sock_recvfrom(serverSocket, datagram, 
+            sizeof(datagram), 0, clientAddress, &address_len)) == -1){
             if(errno == EINPROGRESS)
                 fprintf(stderr,"Error: A timeout occured.\n");
                 /*In case of time-out, terminate*/
             fprintf(stderr, "Error: recvfrom ACK in microtcp_accept. %s", strerror(errno));
             printf("recvfrom ACK in microtcp_accept data size: %d\n", data_size);
-            FREE(received_header, buffer);
+            FREE(received_header);
             return -1;
         }
         
-        if (!microtcp_unpack(buffer, received_header, &received_data)) {
+        if (!microtcp_unpack_view(datagram, data_size, received_header, &received_data)) {
             fprintf(stderr, "Error: unpacking failed (at Checksum check).");
-            FREE(received_header, buffer);
+            FREE(received_header);
             return -1;
         }
         
-        if (!(check_control(received_header, 1, 0, 0, 0) && received_header->ack_number == serverSocket->seq_number + 1)) {
+        /* The client only sends data after the SYN/ACK, so its first segment
+         * completes the handshake when the ACK was lost or overtaken. The
+         * segment itself is dropped and retransmitted later. */
+        if (!(check_control(received_header, 1, 0, 0, 0) && received_header->ack_number == serverSocket->seq_number + 1)
+            && !(check_control(received_header, 0, 0, 0, 0) && received_header->seq_number == serverSocket->ack_number)) {
             fprintf(stderr, "Error: packet's flags were not corresponding to the three-way handshake.");
-            FREE(received_header, buffer, received_data);
+            FREE(received_header);
             return -1;
         }
         serverSocket->seq_number++;
+        serverSocket->rcv_rtt_us = microtcp_now_us() - syn_ack_stamp;
 
-        FREE(buffer, received_data, received_header);
-
-        if (connect(serverSocket->sd, clientAddress, address_len) == -1) {
-            if(errno == EINPROGRESS)
-                fprintf(stderr,"Error: A timeout occured.\n");
-                /*In case of time-out, terminate*/
-            fprintf(stderr, "Error: Something went wrong with connect (HOST). %s\n", strerror(errno));
-            serverSocket->state = INVALID;
-            return -1;
-        }
-        serverSocket->state = ESTABLISHED_HOST;
-        serverSocket->init_win_size = serverSocket->curr_win_size = MICROTCP_WIN_SIZE;
-        serverSocket->recvbuf = malloc(sizeof(uint8_t)*MICROTCP_RECVBUF_LEN);
-        serverSocket->cwnd = MICROTCP_INIT_CWND;
-        serverSocket->ssthresh = MICROTCP_INIT_SSTHRESH;
-        serverSocket->buf_fill_level = 0;
-        return 0;
+        free(received_header);
+        return microtcp_accept_finish(serverSocket, clientAddress, address_len, syn_stamp, NULL, 0);
     }
     
-    
     int microtcp_shutdown(microtcp_sock_t* socket, int how)
     {
+        uint8_t datagram[sizeof(microtcp_header_t) + MICROTCP_MSS];
         void* buffer;
-        char* received_data;
+        uint8_t* received_data;
         int data_size;
         microtcp_header_t* received_header = malloc(sizeof(microtcp_header_t));
         /*------Shutdown host------*/
@@ -273,7 +950,7 @@
                 if(!option)
                 {
                     buffer = microtcp_create_packet(socket->seq_number, socket->ack_number, 1, 0, 0, 0, MICROTCP_WIN_SIZE, 0, (void*)0, 0, 0, 0);
-                        if ((data_size = send(socket->sd, buffer, sizeof(microtcp_header_t), 0)) == -1) {
+                        if ((data_size = microtcp_sock_send(socket, buffer, sizeof(microtcp_header_t), 0)) == -1) {
                             fprintf(stderr, "Error: microtcp_send ACK in microtcp_shutdownServer. %s", strerror(errno));
                             fprintf(stdout, "sendto ACK in microtcp_shutdownSever data size: %d\n", data_size);
                             FREE(received_header, buffer);
@@ -283,32 +960,31 @@
                 }
     
                 buffer = microtcp_create_packet(socket->seq_number, socket->ack_number, 1, 0, 0, 1, MICROTCP_WIN_SIZE, 0, (void*)0, 0, 0, 0);
-                if ((data_size = send(socket->sd, buffer, sizeof(microtcp_header_t), 0)) == -1) {
+                if ((data_size = microtcp_sock_send(socket, buffer, sizeof(microtcp_header_t), 0)) == -1) {
                     fprintf(stderr, "Error: microtcp_send Fin/ACK in microtcp_shutdownServer. %s", strerror(errno));
                     fprintf(stdout, "send Fin/ACK in microtcp_shutdownServer data size: %d\n", data_size);
                     FREE(received_header, buffer);
                     return -1;
                 }
                 free(buffer);
-                buffer = malloc(sizeof(microtcp_header_t));
-                if ((data_size = recv(socket->sd, buffer,
-                    sizeof(microtcp_header_t), 0)) == -1) {
+                if ((data_size = microtcp_sock_recv(socket, datagram,
+                    sizeof(datagram), 0)) == -1) {
                     if(errno == EAGAIN)
                     {
-                        fprintf(stdout, "\"Error\": timeout occured.\n");  
+                        MICROTCP_TRACE(MICROTCP_TRACE_INFO, MICROTCP_EV_TIMEOUT, socket,
+                            socket->seq_number, socket->ack_number, MICROTCP_ACK_TIMEOUT_US);
                         option = 1;
-                        free(buffer);
                         continue;
                     }
                     fprintf(stderr, "Error: Something went wrong with ACK receive %s\n", strerror(errno));
                     printf("recvfrom ACK in microtcp_shutdownServer data size: %d\n", data_size);
-                    FREE(received_header, buffer);
+                    FREE(received_header);
                     return -1;
                 }
-                if (!microtcp_unpack(buffer, received_header, &received_data)) {
-                    fprintf(stdout, "Error: checksum error.\n");
+                if (!microtcp_unpack_view(datagram, data_size, received_header, &received_data)) {
+                    MICROTCP_TRACE(MICROTCP_TRACE_INFO, MICROTCP_EV_BAD_CHECKSUM, socket,
+                        socket->seq_number, socket->ack_number, data_size);
                     option = 1;
-                    FREE(buffer, received_data);
                     continue;
                 }
                 if ((check_control(received_header, 1, 0, 0, 0) && received_header->ack_number == socket->seq_number + 1)) 
@@ -316,19 +992,21 @@
                 if ((check_control(received_header, 1, 0, 0, 1) && received_header->ack_number == socket->seq_number )) 
                 {
                     option = 0;
-                    FREE(buffer, received_data);
                     continue;
                 }
                 
             }while(1);
     
             socket->seq_number++;
-            FREE(buffer, received_data, received_header, socket->recvbuf);
-            socket->state = CLOSED;
+            free(received_header);
+            microtcp_free_recvbuf(socket);
+            microtcp_set_state(socket, CLOSED);
         }  
         /*------Shutdown peer------*/
         else{
             int option = 0;        
+            /* Sent again on timeouts only, a late window update is no reason */
+            int fin_due = 1;
     
             do
             {
@@ -343,48 +1021,50 @@
                 if(option == 2)
                 {    
                     buffer = microtcp_create_packet(socket->seq_number, socket->ack_number, 1, 0, 0, 0, MICROTCP_WIN_SIZE, 0, (void*)0, 0, 0, 0);
-                    if ((data_size = send(socket->sd, buffer, sizeof(microtcp_header_t), 0)) == -1) {
+                    if ((data_size = microtcp_sock_send(socket, buffer, sizeof(microtcp_header_t), 0)) == -1) {
                         fprintf(stderr, "Error: microtcp_send ACK in microtcp_shutdownClient. %s", strerror(errno));
                         fprintf(stdout, "sendto ACK in microtcp_shutdownClient data size: %d\n", data_size);
-                        socket->state = INVALID;
+                        microtcp_set_state(socket, INVALID);
                         FREE(buffer, received_header);
                         return -1;
                     }
+                    free(buffer);
                     break;
                 }
-                if(option == 0)
+                if(option == 0 && fin_due)
                 {
+                    fin_due = 0;
                     if (set_socket_timeout(socket, MICROTCP_ACK_TIMEOUT_US) == -1) {
                         fprintf(stderr, "Error: Error in set_socket_timeout.\n");
                         free(received_header);
                         return -1;
                     }
                     buffer = microtcp_create_packet(socket->seq_number, socket->ack_number, 1, 0, 0, 1, MICROTCP_WIN_SIZE, 0, (void*)0, 0, 0, 0);
-                    if ((data_size = send(socket->sd, buffer, sizeof(microtcp_header_t), 0)) == -1) {
+                    if ((data_size = microtcp_sock_send(socket, buffer, sizeof(microtcp_header_t), 0)) == -1) {
                         fprintf(stderr, "Error: microtcp_send ACK/FIN in microtcp_shutdownClient. %s", strerror(errno));
                         fprintf(stdout, "sendto ACK/FIN in microtcp_shutdownClient data size: %d\n", data_size);
-                        socket->state = INVALID;
+                        microtcp_set_state(socket, INVALID);
                         FREE(buffer, received_header);
                         return -1;
                     }
                     free(buffer);
                 }
     
-                buffer = malloc(sizeof(microtcp_header_t));
-                if ((data_size = recv(socket->sd, buffer,
-                    sizeof(microtcp_header_t), 0)) == -1) {
+                if ((data_size = microtcp_sock_recv(socket, datagram,
+                    sizeof(datagram), 0)) == -1) {
                     if(errno == EAGAIN)
                     {
                         switch(option)
                         {
                             case 0:
-                                fprintf(stderr, "Error: A timeout occured.\n");
-                                free(buffer);
+                                MICROTCP_TRACE(MICROTCP_TRACE_INFO, MICROTCP_EV_TIMEOUT, socket,
+                                    socket->seq_number, socket->ack_number, MICROTCP_ACK_TIMEOUT_US);
+                                fin_due = 1;
                                 continue;
                             case 1:
                                 fprintf(stderr, "Error: A bad timeout occured.\n");
-                                FREE(buffer, received_header);
-                                socket->state = INVALID;
+                                free(received_header);
+                                microtcp_set_state(socket, INVALID);
                                 return -1;
                             case 2:
                                 break;
@@ -398,39 +1078,85 @@
                     }
                     fprintf(stderr, "Error: Something went wrong with ACK receive %s\n", strerror(errno));
                     printf("recvfrom ACK in microtcp_shutdownClient data size: %d\n", data_size);
-                    socket->state = INVALID;
-                    FREE(buffer, received_header);
+                    microtcp_set_state(socket, INVALID);
+                    free(received_header);
                     return -1;
                 }
-                if (!microtcp_unpack(buffer, received_header, &received_data)) {
+                if (!microtcp_unpack_view(datagram, data_size, received_header, &received_data)) {
                     perror("Error: unpacking failed (at Checksum check).");
-                    free(buffer);
                     continue;
                 }
                 if ((check_control(received_header, 1, 0, 0, 0) && received_header->ack_number == socket->seq_number + 1)) 
                 {
-                    FREE(buffer, received_data);
                     socket->seq_number++;
-                    socket->state = CLOSING_BY_HOST;
+                    microtcp_set_state(socket, CLOSING_BY_HOST);
                     option = 1;
                     continue;
                 }
                 if (check_control(received_header, 1, 0, 0, 1))
                 {
                     socket->ack_number++;
-                    FREE(buffer, received_data);
                     option = 2;
                 }
                 
             }while(1);
 
-            FREE(buffer, received_header, socket->recvbuf);
+            free(received_header);
+            microtcp_free_recvbuf(socket);
 
-            socket->state = CLOSED;
+            microtcp_set_state(socket, CLOSED);
         }
         return 0;
     }
     
+    void microtcp_set_state(microtcp_sock_t* socket, microtcp_state_t state)
+    {
+        MICROTCP_PROBE3(state__change, socket->sd, socket->state, state);
+        socket->state = state;
+        if (state == CLOSED || state == INVALID)
+            microtcp_stat_detach(socket);
+        else
+            microtcp_stat_publish(socket);
+    }
+
+    void microtcp_set_cwnd(microtcp_sock_t* socket, size_t cwnd)
+    {
+        MICROTCP_PROBE4(cwnd__change, socket->sd, socket->cwnd, cwnd, socket->ssthresh);
+        socket->cwnd = cwnd;
+    }
+
+    void microtcp_rtt_sample(microtcp_sock_t* socket, uint32_t rtt_us)
+    {
+        uint32_t delta;
+        uint32_t rto;
+
+        /* RFC 6298, section 2 */
+        if (!socket->srtt) {
+            socket->srtt = MAX(rtt_us, 1);
+            socket->rttvar = rtt_us / 2;
+        }
+        else {
+            delta = socket->srtt > rtt_us ? socket->srtt - rtt_us : rtt_us - socket->srtt;
+            socket->rttvar = (3 * socket->rttvar + delta) / 4;
+            socket->srtt = MAX((7 * socket->srtt + rtt_us) / 8, 1);
+        }
+        rto = socket->srtt + 4 * socket->rttvar;
+        rto = MIN(MAX(rto, MICROTCP_MIN_RTO_US), MICROTCP_MAX_RTO_US);
+        if (rto != socket->rto) {
+            socket->rto = rto;
+            set_socket_timeout(socket, rto);
+        }
+    }
+
+    void microtcp_sndlim_enter(microtcp_sock_t* socket, microtcp_sndlim_t state)
+    {
+        uint64_t now = microtcp_now_us();
+        if (socket->sndlim_stamp)
+            socket->sndlim_us[socket->sndlim_state] += now - socket->sndlim_stamp;
+        socket->sndlim_state = state;
+        socket->sndlim_stamp = now;
+    }
+
     int check_control(microtcp_header_t* header, int ack, int rst, int syn, int fin)
     {
         assert(header);
@@ -444,13 +1170,32 @@
         return ack_res && rst_res && syn_res && fin_res;
     }
     
+    size_t microtcp_rcv_window(microtcp_sock_t* socket)
+    {
+        size_t used = socket->buf_fill_level + socket->rcv_held;
+        size_t free_space = socket->recvbuf_len - MIN(used, socket->recvbuf_len);
+        if (free_space < MIN(MICROTCP_MSS, socket->recvbuf_len / 2))
+            return 0;
+        return MIN(free_space, UINT16_MAX);
+    }
+
+    size_t microtcp_sws_window(microtcp_sock_t* socket, size_t window, size_t remaining)
+    {
+        if (window >= MICROTCP_MSS || window >= remaining
+            || window >= socket->peer_max_win_size / 2)
+            return window;
+        return 0;
+    }
+
     ssize_t send_ack(microtcp_sock_t* socket)
     {
         ssize_t data_size;
-        printf("Inside send_ack \n");
+        socket->curr_win_size = microtcp_rcv_window(socket);
+        MICROTCP_TRACE(MICROTCP_TRACE_DEBUG, MICROTCP_EV_ACK_SENT, socket,
+            socket->seq_number, socket->ack_number, socket->curr_win_size);
         void* send_buffer = microtcp_create_packet(socket->seq_number, socket->ack_number, 
                     1, 0, 0, 0, socket->curr_win_size, 0, (void*)0, 0, 0, 0);
-                if((data_size = send(socket->sd, send_buffer, sizeof(microtcp_header_t), 0)) == -1)
+                if((data_size = microtcp_sock_send(socket, send_buffer, sizeof(microtcp_header_t), 0)) == -1)
                 {
                     fprintf(stderr, "Error: Something went wrong with send. %s\n", strerror(errno));
                     free(send_buffer);
@@ -460,346 +1205,1426 @@
         return data_size; 
     }
 
+    /*
+     * Points slice at the len bytes of iov that start offset bytes in, at
+     * most max_pieces pieces of them. Returns the number of pieces
+     * and sets len to the bytes they cover, less when there were more.
+     */
+    static int microtcp_iov_slice(const struct iovec* iov, int iovcnt, size_t offset,
+        uint32_t* len, struct iovec* slice, int max_pieces)
+    {
+        uint32_t covered = 0;
+        int n = 0;
+
+        for (; iovcnt && offset >= iov->iov_len; iov++, iovcnt--)
+            offset -= iov->iov_len;
+        for (; iovcnt && covered < *len && n < max_pieces; iov++, iovcnt--, offset = 0) {
+            slice[n].iov_base = (uint8_t*)iov->iov_base + offset;
+            slice[n].iov_len = MIN(iov->iov_len - offset, *len - covered);
+            covered += slice[n].iov_len;
+            n += slice[n].iov_len != 0;
+        }
+        *len = covered;
+        return n;
+    }
+
+    /*
+     * Sends one data segment straight from the caller's buffers, the header
+     * and the payload pieces are gathered by sendmsg() and the checksum is
+     * carried from one to the next. A payload spread over more than
+     * max_pieces pieces is cut short, the return value tells.
+     */
+    static ssize_t microtcp_send_segment(microtcp_sock_t* socket, const struct iovec* payload,
+        int iovcnt, int max_pieces, size_t payload_offset, uint32_t len, uint32_t total_data_size,
+        uint32_t data_offset, uint32_t control_limit, int flags)
+    {
+        microtcp_header_t header;
+        struct iovec iov[1 + MICROTCP_SEGMENT_IOV];
+        struct msghdr message;
+        uint32_t crc;
+        int i, n;
+
+        n = microtcp_iov_slice(payload, iovcnt, payload_offset, &len, iov + 1, max_pieces);
+        header = microtcp_create_header(socket->seq_number, socket->ack_number, 0, 0, 0, 0,
+            socket->curr_win_size, len, total_data_size, data_offset, control_limit);
+        crc = update_crc32(0xffffffff, (const uint8_t*)&header, sizeof(header));
+        for (i = 1; i <= n; i++)
+            crc = update_crc32(crc, iov[i].iov_base, iov[i].iov_len);
+        header.checksum = htonl(crc ^ 0xffffffff);
+
+        iov[0].iov_base = &header;
+        iov[0].iov_len = sizeof(header);
+        memset(&message, 0, sizeof(message));
+        message.msg_iov = iov;
+        message.msg_iovlen = 1 + n;
+        return microtcp_sock_sendmsg(socket, &message, flags);
+    }
+
+    /*
+     * The bytes of the whole records of iov from offset on that fit in
+     * limit, at least one record so that a flight never splits one.
+     */
+    static size_t microtcp_record_limit(const struct iovec* iov, int iovcnt, size_t offset, size_t limit)
+    {
+        size_t total = 0;
+
+        for (; iovcnt && offset >= iov->iov_len; iov++, iovcnt--)
+            offset -= iov->iov_len;
+        for (; iovcnt; iov++, iovcnt--) {
+            if (total && total + iov->iov_len > limit)
+                break;
+            total += iov->iov_len;
+        }
+        return total;
+    }
+
+    static ssize_t microtcp_send_iov(microtcp_sock_t* socket, const struct iovec* iov, int iovcnt,
+        int flags, int records);
+
+    /* The len bytes of iov from offset on if one piece holds them, else NULL */
+    static const uint8_t* microtcp_iov_contiguous(const struct iovec* iov, int iovcnt, size_t offset,
+        size_t len)
+    {
+        for (; iovcnt && offset >= iov->iov_len; iov++, iovcnt--)
+            offset -= iov->iov_len;
+        return iovcnt && iov->iov_len - offset >= len ? (const uint8_t*)iov->iov_base + offset : NULL;
+    }
+
+    /* Gathers the len bytes of iov from offset on into out */
+    static void microtcp_iov_gather(const struct iovec* iov, int iovcnt, size_t offset,
+        uint8_t* out, size_t len)
+    {
+        size_t piece;
+
+        for (; iovcnt && offset >= iov->iov_len; iov++, iovcnt--)
+            offset -= iov->iov_len;
+        for (; iovcnt && len; iov++, iovcnt--, offset = 0) {
+            piece = MIN(iov->iov_len - offset, len);
+            memcpy(out, (const uint8_t*)iov->iov_base + offset, piece);
+            out += piece;
+            len -= piece;
+        }
+    }
+
+    /*
+     * Compresses the block, NULL if it is to go stored. After a block that
+     * did not shrink the next ones are stored without a try, with the count
+     * doubling on every failure and reset by a success.
+     */
+    static const uint8_t* microtcp_deflate_block(microtcp_sock_t* socket, const uint8_t* block,
+        size_t len, uint8_t* out, size_t* packed_len)
+    {
+        if (socket->compress_skip) {
+            socket->compress_skip--;
+            return NULL;
+        }
+        *packed_len = microtcp_lz_compress(block, len, out, len - len / 32);
+        if (*packed_len && *packed_len < len) {
+            socket->compress_backoff = 0;
+            return out;
+        }
+        socket->compress_skip = socket->compress_backoff;
+        socket->compress_backoff = socket->compress_backoff
+            ? MIN(2 * socket->compress_backoff, MICROTCP_COMPRESS_BACKOFF) : 1;
+        return NULL;
+    }
+
+    /*
+     * Sends iov through the compression stage, in messages of up to about
+     * MICROTCP_COMPRESS_BATCH compressed bytes. Every block follows a header
+     * of its raw and packed length, which are equal for a stored block. A
+     * stored block goes out of the caller's buffers and only the vector
+     * limits how many of them a message takes, so incompressible data keeps
+     * the long messages of microtcp_sendfile().
+     */
+    static ssize_t microtcp_send_deflate(microtcp_sock_t* socket, const struct iovec* iov, int iovcnt,
+        int flags)
+    {
+        struct iovec out[MICROTCP_COMPRESS_IOV];
+        uint32_t header[MICROTCP_COMPRESS_IOV / 2][2];
+        const uint8_t* input;
+        const uint8_t* packed;
+        uint8_t* scratch;
+        size_t length = 0, offset = 0, start, used, wire, block, packed_len;
+        uint32_t len;
+        int i, n, blocks;
+
+        for (i = 0; i < iovcnt; i++)
+            length += iov[i].iov_len;
+        /* Compressed blocks, with room for one more past the batch, then a gathered block */
+        if (!socket->deflate_buf
+            && !(socket->deflate_buf = malloc(MICROTCP_COMPRESS_BATCH + 2 * MICROTCP_COMPRESS_BLOCK))) {
+            fprintf(stderr, "Error: Out of memory for the compression buffer.\n");
+            return -1;
+        }
+        scratch = socket->deflate_buf + MICROTCP_COMPRESS_BATCH + MICROTCP_COMPRESS_BLOCK;
+
+        while (offset < length) {
+            start = offset;
+            n = blocks = 0;
+            used = wire = 0;
+            while (offset < length && used < MICROTCP_COMPRESS_BATCH
+                && n + 1 + MICROTCP_SEGMENT_IOV <= MICROTCP_COMPRESS_IOV) {
+                block = MIN(length - offset, MICROTCP_COMPRESS_BLOCK);
+                input = microtcp_iov_contiguous(iov, iovcnt, offset, block);
+                if (!socket->compress_skip && !input) {
+                    microtcp_iov_gather(iov, iovcnt, offset, scratch, block);
+                    input = scratch;
+                }
+                packed = microtcp_deflate_block(socket, input, block, socket->deflate_buf + used, &packed_len);
+
+                out[n].iov_base = header[blocks];
+                out[n++].iov_len = sizeof(header[blocks]);
+                header[blocks][0] = htonl(block);
+                if (packed) {
+                    header[blocks][1] = htonl(packed_len);
+                    out[n].iov_base = (void*)packed;
+                    out[n++].iov_len = packed_len;
+                    used += packed_len;
+                }
+                else {
+                    header[blocks][1] = htonl(block);
+                    socket->compress_bypassed++;
+                    packed_len = block;
+                    len = block;
+                    if (input && input != scratch) {
+                        out[n].iov_base = (void*)input;
+                        out[n++].iov_len = block;
+                    }
+                    else {
+                        /* Spread over pieces, sent from them unless there are too many */
+                        i = microtcp_iov_slice(iov, iovcnt, offset, &len, out + n, MICROTCP_SEGMENT_IOV);
+                        if (len == block)
+                            n += i;
+                        else {
+                            microtcp_iov_gather(iov, iovcnt, offset, socket->deflate_buf + used, block);
+                            out[n].iov_base = socket->deflate_buf + used;
+                            out[n++].iov_len = block;
+                            used += block;
+                        }
+                    }
+                }
+                wire += MICROTCP_COMPRESS_HEADER + packed_len;
+                offset += block;
+                blocks++;
+            }
+            socket->compress_in += offset - start;
+            socket->compress_out += wire;
+            if (microtcp_send_iov(socket, out, n, flags, 0) == -1)
+                return -1;
+        }
+        return length;
+    }
+
     ssize_t
     microtcp_send(microtcp_sock_t* socket, const void* buffer, size_t length,
         int flags)
     {
+        struct iovec iov;
+
+        iov.iov_base = (void*)buffer;
+        iov.iov_len = length;
+        if (socket->compress_active)
+            return microtcp_send_deflate(socket, &iov, 1, flags);
+        return microtcp_send_iov(socket, &iov, 1, flags, 0);
+    }
+
+    ssize_t
+    microtcp_sendv(microtcp_sock_t* socket, const struct iovec* iov, int iovcnt, int flags)
+    {
+        if (socket->compress_active)
+            return microtcp_send_deflate(socket, iov, iovcnt, flags);
+        return microtcp_send_iov(socket, iov, iovcnt, flags, 0);
+    }
+
+    ssize_t
+    microtcp_send_records(microtcp_sock_t* socket, const struct iovec* iov, int iovcnt, int flags)
+    {
+        int i;
+
+        if (socket->compress_active) {
+            fprintf(stderr, "Error: Records cannot be sent on a compressed connection.\n");
+            return -1;
+        }
+        for (i = 0; i < iovcnt; i++) {
+            if (iov[i].iov_len > MICROTCP_MSS) {
+                fprintf(stderr, "Error: A record of %zu bytes does not fit in one segment.\n", iov[i].iov_len);
+                return -1;
+            }
+        }
+        return microtcp_send_iov(socket, iov, iovcnt, flags, 1);
+    }
+
+    /* With records set, every buffer of iov is one segment */
+    static ssize_t microtcp_send_iov(microtcp_sock_t* socket, const struct iovec* iov, int iovcnt,
+        int flags, int records)
+    {
+        size_t length = 0;
+        int i;
         int data_size;
         int recv_data_size;
-        void *recv_buffer;
-        void *send_buffer;
+        uint8_t datagram[sizeof(microtcp_header_t) + MICROTCP_MSS];
         microtcp_header_t *received_header;
         received_header = malloc(sizeof(microtcp_header_t));
-        char *received_data;
-        void* temp_buffer;
+        uint8_t *received_data;
         int ignore = 0;
         int seg_count = 0;
-        int data_sent;
-        int zero_len = (length) ? 0 : 1;
+        int data_sent = 0;
         int temp_len;
         int data_acked = 0;
-        short unsigned int window = socket->init_win_size;
+        int resend_end = 0;
+        uint16_t window = socket->peer_win_size;
         int slow_start;
         uint32_t control_limit;
+        uint64_t flight_stamp = 0;
+        uint64_t call_stamp = microtcp_now_us();
+        microtcp_seg_stamps_t seg_stamps;
+
+        for (i = 0; i < iovcnt; i++)
+            length += iov[i].iov_len;
+        /* A connection that only sends never passes through recv */
+        microtcp_rcvbuf_idle(socket);
+        seg_stamps.head = seg_stamps.tail = seg_stamps.highest = 0;
         do
         {   
             
             slow_start = socket->cwnd <= socket->ssthresh;
-            printf("Slowstart = %d\n", slow_start);
+            MICROTCP_TRACE(MICROTCP_TRACE_DEBUG, MICROTCP_EV_CWND, socket,
+                socket->seq_number, socket->ack_number, slow_start);
             if(!ignore)
             {
-                printf("Ignore = 0 .\n");
+                /* Anything sent past the acknowledged point goes out again, the
+                 * only place a retransmission starts */
+                if (data_sent > data_acked)
+                    MICROTCP_PROBE3(retransmit, socket->sd, socket->seq_number + data_acked, socket->ssthresh);
+                resend_end = MAX(resend_end, data_sent);
                 data_sent = data_acked;
 
-                if (microtcp_zero_win_send(socket, &window, length, data_sent, 0) == -1) {
-                    free(received_header);
-                    return -1;
+                /* A window too small to fill a segment is treated as closed */
+                while (!microtcp_sws_window(socket, window, length - data_sent)) {
+                    window = 0;
+                    microtcp_sndlim_enter(socket, MICROTCP_SNDLIM_RWND);
+                    if (microtcp_zero_win_send(socket, &window, length, data_sent, 0) == -1) {
+                        free(received_header);
+                        return -1;
+                    }
                 }
                 
                 control_limit = MIN3(length - data_sent, socket->cwnd, window);
+                if (records)
+                    control_limit = microtcp_record_limit(iov, iovcnt, data_sent, control_limit);
+                microtcp_sndlim_enter(socket, window < MIN(length - data_sent, socket->cwnd)
+                    ? MICROTCP_SNDLIM_RWND : MICROTCP_SNDLIM_CWND);
+                /* Karn's rule, flights carrying retransmitted data give no RTT sample */
+                flight_stamp = data_sent < resend_end ? 0 : microtcp_now_us();
+                microtcp_stat_publish(socket);
+                MICROTCP_TRACE(MICROTCP_TRACE_DEBUG, MICROTCP_EV_FLIGHT_START, socket,
+                    socket->seq_number + data_sent, socket->ack_number, control_limit);
                 while (data_sent - data_acked < control_limit)
                 {
                     temp_len = MIN(control_limit - (data_sent - data_acked), MICROTCP_MSS);
-                    temp_buffer = malloc(sizeof(uint8_t) * (control_limit ? temp_len : 1));
+                    if ((data_size = microtcp_send_segment(socket, iov, iovcnt,
+                        records ? 1 : MICROTCP_SEGMENT_IOV, data_sent, temp_len,
+                        length, data_sent, control_limit, flags)) == -1) {
+                        free(received_header);
+                        return -1;
+                    }
+                    temp_len = data_size - sizeof(microtcp_header_t);
+
+                    MICROTCP_TRACE(MICROTCP_TRACE_DEBUG, MICROTCP_EV_SEGMENT_SENT, socket,
+                        socket->seq_number + data_sent, socket->ack_number, temp_len);
+                    MICROTCP_PROBE4(segment__sent, socket->sd, socket->seq_number + data_sent, temp_len, socket->cwnd);
+                    if (data_sent < resend_end) {
+                        socket->packets_lost++;
+                        socket->bytes_lost += temp_len;
+                    }
+                    microtcp_seg_stamps_sent(&seg_stamps, data_sent + temp_len, microtcp_now_us());
+                    data_sent += temp_len;
+                }  
+                socket->bytes_in_flight = data_sent - data_acked;
+            }         
+            ignore = 1;
+            
+            /*Receiving packet, the peer may be sending data of its own*/
+            if((recv_data_size = microtcp_sock_recv(socket, datagram, sizeof(datagram), 0)) == -1)
+            {
+                if (errno == EAGAIN)
+                {
+                    MICROTCP_TRACE(MICROTCP_TRACE_INFO, MICROTCP_EV_TIMEOUT, socket,
+                        socket->seq_number + data_acked, socket->ack_number, socket->rto);
+                    socket->timeouts++;
+                    // send dup ack                  
+                    if (send_ack(socket) == -1) {
+                        free(received_header);
+                        return -1;
+                    }
+                    /* As in RFC 5681, or timeouts in a row take the window down to nothing */
+                    socket->ssthresh = MAX(socket->cwnd / 2, 2 * MICROTCP_MSS);
+                    microtcp_set_cwnd(socket, MICROTCP_MSS);
+                    continue;
+                }
+                fprintf(stderr, "Error: Something went wrong with recv. %s\n", strerror(errno));
+                free(received_header);
+                return -1;
+            }
+            
+            /*Checksum*/
+            if (!microtcp_unpack_view(datagram, recv_data_size, received_header, &received_data)) 
+            {
+                MICROTCP_TRACE(MICROTCP_TRACE_INFO, MICROTCP_EV_BAD_CHECKSUM, socket,
+                    socket->seq_number, socket->ack_number, recv_data_size);
+                if (send_ack(socket) == -1) {
+                    free(received_header);
+                    return -1;
+                }
+                continue;
+            }
+            /*Data*/
+            if(check_control(received_header, 0, 0, 0, 0))             
+            {
+                MICROTCP_TRACE(MICROTCP_TRACE_DEBUG, MICROTCP_EV_SEGMENT_RECV, socket,
+                    received_header->seq_number, received_header->ack_number, received_header->data_len);
+                if (send_ack(socket) == -1) {
+                    free(received_header);
+                    return -1;
+                }
+                continue;
+            } 
+            /*Ack*/
+            else if (check_control(received_header, 1, 0, 0, 0))
+            {
+                MICROTCP_TRACE(MICROTCP_TRACE_DEBUG, MICROTCP_EV_ACK_RECV, socket,
+                    received_header->seq_number, received_header->ack_number, received_header->window);
+                MICROTCP_PROBE4(ack__processed, socket->sd, received_header->ack_number,
+                    received_header->window, socket->cwnd);
+                /*Final Ack received*/
+                if (received_header->ack_number == (uint32_t)(socket->seq_number + length)) 
+                {
+                    MICROTCP_TRACE(MICROTCP_TRACE_DEBUG, MICROTCP_EV_FINAL_ACK, socket,
+                        socket->seq_number, received_header->ack_number, length);
+                    socket->dup_ack = 0;
+                    if (flight_stamp)
+                        microtcp_rtt_sample(socket, microtcp_now_us() - flight_stamp);
+                    microtcp_seg_stamps_acked(socket, &seg_stamps, length, microtcp_now_us());
+                    microtcp_set_cwnd(socket, socket->cwnd + (slow_start ? socket->cwnd : MICROTCP_MSS));
+                    window = received_header->window;
+                    break;
+                }
+                /*Up to congestion window ack received, or past it when a retransmission
+                 * filled the hole in front of segments the receiver already held*/
+                else if ((uint32_t)(received_header->ack_number - socket->seq_number) >= (uint32_t)data_sent
+                && (uint32_t)(received_header->ack_number - socket->seq_number) <= (uint32_t)MAX(data_sent, resend_end))
+                {
+                    MICROTCP_TRACE(MICROTCP_TRACE_DEBUG, MICROTCP_EV_FLIGHT_ACK, socket,
+                        socket->seq_number, received_header->ack_number, data_sent - data_acked);
+                    socket->dup_ack = 0;
+                    ignore = 0;
+                    data_acked = received_header->ack_number - socket->seq_number;
+                    socket->bytes_in_flight = 0;
+                    if (flight_stamp)
+                        microtcp_rtt_sample(socket, microtcp_now_us() - flight_stamp);
+                    microtcp_seg_stamps_acked(socket, &seg_stamps, data_acked, microtcp_now_us());
+                    microtcp_set_cwnd(socket, socket->cwnd + (slow_start ? socket->cwnd : MICROTCP_MSS));
+                }
+                /* Offsets into the message, which wrap with the sequence space */
+                else if ((uint32_t)(received_header->ack_number - socket->seq_number) >= (uint32_t)data_acked 
+                && (uint32_t)(received_header->ack_number - socket->seq_number) < (uint32_t)data_sent) 
+                {
+                    /* A window update is not a duplicate */
+                    if (data_acked == received_header->ack_number - socket->seq_number
+                        && received_header->window == window) 
+                    {
+                        socket->dup_ack++;
+                        socket->dup_acks++;
+                        MICROTCP_PROBE3(dup__ack, socket->sd, received_header->ack_number, socket->dup_ack);
+                        MICROTCP_TRACE(MICROTCP_TRACE_INFO, MICROTCP_EV_DUP_ACK, socket,
+                            socket->seq_number, received_header->ack_number, socket->dup_ack);
+                    }
+                    else {
+                        data_acked = received_header->ack_number - socket->seq_number;
+                        socket->bytes_in_flight = data_sent - data_acked;
+                        microtcp_seg_stamps_acked(socket, &seg_stamps, data_acked, microtcp_now_us());
+                        socket->dup_ack = 0;
+                    }
+                    if (socket->dup_ack == 3)
+                    {         
+                      socket->dup_ack = 0;
+                      ignore = 0;  
+                      /* RFC 5681 (4), and no inflation as the whole flight goes out again */
+                      socket->ssthresh = MAX((data_sent - data_acked) / 2, 2 * MICROTCP_MSS);
+                      microtcp_set_cwnd(socket, socket->ssthresh);
+                      MICROTCP_TRACE(MICROTCP_TRACE_INFO, MICROTCP_EV_FAST_RETRANSMIT, socket,
+                          socket->seq_number + data_acked, received_header->ack_number, socket->ssthresh);
+                    }
+                }
+            }
+            else if (check_control(received_header, 0, 1, 0, 0))
+            {
+                microtcp_set_state(socket, INVALID);
+                free(received_header);
+                return -1;
+            }
+            
+            window = received_header->window;
+            
+        }while(1);
+        socket->peer_win_size = window;
+        socket->peer_max_win_size = MAX(socket->peer_max_win_size, window);
+        socket->seq_number += length;
+        socket->bytes_in_flight = 0;
+        microtcp_sndlim_enter(socket, MICROTCP_SNDLIM_SENDER);
+        microtcp_hist_record(&socket->latency.send, microtcp_now_us() - call_stamp);
+        microtcp_stat_publish(socket);
+        free(received_header);
+        return length;
+    }
+
+    ssize_t
+    microtcp_sendfile(microtcp_sock_t* socket, int fd, off_t offset, size_t length)
+    {
+        long page = sysconf(_SC_PAGESIZE);
+        struct stat st;
+        size_t sent = 0;
+        size_t piece;
+        size_t skew;
+        uint8_t* map;
+        ssize_t ret;
+
+        if (fstat(fd, &st) == -1) {
+            fprintf(stderr, "Error: Unable to stat the file to send. %s\n", strerror(errno));
+            return -1;
+        }
+        if (S_ISREG(st.st_mode))
+            length = offset < st.st_size ? MIN(length, (size_t)(st.st_size - offset)) : 0;
+
+        while (sent < length) {
+            piece = MIN(length - sent, MICROTCP_SENDFILE_MAP);
+            /* mmap() wants a page aligned offset */
+            skew = (offset + sent) % page;
+            map = mmap(NULL, piece + skew, PROT_READ, MAP_SHARED, fd, offset + sent - skew);
+            if (map == MAP_FAILED) {
+                piece = MIN(piece, MICROTCP_SENDFILE_BUF);
+                map = malloc(piece);
+                if (!map)
+                    return -1;
+                ret = pread(fd, map, piece, offset + sent);
+                if (ret <= 0) {
+                    free(map);
+                    return ret == 0 ? (ssize_t)sent : -1;
+                }
+                piece = ret;
+                ret = microtcp_send(socket, map, piece, 0);
+                free(map);
+            }
+            else {
+                madvise(map, piece + skew, MADV_SEQUENTIAL);
+                ret = microtcp_send(socket, map + skew, piece, 0);
+                munmap(map, piece + skew);
+            }
+            if (ret == -1)
+                return -1;
+            sent += piece;
+        }
+        return sent;
+    }
+
+    
+
+    ssize_t microtcp_check_dupAck(microtcp_sock_t* socket, size_t* dup_ack, 
+        ssize_t* last_ack_sent, microtcp_header_node** header_list)
+    {
+        if (send_ack(socket) == -1)
+            return -1;
+        if (socket->ack_number == *last_ack_sent) {
+            (*dup_ack)++;
+            if (*dup_ack == 3) {
+                *dup_ack = 0;
+                free_microtcp_header_node(header_list);
+                socket->ooo_depth = 0;
+            }
+        }
+        else {
+            *last_ack_sent = socket->ack_number;
+            *dup_ack = 0;
+        }  
+        return 0;
+    } 
+
+
+    // :JUMP
+    static ssize_t microtcp_consumed(microtcp_sock_t* socket, size_t copied, int ack_pending);
+
+    /* Copies len bytes of data to offset bytes into the vector iov */
+    static void microtcp_iov_copy(const struct iovec* iov, int iovcnt, size_t offset,
+        const uint8_t* data, size_t len)
+    {
+        size_t piece;
+
+        for (; iovcnt && offset >= iov->iov_len; iov++, iovcnt--)
+            offset -= iov->iov_len;
+        for (; iovcnt && len; iov++, iovcnt--, offset = 0) {
+            piece = MIN(iov->iov_len - offset, len);
+            memcpy((uint8_t*)iov->iov_base + offset, data, piece);
+            data += piece;
+            len -= piece;
+        }
+    }
+
+    /*
+     * Where microtcp_intake() puts the payload. room tells how many more
+     * in-order bytes the destination takes; what goes past it waits in
+     * recvbuf for the next call. place takes in-order bytes. ahead takes a
+     * segment that starts gap bytes past the next in-order byte and returns
+     * 1 once it stored the payload, 0 to have a copy held until the gap
+     * fills. Both return -1 on failure.
+     */
+    typedef struct microtcp_sink microtcp_sink_t;
+
+    struct microtcp_sink
+    {
+        size_t (*room)(microtcp_sink_t* sink);
+        int (*place)(microtcp_sink_t* sink, const uint8_t* data, size_t len);
+        int (*ahead)(microtcp_sink_t* sink, size_t gap, const uint8_t* data, size_t len);
+        size_t placed;        /* In-order bytes of this call, recvbuf included */
+        int whole_flights;    /* ACK every flight at once and go on while there is room */
+        int stop;             /* Set by the sink to return after the current segment */
+    };
+
+    /* Hands len in-order bytes to the sink, the part past its room to recvbuf */
+    static int microtcp_intake_place(microtcp_sock_t* socket, microtcp_sink_t* sink,
+        const uint8_t* data, size_t len)
+    {
+        size_t direct = MIN(len, sink->room(sink));
+
+        if (direct && sink->place(sink, data, direct) == -1)
+            return -1;
+        memcpy(socket->recvbuf + socket->buf_fill_level, data + direct, len - direct);
+        socket->buf_fill_level += len - direct;
+        sink->placed += len;
+        return 0;
+    }
+
+    /* Whether len in-order bytes fit the sink and what is left of recvbuf */
+    static int microtcp_intake_fits(microtcp_sock_t* socket, microtcp_sink_t* sink, size_t len)
+    {
+        return len - MIN(len, sink->room(sink)) <= socket->recvbuf_len - socket->buf_fill_level;
+    }
+
+    /*
+     * The receive state machine behind microtcp_recv(), microtcp_recvfile()
+     * and microtcp_recv_segments(). Takes in segments until a flight ends,
+     * or with whole_flights until the sink has no room left, and until the
+     * sink sets stop. state->held is left to the caller.
+     *
+     * Returns 1 when the call is done (without whole_flights the ACK of the
+     * flight is then still due), 0 once the peer shut down, or -1.
+     */
+    static int microtcp_intake(microtcp_sock_t* socket, microtcp_sink_t* sink,
+        microtcp_segment_state_t* state, int flags)
+    {
+        int recv_data_size;
+        /* Every datagram lands here; only held payload is copied out of it */
+        uint8_t datagram[sizeof(microtcp_header_t) + MICROTCP_MSS];
+        microtcp_header_t received_header;
+        microtcp_header_t header;
+        uint8_t* received_data;
+        uint8_t* node_data;
+        int stored;
+        int ret;
+        /*
+         * The next flight is one RTT after our last ACK only if the call was
+         * already waiting for it. What is queued when the call starts may
+         * have sat through the application's think time, so the first read
+         * only peeks and such a datagram ends the sample.
+         */
+        int first = socket->rcv_ack_stamp != 0;
+
+        do {
+            /* Receiving*/   
+            recv_data_size = microtcp_sock_recv(socket, datagram, sizeof(datagram),
+                flags | (first ? MSG_DONTWAIT : 0));
+            if (first && recv_data_size != -1)
+                socket->rcv_ack_stamp = 0;
+            else if (first && errno == EAGAIN) {
+                first = 0;
+                continue;
+            }
+            first = 0;
+            if (recv_data_size == -1) {
+                if (errno == EAGAIN)
+                {
+                    MICROTCP_TRACE(MICROTCP_TRACE_INFO, MICROTCP_EV_TIMEOUT, socket,
+                        socket->seq_number, socket->ack_number, MICROTCP_ACK_TIMEOUT_US);
+                    if (__atomic_load_n(&socket->rcv_abort, __ATOMIC_RELAXED)) {
+                        errno = ECANCELED;
+                        return -1;
+                    }
+                    microtcp_rcvbuf_idle(socket);
+                    if (microtcp_check_dupAck(socket, &state->dup_ack, &state->last_ack_sent, &state->held) == -1)
+                        return -1;
+                    /* The sender starts its next flight at this ACK */
+                    state->flight = 0;
+                    continue;
+                }
+                fprintf(stderr, "Error: Something went wrong with recv. %s\n", strerror(errno));
+                return -1;
+            }
+
+            /*Ignore packet*/
+            if (!microtcp_unpack_view(datagram, recv_data_size, &received_header, &received_data))
+            {
+                MICROTCP_TRACE(MICROTCP_TRACE_INFO, MICROTCP_EV_BAD_CHECKSUM, socket,
+                    socket->seq_number, socket->ack_number, recv_data_size);
+                continue;
+            }
+
+            /*Correct packet, fragmentation*/
+
+            /*Zero window probe, answer with the current window*/
+            if(check_control(&received_header, 0, 0, 0, 0) && !received_header.data_len)
+            {
+                MICROTCP_TRACE(MICROTCP_TRACE_INFO, MICROTCP_EV_WINDOW_PROBE, socket,
+                    received_header.seq_number, socket->ack_number, microtcp_rcv_window(socket));
+                if (send_ack(socket) == -1)
+                    return -1;
+            }
+            else if(check_control(&received_header, 0, 0, 0, 0)
+            && received_header.seq_number == socket->ack_number - socket->rcv_msg_offset)
+            {
+                MICROTCP_TRACE(MICROTCP_TRACE_DEBUG, MICROTCP_EV_SEGMENT_RECV, socket,
+                    received_header.seq_number + received_header.data_offset,
+                    received_header.ack_number, received_header.data_len);
+                MICROTCP_PROBE4(segment__recv, socket->sd, received_header.seq_number + received_header.data_offset,
+                    received_header.data_len, socket->ack_number);
+                /*In order, but the sender overran the advertised window*/
+                if(received_header.data_offset == socket->rcv_msg_offset
+                && !microtcp_intake_fits(socket, sink, received_header.data_len))
+                {
+                    if (microtcp_check_dupAck(socket, &state->dup_ack, &state->last_ack_sent, &state->held) == -1)
+                        return -1;
+                }
+                else if(received_header.data_offset == socket->rcv_msg_offset)
+                {
+                    MICROTCP_TRACE(MICROTCP_TRACE_DEBUG, MICROTCP_EV_IN_ORDER, socket,
+                        socket->seq_number, socket->ack_number, received_header.data_len);
+                    /* First segment of a new flight, one RTT after our ACK */
+                    if (socket->rcv_ack_stamp) {
+                        uint32_t sample = microtcp_now_us() - socket->rcv_ack_stamp;
+                        socket->rcv_rtt_us = socket->rcv_rtt_us ? (socket->rcv_rtt_us * 7 + sample) / 8 : sample;
+                        socket->rcv_ack_stamp = 0;
+                    }
+                    if (microtcp_intake_place(socket, sink, received_data, received_header.data_len) == -1)
+                        return -1;
+                    socket->ack_number += received_header.data_len;
+                    socket->rcv_msg_offset += received_header.data_len;
+                    state->flight += received_header.data_len;
+
+                    /*Check ordered list, a segment the sink stored carries no payload*/
+                    while(state->held)
+                    {   
+                        header = get_microtcp_header_node_list_header(state->held);
+                        if (header.data_offset != socket->rcv_msg_offset
+                        || (state->held->payload && !microtcp_intake_fits(socket, sink, header.data_len)))
+                            break;
+                        node_data = pop_microtcp_header_node(&state->held);
+                        MICROTCP_TRACE(MICROTCP_TRACE_DEBUG, MICROTCP_EV_REASSEMBLED, socket,
+                            socket->seq_number, socket->ack_number, header.data_len);
+                        if (node_data) {
+                            ret = microtcp_intake_place(socket, sink, node_data, header.data_len);
+                            free(node_data);
+                            if (ret == -1)
+                                return -1;
+                        }
+                        else
+                            sink->placed += header.data_len;
+                        socket->ack_number += header.data_len;
+                        socket->rcv_msg_offset += header.data_len;
+                        state->flight += header.data_len;
+                    } 
+                    socket->ooo_depth = count_microtcp_header_node(state->held);
+                    state->dup_ack = 0;
+
+                    /* End of the message, a full receive buffer, or the congestion
+                     * or flow limit reached: the flight is over */
+                    if (received_header.total_data_size == socket->rcv_msg_offset
+                    || socket->buf_fill_level == socket->recvbuf_len
+                    || state->flight >= received_header.control_limit)
+                    {
+                        if (received_header.total_data_size == socket->rcv_msg_offset)
+                            socket->rcv_msg_offset = 0;
+                        /* The ACK leaves after delivery, so that it advertises the
+                         * space the application frees */
+                        if (!sink->whole_flights)
+                            return 1;
+                        microtcp_rcvbuf_tune(socket, state->flight);
+                        if (send_ack(socket) == -1)
+                            return -1;
+                        socket->rcv_ack_stamp = microtcp_now_us();
+                        state->flight = 0;
+                        if (!sink->room(sink) || socket->buf_fill_level)
+                            return 1;
+                    }
+                } 
+                /*Out of sequence received packet, the sink stores it or it is held*/
+                else if(received_header.data_offset > socket->rcv_msg_offset
+                && !has_microtcp_header_node(state->held, received_header.data_offset))
+                {
+                    MICROTCP_TRACE(MICROTCP_TRACE_INFO, MICROTCP_EV_OUT_OF_ORDER, socket,
+                        socket->seq_number, socket->ack_number, received_header.data_offset);
+                    if ((stored = sink->ahead(sink, received_header.data_offset - socket->rcv_msg_offset,
+                        received_data, received_header.data_len)) == -1)
+                        return -1;
+                    state->held = add_microtcp_header_node(state->held, &received_header,
+                        stored ? NULL : received_data);
+                    socket->ooo_depth = count_microtcp_header_node(state->held);
+                }
+                /*Ignore*/
+            }
+            /*Shutdown*/
+            else if ((check_control(&received_header, 1, 0, 0, 1) && socket->ack_number == received_header.seq_number))
+            {
+                socket->ack_number++;
+                microtcp_set_state(socket, CLOSING_BY_PEER);
+                return 0;
+            }
+            else if (check_control(&received_header, 0, 1, 0, 0))
+            {
+                microtcp_set_state(socket, INVALID);
+                return -1;
+            }
+            else if (microtcp_check_dupAck(socket, &state->dup_ack, &state->last_ack_sent, &state->held) == -1)
+                return -1;
+        } while (!sink->stop);
+        return 1;
+    }
+
+    /* microtcp_recv() puts in-order payload straight into the caller's buffers */
+    typedef struct
+    {
+        microtcp_sink_t sink;
+        const struct iovec* iov;
+        int iovcnt;
+        size_t length;
+    } microtcp_iov_sink_t;
+
+    static size_t microtcp_iov_room(microtcp_sink_t* sink)
+    {
+        microtcp_iov_sink_t* to = (microtcp_iov_sink_t*)sink;
+
+        return to->length - MIN(sink->placed, to->length);
+    }
+
+    static int microtcp_iov_place(microtcp_sink_t* sink, const uint8_t* data, size_t len)
+    {
+        microtcp_iov_sink_t* to = (microtcp_iov_sink_t*)sink;
+
+        microtcp_iov_copy(to->iov, to->iovcnt, sink->placed, data, len);
+        return 0;
+    }
+
+    /* The gap may lie past the caller's buffers, so segments ahead are held */
+    static int microtcp_iov_ahead(microtcp_sink_t* sink, size_t gap, const uint8_t* data, size_t len)
+    {
+        (void) sink;
+        (void) gap;
+        (void) data;
+        (void) len;
+        return 0;
+    }
+
+    ssize_t
+    microtcp_recv(microtcp_sock_t* socket, void* buffer, size_t length, int flags)
+    {
+        struct iovec iov;
+
+        iov.iov_base = buffer;
+        iov.iov_len = length;
+        return microtcp_recvv(socket, &iov, 1, flags);
+    }
+
+    static ssize_t microtcp_recv_iov(microtcp_sock_t* socket, const struct iovec* iov, int iovcnt,
+        int flags)
+    {
+        microtcp_iov_sink_t to = { { microtcp_iov_room, microtcp_iov_place, microtcp_iov_ahead, 0, 0, 0 },
+            iov, iovcnt, 0 };
+        microtcp_segment_state_t state = MICROTCP_SEGMENT_STATE_INIT;
+        ssize_t return_value;
+        size_t copied;
+        int ret;
+        int i;
+        uint64_t call_stamp = microtcp_now_us();
+
+        for (i = 0; i < iovcnt; i++)
+            to.length += iov[i].iov_len;
+        /* Data left over from a previous call is delivered first */
+        if (socket->buf_fill_level) {
+            copied = MIN(to.length, socket->buf_fill_level);
+            microtcp_iov_copy(iov, iovcnt, 0, socket->recvbuf, copied);
+            return_value = microtcp_consumed(socket, copied, 0);
+            microtcp_hist_record(&socket->latency.recv, microtcp_now_us() - call_stamp);
+            return return_value;
+        }
+        microtcp_rcvbuf_idle(socket);
+
+        ret = microtcp_intake(socket, &to.sink, &state, flags);
+        free_microtcp_header_node(&state.held);
+        if (ret != 1)
+            return -1;
+        socket->ooo_depth = 0;
+        /* recvbuf only holds what the caller's buffers had no room for */
+        copied = MIN(to.sink.placed, to.length);
+        microtcp_rcvbuf_tune(socket, copied);
+        return_value = microtcp_consumed(socket, 0, 1);
+        microtcp_hist_record(&socket->latency.recv, microtcp_now_us() - call_stamp);
+        return return_value == -1 ? -1 : (ssize_t)copied;
+    }
+
+    /*
+     * Takes in the next block once inflate_buf holds its header, and for a
+     * compressed one the whole of it. A malformed one ends the connection,
+     * there is no telling where the next block starts.
+     */
+    static int microtcp_inflate_block(microtcp_sock_t* socket, uint8_t* raw)
+    {
+        uint8_t* head = socket->inflate_buf + socket->inflate_head;
+        size_t avail = socket->inflate_fill - socket->inflate_head;
+        uint32_t len[2];
+
+        if (avail < MICROTCP_COMPRESS_HEADER)
+            return 0;
+        memcpy(len, head, sizeof(len));
+        len[0] = ntohl(len[0]);
+        len[1] = ntohl(len[1]);
+        if (!len[0] || len[0] > MICROTCP_COMPRESS_BLOCK || !len[1] || len[1] > len[0]) {
+            fprintf(stderr, "Error: Malformed compressed block header.\n");
+            socket->inflate_head = socket->inflate_fill = 0;
+            microtcp_set_state(socket, INVALID);
+            return -1;
+        }
+        if (len[1] == len[0]) {
+            socket->inflate_head += MICROTCP_COMPRESS_HEADER;
+            socket->inflate_stored = len[0];
+            socket->decompress_in += MICROTCP_COMPRESS_HEADER;
+        }
+        else if (avail >= MICROTCP_COMPRESS_HEADER + len[1]) {
+            if (microtcp_lz_decompress(head + MICROTCP_COMPRESS_HEADER, len[1], raw, len[0]) != (ssize_t)len[0]) {
+                fprintf(stderr, "Error: Malformed compressed block.\n");
+                socket->inflate_head = socket->inflate_fill = 0;
+                microtcp_set_state(socket, INVALID);
+                return -1;
+            }
+            socket->inflate_head += MICROTCP_COMPRESS_HEADER + len[1];
+            socket->inflate_len = len[0];
+            socket->inflate_pos = 0;
+            socket->decompress_in += MICROTCP_COMPRESS_HEADER + len[1];
+            socket->decompress_out += len[0];
+        }
+        return 0;
+    }
+
+    /*
+     * Delivers the payload of a compressed connection. What arrives goes to
+     * inflate_buf, up to a block header and compressed block at a time, and
+     * compressed blocks expand behind it. Stored blocks are received
+     * straight into iov once inflate_buf runs dry. Returns once something
+     * is delivered and the next byte would have to be waited for.
+     */
+    static ssize_t microtcp_recv_inflate(microtcp_sock_t* socket, const struct iovec* iov, int iovcnt,
+        int flags)
+    {
+        struct iovec slice[MICROTCP_SEGMENT_IOV];
+        uint8_t* raw;
+        size_t length = 0;
+        size_t delivered = 0;
+        size_t copied;
+        uint32_t len;
+        ssize_t ret;
+        int i, n;
+
+        for (i = 0; i < iovcnt; i++)
+            length += iov[i].iov_len;
+        if (!length)
+            return 0;
+        if (!socket->inflate_buf
+            && !(socket->inflate_buf = malloc(MICROTCP_COMPRESS_HEADER + 2 * MICROTCP_COMPRESS_BLOCK))) {
+            fprintf(stderr, "Error: Out of memory for the decompression buffer.\n");
+            return -1;
+        }
+        raw = socket->inflate_buf + MICROTCP_COMPRESS_HEADER + MICROTCP_COMPRESS_BLOCK;
+
+        while (delivered < length) {
+            if (socket->inflate_pos < socket->inflate_len) {
+                copied = MIN(socket->inflate_len - socket->inflate_pos, length - delivered);
+                microtcp_iov_copy(iov, iovcnt, delivered, raw + socket->inflate_pos, copied);
+                socket->inflate_pos += copied;
+                delivered += copied;
+                continue;
+            }
+            if (socket->inflate_stored && socket->inflate_head < socket->inflate_fill) {
+                copied = MIN(MIN(socket->inflate_stored, length - delivered),
+                    socket->inflate_fill - socket->inflate_head);
+                microtcp_iov_copy(iov, iovcnt, delivered, socket->inflate_buf + socket->inflate_head, copied);
+                socket->inflate_head += copied;
+                socket->inflate_stored -= copied;
+                socket->decompress_in += copied;
+                socket->decompress_out += copied;
+                delivered += copied;
+                continue;
+            }
+            if (!socket->inflate_stored) {
+                if (microtcp_inflate_block(socket, raw) == -1)
+                    return -1;
+                if (socket->inflate_stored || socket->inflate_pos < socket->inflate_len)
+                    continue;
+            }
+            /* Nothing more without waiting */
+            if (delivered && !socket->buf_fill_level)
+                break;
+
+            if (socket->inflate_stored) {
+                /* Reading on past the block keeps the flight out of recvbuf, and
+                 * so the window open; the bytes past it move to inflate_buf */
+                len = MIN(socket->inflate_stored + MICROTCP_COMPRESS_HEADER + MICROTCP_COMPRESS_BLOCK,
+                    length - delivered);
+                n = microtcp_iov_slice(iov, iovcnt, delivered, &len, slice, MICROTCP_SEGMENT_IOV);
+                if ((ret = microtcp_recv_iov(socket, slice, n, flags)) == -1)
+                    break;
+                if ((size_t)ret > socket->inflate_stored) {
+                    microtcp_iov_gather(iov, iovcnt, delivered + socket->inflate_stored, socket->inflate_buf,
+                        ret - socket->inflate_stored);
+                    socket->inflate_head = 0;
+                    socket->inflate_fill = ret - socket->inflate_stored;
+                    ret = socket->inflate_stored;
+                }
+                socket->inflate_stored -= ret;
+                socket->decompress_in += ret;
+                socket->decompress_out += ret;
+                delivered += ret;
+                continue;
+            }
+            /* The rest of a block moves to the front, where the whole of it fits */
+            memmove(socket->inflate_buf, socket->inflate_buf + socket->inflate_head,
+                socket->inflate_fill - socket->inflate_head);
+            socket->inflate_fill -= socket->inflate_head;
+            socket->inflate_head = 0;
+            slice[0].iov_base = socket->inflate_buf + socket->inflate_fill;
+            slice[0].iov_len = MICROTCP_COMPRESS_HEADER + MICROTCP_COMPRESS_BLOCK - socket->inflate_fill;
+            if ((ret = microtcp_recv_iov(socket, slice, 1, flags)) == -1)
+                break;
+            socket->inflate_fill += ret;
+        }
+
+        if (delivered)
+            return delivered;
+        if (socket->state == CLOSING_BY_PEER && (socket->inflate_fill > socket->inflate_head || socket->inflate_stored))
+            fprintf(stderr, "Error: The peer shut down within a compressed block.\n");
+        return -1;
+    }
+
+    ssize_t
+    microtcp_recvv(microtcp_sock_t* socket, const struct iovec* iov, int iovcnt, int flags)
+    {
+        if (socket->compress_active)
+            return microtcp_recv_inflate(socket, iov, iovcnt, flags);
+        return microtcp_recv_iov(socket, iov, iovcnt, flags);
+    }
+
+    int microtcp_get_info(const microtcp_sock_t* socket, microtcp_info_t* info, size_t info_len)
+    {
+        microtcp_info_t snapshot;
+        uint64_t sndlim_us[3];
+
+        if (!socket || !info) {
+            fprintf(stderr, "Error: microtcp_get_info called with a NULL argument.\n");
+            return -1;
+        }
+        memcpy(sndlim_us, socket->sndlim_us, sizeof(sndlim_us));
+        if (socket->sndlim_stamp)
+            sndlim_us[socket->sndlim_state] += microtcp_now_us() - socket->sndlim_stamp;
+
+        memset(&snapshot, 0, sizeof(snapshot));
+        snapshot.version = MICROTCP_INFO_VERSION;
+        snapshot.state = socket->state;
+        snapshot.cwnd = socket->cwnd;
+        snapshot.ssthresh = socket->ssthresh;
+        snapshot.srtt_us = socket->srtt;
+        snapshot.rttvar_us = socket->rttvar;
+        snapshot.rto_us = socket->rto;
+        snapshot.bytes_in_flight = socket->bytes_in_flight;
+        snapshot.peer_window = socket->peer_win_size;
+        snapshot.advertised_window = socket->curr_win_size;
+        snapshot.ooo_queue_depth = socket->ooo_depth;
+        snapshot.recvbuf_fill = socket->buf_fill_level;
+        snapshot.recvbuf_len = socket->recvbuf_len;
+        snapshot.packets_sent = socket->packets_send;
+        snapshot.packets_received = socket->packets_received;
+        snapshot.packets_retransmitted = socket->packets_lost;
+        snapshot.bytes_sent = socket->bytes_send;
+        snapshot.bytes_received = socket->bytes_received;
+        snapshot.bytes_retransmitted = socket->bytes_lost;
+        snapshot.dup_acks = socket->dup_acks;
+        snapshot.timeouts = socket->timeouts;
+        snapshot.zero_window_events = socket->zero_win_events;
+        snapshot.sender_limited_us = sndlim_us[MICROTCP_SNDLIM_SENDER];
+        snapshot.receiver_limited_us = sndlim_us[MICROTCP_SNDLIM_RWND];
+        snapshot.network_limited_us = sndlim_us[MICROTCP_SNDLIM_CWND];
+        snapshot.compress_bytes_in = socket->compress_in;
+        snapshot.compress_bytes_out = socket->compress_out;
+        snapshot.compress_blocks_bypassed = socket->compress_bypassed;
+        snapshot.decompress_bytes_in = socket->decompress_in;
+        snapshot.decompress_bytes_out = socket->decompress_out;
+
+        memcpy(info, &snapshot, MIN(info_len, sizeof(snapshot)));
+        return 0;
+    }
+
+    int microtcp_get_latency(const microtcp_sock_t* socket, microtcp_latency_t* latency)
+    {
+        if (!socket || !latency) {
+            fprintf(stderr, "Error: microtcp_get_latency called with a NULL argument.\n");
+            return -1;
+        }
+        *latency = socket->latency;
+        return 0;
+    }
+
+    void microtcp_seg_stamps_sent(microtcp_seg_stamps_t* stamps, uint32_t end, uint64_t now)
+    {
+        uint32_t slot;
+
+        /* Retransmissions keep the time of the first transmission */
+        if (end <= stamps->highest || stamps->tail - stamps->head == MICROTCP_SEG_STAMPS)
+            return;
+        slot = stamps->tail++ & (MICROTCP_SEG_STAMPS - 1);
+        stamps->end[slot] = end;
+        stamps->stamp[slot] = now;
+        stamps->highest = end;
+    }
+
+    void microtcp_seg_stamps_acked(microtcp_sock_t* socket, microtcp_seg_stamps_t* stamps,
+        uint32_t acked, uint64_t now)
+    {
+        uint32_t slot;
+
+        while (stamps->head != stamps->tail) {
+            slot = stamps->head & (MICROTCP_SEG_STAMPS - 1);
+            if (stamps->end[slot] > acked)
+                break;
+            microtcp_hist_record(&socket->latency.ack, now - stamps->stamp[slot]);
+            stamps->head++;
+        }
+    }
+
+    /* Sends the pending ACK, or an update once the application opened a worthwhile amount of space */
+    static int microtcp_window_update(microtcp_sock_t* socket, int ack_pending)
+    {
+        size_t threshold = MIN(MICROTCP_MSS, socket->recvbuf_len / 2);
+
+        if (ack_pending || microtcp_rcv_window(socket) >= socket->curr_win_size + threshold) {
+            if (!ack_pending)
+                MICROTCP_TRACE(MICROTCP_TRACE_INFO, MICROTCP_EV_WINDOW_UPDATE, socket,
+                    socket->seq_number, socket->ack_number, microtcp_rcv_window(socket));
+            if (send_ack(socket) == -1)
+                return -1;
+            if (ack_pending)
+                socket->rcv_ack_stamp = microtcp_now_us();
+        }
+        return 0;
+    }
+
+    /* Drops the first copied bytes of recvbuf, which the application now holds */
+    static ssize_t microtcp_consumed(microtcp_sock_t* socket, size_t copied, int ack_pending)
+    {
+        socket->buf_fill_level -= copied;
+        memmove(socket->recvbuf, socket->recvbuf + copied, socket->buf_fill_level);
+        microtcp_rcvbuf_tune(socket, copied);
+        MICROTCP_TRACE(MICROTCP_TRACE_DEBUG, MICROTCP_EV_DELIVER, socket,
+            socket->seq_number, socket->ack_number, copied);
+        microtcp_stat_publish(socket);
+        return microtcp_window_update(socket, ack_pending) == -1 ? -1 : (ssize_t)copied;
+    }
 
-                    memcpy(temp_buffer, (char*)buffer + data_sent, temp_len);
+    ssize_t microtcp_deliver(microtcp_sock_t* socket, void* buffer, size_t length, int ack_pending)
+    {
+        size_t copied = MIN(length, socket->buf_fill_level);
 
-                    //printf("temp len = %u, control limit = %u\n", temp_len, control_limit);
+        memcpy(buffer, socket->recvbuf, sizeof(uint8_t) * copied);
+        return microtcp_consumed(socket, copied, ack_pending);
+    }
 
-                    send_buffer = microtcp_create_packet(socket->seq_number, socket->ack_number,
-                     0, 0, 0, 0, socket->curr_win_size, temp_len, temp_buffer, length, data_sent, control_limit);
+    int microtcp_rcv_release(microtcp_sock_t* socket, size_t len)
+    {
+        socket->rcv_held -= MIN(len, socket->rcv_held);
+        return microtcp_window_update(socket, 0);
+    }
 
-                    if ((data_size = send(socket->sd, send_buffer, sizeof(microtcp_header_t) + temp_len, flags)) == -1) {
-                        FREE(send_buffer, temp_buffer, received_header);
-                        return -1;
-                    }
+    static int microtcp_pwrite_all(int fd, const void* data, size_t len, off_t pos)
+    {
+        ssize_t ret;
 
-                    data_sent += data_size - sizeof(microtcp_header_t);
-                    FREE(send_buffer, temp_buffer);
-                }  
-            }         
-            ignore = 1;
-            recv_buffer = malloc(sizeof(microtcp_header_t));
-            
-            /*Receiving packet.*/
-            if((recv_data_size = recv(socket->sd, recv_buffer, sizeof(microtcp_header_t), 0)) == -1)
-            {
-                if (errno == EAGAIN)
-                {
-                    fprintf(stderr, "Error: A timeout occured.\n");
-                    free(recv_buffer);  
-                    // send dup ack                  
-                    if (send_ack(socket) == -1) {
-                        FREE(recv_buffer, received_header);
-                        return -1;
-                    }
-                    socket->ssthresh = socket->cwnd / 2;
-                    socket->cwnd = MIN(MICROTCP_MSS, socket->ssthresh);
+        while (len) {
+            if ((ret = pwrite(fd, data, len, pos)) == -1) {
+                if (errno == EINTR)
                     continue;
-                }
-                fprintf(stderr, "Error: Something went wrong with recv. %s\n", strerror(errno));
-                FREE(recv_buffer, received_header);
-                return -1;
-            }
-            
-            /*Checksum*/
-            if (!microtcp_unpack(recv_buffer, received_header, &received_data)) 
-            {
-                if (send_ack(socket) == -1) {
-                    FREE(recv_buffer, received_header);
-                    return -1;
-                }
-                free(recv_buffer);
-                continue;
-            }
-            /*Data*/
-            if(check_control(received_header, 0, 0, 0, 0))             
-            {
-                printf("Data .\n");
-                if (send_ack(socket) == -1) {
-                    FREE(recv_buffer, received_header, received_data);
-                    return -1;
-                }
-                continue;
-            } 
-            /*Ack*/
-            else if (check_control(received_header, 1, 0, 0, 0))
-            {
-                printf("Ack : ");
-                /*Final Ack received*/
-                if (received_header->ack_number == socket->seq_number + length) 
-                {
-                    printf("Final Ack.\n");
-                    socket->dup_ack = 0;
-                    socket->cwnd += slow_start ? socket->cwnd : MICROTCP_MSS;
-                    window = received_header->window;
-                    break;
-                }
-                /*Up to congestion window ack received*/
-                else if (received_header->ack_number == socket->seq_number + data_sent)
-                {
-                    printf("Congestion limit ack\n");
-                    socket->dup_ack = 0;
-                    ignore = 0;
-                    data_acked = received_header->ack_number - socket->seq_number;
-                    socket->cwnd += slow_start ? socket->cwnd : MICROTCP_MSS;
-                }
-                else if (received_header->ack_number >= socket->seq_number + data_acked 
-                && received_header->ack_number < socket->seq_number + data_sent) 
-                {
-                    printf("Possibly Dup Ack.\n");
-                    if (data_acked == received_header->ack_number - socket->seq_number) 
-                    {
-                        socket->dup_ack++;
-                    }
-                    else {
-                        data_acked = received_header->ack_number - socket->seq_number;
-                        socket->dup_ack = 0;
-                    }
-                    if (socket->dup_ack == 3)
-                    {         
-                      socket->dup_ack = 0;
-                      ignore = 0;  
-                      socket->ssthresh = socket->cwnd / 2;
-                      socket->cwnd = socket->cwnd/2 + 1;
-                    }
-                }
-            }
-            else if (check_control(received_header, 0, 1, 0, 0))
-            {
-                socket->state = INVALID;
-                FREE(received_data, received_header);
+                fprintf(stderr, "Error: Unable to write the received data. %s\n", strerror(errno));
                 return -1;
             }
-            
-            window = received_header->window;
-            FREE(received_data, recv_buffer);
-            
-        }while(1);
-        socket->seq_number += length;
-        FREE(recv_buffer, received_data, received_header);
-        return data_size;
+            data = (const char*)data + ret;
+            len -= ret;
+            pos += ret;
+        }
+        return 0;
     }
 
-    
+    /*
+     * microtcp_recvfile() writes in-order data at its file position, the
+     * part past limit stays in recvbuf for the next call, as microtcp_recv()
+     * keeps what does not fit the caller's buffer.
+     */
+    typedef struct
+    {
+        microtcp_sink_t sink;
+        int fd;
+        off_t offset;
+        off_t limit;
+    } microtcp_file_sink_t;
 
-    ssize_t microtcp_check_dupAck(microtcp_sock_t* socket, int* dup_ack, 
-        int* last_ack_sent, microtcp_header_node** header_list)
+    static size_t microtcp_file_room(microtcp_sink_t* sink)
     {
-        if (send_ack(socket) == -1)
+        microtcp_file_sink_t* to = (microtcp_file_sink_t*)sink;
+        off_t pos = to->offset + (off_t)sink->placed;
+
+        return pos < to->limit ? (size_t)(to->limit - pos) : 0;
+    }
+
+    static int microtcp_file_place(microtcp_sink_t* sink, const uint8_t* data, size_t len)
+    {
+        microtcp_file_sink_t* to = (microtcp_file_sink_t*)sink;
+
+        return microtcp_pwrite_all(to->fd, data, len, to->offset + (off_t)sink->placed);
+    }
+
+    /* Ahead of the gap: written in place when it fits before limit, held otherwise */
+    static int microtcp_file_ahead(microtcp_sink_t* sink, size_t gap, const uint8_t* data, size_t len)
+    {
+        microtcp_file_sink_t* to = (microtcp_file_sink_t*)sink;
+        off_t pos = to->offset + (off_t)(sink->placed + gap);
+
+        if (pos + (off_t)len > to->limit)
+            return 0;
+        return microtcp_pwrite_all(to->fd, data, len, pos) == -1 ? -1 : 1;
+    }
+
+    /*
+     * microtcp_recvfile() of a compressed connection. The payload has to be
+     * expanded first, so it goes through microtcp_recv() and a buffer.
+     */
+    static ssize_t microtcp_recvfile_inflate(microtcp_sock_t* socket, int fd, off_t offset, size_t max_len)
+    {
+        uint8_t* buffer;
+        size_t written = 0;
+        ssize_t ret;
+
+        if (socket->state == CLOSING_BY_PEER || !max_len)
+            return 0;
+        buffer = malloc(MICROTCP_COMPRESS_BLOCK);
+        if (!buffer) {
+            fprintf(stderr, "Error: Out of memory for the receive buffer.\n");
             return -1;
-        if (socket->ack_number == *last_ack_sent) {
-            *dup_ack++;
-            if (*dup_ack == 3) {
-                *dup_ack = 0;
-                free_microtcp_header_node(header_list);
+        }
+        while (written < max_len
+            && (ret = microtcp_recv(socket, buffer, MIN(max_len - written, MICROTCP_COMPRESS_BLOCK), 0)) != -1) {
+            if (microtcp_pwrite_all(fd, buffer, ret, offset + written) == -1) {
+                free(buffer);
+                return -1;
             }
+            written += ret;
         }
-        else {
-            *last_ack_sent = socket->ack_number;
-            *dup_ack = 0;
-        }  
+        free(buffer);
+        return written || socket->state == CLOSING_BY_PEER ? (ssize_t)written : -1;
+    }
+
+    ssize_t
+    microtcp_recvfile(microtcp_sock_t* socket, int fd, off_t offset, size_t max_len)
+    {
+        microtcp_file_sink_t to = { { microtcp_file_room, microtcp_file_place, microtcp_file_ahead, 0, 1, 0 },
+            fd, offset, offset + (off_t)MIN(max_len, (size_t)(INT64_MAX - offset)) };
+        microtcp_segment_state_t state = MICROTCP_SEGMENT_STATE_INIT;
+        size_t written;
+        int ret;
+        uint64_t call_stamp = microtcp_now_us();
+
+        if (socket->compress_active)
+            return microtcp_recvfile_inflate(socket, fd, offset, max_len);
+        /* Data microtcp_recv() or the last call could not hand out goes first */
+        if (socket->buf_fill_level) {
+            written = MIN(max_len, socket->buf_fill_level);
+            if (microtcp_pwrite_all(fd, socket->recvbuf, written, offset) == -1)
+                return -1;
+            return microtcp_consumed(socket, written, 0);
+        }
+        if (socket->state == CLOSING_BY_PEER || !max_len)
+            return 0;
+        microtcp_rcvbuf_idle(socket);
+
+        /* The file takes whole flights, the connection only stops at their ends */
+        ret = microtcp_intake(socket, &to.sink, &state, 0);
+        free_microtcp_header_node(&state.held);
+        if (ret == -1)
+            return -1;
+        socket->ooo_depth = 0;
+        written = MIN(to.sink.placed, (size_t)(to.limit - offset));
+        MICROTCP_TRACE(MICROTCP_TRACE_DEBUG, MICROTCP_EV_DELIVER, socket,
+            socket->seq_number, socket->ack_number, written);
+        microtcp_stat_publish(socket);
+        microtcp_hist_record(&socket->latency.recv, microtcp_now_us() - call_stamp);
+        return written;
+    }
+
+    /*
+     * microtcp_recv_segments() hands every segment over the first time it
+     * arrives, so it takes any amount and nothing ahead of the gap is held
+     * with its payload.
+     */
+    typedef struct
+    {
+        microtcp_sink_t sink;
+        microtcp_segment_fn fn;
+        void* ctx;
+        size_t handed;
+    } microtcp_fn_sink_t;
+
+    static size_t microtcp_fn_room(microtcp_sink_t* sink)
+    {
+        (void) sink;
+        return SIZE_MAX;
+    }
+
+    static int microtcp_fn_place(microtcp_sink_t* sink, const uint8_t* data, size_t len)
+    {
+        microtcp_fn_sink_t* to = (microtcp_fn_sink_t*)sink;
+
+        sink->stop |= to->fn(to->ctx, data, len);
+        to->handed += len;
         return 0;
-    } 
+    }
 
+    static int microtcp_fn_ahead(microtcp_sink_t* sink, size_t gap, const uint8_t* data, size_t len)
+    {
+        (void) gap;
+        microtcp_fn_place(sink, data, len);
+        return 1;
+    }
 
-    // :JUMP
     ssize_t
-    microtcp_recv(microtcp_sock_t* socket, void* buffer, size_t length, int flags)
+    microtcp_recv_segments(microtcp_sock_t* socket, microtcp_segment_state_t* state,
+        microtcp_segment_fn fn, void* ctx)
     {
-        int data_size;
-        int recv_data_size;
-        void* recv_buffer;
-        int retun_value;
-        ssize_t return_value;
-        size_t dup_ack = 0;
-        ssize_t last_ack_sent = -1;
-        microtcp_header_t* received_header = malloc(sizeof(microtcp_header_t));
-        microtcp_header_node* header_list = NULL;
-        microtcp_header_t header;
-        char* received_data;
-        char* node_data;
+        microtcp_fn_sink_t to = { { microtcp_fn_room, microtcp_fn_place, microtcp_fn_ahead, 0, 1, 0 },
+            fn, ctx, 0 };
+        int ret;
+        uint64_t call_stamp = microtcp_now_us();
 
-        socket->curr_win_size = MICROTCP_WIN_SIZE;
+        if (socket->compress_active) {
+            fprintf(stderr, "Error: Segments cannot be received on a compressed connection.\n");
+            return -1;
+        }
+        if (socket->state == CLOSING_BY_PEER)
+            return -1;
+        if ((ret = microtcp_intake(socket, &to.sink, state, 0)) == 0) {
+            free_microtcp_header_node(&state->held);
+            socket->ooo_depth = 0;
+        }
+        if (ret != 1)
+            return -1;
+        microtcp_stat_publish(socket);
+        microtcp_hist_record(&socket->latency.recv, microtcp_now_us() - call_stamp);
+        return to.handed;
+    }
 
-        do {
-            recv_buffer = malloc(length);
-            /* Receiving*/   
-            if ((recv_data_size = recv(socket->sd, recv_buffer, length, flags)) == -1) {
-                if (errno == EAGAIN)
-                {
-                    fprintf(stderr, "Error: A timeout occured.\n");
-                    free(recv_buffer);                    
-                    if (microtcp_check_dupAck(socket, &dup_ack, &last_ack_sent, &header_list) == -1) {
-                        FREE(recv_buffer, received_header);
-                        free_microtcp_header_node(&header_list);
-                        return -1;
-                    }
-                    continue;
-                }
-                fprintf(stderr, "Error: Something went wrong with recv. %s\n", strerror(errno));
-                FREE(recv_buffer, received_header);
-                free_microtcp_header_node(&header_list);
-                return -1;
-            }
+    static size_t microtcp_rcvbuf_total;
 
-            /*Ignore packet*/
-            if (!microtcp_unpack(recv_buffer, received_header, &received_data))
-            {
-                printf("In Bad Unpack.\n");
-                free(recv_buffer);
-                continue;
-            }
+    int microtcp_set_recvbuf(microtcp_sock_t* socket, size_t len, size_t max_len)
+    {
+        uint8_t* resized;
+        size_t old_len = socket->recvbuf ? socket->recvbuf_len : 0;
 
-            free(recv_buffer);
-            /*Correct packet, fragmentation*/
+        len = MAX(len, socket->buf_fill_level);
+        if (!len)
+            return -1;
+        if (socket->recvbuf && len == old_len) {
+            socket->recvbuf_max = max_len;
+            return 0;
+        }
+        if (len > old_len && __atomic_add_fetch(&microtcp_rcvbuf_total, len - old_len,
+            __ATOMIC_RELAXED) > MICROTCP_RECVBUF_GLOBAL_MAX && socket->recvbuf) {
+            __atomic_sub_fetch(&microtcp_rcvbuf_total, len - old_len, __ATOMIC_RELAXED);
+            return -1;
+        }
+        if (len < old_len)
+            __atomic_sub_fetch(&microtcp_rcvbuf_total, old_len - len, __ATOMIC_RELAXED);
+        if (!(resized = realloc(socket->recvbuf, len))) {
+            if (len > old_len)
+                __atomic_sub_fetch(&microtcp_rcvbuf_total, len - old_len, __ATOMIC_RELAXED);
+            else
+                __atomic_add_fetch(&microtcp_rcvbuf_total, old_len - len, __ATOMIC_RELAXED);
+            return -1;
+        }
+        socket->recvbuf = resized;
+        socket->recvbuf_len = len;
+        MICROTCP_TRACE(MICROTCP_TRACE_INFO, MICROTCP_EV_RCVBUF_RESIZE, socket,
+            socket->seq_number, socket->ack_number, len);
+        socket->recvbuf_max = max_len;
+        return 0;
+    }
 
-            if(check_control(received_header, 0, 0, 0, 0)
-            && received_header->seq_number == socket->ack_number - socket->bytes_received)
-            {
-                printf("In data packet.\n");
-                if(received_header->data_offset == socket->bytes_received)
-                {
-                    printf("In in order received Packet.\n");
-                    socket->ack_number += received_header->data_len;
-                    memcpy((char*)socket->recvbuf + socket->buf_fill_level, received_data, sizeof(uint8_t) * received_header->data_len); 
-                    socket->bytes_received += received_header->data_len;
-                    socket->buf_fill_level += received_header->data_len;
-                    socket->curr_win_size -= received_header->data_len;
-
-                    /*Check ordered list*/
-                    while(header_list)
-                    {   
-                        fprintf(stdout,"In header list while.\n");
-                        header = get_microtcp_header_node_list_header(header_list);
-                        
-                        if(header.data_offset == socket->bytes_received)
-                        {
-                            node_data = pop_microtcp_header_node(&header_list);       
-                            socket->ack_number += header.data_len;
-                            memcpy((char*)socket->recvbuf + socket->buf_fill_level, node_data, sizeof(uint8_t) * header.data_len); 
-                            socket->bytes_received += header.data_len;
-                            socket->buf_fill_level += header.data_len;
-                            socket->curr_win_size -= header.data_len;
-                            free(node_data);
-                        }
-                        else
-                            break;                       
-                    } 
+    void microtcp_rcvbuf_tune(microtcp_sock_t* socket, size_t copied)
+    {
+        uint64_t now = microtcp_now_us();
+        size_t target;
 
-                    dup_ack = 0;
-                    /* Return if bytes received successfully , we don't care about window size*/
-                    if(received_header->total_data_size == socket->bytes_received) 
-                    {  
-                        // printf("Final Ack sent : %u\n", socket->ack_number);
-                        // printf("total_data_size = %u\n", received_header->total_data_size);
-                        // printf("Bytes received = %u\n", socket->bytes_received);
-                        socket->curr_win_size = MICROTCP_RECVBUF_LEN;                      
-                        socket->bytes_received = 0;
-                        if (send_ack(socket) == -1) {
-                            FREE(received_data, received_header);
-                            free_microtcp_header_node(&header_list);
-                            return -1;
-                        }
-                        break;                        
-                    }                    
-                    /* Window size = 0, return back to main OR
-                    /* Congestion or flow limit reached. Continue, free received header list.*/
-                    else if (!socket->curr_win_size || received_header->control_limit == socket->buf_fill_level) 
-                    {                        
-                        // printf("Control Ack sent : %u\n", socket->ack_number);
-                        // printf("total_data_size = %u\n", received_header->total_data_size);
-                        // printf("Bytes received = %u\n", socket->bytes_received);
-                        socket->curr_win_size = MICROTCP_RECVBUF_LEN;
-                        if (send_ack(socket) == -1) {
-                            FREE(received_data, received_header);
-                            free_microtcp_header_node(&header_list);
-                            return -1;
-                        }
-                        break;    
-                    }
-                } 
-                /*Out of sequence received packet, insert to list.*/
-                else if(received_header->data_offset > socket->bytes_received) 
-                {
-                    printf("Out of order received Packet.\n");
-                    header_list = add_microtcp_header_node(header_list, received_header, received_data);
-                }
-                /*Ignore*/
-            }
-            /*Shutdown*/
-            else if ((check_control(received_header, 1, 0, 0, 1) && socket->ack_number == received_header->seq_number))
-            {
-                socket->ack_number++;
-                socket->state = CLOSING_BY_PEER;
-                free_microtcp_header_node(&header_list);
-                FREE(received_data, received_header);
-                return -1;
-            }
-            else if (check_control(received_header, 0, 1, 0, 0))
-            {
-                socket->state = INVALID;
-                free_microtcp_header_node(&header_list);
-                FREE(received_data, received_header);
-                return -1;
-            }
-            else 
-                if (microtcp_check_dupAck(socket, &dup_ack, &last_ack_sent, &header_list) == -1) {
-                    FREE(received_data, received_header);
-                    free_microtcp_header_node(&header_list);
-                    return -1;
-                }
+        socket->rcv_last_data = now;
+        socket->rcv_space_copied += copied;
+        if (!socket->rcv_space_stamp) {
+            socket->rcv_space_stamp = now;
+            return;
+        }
+        if (now - socket->rcv_space_stamp < MAX(socket->rcv_rtt_us, 1))
+            return;
+
+        target = MIN(2 * socket->rcv_space_copied, socket->recvbuf_max);
+        if (target > socket->recvbuf_len) {
+            /* Grow by what the global budget still allows */
+            size_t total = __atomic_load_n(&microtcp_rcvbuf_total, __ATOMIC_RELAXED);
+            size_t room = total < MICROTCP_RECVBUF_GLOBAL_MAX ? MICROTCP_RECVBUF_GLOBAL_MAX - total : 0;
+            target = MIN(target, socket->recvbuf_len + room);
+            if (target > socket->recvbuf_len)
+                microtcp_set_recvbuf(socket, target, socket->recvbuf_max);
+        }
+        socket->rcv_space_copied = 0;
+        socket->rcv_space_stamp = now;
+    }
+
+    void microtcp_rcvbuf_idle(microtcp_sock_t* socket)
+    {
+        /* The peer may still fill the window of our last ACK, taking it back would renege */
+        size_t len = MAX(MICROTCP_RECVBUF_LEN, socket->curr_win_size);
+
+        if (socket->buf_fill_level || socket->rcv_held || socket->recvbuf_len <= len
+            || microtcp_now_us() - socket->rcv_last_data < MICROTCP_RECVBUF_IDLE_US)
+            return;
+        microtcp_set_recvbuf(socket, len, socket->recvbuf_max);
+        socket->rcv_space_copied = 0;
+        socket->rcv_space_stamp = 0;
+    }
 
-            FREE(received_data);
-            printf("End of while\n");
-        } while (1);
-        printf("Out of rcv while.\n");
-        memcpy(buffer, socket->recvbuf, sizeof(uint8_t) * socket->buf_fill_level);
-        return_value = socket->buf_fill_level;
-        socket->buf_fill_level = 0;
-        free_microtcp_header_node(&header_list);
-        FREE(received_data, received_header);
-        return return_value;
+    void microtcp_free_recvbuf(microtcp_sock_t* socket)
+    {
+        if (!socket->recvbuf)
+            return;
+        __atomic_sub_fetch(&microtcp_rcvbuf_total, socket->recvbuf_len, __ATOMIC_RELAXED);
+        free(socket->recvbuf);
+        socket->recvbuf = NULL;
     }
     
     
@@ -899,15 +2724,30 @@
         if (!microtcp_checksum_check(packet)) return 0;
         unpack_ntoh(h);
         *header = *h;
-        if (!h->data_len)
-            h->data_len = 1;
-        *data = malloc(sizeof(char) * h->data_len);
+        /* Header only segments still get a buffer, callers free it unconditionally */
+        *data = malloc(sizeof(char) * MAX(h->data_len, 1));
         memcpy(*data, d + sizeof(microtcp_header_t), sizeof(char) * h->data_len);
         // TODO: Network byte order
         
         return 1;
     }
     
+    unsigned int
+    microtcp_unpack_view(void* packet, size_t len, microtcp_header_t* header, uint8_t** data)
+    {
+        microtcp_header_t* h = packet;
+
+        /* A data_len past the datagram would send the checksum beyond it */
+        if (len < sizeof(microtcp_header_t) || len != sizeof(microtcp_header_t) + ntohl(h->data_len))
+            return 0;
+        h->checksum = ntohl(h->checksum);
+        if (!microtcp_checksum_check(packet)) return 0;
+        unpack_ntoh(h);
+        *header = *h;
+        *data = (uint8_t*)packet + sizeof(microtcp_header_t);
+        return 1;
+    }
+    
     unsigned int
     microtcp_checksum_check(void* packet)
     {
@@ -915,9 +2755,6 @@
         uint32_t old_checksum = h[0].checksum;
         uint32_t data_len = ntohl(h[0].data_len);
         h[0].checksum = 0;
-        uint32_t a = crc32((uint8_t*)packet, sizeof(microtcp_header_t) + sizeof(char) * data_len);
-    
-        printf("old_checksum = %u\nnew_checksum = %u\n", old_checksum, a);
         if (old_checksum != crc32((uint8_t*)packet, sizeof(microtcp_header_t) + sizeof(char) * data_len))
             return 0;
         return 1;
@@ -1037,7 +2874,11 @@ microtcp_header_node* add_microtcp_header_node(microtcp_header_node* list, micro
 		}
 		/*sth is wrong probably packet was resent*/
 		else
+		{
+			free(new_node->payload);
+			free(new_node);
 			return list;
+		}
 	}
 	/*Placed at end*/
     if(prev)
@@ -1048,10 +2889,14 @@ microtcp_header_node* add_microtcp_header_node(microtcp_header_node* list, micro
 
 microtcp_header_node* create_microtcp_header_node(microtcp_header_t* header, uint8_t* payload)
 {
-    microtcp_header_node* new;
+    microtcp_header_node* new = malloc(sizeof(microtcp_header_node));
     new->header = *header;
-    new->payload = malloc(sizeof(uint8_t) * header->data_len);
-    memcpy(new->payload, payload, header->data_len*sizeof(uint8_t));
+    /* No payload for segments the receive sink already stored */
+    new->payload = NULL;
+    if (payload) {
+        new->payload = malloc(sizeof(uint8_t) * header->data_len);
+        memcpy(new->payload, payload, header->data_len*sizeof(uint8_t));
+    }
     new->next = NULL;
     return new;
 }
@@ -1065,9 +2910,27 @@ microtcp_header_t get_microtcp_header_node_list_header(microtcp_header_node* lis
 
 uint8_t* pop_microtcp_header_node(microtcp_header_node** list)
 {
-	microtcp_header_node* head = list;
-	*list = (*list)->next;
-	return head->payload;
+	microtcp_header_node* head = *list;
+	uint8_t* payload = head->payload;
+	*list = head->next;
+	free(head);
+	return payload;
+}
+
+int has_microtcp_header_node(microtcp_header_node* list, uint32_t data_offset)
+{
+	for (; list; list = list->next)
+		if (list->header.data_offset == data_offset)
+			return 1;
+	return 0;
+}
+
+size_t count_microtcp_header_node(microtcp_header_node* list)
+{
+	size_t count = 0;
+	for (; list; list = list->next)
+		count++;
+	return count;
 }
 
 void free_microtcp_header_node(microtcp_header_node** list)
@@ -1075,10 +2938,13 @@ void free_microtcp_header_node(microtcp_header_node** list)
     if(*list != NULL)
     {
       microtcp_header_node* iter = *list;
+      microtcp_header_node* next;
       while(iter)
       {
+        next = iter->next;
         free(iter->payload);
-        iter = iter->next;          
+        free(iter);
+        iter = next;          
       }
       *list = NULL;
     }
@@ -1088,54 +2954,78 @@ void free_microtcp_header_node(microtcp_header_node** list)
 ssize_t microtcp_zero_win_send(microtcp_sock_t* socket, uint16_t* window, 
     uint32_t total_data_size, uint32_t data_offset, uint32_t control_limit)
 {
-    time_t t;
+    uint8_t datagram[sizeof(microtcp_header_t) + MICROTCP_MSS];
     uint8_t* send_buffer;
-    uint8_t* recv_buffer;
-    char* received_data;
-    size_t recv_data_size;
-    size_t data_size;
-    microtcp_header_t* received_header = malloc(sizeof(microtcp_header_t));
+    uint8_t* received_data;
+    ssize_t recv_data_size;
+    ssize_t data_size;
+    uint32_t persist_timeout;
+    uint32_t probe_seq = socket->seq_number + data_offset;
+    uint64_t zero_stamp;
+    uint64_t deadline;
+    uint64_t now;
+    microtcp_header_t received_header;
+
+    if (*window)
+        return 0;
 
+    persist_timeout = socket->rto;
+    zero_stamp = microtcp_now_us();
+    socket->zero_win_events++;
+    MICROTCP_PROBE2(window__zero__enter, socket->sd, probe_seq);
     while (!*window) {
-        printf("Inside microtcp_zero_win_send.\n");
-        srand((unsigned int)time(&t) + 152024);
-        sleep(rand() % MICROTCP_ACK_TIMEOUT_US);
+        MICROTCP_TRACE(MICROTCP_TRACE_INFO, MICROTCP_EV_WINDOW_PROBE, socket,
+            probe_seq, socket->ack_number, persist_timeout);
         send_buffer = microtcp_create_packet(socket->seq_number, socket->ack_number,
             0, 0, 0, 0, socket->curr_win_size, 0, NULL, total_data_size, data_offset, control_limit);
-        if ((data_size = send(socket->sd, send_buffer, sizeof(microtcp_header_t), 0)) == -1)
+        if ((data_size = microtcp_sock_send(socket, send_buffer, sizeof(microtcp_header_t), 0)) == -1) {
+            free(send_buffer);
             return -1;
+        }
         free(send_buffer);
-        recv_buffer = malloc(sizeof(microtcp_header_t));
-        if ((recv_data_size = recv(socket->sd, recv_buffer, sizeof(microtcp_header_t), 0)) == -1)
-        {
-            if (errno == EAGAIN)
-              fprintf(stderr, "Error: A timeout occured.\n");
-            else {
-                FREE(received_header, recv_buffer);
+
+        /* The next probe waits for the whole persist timer, a reply that keeps
+         * the window closed does not bring it closer */
+        deadline = microtcp_now_us() + persist_timeout;
+        while (!*window && (now = microtcp_now_us()) < deadline) {
+            if (set_socket_timeout(socket, deadline - now) == -1)
                 return -1;
+            if ((recv_data_size = microtcp_sock_recv(socket, datagram, sizeof(datagram), 0)) == -1) {
+                if (errno != EAGAIN)
+                    return -1;
+                break;
             }
-            free(recv_buffer);
-            continue;
-        }
-        if (!microtcp_unpack(recv_buffer, received_header, &received_data)){
-            free(recv_buffer);
-            continue;
-        }
-        if (check_control(received_header, 1, 0, 0, 0) && socket->seq_number + data_offset == received_header->ack_number)
-        {
-            *window = received_header->window;
-            printf("Ack inside window size zero ack. window: %d\n",*window); 
-        }   
-        else if (check_control(received_header, 0, 0, 0, 0))
-        {
-            if (send_ack(socket) == -1) {
-                FREE(received_header, recv_buffer, received_data);
+            if (!microtcp_unpack_view(datagram, recv_data_size, &received_header, &received_data))
+                continue;
+            if (check_control(&received_header, 0, 1, 0, 0)) {
+                microtcp_set_state(socket, INVALID);
                 return -1;
             }
-            *window = received_header->window;
+            if (check_control(&received_header, 0, 0, 0, 0) && send_ack(socket) == -1)
+                return -1;
+            /* Only an ACK up to the probe, or past it, tells the window now */
+            if ((check_control(&received_header, 1, 0, 0, 0) || check_control(&received_header, 0, 0, 0, 0))
+                && (int32_t)(received_header.ack_number - probe_seq) >= 0)
+                *window = received_header.window;
         }
-        FREE(received_data, recv_buffer);
+        persist_timeout = MIN(persist_timeout * 2, MICROTCP_PERSIST_MAX_US);
     }
-    free(received_header);
-    return 0;
-}
\ No newline at end of file
+    socket->peer_win_size = *window;
+    MICROTCP_PROBE3(window__zero__exit, socket->sd, *window, microtcp_now_us() - zero_stamp);
+    return set_socket_timeout(socket, socket->rto);
+}
+
+uint64_t microtcp_now_ns(void)
+{
+    struct timespec ts;
+
+    if (microtcp_clock.now_ns)
+        return microtcp_clock.now_ns(microtcp_clock.ctx);
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+uint64_t microtcp_now_us(void)
+{
+    return microtcp_now_ns() / 1000;
+}
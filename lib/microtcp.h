@@ -23,6 +23,7 @@
 
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
@@ -32,6 +33,7 @@
 #include <arpa/inet.h>
 #include <stdarg.h>
 #include <math.h>
+#include "microtcp_hist.h"
  /*
   * Several useful constants
   */
@@ -41,12 +43,33 @@
 #define MICROTCP_WIN_SIZE MICROTCP_RECVBUF_LEN
 #define MICROTCP_INIT_CWND (3 * MICROTCP_MSS)
 #define MICROTCP_INIT_SSTHRESH MICROTCP_WIN_SIZE
+#define MICROTCP_PERSIST_MAX_US 1000000   /**< Upper bound of the zero-window probe backoff */
+#define MICROTCP_MIN_RTO_US MICROTCP_ACK_TIMEOUT_US  /**< Floor of the estimated retransmission timeout */
+#define MICROTCP_MAX_RTO_US 3000000       /**< Ceiling of the estimated retransmission timeout */
+#define MICROTCP_RECVBUF_MAX UINT16_MAX   /**< Default per-socket auto-tuning cap, the window field is 16 bits */
+#define MICROTCP_RECVBUF_GLOBAL_MAX (64 * 1024 * 1024) /**< Receive buffer memory of all sockets */
+#define MICROTCP_RECVBUF_IDLE_US 1000000  /**< Idle time after which the receive buffer shrinks back */
+#define MICROTCP_SYN_RETRIES 5           /**< SYN retransmissions of microtcp_connect(), one per ACK timeout */
+#define MICROTCP_OPT_FASTOPEN 0x1        /**< Option bit in control_limit of a SYN or SYN/ACK, the cookie is in total_data_size */
+#define MICROTCP_OPT_COMPACT 0x2         /**< Option bit of a SYN or SYN/ACK, both ends then use the compact header */
+#define MICROTCP_OPT_COMPRESS 0x4        /**< Option bit of a SYN or SYN/ACK, both ends then compress the payload */
+#define MICROTCP_COMPRESS_BLOCK (64 * 1024)       /**< Payload bytes compressed as one block */
+#define MICROTCP_COMPRESS_BATCH (1024 * 1024)     /**< Compressed bytes microtcp_send() sends as one message */
+#define MICROTCP_COMPRESS_BACKOFF 64     /**< Most blocks stored without a try after incompressible ones */
+#define MICROTCP_COMPRESS_IOV 512        /**< Pieces of the vector of one message of blocks at most */
+#define MICROTCP_COMPRESS_HEADER 8       /**< Raw and packed length of a block, before it */
+#define MICROTCP_FASTOPEN_CACHE 64       /**< Servers whose fast open cookie a process remembers */
+#define MICROTCP_SENDFILE_MAP (256 * 1024 * 1024) /**< File bytes microtcp_sendfile() maps and sends as one message */
+#define MICROTCP_SENDFILE_BUF (4 * 1024 * 1024)   /**< Read buffer of microtcp_sendfile() for files it cannot map */
+#define MICROTCP_SEGMENT_IOV 16                   /**< Pieces of a microtcp_sendv() vector one segment gathers at most */
+#define MICROTCP_SYNCOOKIE_PERIOD_S 64  /**< Granularity of the SYN cookie clock */
+#define MICROTCP_SYNCOOKIE_MAX_AGE 2     /**< Periods a SYN cookie stays valid after the current one */
 #define MAX_PAYLOAD 508
 #define data_offset future_use0
 #define total_data_size future_use1
 #define control_limit future_use2
-#define MIN(x,y) x < y ? x : y
-#define MIN3(x,y,z) x < MIN(y,z) ? x : MIN(y,z)
+#define MIN(x,y) ((x) < (y) ? (x) : (y))
+#define MIN3(x,y,z) MIN(x, MIN(y,z))
 
 #define FREE(...) free_("", __VA_ARGS__, NULL)
 // #define WINDOW_SIZE 66546
@@ -72,6 +95,41 @@ typedef enum
 } microtcp_state_t;
 
 
+/**
+ * The system calls under a microTCP socket. Every datagram and every wait
+ * of the protocol goes through one of these, so the same code runs over
+ * UDP (the default) or over an in-process simulated network, see
+ * test/simnet.h. The calls follow their POSIX namesakes: -1 and errno on
+ * failure, EAGAIN when a receive times out.
+ */
+typedef struct microtcp_transport
+{
+    int (*socket)(void* ctx, int domain, int type, int protocol);
+    int (*bind)(void* ctx, int sd, const struct sockaddr* address, socklen_t address_len);
+    int (*connect)(void* ctx, int sd, const struct sockaddr* address, socklen_t address_len);
+    int (*getpeername)(void* ctx, int sd, struct sockaddr* address, socklen_t* address_len);
+    int (*getsockname)(void* ctx, int sd, struct sockaddr* address, socklen_t* address_len);
+    ssize_t (*send)(void* ctx, int sd, const void* buffer, size_t length, int flags);
+    ssize_t (*recv)(void* ctx, int sd, void* buffer, size_t length, int flags);
+    ssize_t (*sendto)(void* ctx, int sd, const void* buffer, size_t length, int flags,
+        const struct sockaddr* address, socklen_t address_len);
+    ssize_t (*recvfrom)(void* ctx, int sd, void* buffer, size_t length, int flags,
+        struct sockaddr* address, socklen_t* address_len);
+    ssize_t (*sendmsg)(void* ctx, int sd, const struct msghdr* message, int flags);
+    int (*set_timeout)(void* ctx, int sd, uint32_t timeout_us);   /**< Receive timeout, 0 blocks */
+    int (*close)(void* ctx, int sd);
+    void* ctx;
+} microtcp_transport_t;
+
+/**
+ * The time source of the library, CLOCK_MONOTONIC unless replaced.
+ */
+typedef struct
+{
+    uint64_t (*now_ns)(void* ctx);
+    void* ctx;
+} microtcp_clock_t;
+
 /**
  * This is the microTCP socket structure. It holds all the necessary
  * information of each microTCP socket.
@@ -81,28 +139,122 @@ typedef enum
 typedef struct
 {
     int sd;                       /**< The underline UDP socket descriptor */
+    const microtcp_transport_t* transport; /**< Where sd lives, see microtcp_set_transport() */
     microtcp_state_t state;       /**< The state of the microTCP socket */
+    int syncookies;               /**< microtcp_accept() keeps no state until the final ACK */
+    int fastopen;                 /**< microtcp_accept() takes data from SYNs with a valid cookie */
+    int compact;                  /**< The handshake offers the compact header */
+    int compact_header;           /**< Packets go in the compact header, see microtcp_codec.h */
+    int compress;                 /**< The handshake offers payload compression */
+    int compress_active;          /**< The payload goes in compressed blocks, see microtcp_set_compress() */
+    uint32_t compress_skip;       /**< Blocks still stored without a try */
+    uint32_t compress_backoff;    /**< Blocks to skip after the next incompressible one */
+    uint8_t* deflate_buf;         /**< Compressed blocks of one message, then blocks gathered from pieces */
+    uint8_t* inflate_buf;         /**< Received blocks not yet taken in, then the expanded block */
+    size_t inflate_head;          /**< Start of what inflate_buf holds */
+    size_t inflate_fill;          /**< End of it */
+    size_t inflate_stored;        /**< Bytes of a stored block still to pass through */
+    size_t inflate_pos;           /**< Bytes of the decompressed block delivered so far */
+    size_t inflate_len;           /**< Size of the decompressed block */
     size_t init_win_size;         /**< The window size negotiated at the 3-way handshake */
-    size_t curr_win_size;         /**< The current window size */
+    size_t curr_win_size;         /**< The window size advertised with the last ACK */
     uint8_t* recvbuf;             /**< The *receive* buffer of the TCP
                                        connection. It is allocated during the connection establishment and
                                        is freed at the shutdown of the connection. This buffer is used
                                        to retrieve the data from the network. */
     size_t buf_fill_level;        /**< Amount of data in the buffer */
-
+    size_t rcv_held;              /**< Received data a layer above buffers, it counts against the window */
+    size_t recvbuf_len;           /**< Current size of the receive buffer */
+    size_t recvbuf_max;           /**< Upper bound for receive buffer auto-tuning */
+    uint32_t rcv_rtt_us;          /**< Receiver side RTT estimate, drives auto-tuning */
+    uint64_t rcv_ack_stamp;       /**< Time the last flight was acknowledged, 0 once no sample is due */
+    uint64_t rcv_space_stamp;     /**< Start of the current auto-tuning measurement */
+    size_t rcv_space_copied;      /**< Bytes delivered to the application in this measurement */
+    uint64_t rcv_last_data;       /**< Time data was last delivered to the application */
+    int rcv_abort;                /**< Set by another thread, a blocked receive fails at its next timeout */
+
+    size_t peer_win_size;         /**< Last window advertised by the peer */
+    size_t peer_max_win_size;     /**< Largest window the peer ever advertised */
     size_t cwnd;
     size_t ssthresh;
+    uint32_t rto;                 /**< Retransmission timeout in microseconds */
 
     uint32_t seq_number;            /**< Keep the state of the sequence number */
     uint32_t ack_number;            /**< Keep the state of the ack number */
-    uint64_t packets_send;
+    uint32_t rcv_msg_offset;        /**< Bytes of the incoming message received in order */
+    uint32_t srtt;                  /**< Smoothed RTT in microseconds, 0 until measured */
+    uint32_t rttvar;                /**< RTT variation in microseconds */
+    size_t bytes_in_flight;         /**< Sent and not yet acknowledged */
+    size_t ooo_depth;               /**< Segments waiting in the out-of-order list */
+    uint64_t packets_send;          /**< Datagrams sent, control included */
+    uint64_t packets_received;      /**< Datagrams received, control included */
+    uint64_t packets_lost;          /**< Segments sent again */
+    uint64_t bytes_send;            /**< Payload bytes sent, retransmissions included */
+    uint64_t bytes_received;        /**< Payload bytes received, duplicates included */
+    uint64_t bytes_lost;            /**< Payload bytes sent again */
+    uint64_t dup_ack;               /**< Length of the current duplicate ACK run */
+    uint64_t dup_acks;              /**< Duplicate ACKs received */
+    uint64_t timeouts;              /**< Retransmission timeouts */
+    uint64_t zero_win_events;       /**< Times the peer's window closed on us */
+    uint64_t compress_in;           /**< Payload bytes handed to the compression stage */
+    uint64_t compress_out;          /**< Bytes it sent for them, block headers included */
+    uint64_t compress_bypassed;     /**< Blocks sent stored because they did not shrink */
+    uint64_t decompress_in;         /**< Block bytes received, headers included */
+    uint64_t decompress_out;        /**< Payload bytes they expanded to */
+    int sndlim_state;               /**< What limits the sender right now, microtcp_sndlim_t */
+    uint64_t sndlim_stamp;          /**< Since when */
+    uint64_t sndlim_us[3];          /**< Time spent in each microtcp_sndlim_t */
+    struct microtcp_stat_slot* stat; /**< Shared memory statistics slot, NULL if not published */
+    microtcp_latency_t latency;     /**< Latency histograms, see microtcp_get_latency() */
+} microtcp_sock_t;
+
+typedef enum
+{
+    MICROTCP_SNDLIM_SENDER = 0,     /**< The application has no more data */
+    MICROTCP_SNDLIM_RWND,           /**< The peer's window is the limit */
+    MICROTCP_SNDLIM_CWND            /**< The congestion window is the limit */
+} microtcp_sndlim_t;
+
+#define MICROTCP_INFO_VERSION 2
+
+/**
+ * Snapshot of a connection returned by microtcp_get_info(). New fields are
+ * only ever appended, and version tells which of them the library filled.
+ */
+typedef struct
+{
+    uint32_t version;               /**< MICROTCP_INFO_VERSION of the library */
+    uint32_t state;                 /**< microtcp_state_t */
+    uint32_t cwnd;
+    uint32_t ssthresh;
+    uint32_t srtt_us;
+    uint32_t rttvar_us;
+    uint32_t rto_us;
+    uint32_t bytes_in_flight;
+    uint32_t peer_window;           /**< Last window advertised by the peer */
+    uint32_t advertised_window;     /**< Last window we advertised */
+    uint32_t ooo_queue_depth;
+    uint32_t recvbuf_fill;
+    uint32_t recvbuf_len;
+    uint64_t packets_sent;
     uint64_t packets_received;
-    uint64_t packets_lost;
-    uint64_t bytes_send;
+    uint64_t packets_retransmitted;
+    uint64_t bytes_sent;
     uint64_t bytes_received;
-    uint64_t bytes_lost;
-    uint64_t dup_ack;
-} microtcp_sock_t;
+    uint64_t bytes_retransmitted;
+    uint64_t dup_acks;
+    uint64_t timeouts;
+    uint64_t zero_window_events;
+    uint64_t sender_limited_us;     /**< Waiting for the application */
+    uint64_t receiver_limited_us;   /**< Waiting for the peer's window */
+    uint64_t network_limited_us;    /**< Waiting for the congestion window */
+    /* Version 2 */
+    uint64_t compress_bytes_in;     /**< Payload bytes given to the compression stage */
+    uint64_t compress_bytes_out;    /**< Bytes sent for them, so in / out is the ratio */
+    uint64_t compress_blocks_bypassed; /**< Blocks sent stored, they did not shrink */
+    uint64_t decompress_bytes_in;
+    uint64_t decompress_bytes_out;
+} microtcp_info_t;
 
 
 /**
@@ -129,11 +281,11 @@ typedef struct {
 } microtcp_socket_image;
 
 
-typedef struct 
+typedef struct microtcp_header_node
 {
     microtcp_header_t header;
     uint8_t* payload;
-    microtcp_header_t* next;
+    struct microtcp_header_node* next;
 
 } microtcp_header_node;
 
@@ -141,6 +293,29 @@ typedef struct
 microtcp_sock_t
 microtcp_socket(int domain, int type, int protocol);
 
+/**
+ * Closes the descriptor of a socket that was shut down or never connected.
+ */
+int microtcp_close(microtcp_sock_t* socket);
+
+/**
+ * Sets the transport of the sockets microtcp_socket() creates from now on,
+ * NULL for UDP.
+ */
+void microtcp_set_transport(const microtcp_transport_t* transport);
+
+/**
+ * Replaces the clock of the library, NULL for CLOCK_MONOTONIC. Meant to
+ * be called before any socket exists.
+ */
+void microtcp_set_clock(const microtcp_clock_t* clock);
+
+/**
+ * Sets the key of the ISN, SYN cookie and fast open MACs instead of
+ * drawing it from the system, so that a simulation repeats exactly.
+ */
+void microtcp_set_secret(const uint8_t key[16]);
+
 int
 microtcp_bind(microtcp_sock_t* socket, const struct sockaddr* address,
     socklen_t address_len);
@@ -149,6 +324,19 @@ int
 microtcp_connect(microtcp_sock_t* socket, const struct sockaddr* address,
     socklen_t address_len);
 
+/**
+ * Connects and sends the first message, in the SYN itself when a fast open
+ * cookie of the server is cached and the message fits in one MSS. The
+ * server then has the data half an RTT after the call instead of one and a
+ * half. Otherwise the SYN asks for a cookie for the next connection and
+ * the message is sent with microtcp_send() after the handshake.
+ *
+ * @return length on success, -1 on failure
+ */
+ssize_t
+microtcp_connect_fastopen(microtcp_sock_t* socket, const struct sockaddr* address,
+    socklen_t address_len, const void* buffer, size_t length);
+
 /**
  * Blocks waiting for a new connection from a remote peer.
  *
@@ -162,13 +350,220 @@ int
 microtcp_accept(microtcp_sock_t* socket, struct sockaddr* address,
     socklen_t address_len);
 
+/**
+ * Enables SYN cookies on a listening socket. microtcp_accept() then answers
+ * every SYN with a SYN/ACK whose sequence number is a MAC of the peer and
+ * its window, keeps no state for it, and only establishes the connection
+ * when an ACK carrying a valid cookie arrives. Floods of SYNs cost no memory
+ * and cannot stall accept. Also enabled by the MICROTCP_SYNCOOKIES
+ * environment variable.
+ */
+int microtcp_set_syncookies(microtcp_sock_t* socket, int enable);
+
+/**
+ * Offers the compact header of microtcp_codec.h in the handshake, used
+ * when the peer offers it too. Saves up to 20 bytes on every packet, most
+ * of a pure ACK. Also enabled by the MICROTCP_COMPACT environment
+ * variable. Not offered by microtcp_accept() with SYN cookies.
+ */
+int microtcp_set_compact(microtcp_sock_t* socket, int enable);
+
+/**
+ * Offers payload compression in the handshake, used when the peer offers
+ * it too. microtcp_send() then cuts the data in blocks of
+ * MICROTCP_COMPRESS_BLOCK bytes and compresses each with the codec of
+ * microtcp_lz.h before segmentation, and microtcp_recv() expands them on
+ * delivery. A block that does not shrink by at least 1/32 goes stored,
+ * and after such a block the next ones are stored without a try, twice as
+ * many each time up to MICROTCP_COMPRESS_BACKOFF, so already compressed
+ * or encrypted data costs next to nothing. microtcp_get_info() counts the
+ * bytes on both sides of the stage.
+ *
+ * Not offered with fast open data or by microtcp_accept() with SYN
+ * cookies. microtcp_send_records() and microtcp_recv_segments() fail on
+ * a compressed connection, so the stream multiplexer needs it off. Also
+ * enabled by the MICROTCP_COMPRESS environment variable.
+ */
+int microtcp_set_compress(microtcp_sock_t* socket, int enable);
+
+/**
+ * Lets microtcp_accept() issue fast open cookies and accept data in SYNs
+ * that carry a valid one. Such a connection is returned as soon as the
+ * SYN/ACK is sent and the data is read by the first microtcp_recv(). Also
+ * enabled by the MICROTCP_FASTOPEN environment variable.
+ */
+int microtcp_set_fastopen(microtcp_sock_t* socket, int enable);
+
+/**
+ * The fast open cookie of a client address, a MAC of the address alone.
+ * Never 0, which in a SYN asks for a cookie.
+ */
+uint32_t microtcp_fastopen_cookie(const struct sockaddr* peer);
+
+/**
+ * Initial sequence number for a connection with peer, RFC 6528 style: a
+ * keyed hash of the peer address plus a 4 microsecond clock.
+ */
+uint32_t microtcp_isn(const struct sockaddr* peer);
+
+/**
+ * Encodes a SYN cookie for the SYN with sequence number peer_isn and
+ * advertised window. The top 5 bits hold the cookie clock, the next 3 a
+ * window class and the low 24 a SipHash MAC of the rest.
+ */
+uint32_t microtcp_syn_cookie(const struct sockaddr* peer, uint32_t peer_isn, size_t window);
+
+/**
+ * Validates a SYN cookie echoed by the peer.
+ *
+ * @param window set to the window class the cookie encodes
+ * @return 1 if the cookie is authentic and not older than
+ * MICROTCP_SYNCOOKIE_MAX_AGE periods, 0 otherwise
+ */
+int microtcp_syn_cookie_check(const struct sockaddr* peer, uint32_t peer_isn,
+    uint32_t cookie, size_t* window);
+
 ssize_t
 microtcp_send(microtcp_sock_t* socket, const void* buffer, size_t length,
     int flags);
 
+/**
+ * Sends the iovcnt buffers of iov as one message, like microtcp_send() of
+ * their concatenation. Segments are gathered from the buffers by
+ * sendmsg(), so a header and a body need no copy into one buffer first.
+ * A segment takes at most MICROTCP_SEGMENT_IOV pieces of the vector and
+ * is sent short when it would need more.
+ *
+ * @return the bytes of all buffers once the peer acknowledged them, or -1
+ */
+ssize_t
+microtcp_sendv(microtcp_sock_t* socket, const struct iovec* iov, int iovcnt, int flags);
+
+/**
+ * Like microtcp_sendv(), but every buffer of iov goes out as exactly one
+ * segment, so the receiver sees the buffers as units even out of order
+ * (see microtcp_recv_segments()). Buffers hold at most MICROTCP_MSS bytes.
+ *
+ * @return the bytes of all buffers once the peer acknowledged them, or -1
+ */
+ssize_t
+microtcp_send_records(microtcp_sock_t* socket, const struct iovec* iov, int iovcnt, int flags);
+
+/**
+ * Sends length bytes of the file fd from offset, segmenting straight from
+ * the page cache. The file is mapped MICROTCP_SENDFILE_MAP bytes at a
+ * time and each mapping goes out as one message, so the window only
+ * drains at their boundaries. Files that cannot be mapped are read with
+ * pread() MICROTCP_SENDFILE_BUF bytes at a time instead. The file offset of fd is not changed.
+ *
+ * @return the bytes sent, less than length if the file ends first, or -1
+ */
+ssize_t
+microtcp_sendfile(microtcp_sock_t* socket, int fd, off_t offset, size_t length);
+
 ssize_t
 microtcp_recv(microtcp_sock_t* socket, void* buffer, size_t length, int flags);
 
+/**
+ * Like microtcp_recv(), but fills the iovcnt buffers of iov in order.
+ * In-order payload is copied once, into the buffer it belongs to.
+ *
+ * @return the bytes received over all buffers, or -1
+ */
+ssize_t
+microtcp_recvv(microtcp_sock_t* socket, const struct iovec* iov, int iovcnt, int flags);
+
+/**
+ * Receives up to max_len bytes into the file fd, starting at offset, with
+ * pwrite() straight from the datagram. Out-of-order segments are written
+ * at their place ahead of the gap and only remembered as ranges, so the
+ * file may be sparse until the gap fills. Unlike microtcp_recv() it does
+ * not return at message or flight boundaries, only once max_len bytes are
+ * written or the peer shuts down; pass SIZE_MAX to receive a whole
+ * transfer. The file offset of fd is not changed.
+ *
+ * @return the bytes written, 0 once the peer has shut down (the state is
+ * then CLOSING_BY_PEER), or -1
+ */
+ssize_t
+microtcp_recvfile(microtcp_sock_t* socket, int fd, off_t offset, size_t max_len);
+
+/**
+ * Receive state of microtcp_recv_segments() that lives between calls.
+ * Zero it with MICROTCP_SEGMENT_STATE_INIT before the first call.
+ */
+typedef struct
+{
+    microtcp_header_node* held;   /**< Segments ahead of the gap, already handed over */
+    size_t flight;                /**< Bytes since the last flight ACK */
+    size_t dup_ack;
+    ssize_t last_ack_sent;
+} microtcp_segment_state_t;
+
+#define MICROTCP_SEGMENT_STATE_INIT { NULL, 0, 0, -1 }
+
+/**
+ * Called with the payload of every data segment the first time it
+ * arrives, in or out of order. Nonzero makes microtcp_recv_segments()
+ * return after this segment.
+ */
+typedef int (*microtcp_segment_fn)(void* ctx, const uint8_t* data, size_t len);
+
+/**
+ * Receives segments for a layer that orders data itself, like the stream
+ * multiplexer. Out-of-order segments are handed to fn straight away; the
+ * connection still acknowledges cumulatively, so a retransmission may hand
+ * over a segment again. Segments match the records of
+ * microtcp_send_records() one to one.
+ *
+ * @return the bytes handed to fn, or -1 on failure and once the peer shut
+ * down (the state is then CLOSING_BY_PEER)
+ */
+ssize_t
+microtcp_recv_segments(microtcp_sock_t* socket, microtcp_segment_state_t* state,
+    microtcp_segment_fn fn, void* ctx);
+
+/**
+ * Copies the statistics of the connection in info, like TCP_INFO.
+ *
+ * @param info_len sizeof(microtcp_info_t) as the caller knows it; only this
+ * many bytes are written, so older callers keep working
+ * @return 0 on success, -1 on failure
+ */
+int
+microtcp_get_info(const microtcp_sock_t* socket, microtcp_info_t* info, size_t info_len);
+
+/**
+ * Copies the latency histograms of the connection in latency. Use
+ * microtcp_latency_merge() to add up several connections and
+ * microtcp_latency_dump() to print percentiles.
+ *
+ * @return 0 on success, -1 on failure
+ */
+int
+microtcp_get_latency(const microtcp_sock_t* socket, microtcp_latency_t* latency);
+
+/**
+ * Copies up to length bytes of the receive buffer to the application and
+ * keeps the rest for the next call. Sends the pending ACK, or a window
+ * update when the freed space opens the window by min(MSS, half the buffer).
+ *
+ * @return the number of bytes copied, -1 on failure
+ */
+ssize_t
+microtcp_deliver(microtcp_sock_t* socket, void* buffer, size_t length, int ack_pending);
+
+/**
+ * For a layer that buffers received data itself, like the stream
+ * multiplexer: it adds what it keeps to rcv_held, which the advertised
+ * window leaves out, and hands it back here once the application took
+ * it. Sends a window update like microtcp_deliver().
+ *
+ * @return 0 on success, -1 on failure
+ */
+int
+microtcp_rcv_release(microtcp_sock_t* socket, size_t len);
+
 
 microtcp_header_t
 microtcp_create_header(uint32_t seq_num, uint32_t ack_num, size_t ack,
@@ -188,11 +583,50 @@ microtcp_create_control(int ack, int rst, int syn, int fin);
 unsigned int
 microtcp_unpack(void* packet, microtcp_header_t* header, char** data);
 
+/**
+ * Like microtcp_unpack(), but data points at the payload inside packet
+ * instead of a copy, so nothing is allocated and packet must outlive it.
+ * Datagrams whose length len disagrees with data_len are rejected.
+ */
+unsigned int
+microtcp_unpack_view(void* packet, size_t len, microtcp_header_t* header, uint8_t** data);
+
 unsigned int
 microtcp_checksum(microtcp_header_t* header);
 
 int F_timeout(microtcp_sock_t* socket, int duration);
 
+int set_socket_timeout(microtcp_sock_t* socket, uint32_t duration);
+
+uint64_t microtcp_now_us(void);
+
+uint64_t microtcp_now_ns(void);
+
+/**
+ * Configures the receive buffer. len is the initial size, max_len the cap
+ * of the auto-tuning. May be called before or after the connection is
+ * established; a buffer holding data is never shrunk below its fill level.
+ *
+ * @return 0 on success, -1 if the buffer could not be resized
+ */
+int microtcp_set_recvbuf(microtcp_sock_t* socket, size_t len, size_t max_len);
+
+/**
+ * Dynamic right-sizing of the receive buffer. Counts the bytes delivered to
+ * the application and once per receiver RTT grows the buffer to twice that
+ * amount, bounded by recvbuf_max and MICROTCP_RECVBUF_GLOBAL_MAX.
+ */
+void microtcp_rcvbuf_tune(microtcp_sock_t* socket, size_t copied);
+
+/**
+ * Returns an idle connection's receive buffer to MICROTCP_RECVBUF_LEN, or
+ * to the window of the last ACK if that is larger, which the peer may
+ * still fill. Sending and receiving call it, a pool for its idle entries.
+ */
+void microtcp_rcvbuf_idle(microtcp_sock_t* socket);
+
+void microtcp_free_recvbuf(microtcp_sock_t* socket);
+
 
 int
 microtcp_shutdownClient(microtcp_sock_t* clientSocket, int how);
@@ -221,9 +655,71 @@ struct sockaddr create_sockaddr_self(int port);
 
 int check_control(microtcp_header_t* header, int ack, int rst, int syn, int fin);
 
+/* State and cwnd changes go through these, they fire the USDT probes */
+void microtcp_set_state(microtcp_sock_t* socket, microtcp_state_t state);
+
+void microtcp_set_cwnd(microtcp_sock_t* socket, size_t cwnd);
+
 ssize_t send_ack(microtcp_sock_t* socket);
 
-ssize_t microtcp_check_dupAck(microtcp_sock_t* socket, int* dup_ack, int* last_ack_sent, microtcp_header_node** header_list);
+/**
+ * Window to advertise, derived from the free space of the receive buffer
+ * less what a layer above holds (rcv_held).
+ * Openings smaller than min(MSS, half the buffer) are advertised as zero,
+ * so the peer never sees a silly window.
+ */
+size_t microtcp_rcv_window(microtcp_sock_t* socket);
+
+/**
+ * Sender side silly window avoidance. Returns the usable window or 0 if it
+ * is too small to be worth a segment: less than an MSS, less than the
+ * remaining data and less than half the largest window the peer offered.
+ */
+size_t microtcp_sws_window(microtcp_sock_t* socket, size_t window, size_t remaining);
+
+ssize_t microtcp_check_dupAck(microtcp_sock_t* socket, size_t* dup_ack, ssize_t* last_ack_sent, microtcp_header_node** header_list);
+
+/* Datagram I/O of a socket, keeps the packet and byte counters */
+ssize_t microtcp_sock_send(microtcp_sock_t* socket, const void* buffer, size_t length, int flags);
+ssize_t microtcp_sock_recv(microtcp_sock_t* socket, void* buffer, size_t length, int flags);
+ssize_t microtcp_sock_sendmsg(microtcp_sock_t* socket, const struct msghdr* message, int flags);
+ssize_t microtcp_sock_sendto(microtcp_sock_t* socket, const void* buffer, size_t length, int flags,
+    const struct sockaddr* address, socklen_t address_len);
+ssize_t microtcp_sock_recvfrom(microtcp_sock_t* socket, void* buffer, size_t length, int flags,
+    struct sockaddr* address, socklen_t* address_len);
+
+/**
+ * Feeds an RTT sample to the RFC 6298 estimator and updates the RTO.
+ */
+void microtcp_rtt_sample(microtcp_sock_t* socket, uint32_t rtt_us);
+
+#define MICROTCP_SEG_STAMPS 256   /**< Segments timed per microtcp_send(), power of two */
+
+/**
+ * First transmission times of the unacknowledged segments of a message,
+ * oldest first, for the send-to-ACK histogram.
+ */
+typedef struct
+{
+    uint32_t end[MICROTCP_SEG_STAMPS];   /**< Message offset right after the segment */
+    uint64_t stamp[MICROTCP_SEG_STAMPS];
+    uint32_t head;
+    uint32_t tail;
+    uint32_t highest;                    /**< Largest end timed, retransmissions stay below */
+} microtcp_seg_stamps_t;
+
+void microtcp_seg_stamps_sent(microtcp_seg_stamps_t* stamps, uint32_t end, uint64_t now);
+
+/**
+ * Records the segments covered by a cumulative ACK of acked bytes.
+ */
+void microtcp_seg_stamps_acked(microtcp_sock_t* socket, microtcp_seg_stamps_t* stamps,
+    uint32_t acked, uint64_t now);
+
+/**
+ * Closes the current sender limitation period and starts a new one.
+ */
+void microtcp_sndlim_enter(microtcp_sock_t* socket, microtcp_sndlim_t state);
 
 int rst_socket(microtcp_socket_image image, microtcp_sock_t* socket);
 
@@ -237,11 +733,23 @@ int create_sock_image(microtcp_socket_image* image, microtcp_sock_t* socket);
 microtcp_header_node* add_microtcp_header_node(microtcp_header_node* list, microtcp_header_t* header, uint8_t* payload);
 microtcp_header_node* create_microtcp_header_node(microtcp_header_t* header, uint8_t* payload);
 microtcp_header_t get_microtcp_header_node_list_header(microtcp_header_node* list);
+size_t count_microtcp_header_node(microtcp_header_node* list);
+int has_microtcp_header_node(microtcp_header_node* list, uint32_t data_offset);
 uint8_t* pop_microtcp_header_node(microtcp_header_node** list);
 
 void free_microtcp_header_node(microtcp_header_node**);
 
 
+/**
+ * Persist timer of the sender. While the peer advertises a zero window it
+ * sends header-only probes, one per persist timer, which backs off
+ * exponentially from the RTO up to MICROTCP_PERSIST_MAX_US. An ACK of the
+ * probed sequence number opening the window (a probe reply or an
+ * unsolicited window update) ends the wait immediately; stale ACKs and
+ * replies with a zero window do not.
+ *
+ * @return 0 when the window is open again, -1 on socket error
+ */
 ssize_t microtcp_zero_win_send(microtcp_sock_t* socket, uint16_t* window, 
     uint32_t total_data_size, uint32_t data_offset, uint32_t control_limit);
 
@@ -0,0 +1,121 @@
+/*
+ * microtcp, a lightweight implementation of TCP for teaching,
+ * and academic purposes.
+ *
+ * Copyright (C) 2015-2017  Manolis Surligas <surligas@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "microtcp_codec.h"
+#include <string.h>
+
+static uint8_t* codec_put_varint(uint8_t* out, uint32_t value)
+{
+    while (value >= 0x80) {
+        *out++ = value | 0x80;
+        value >>= 7;
+    }
+    *out++ = value;
+    return out;
+}
+
+/* Returns NULL past end or past 32 bits */
+static const uint8_t* codec_get_varint(const uint8_t* in, const uint8_t* end, uint32_t* value)
+{
+    int shift;
+
+    *value = 0;
+    for (shift = 0; in < end && shift < 35; shift += 7) {
+        *value |= (uint32_t)(*in & 0x7f) << shift;
+        if (!(*in++ & 0x80))
+            return *value ? in : NULL;
+    }
+    return NULL;
+}
+
+size_t microtcp_compact_encode(const microtcp_header_t* header, uint8_t* out)
+{
+    uint16_t control = ntohs(header->control);
+    uint32_t data_len = ntohl(header->data_len);
+    uint8_t* p = out + 2;
+    uint8_t has = 0;
+
+    if (control > 0xf || data_len > UINT16_MAX)
+        return 0;
+    memcpy(p, &header->seq_number, 4);
+    memcpy(p + 4, &header->ack_number, 4);
+    memcpy(p + 8, &header->window, 2);
+    memcpy(p + 10, &header->checksum, 4);
+    p += 14;
+    if (data_len) {
+        has |= MICROTCP_COMPACT_HAS_LEN;
+        *p++ = data_len >> 8;
+        *p++ = data_len;
+    }
+    if (header->total_data_size) {
+        has |= MICROTCP_COMPACT_HAS_TOTAL;
+        p = codec_put_varint(p, ntohl(header->total_data_size));
+    }
+    if (header->data_offset) {
+        has |= MICROTCP_COMPACT_HAS_OFFSET;
+        p = codec_put_varint(p, ntohl(header->data_offset));
+    }
+    if (header->control_limit) {
+        has |= MICROTCP_COMPACT_HAS_LIMIT;
+        p = codec_put_varint(p, ntohl(header->control_limit));
+    }
+    out[0] = MICROTCP_COMPACT_MARKER | control;
+    out[1] = has;
+    return p - out;
+}
+
+size_t microtcp_compact_decode(const uint8_t* in, size_t len, microtcp_header_t* header)
+{
+    const uint8_t* end = in + len;
+    const uint8_t* p = in + 2;
+    uint32_t value;
+
+    if (len < MICROTCP_COMPACT_MIN || (in[0] & 0xf0) != MICROTCP_COMPACT_MARKER || in[1] & 0xf0)
+        return 0;
+    memset(header, 0, sizeof(microtcp_header_t));
+    header->control = htons(in[0] & 0x0f);
+    memcpy(&header->seq_number, p, 4);
+    memcpy(&header->ack_number, p + 4, 4);
+    memcpy(&header->window, p + 8, 2);
+    memcpy(&header->checksum, p + 10, 4);
+    p += 14;
+    if (in[1] & MICROTCP_COMPACT_HAS_LEN) {
+        if (end - p < 2)
+            return 0;
+        header->data_len = htonl(p[0] << 8 | p[1]);
+        p += 2;
+    }
+    if (in[1] & MICROTCP_COMPACT_HAS_TOTAL) {
+        if (!(p = codec_get_varint(p, end, &value)))
+            return 0;
+        header->total_data_size = htonl(value);
+    }
+    if (in[1] & MICROTCP_COMPACT_HAS_OFFSET) {
+        if (!(p = codec_get_varint(p, end, &value)))
+            return 0;
+        header->data_offset = htonl(value);
+    }
+    if (in[1] & MICROTCP_COMPACT_HAS_LIMIT) {
+        if (!(p = codec_get_varint(p, end, &value)))
+            return 0;
+        header->control_limit = htonl(value);
+    }
+    return p - in;
+}
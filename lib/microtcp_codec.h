@@ -0,0 +1,74 @@
+/*
+ * microtcp, a lightweight implementation of TCP for teaching,
+ * and academic purposes.
+ *
+ * Copyright (C) 2015-2017  Manolis Surligas <surligas@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIB_MICROTCP_CODEC_H_
+#define LIB_MICROTCP_CODEC_H_
+
+#include "microtcp.h"
+
+/*
+ * Compact encoding of microtcp_header_t, used on the wire once both ends
+ * offered MICROTCP_OPT_COMPACT in the handshake:
+ *
+ *   byte 0      MICROTCP_COMPACT_MARKER | control bits
+ *   byte 1      which optional fields follow, MICROTCP_COMPACT_HAS_*
+ *   4 bytes     seq_number
+ *   4 bytes     ack_number
+ *   2 bytes     window
+ *   4 bytes     checksum
+ *   2 bytes     data_len, if nonzero
+ *   varints     total_data_size, data_offset and control_limit, if nonzero
+ *
+ * Fixed fields are in network order, varints are LEB128. A pure ACK takes
+ * 16 bytes instead of 36 and a full data segment about 27.
+ *
+ * Fields are only dropped when zero, never predicted from earlier
+ * segments, so every datagram decodes alone whatever was lost or
+ * reordered before it. The checksum is the one of the classic header:
+ * decoding rebuilds that header exactly, and the payload is never
+ * checksummed twice.
+ */
+
+#define MICROTCP_COMPACT_MARKER 0xa0
+#define MICROTCP_COMPACT_MIN 16
+#define MICROTCP_COMPACT_MAX (MICROTCP_COMPACT_MIN + 2 + 3 * 5)
+
+#define MICROTCP_COMPACT_HAS_LEN 0x1
+#define MICROTCP_COMPACT_HAS_TOTAL 0x2
+#define MICROTCP_COMPACT_HAS_OFFSET 0x4
+#define MICROTCP_COMPACT_HAS_LIMIT 0x8
+
+/**
+ * Encodes a header in network order, checksum included, as found at the
+ * start of a packet.
+ * @param out at least MICROTCP_COMPACT_MAX bytes
+ * @return the bytes written, 0 if the header has no compact form
+ */
+size_t microtcp_compact_encode(const microtcp_header_t* header, uint8_t* out);
+
+/**
+ * Decodes a compact header back into the network order header it came
+ * from.
+ * @return the bytes of in taken by the compact header, 0 if in does not
+ *         start with one
+ */
+size_t microtcp_compact_decode(const uint8_t* in, size_t len, microtcp_header_t* header);
+
+#endif /* LIB_MICROTCP_CODEC_H_ */
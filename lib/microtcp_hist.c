@@ -0,0 +1,118 @@
+/*
+ * microtcp, a lightweight implementation of TCP for teaching,
+ * and academic purposes.
+ *
+ * Copyright (C) 2015-2017  Manolis Surligas <surligas@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "microtcp_hist.h"
+#include <inttypes.h>
+
+static uint32_t hist_index(uint32_t value)
+{
+    uint32_t shift;
+
+    if (value < MICROTCP_HIST_SUB_BUCKETS)
+        return value;
+    shift = 31 - __builtin_clz(value) - MICROTCP_HIST_SUB_BITS + 1;
+    return shift * MICROTCP_HIST_HALF_BUCKETS + (value >> shift);
+}
+
+/* Highest value that lands in bucket index */
+static uint32_t hist_upper(uint32_t index)
+{
+    uint32_t shift;
+    uint64_t mantissa;
+
+    if (index < MICROTCP_HIST_SUB_BUCKETS)
+        return index;
+    shift = index / MICROTCP_HIST_HALF_BUCKETS - 1;
+    mantissa = index - shift * MICROTCP_HIST_HALF_BUCKETS;
+    return (uint32_t)(((mantissa + 1) << shift) - 1);
+}
+
+void microtcp_hist_record(microtcp_hist_t* hist, uint64_t value_us)
+{
+    uint32_t value = value_us > UINT32_MAX ? UINT32_MAX : (uint32_t)value_us;
+
+    if (!hist->count || value < hist->min)
+        hist->min = value;
+    if (value > hist->max)
+        hist->max = value;
+    hist->count++;
+    hist->sum += value;
+    hist->buckets[hist_index(value)]++;
+}
+
+void microtcp_hist_merge(microtcp_hist_t* dst, const microtcp_hist_t* src)
+{
+    uint32_t i;
+
+    if (!src->count)
+        return;
+    if (!dst->count || src->min < dst->min)
+        dst->min = src->min;
+    if (src->max > dst->max)
+        dst->max = src->max;
+    dst->count += src->count;
+    dst->sum += src->sum;
+    for (i = 0; i < MICROTCP_HIST_BUCKETS; i++)
+        dst->buckets[i] += src->buckets[i];
+}
+
+uint32_t microtcp_hist_percentile(const microtcp_hist_t* hist, double percentile)
+{
+    uint64_t rank;
+    uint64_t seen = 0;
+    uint32_t i;
+
+    if (!hist->count)
+        return 0;
+    if (percentile >= 100)
+        return hist->max;
+    rank = (uint64_t)(percentile / 100 * hist->count) + 1;
+    for (i = 0; i < MICROTCP_HIST_BUCKETS; i++) {
+        seen += hist->buckets[i];
+        if (seen >= rank)
+            return hist_upper(i) < hist->max ? hist_upper(i) : hist->max;
+    }
+    return hist->max;
+}
+
+void microtcp_hist_dump(FILE* fp, const char* name, const microtcp_hist_t* hist)
+{
+    fprintf(fp, "%-10s count %-8" PRIu64 " mean %-10.1f p50 %-8u p99 %-8u p99.9 %-8u max %u (us)\n",
+        name, hist->count, hist->count ? (double)hist->sum / hist->count : 0.0,
+        microtcp_hist_percentile(hist, 50), microtcp_hist_percentile(hist, 99),
+        microtcp_hist_percentile(hist, 99.9), hist->max);
+}
+
+void microtcp_latency_merge(microtcp_latency_t* dst, const microtcp_latency_t* src)
+{
+    microtcp_hist_merge(&dst->ack, &src->ack);
+    microtcp_hist_merge(&dst->send, &src->send);
+    microtcp_hist_merge(&dst->recv, &src->recv);
+    microtcp_hist_merge(&dst->handshake, &src->handshake);
+}
+
+void microtcp_latency_dump(FILE* fp, const microtcp_latency_t* latency)
+{
+    microtcp_hist_dump(fp, "ack", &latency->ack);
+    microtcp_hist_dump(fp, "send", &latency->send);
+    microtcp_hist_dump(fp, "recv", &latency->recv);
+    microtcp_hist_dump(fp, "handshake", &latency->handshake);
+}
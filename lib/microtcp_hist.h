@@ -0,0 +1,86 @@
+/*
+ * microtcp, a lightweight implementation of TCP for teaching,
+ * and academic purposes.
+ *
+ * Copyright (C) 2015-2017  Manolis Surligas <surligas@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef LIB_MICROTCP_HIST_H_
+#define LIB_MICROTCP_HIST_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Log-linear latency histograms in the spirit of HdrHistogram. Values are
+ * microseconds. Below 2^MICROTCP_HIST_SUB_BITS every value has its own
+ * bucket, above it every power of two is split in 2^(SUB_BITS - 1) linear
+ * buckets, so a recorded value is off by less than 1/16 (6.25%) while a
+ * 32-bit range fits in 464 counters. Recording is a clz and an increment.
+ *
+ * Histograms of the same layout add up bucket by bucket, so the ones of
+ * many sockets can be merged into a process-wide view.
+ */
+
+#define MICROTCP_HIST_SUB_BITS 5
+#define MICROTCP_HIST_SUB_BUCKETS (1 << MICROTCP_HIST_SUB_BITS)
+#define MICROTCP_HIST_HALF_BUCKETS (MICROTCP_HIST_SUB_BUCKETS / 2)
+#define MICROTCP_HIST_BUCKETS ((32 - MICROTCP_HIST_SUB_BITS + 2) * MICROTCP_HIST_HALF_BUCKETS)
+
+typedef struct
+{
+    uint64_t count;
+    uint64_t sum;
+    uint32_t min;
+    uint32_t max;
+    uint32_t buckets[MICROTCP_HIST_BUCKETS];
+} microtcp_hist_t;
+
+/**
+ * Latencies kept by every socket.
+ */
+typedef struct
+{
+    microtcp_hist_t ack;          /**< First transmission of a segment to its cumulative ACK */
+    microtcp_hist_t send;         /**< Duration of microtcp_send() calls */
+    microtcp_hist_t recv;         /**< Time microtcp_recv() calls waited for data */
+    microtcp_hist_t handshake;    /**< microtcp_connect()/microtcp_accept() */
+} microtcp_latency_t;
+
+void microtcp_hist_record(microtcp_hist_t* hist, uint64_t value_us);
+
+/**
+ * Adds the samples of src to dst.
+ */
+void microtcp_hist_merge(microtcp_hist_t* dst, const microtcp_hist_t* src);
+
+/**
+ * @param percentile in [0, 100]
+ * @return the highest value equivalent to the sample at percentile, 0 if empty
+ */
+uint32_t microtcp_hist_percentile(const microtcp_hist_t* hist, double percentile);
+
+/**
+ * Prints one line with the count, mean, p50, p99, p99.9 and max of hist.
+ */
+void microtcp_hist_dump(FILE* fp, const char* name, const microtcp_hist_t* hist);
+
+void microtcp_latency_merge(microtcp_latency_t* dst, const microtcp_latency_t* src);
+
+void microtcp_latency_dump(FILE* fp, const microtcp_latency_t* latency);
+
+#endif /* LIB_MICROTCP_HIST_H_ */
@@ -0,0 +1,175 @@
+/*
+ * microtcp, a lightweight implementation of TCP for teaching,
+ * and academic purposes.
+ *
+ * Copyright (C) 2015-2017  Manolis Surligas <surligas@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "microtcp_lz.h"
+#include <string.h>
+
+/* Matches stop this far from the end, so the 4-byte reads stay inside */
+#define LZ_END_LITERALS 8
+#define LZ_MAX_OFFSET 65535
+
+static uint32_t lz_read32(const uint8_t* p)
+{
+    uint32_t value;
+
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static uint32_t lz_hash(uint32_t value)
+{
+    return (value * 2654435761u) >> (32 - MICROTCP_LZ_HASH_BITS);
+}
+
+/* Writes the 255-byte continuation of a length past its nibble */
+static uint8_t* lz_put_length(uint8_t* op, size_t len)
+{
+    for (; len >= 255; len -= 255)
+        *op++ = 255;
+    *op++ = len;
+    return op;
+}
+
+/*
+ * Emits the literals from anchor and, with match_len set, the match
+ * after them. Returns NULL if out is too small.
+ */
+static uint8_t* lz_sequence(uint8_t* op, uint8_t* out_end, const uint8_t* anchor, size_t literals,
+    size_t offset, size_t match_len)
+{
+    uint8_t* token = op;
+    size_t ml = match_len ? match_len - MICROTCP_LZ_MIN_MATCH : 0;
+
+    /* Token, literals, their length bytes, offset and match length bytes */
+    if ((size_t)(out_end - op) < 2 + literals + literals / 255 + (match_len ? 3 + ml / 255 : 0))
+        return NULL;
+    op++;
+    *token = (literals >= 15 ? 15 : literals) << 4;
+    if (literals >= 15)
+        op = lz_put_length(op, literals - 15);
+    memcpy(op, anchor, literals);
+    op += literals;
+    if (!match_len)
+        return op;
+    *op++ = offset;
+    *op++ = offset >> 8;
+    *token |= ml >= 15 ? 15 : ml;
+    if (ml >= 15)
+        op = lz_put_length(op, ml - 15);
+    return op;
+}
+
+size_t microtcp_lz_compress(const uint8_t* in, size_t len, uint8_t* out, size_t out_len)
+{
+    uint32_t table[1 << MICROTCP_LZ_HASH_BITS];
+    const uint8_t* ip = in;
+    const uint8_t* anchor = in;
+    const uint8_t* limit = in + (len > LZ_END_LITERALS ? len - LZ_END_LITERALS : 0);
+    const uint8_t* end = in + len;
+    const uint8_t* ref;
+    uint8_t* op = out;
+    uint8_t* out_end = out + out_len;
+    uint32_t value, h;
+    size_t match_len;
+    unsigned int misses = 0;
+
+    memset(table, 0, sizeof(table));
+    while (ip < limit) {
+        value = lz_read32(ip);
+        h = lz_hash(value);
+        ref = in + table[h];
+        table[h] = ip - in;
+        if (ref >= ip || ip - ref > LZ_MAX_OFFSET || lz_read32(ref) != value) {
+            /* Step further the longer nothing matched */
+            ip += 1 + (misses++ >> 5);
+            continue;
+        }
+        misses = 0;
+        match_len = MICROTCP_LZ_MIN_MATCH;
+        while (ip + match_len < end - LZ_END_LITERALS && ref[match_len] == ip[match_len])
+            match_len++;
+        op = lz_sequence(op, out_end, anchor, ip - anchor, ip - ref, match_len);
+        if (!op)
+            return 0;
+        ip += match_len;
+        anchor = ip;
+    }
+    op = lz_sequence(op, out_end, anchor, end - anchor, 0, 0);
+    return op ? (size_t)(op - out) : 0;
+}
+
+/* Reads the continuation of a length, NULL past end */
+static const uint8_t* lz_get_length(const uint8_t* ip, const uint8_t* end, size_t* len)
+{
+    uint8_t byte;
+
+    do {
+        if (ip >= end)
+            return NULL;
+        byte = *ip++;
+        *len += byte;
+    } while (byte == 255);
+    return ip;
+}
+
+ssize_t microtcp_lz_decompress(const uint8_t* in, size_t len, uint8_t* out, size_t out_len)
+{
+    const uint8_t* ip = in;
+    const uint8_t* end = in + len;
+    uint8_t* op = out;
+    uint8_t* out_end = out + out_len;
+    size_t literals, match_len, offset;
+    uint8_t token;
+
+    while (ip < end) {
+        token = *ip++;
+        literals = token >> 4;
+        if (literals == 15 && !(ip = lz_get_length(ip, end, &literals)))
+            return -1;
+        if ((size_t)(end - ip) < literals || (size_t)(out_end - op) < literals)
+            return -1;
+        memcpy(op, ip, literals);
+        ip += literals;
+        op += literals;
+        if (ip == end)
+            break;
+
+        if (end - ip < 2)
+            return -1;
+        offset = ip[0] | ip[1] << 8;
+        ip += 2;
+        match_len = token & 0x0f;
+        if (match_len == 15 && !(ip = lz_get_length(ip, end, &match_len)))
+            return -1;
+        match_len += MICROTCP_LZ_MIN_MATCH;
+        if (!offset || offset > (size_t)(op - out) || (size_t)(out_end - op) < match_len)
+            return -1;
+        if (offset >= match_len)
+            memcpy(op, op - offset, match_len);
+        else {
+            /* Overlapping, a run of the last offset bytes */
+            for (; match_len; match_len--, op++)
+                *op = op[-offset];
+            continue;
+        }
+        op += match_len;
+    }
+    return op - out;
+}
@@ -0,0 +1,60 @@
+/*
+ * microtcp, a lightweight implementation of TCP for teaching,
+ * and academic purposes.
+ *
+ * Copyright (C) 2015-2017  Manolis Surligas <surligas@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIB_MICROTCP_LZ_H_
+#define LIB_MICROTCP_LZ_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * A small LZ77 block codec in the spirit of LZ4, for the compression
+ * stage of microtcp_send(). A block is a run of sequences, each a token
+ * byte (literal count in the high nibble, match length - 4 in the low
+ * one, 15 meaning more length bytes follow), the literals, and a 16-bit
+ * little-endian match offset. The last sequence has literals only.
+ *
+ * Matches are found greedily through a hash table of 4-byte prefixes,
+ * skipping faster over data that does not match, so incompressible input
+ * costs little. The decoder checks every length and offset against both
+ * buffers and never trusts its input.
+ */
+
+#define MICROTCP_LZ_MIN_MATCH 4
+#define MICROTCP_LZ_HASH_BITS 13
+
+/**
+ * The most a block of len bytes can grow to.
+ */
+#define MICROTCP_LZ_BOUND(len) ((len) + (len) / 255 + 16)
+
+/**
+ * @return the compressed size, 0 if it would not fit in out_len
+ */
+size_t microtcp_lz_compress(const uint8_t* in, size_t len, uint8_t* out, size_t out_len);
+
+/**
+ * @return the decompressed size, -1 if in is malformed or does not fit in
+ *         out_len
+ */
+ssize_t microtcp_lz_decompress(const uint8_t* in, size_t len, uint8_t* out, size_t out_len);
+
+#endif /* LIB_MICROTCP_LZ_H_ */
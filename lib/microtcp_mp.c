@@ -0,0 +1,583 @@
+/*
+ * microtcp, a lightweight implementation of TCP for teaching,
+ * and academic purposes.
+ *
+ * Copyright (C) 2015-2017  Manolis Surligas <surligas@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "microtcp_mp.h"
+#include <endian.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/random.h>
+
+typedef struct microtcp_mp_chunk
+{
+    struct microtcp_mp_chunk* next;
+    uint64_t offset;
+    size_t len;                       /**< Data, header excluded */
+    size_t read;                      /**< Data already taken by microtcp_mp_recv() */
+    uint8_t bytes[];                  /**< Header and data on the sending side, data on the receiving one */
+} microtcp_mp_chunk_t;
+
+typedef struct
+{
+    microtcp_mp_t* mp;
+    int index;
+    microtcp_sock_t socket;
+    pthread_t thread;
+    int opened;
+    int started;
+    int weight;
+    int current;                      /**< Smooth weighted round robin credit */
+    uint32_t srtt_us;
+    size_t queued;
+    microtcp_mp_chunk_t* head;        /**< Sending: the chunk being sent first */
+    microtcp_mp_chunk_t* tail;
+    int done;                         /**< Receiving: the peer shut the subflow down */
+    uint64_t chunks;
+    uint64_t bytes;
+} microtcp_mp_subflow_t;
+
+struct microtcp_mp
+{
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    int sender;
+    microtcp_mp_scheduler_t scheduler;
+    int count;
+    int closing;
+    int failed;
+    int chosen;                       /**< Weighted round robin choice waiting for room, -1 for none */
+    uint64_t offset;                  /**< Sending: of the next chunk; receiving: of the next byte read */
+    microtcp_mp_chunk_t* reorder;     /**< Receiving, ordered by offset */
+    size_t reorder_bytes;
+    microtcp_mp_subflow_t subflow[MICROTCP_MP_MAX_SUBFLOWS];
+};
+
+static microtcp_mp_t* mp_create(int count, int sender)
+{
+    microtcp_mp_t* mp;
+    int i;
+
+    if (count < 1 || count > MICROTCP_MP_MAX_SUBFLOWS) {
+        fprintf(stderr, "Error: Between 1 and %d subflows are supported.\n", MICROTCP_MP_MAX_SUBFLOWS);
+        return NULL;
+    }
+    mp = calloc(1, sizeof(microtcp_mp_t));
+    if (!mp)
+        return NULL;
+    pthread_mutex_init(&mp->lock, NULL);
+    pthread_cond_init(&mp->changed, NULL);
+    mp->sender = sender;
+    mp->count = count;
+    mp->chosen = -1;
+    for (i = 0; i < count; i++) {
+        mp->subflow[i].mp = mp;
+        mp->subflow[i].index = i;
+    }
+    return mp;
+}
+
+static int mp_established(const microtcp_sock_t* socket)
+{
+    return socket->state == ESTABLISHED || socket->state == ESTABLISHED_PEER
+        || socket->state == ESTABLISHED_HOST;
+}
+
+/*
+ * Resets a subflow whose peer may no longer read it, a FIN would wait for
+ * an ACK forever. A sender blocked on it gets the RST and fails too.
+ */
+static void mp_reset(microtcp_sock_t* socket)
+{
+    void* packet = microtcp_create_packet(socket->seq_number, socket->ack_number, 0, 1, 0, 0,
+        0, 0, NULL, 0, 0, 0);
+
+    if (packet && microtcp_sock_send(socket, packet, sizeof(microtcp_header_t), 0) == -1)
+        fprintf(stderr, "Error: Could not reset a failed subflow.\n");
+    free(packet);
+    microtcp_set_state(socket, INVALID);
+}
+
+/*
+ * Stops the workers and frees everything. Receive workers blocked in
+ * microtcp_recv() return at its next timeout. Established subflows are
+ * shut down first, or reset if the connection failed.
+ */
+static void mp_destroy(microtcp_mp_t* mp)
+{
+    microtcp_mp_chunk_t* chunk;
+    int i;
+
+    pthread_mutex_lock(&mp->lock);
+    mp->closing = 1;
+    pthread_cond_broadcast(&mp->changed);
+    pthread_mutex_unlock(&mp->lock);
+    for (i = 0; i < mp->count; i++)
+        __atomic_store_n(&mp->subflow[i].socket.rcv_abort, 1, __ATOMIC_RELAXED);
+    for (i = 0; i < mp->count; i++) {
+        if (mp->subflow[i].started)
+            pthread_join(mp->subflow[i].thread, NULL);
+        while ((chunk = mp->subflow[i].head)) {
+            mp->subflow[i].head = chunk->next;
+            free(chunk);
+        }
+        if (mp->failed && mp_established(&mp->subflow[i].socket))
+            mp_reset(&mp->subflow[i].socket);
+        else if (mp_established(&mp->subflow[i].socket) || mp->subflow[i].socket.state == CLOSING_BY_PEER)
+            microtcp_shutdown(&mp->subflow[i].socket, SHUT_RDWR);
+        if (mp->subflow[i].opened)
+            microtcp_close(&mp->subflow[i].socket);
+    }
+    while ((chunk = mp->reorder)) {
+        mp->reorder = chunk->next;
+        free(chunk);
+    }
+    pthread_cond_destroy(&mp->changed);
+    pthread_mutex_destroy(&mp->lock);
+    free(mp);
+}
+
+static void mp_fail(microtcp_mp_t* mp)
+{
+    pthread_mutex_lock(&mp->lock);
+    mp->failed = 1;
+    pthread_cond_broadcast(&mp->changed);
+    pthread_mutex_unlock(&mp->lock);
+}
+
+static void* mp_send_worker(void* arg)
+{
+    microtcp_mp_subflow_t* subflow = arg;
+    microtcp_mp_t* mp = subflow->mp;
+    microtcp_mp_chunk_t* chunk;
+    microtcp_info_t info;
+
+    for (;;) {
+        pthread_mutex_lock(&mp->lock);
+        while (!subflow->head && !mp->closing && !mp->failed)
+            pthread_cond_wait(&mp->changed, &mp->lock);
+        chunk = mp->failed ? NULL : subflow->head;
+        pthread_mutex_unlock(&mp->lock);
+        if (!chunk)
+            return NULL;
+
+        if (microtcp_send(&subflow->socket, chunk->bytes,
+            sizeof(microtcp_mp_chunk_header_t) + chunk->len, 0) == -1) {
+            fprintf(stderr, "Error: Subflow %d failed sending.\n", subflow->index);
+            mp_fail(mp);
+            return NULL;
+        }
+        microtcp_get_info(&subflow->socket, &info, sizeof(info));
+
+        pthread_mutex_lock(&mp->lock);
+        subflow->head = chunk->next;
+        if (!subflow->head)
+            subflow->tail = NULL;
+        subflow->queued--;
+        subflow->chunks++;
+        subflow->bytes += chunk->len;
+        subflow->srtt_us = info.srtt_us;
+        pthread_cond_broadcast(&mp->changed);
+        pthread_mutex_unlock(&mp->lock);
+        free(chunk);
+    }
+}
+
+/*
+ * Receives exactly length bytes. Returns 0 if the peer shut down before
+ * the first byte, -1 on failure or a shutdown halfway.
+ */
+static int mp_recv_all(microtcp_sock_t* socket, void* buffer, size_t length)
+{
+    size_t received = 0;
+    ssize_t ret;
+
+    while (received < length) {
+        ret = microtcp_recv(socket, (uint8_t*)buffer + received, length - received, 0);
+        if (ret == -1)
+            return !received && socket->state == CLOSING_BY_PEER ? 0 : -1;
+        received += ret;
+    }
+    return 1;
+}
+
+static void* mp_recv_worker(void* arg)
+{
+    microtcp_mp_subflow_t* subflow = arg;
+    microtcp_mp_t* mp = subflow->mp;
+    microtcp_mp_chunk_header_t header;
+    microtcp_mp_chunk_t** at;
+    microtcp_mp_chunk_t* chunk;
+    uint64_t offset;
+    uint32_t len;
+    int stop;
+    int ret;
+
+    for (;;) {
+        pthread_mutex_lock(&mp->lock);
+        stop = mp->failed || mp->closing;
+        pthread_mutex_unlock(&mp->lock);
+        if (stop) {
+            ret = 1;
+            break;
+        }
+        if ((ret = mp_recv_all(&subflow->socket, &header, sizeof(header))) <= 0)
+            break;
+        offset = be64toh(header.offset);
+        len = ntohl(header.len);
+        if (len > MICROTCP_MP_CHUNK) {
+            fprintf(stderr, "Error: Subflow %d got a chunk of %u bytes.\n", subflow->index, len);
+            ret = -1;
+            break;
+        }
+
+        /* Past the reorder limit only the chunk the reader waits for goes in */
+        pthread_mutex_lock(&mp->lock);
+        while (mp->reorder_bytes >= MICROTCP_MP_REORDER && offset != mp->offset && !mp->failed)
+            pthread_cond_wait(&mp->changed, &mp->lock);
+        pthread_mutex_unlock(&mp->lock);
+
+        chunk = malloc(sizeof(microtcp_mp_chunk_t) + len);
+        if (!chunk) {
+            fprintf(stderr, "Error: Could not allocate a chunk of subflow %d.\n", subflow->index);
+            ret = -1;
+            break;
+        }
+        chunk->offset = offset;
+        chunk->len = len;
+        chunk->read = 0;
+        if (mp_recv_all(&subflow->socket, chunk->bytes, len) <= 0) {
+            free(chunk);
+            ret = -1;
+            break;
+        }
+
+        pthread_mutex_lock(&mp->lock);
+        for (at = &mp->reorder; *at && (*at)->offset < offset; at = &(*at)->next)
+            ;
+        chunk->next = *at;
+        *at = chunk;
+        mp->reorder_bytes += len;
+        subflow->chunks++;
+        subflow->bytes += len;
+        pthread_cond_broadcast(&mp->changed);
+        pthread_mutex_unlock(&mp->lock);
+    }
+
+    /* The sender shuts the subflows down one after the other, each waiting for our FIN */
+    if (!ret)
+        microtcp_shutdown(&subflow->socket, SHUT_RDWR);
+    pthread_mutex_lock(&mp->lock);
+    /* Not when another subflow failed first or microtcp_mp_close() aborted the receive */
+    if (ret == -1 && !mp->failed && !mp->closing) {
+        fprintf(stderr, "Error: Subflow %d failed receiving.\n", subflow->index);
+        mp->failed = 1;
+    }
+    subflow->done = 1;
+    pthread_cond_broadcast(&mp->changed);
+    pthread_mutex_unlock(&mp->lock);
+    return NULL;
+}
+
+static int mp_start(microtcp_mp_t* mp)
+{
+    int i;
+
+    for (i = 0; i < mp->count; i++) {
+        if (pthread_create(&mp->subflow[i].thread, NULL, mp->sender ? mp_send_worker : mp_recv_worker,
+            &mp->subflow[i])) {
+            fprintf(stderr, "Error: Could not start the worker of subflow %d.\n", i);
+            mp_fail(mp);
+            return -1;
+        }
+        mp->subflow[i].started = 1;
+    }
+    return 0;
+}
+
+microtcp_mp_t* microtcp_mp_connect(const microtcp_mp_path_t* path, int count,
+    microtcp_mp_scheduler_t scheduler)
+{
+    microtcp_mp_t* mp = mp_create(count, 1);
+    microtcp_mp_subflow_t* subflow;
+    microtcp_mp_hello_t hello;
+    microtcp_info_t info;
+    uint64_t token;
+    int i;
+
+    if (!mp)
+        return NULL;
+    mp->scheduler = scheduler;
+    if (getrandom(&token, sizeof(token), 0) != sizeof(token))
+        token = microtcp_now_ns();
+    for (i = 0; i < count; i++) {
+        subflow = &mp->subflow[i];
+        subflow->weight = path[i].weight > 0 ? path[i].weight : 1;
+        subflow->socket = microtcp_socket(path[i].remote->sa_family, SOCK_DGRAM, IPPROTO_UDP);
+        subflow->opened = subflow->socket.state != INVALID;
+        if (!subflow->opened
+            || (path[i].local && microtcp_bind(&subflow->socket, path[i].local, path[i].local_len) == -1)
+            || microtcp_connect(&subflow->socket, path[i].remote, path[i].remote_len) == -1) {
+            fprintf(stderr, "Error: Could not connect subflow %d.\n", i);
+            mp_destroy(mp);
+            return NULL;
+        }
+        hello.magic = htonl(MICROTCP_MP_MAGIC);
+        hello.index = htons(i);
+        hello.count = htons(count);
+        hello.token = token;
+        if (microtcp_send(&subflow->socket, &hello, sizeof(hello), 0) == -1) {
+            fprintf(stderr, "Error: Could not greet on subflow %d.\n", i);
+            mp_destroy(mp);
+            return NULL;
+        }
+        microtcp_get_info(&subflow->socket, &info, sizeof(info));
+        subflow->srtt_us = info.srtt_us;
+    }
+    if (mp_start(mp) == -1) {
+        mp_destroy(mp);
+        return NULL;
+    }
+    return mp;
+}
+
+microtcp_mp_t* microtcp_mp_accept(const microtcp_mp_path_t* path, int count)
+{
+    microtcp_mp_t* mp = mp_create(count, 0);
+    microtcp_mp_subflow_t* subflow;
+    microtcp_mp_hello_t hello;
+    struct sockaddr_storage peer;
+    uint64_t token = 0;
+    int i, seen = 0;
+
+    if (!mp)
+        return NULL;
+    for (i = 0; i < count; i++) {
+        subflow = &mp->subflow[i];
+        subflow->socket = microtcp_socket(path[i].local->sa_family, SOCK_DGRAM, IPPROTO_UDP);
+        subflow->opened = subflow->socket.state != INVALID;
+        if (!subflow->opened
+            || microtcp_bind(&subflow->socket, path[i].local, path[i].local_len) == -1
+            || microtcp_accept(&subflow->socket, (struct sockaddr*)&peer, sizeof(peer)) == -1
+            || mp_recv_all(&subflow->socket, &hello, sizeof(hello)) <= 0) {
+            fprintf(stderr, "Error: Could not accept subflow %d.\n", i);
+            mp_destroy(mp);
+            return NULL;
+        }
+        if (ntohl(hello.magic) != MICROTCP_MP_MAGIC || ntohs(hello.count) != count
+            || ntohs(hello.index) >= count || (seen & 1 << ntohs(hello.index))
+            || (i && hello.token != token)) {
+            fprintf(stderr, "Error: Subflow %d does not belong to this connection.\n", i);
+            mp_destroy(mp);
+            return NULL;
+        }
+        seen |= 1 << ntohs(hello.index);
+        token = hello.token;
+    }
+    if (mp_start(mp) == -1) {
+        mp_destroy(mp);
+        return NULL;
+    }
+    return mp;
+}
+
+/*
+ * The subflow for the next chunk, -1 if the scheduler waits for room.
+ */
+static int mp_schedule(microtcp_mp_t* mp)
+{
+    microtcp_mp_subflow_t* subflow;
+    int i, best = -1, total = 0;
+
+    if (mp->scheduler == MICROTCP_MP_MIN_RTT) {
+        for (i = 0; i < mp->count; i++) {
+            subflow = &mp->subflow[i];
+            if (subflow->queued < MICROTCP_MP_QUEUE
+                && (best == -1 || subflow->srtt_us < mp->subflow[best].srtt_us))
+                best = i;
+        }
+        return best;
+    }
+
+    /* Smooth weighted round robin, a choice stands until it has room */
+    if (mp->chosen == -1) {
+        for (i = 0; i < mp->count; i++) {
+            subflow = &mp->subflow[i];
+            subflow->current += subflow->weight;
+            total += subflow->weight;
+            if (best == -1 || subflow->current > mp->subflow[best].current)
+                best = i;
+        }
+        mp->subflow[best].current -= total;
+        mp->chosen = best;
+    }
+    return mp->subflow[mp->chosen].queued < MICROTCP_MP_QUEUE ? mp->chosen : -1;
+}
+
+ssize_t microtcp_mp_send(microtcp_mp_t* mp, const void* buffer, size_t length)
+{
+    const uint8_t* data = buffer;
+    microtcp_mp_chunk_header_t header;
+    microtcp_mp_subflow_t* subflow;
+    microtcp_mp_chunk_t* chunk;
+    size_t sent, len;
+    int i;
+
+    if (!mp->sender) {
+        fprintf(stderr, "Error: Only the connecting side sends.\n");
+        return -1;
+    }
+    for (sent = 0; sent < length; sent += len) {
+        len = MIN(length - sent, MICROTCP_MP_CHUNK);
+        chunk = malloc(sizeof(microtcp_mp_chunk_t) + sizeof(header) + len);
+        if (!chunk) {
+            fprintf(stderr, "Error: Could not allocate a chunk.\n");
+            return -1;
+        }
+        chunk->next = NULL;
+        chunk->len = len;
+        memcpy(chunk->bytes + sizeof(header), data + sent, len);
+
+        pthread_mutex_lock(&mp->lock);
+        while (!mp->failed && (i = mp_schedule(mp)) == -1)
+            pthread_cond_wait(&mp->changed, &mp->lock);
+        if (mp->failed) {
+            pthread_mutex_unlock(&mp->lock);
+            free(chunk);
+            return -1;
+        }
+        chunk->offset = mp->offset;
+        header.offset = htobe64(mp->offset);
+        header.len = htonl(len);
+        header.reserved = 0;
+        memcpy(chunk->bytes, &header, sizeof(header));
+        mp->offset += len;
+        mp->chosen = -1;
+        subflow = &mp->subflow[i];
+        if (subflow->tail)
+            subflow->tail->next = chunk;
+        else
+            subflow->head = chunk;
+        subflow->tail = chunk;
+        subflow->queued++;
+        pthread_cond_broadcast(&mp->changed);
+        pthread_mutex_unlock(&mp->lock);
+    }
+    return length;
+}
+
+static int mp_all_done(microtcp_mp_t* mp)
+{
+    int i;
+
+    for (i = 0; i < mp->count; i++)
+        if (!mp->subflow[i].done)
+            return 0;
+    return 1;
+}
+
+ssize_t microtcp_mp_recv(microtcp_mp_t* mp, void* buffer, size_t length)
+{
+    microtcp_mp_chunk_t* chunk;
+    size_t copied = 0;
+    size_t len;
+
+    if (mp->sender) {
+        fprintf(stderr, "Error: Only the accepting side receives.\n");
+        return -1;
+    }
+    pthread_mutex_lock(&mp->lock);
+    while ((!mp->reorder || mp->reorder->offset + mp->reorder->read != mp->offset)
+        && !mp->failed && !mp_all_done(mp))
+        pthread_cond_wait(&mp->changed, &mp->lock);
+    if (mp->failed) {
+        pthread_mutex_unlock(&mp->lock);
+        return -1;
+    }
+    while (copied < length && (chunk = mp->reorder) && chunk->offset + chunk->read == mp->offset) {
+        len = MIN(chunk->len - chunk->read, length - copied);
+        memcpy((uint8_t*)buffer + copied, chunk->bytes + chunk->read, len);
+        chunk->read += len;
+        copied += len;
+        mp->offset += len;
+        if (chunk->read == chunk->len) {
+            mp->reorder = chunk->next;
+            mp->reorder_bytes -= chunk->len;
+            free(chunk);
+            pthread_cond_broadcast(&mp->changed);
+        }
+    }
+    /* Every subflow ended with a gap before the next byte */
+    if (!copied && mp->reorder) {
+        fprintf(stderr, "Error: The subflows ended with data at %llu missing.\n",
+            (unsigned long long)mp->offset);
+        pthread_mutex_unlock(&mp->lock);
+        return -1;
+    }
+    pthread_mutex_unlock(&mp->lock);
+    return copied;
+}
+
+int microtcp_mp_get_info(microtcp_mp_t* mp, int subflow, microtcp_mp_subflow_info_t* info)
+{
+    if (subflow < 0 || subflow >= mp->count) {
+        fprintf(stderr, "Error: There is no subflow %d.\n", subflow);
+        return -1;
+    }
+    pthread_mutex_lock(&mp->lock);
+    info->chunks = mp->subflow[subflow].chunks;
+    info->bytes = mp->subflow[subflow].bytes;
+    pthread_mutex_unlock(&mp->lock);
+    /* The counters of a socket are only written by its worker, a torn read is harmless */
+    return microtcp_get_info(&mp->subflow[subflow].socket, &info->info, sizeof(info->info));
+}
+
+/*
+ * Waits until every subflow sent its queue, or got shut down by the peer.
+ */
+static int mp_drain(microtcp_mp_t* mp)
+{
+    int i, failed;
+
+    pthread_mutex_lock(&mp->lock);
+    for (i = 0; i < mp->count; i++)
+        while (!mp->failed && (mp->sender ? mp->subflow[i].queued != 0 : !mp->subflow[i].done))
+            pthread_cond_wait(&mp->changed, &mp->lock);
+    failed = mp->failed;
+    pthread_mutex_unlock(&mp->lock);
+    return failed ? -1 : 0;
+}
+
+int microtcp_mp_flush(microtcp_mp_t* mp)
+{
+    if (!mp->sender) {
+        fprintf(stderr, "Error: Only the connecting side sends.\n");
+        return -1;
+    }
+    return mp_drain(mp);
+}
+
+int microtcp_mp_close(microtcp_mp_t* mp)
+{
+    int ret = mp_drain(mp);
+
+    mp_destroy(mp);
+    return ret;
+}
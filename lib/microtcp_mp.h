@@ -0,0 +1,147 @@
+/*
+ * microtcp, a lightweight implementation of TCP for teaching,
+ * and academic purposes.
+ *
+ * Copyright (C) 2015-2017  Manolis Surligas <surligas@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIB_MICROTCP_MP_H_
+#define LIB_MICROTCP_MP_H_
+
+#include "microtcp.h"
+
+/*
+ * One logical connection striped over several microTCP connections, the
+ * subflows, each on its own UDP socket and so its own local port or
+ * address and network path. Every subflow keeps its own cwnd and RTT
+ * estimate. Data flows from the side that connects to the side that
+ * accepts.
+ *
+ * The sender cuts the data in chunks of at most MICROTCP_MP_CHUNK bytes,
+ * each preceded on its subflow by a header with its offset in the logical
+ * stream, and a worker thread per subflow sends the chunks queued on it.
+ * The scheduler hands the next chunk to
+ *
+ *   MICROTCP_MP_MIN_RTT   the subflow of the lowest smoothed RTT among
+ *                         those with room in their queue;
+ *   MICROTCP_MP_WEIGHTED  the subflows in turn, each as often as its
+ *                         weight, waiting for the chosen one if needed.
+ *
+ * At the receiver a worker per subflow reads chunks into a reassembly
+ * queue ordered by offset. Once MICROTCP_MP_REORDER bytes wait there,
+ * workers only take the chunk the reader needs next and the other
+ * subflows are held back by their receive windows.
+ *
+ * Each subflow opens with a hello carrying a random token of the logical
+ * connection and its index, so the accepting side only groups subflows
+ * of the same connection. The accepting side listens on one port per
+ * subflow.
+ */
+
+#define MICROTCP_MP_MAX_SUBFLOWS 8
+#define MICROTCP_MP_CHUNK (64 * 1024)            /**< Data per chunk, one message of its subflow */
+#define MICROTCP_MP_QUEUE 2                      /**< Chunks a subflow holds, the one being sent included */
+#define MICROTCP_MP_REORDER (32 * MICROTCP_MP_CHUNK)
+#define MICROTCP_MP_MAGIC 0x4d544d50             /**< "MTMP" */
+
+typedef enum
+{
+    MICROTCP_MP_MIN_RTT,
+    MICROTCP_MP_WEIGHTED
+} microtcp_mp_scheduler_t;
+
+typedef struct
+{
+    const struct sockaddr* local;   /**< Address to bind, NULL for any on the sending side */
+    socklen_t local_len;
+    const struct sockaddr* remote;  /**< Address to connect to, sending side only */
+    socklen_t remote_len;
+    int weight;                     /**< Share with MICROTCP_MP_WEIGHTED, 0 for 1 */
+} microtcp_mp_path_t;
+
+/** Sent first on every subflow, in network order */
+typedef struct
+{
+    uint32_t magic;
+    uint16_t index;
+    uint16_t count;
+    uint64_t token;
+} microtcp_mp_hello_t;
+
+/** Precedes every chunk on its subflow, in network order */
+typedef struct
+{
+    uint64_t offset;
+    uint32_t len;
+    uint32_t reserved;
+} microtcp_mp_chunk_header_t;
+
+typedef struct
+{
+    uint64_t chunks;                /**< Chunks sent or received on the subflow */
+    uint64_t bytes;                 /**< Their data, headers excluded */
+    microtcp_info_t info;
+} microtcp_mp_subflow_info_t;
+
+typedef struct microtcp_mp microtcp_mp_t;
+
+/**
+ * Connects a subflow over each path and starts sending workers.
+ * @return the connection, NULL on failure
+ */
+microtcp_mp_t* microtcp_mp_connect(const microtcp_mp_path_t* path, int count,
+    microtcp_mp_scheduler_t scheduler);
+
+/**
+ * Accepts a subflow on the local address of each path and starts
+ * receiving workers. Fails if the hellos do not belong to one connection
+ * of count subflows.
+ * @return the connection, NULL on failure
+ */
+microtcp_mp_t* microtcp_mp_accept(const microtcp_mp_path_t* path, int count);
+
+/**
+ * Copies length bytes into chunks and queues them on the subflows,
+ * blocking while their queues are full.
+ * @return length, -1 once a subflow failed
+ */
+ssize_t microtcp_mp_send(microtcp_mp_t* mp, const void* buffer, size_t length);
+
+/**
+ * Receives the next bytes of the logical stream, blocking until there
+ * are some.
+ * @return the bytes received, 0 once every subflow ended and everything
+ *         was read, -1 once a subflow failed
+ */
+ssize_t microtcp_mp_recv(microtcp_mp_t* mp, void* buffer, size_t length);
+
+/**
+ * Waits until every queued chunk was acknowledged.
+ * @return 0 on success, -1 if a subflow failed
+ */
+int microtcp_mp_flush(microtcp_mp_t* mp);
+
+int microtcp_mp_get_info(microtcp_mp_t* mp, int subflow, microtcp_mp_subflow_info_t* info);
+
+/**
+ * On the sending side flushes the queued chunks, then shuts down every
+ * subflow. On the receiving side waits for the peer to shut down every
+ * subflow. Either way frees the connection.
+ * @return 0 on success, -1 if a subflow failed
+ */
+int microtcp_mp_close(microtcp_mp_t* mp);
+
+#endif /* LIB_MICROTCP_MP_H_ */
@@ -0,0 +1,407 @@
+/*
+ * microtcp, a lightweight implementation of TCP for teaching,
+ * and academic purposes.
+ *
+ * Copyright (C) 2015-2017  Manolis Surligas <surligas@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "microtcp_mux.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct microtcp_mux_frame
+{
+    struct microtcp_mux_frame* next;
+    size_t len;                       /**< Sub-header included */
+    uint8_t bytes[];
+} microtcp_mux_frame_t;
+
+typedef struct microtcp_mux_chunk
+{
+    struct microtcp_mux_chunk* next;
+    uint32_t offset;
+    size_t len;
+    uint8_t data[];
+} microtcp_mux_chunk_t;
+
+typedef struct
+{
+    /* Sending */
+    microtcp_mux_frame_t* head;
+    microtcp_mux_frame_t* tail;
+    uint32_t send_offset;
+    int urgency;
+    int weight;
+    size_t deficit;
+    int closed;
+    /* Receiving */
+    microtcp_mux_chunk_t* chunks;     /**< Ordered by offset, may have gaps */
+    uint32_t recv_offset;
+    uint32_t fin_offset;
+    int fin;
+    int eof_reported;
+} microtcp_mux_stream_t;
+
+struct microtcp_mux
+{
+    microtcp_sock_t* socket;
+    microtcp_segment_state_t segments;
+    uint16_t wanted;                  /**< Stream microtcp_mux_recv() waits for */
+    int failed;
+    int cursor[MICROTCP_MUX_URGENCY_LEVELS];
+    microtcp_mux_stream_t stream[MICROTCP_MUX_MAX_STREAMS];
+};
+
+static int32_t mux_distance(uint32_t from, uint32_t to)
+{
+    return (int32_t)(to - from);
+}
+
+static void mux_pack(uint8_t* bytes, uint16_t stream, uint8_t flags, uint32_t offset)
+{
+    microtcp_mux_header_t header;
+
+    header.stream = htons(stream);
+    header.flags = flags;
+    header.reserved = 0;
+    header.offset = htonl(offset);
+    memcpy(bytes, &header, sizeof(header));
+}
+
+static int mux_queue(microtcp_mux_t* mux, uint16_t id, uint8_t flags, const uint8_t* data, size_t len)
+{
+    microtcp_mux_stream_t* stream = &mux->stream[id];
+    microtcp_mux_frame_t* frame;
+
+    frame = malloc(sizeof(microtcp_mux_frame_t) + MICROTCP_MUX_HEADER + len);
+    if (!frame) {
+        fprintf(stderr, "Error: Could not allocate a frame of stream %u.\n", id);
+        return -1;
+    }
+    frame->next = NULL;
+    frame->len = MICROTCP_MUX_HEADER + len;
+    mux_pack(frame->bytes, id, flags, stream->send_offset);
+    if (len)
+        memcpy(frame->bytes + MICROTCP_MUX_HEADER, data, len);
+    stream->send_offset += len;
+    if (stream->tail)
+        stream->tail->next = frame;
+    else
+        stream->head = frame;
+    stream->tail = frame;
+    return 0;
+}
+
+static int mux_readable(const microtcp_mux_stream_t* stream)
+{
+    /* The first chunk may be partly read already */
+    if (stream->chunks && mux_distance(stream->recv_offset, stream->chunks->offset) <= 0)
+        return 1;
+    return stream->fin && stream->recv_offset == stream->fin_offset && !stream->eof_reported;
+}
+
+/*
+ * Files a frame in its stream. Frames the stream already has are
+ * retransmissions and dropped. What is buffered counts against the
+ * advertised window, so a peer that keeps to it never takes more than
+ * the receive buffer. Returns 1 once the stream the caller waits for can
+ * be read.
+ */
+static int mux_segment(void* ctx, const uint8_t* data, size_t len)
+{
+    microtcp_mux_t* mux = ctx;
+    microtcp_mux_stream_t* stream;
+    microtcp_mux_header_t header;
+    microtcp_mux_chunk_t** at;
+    microtcp_mux_chunk_t* chunk;
+    uint16_t id;
+    uint32_t offset;
+
+    if (len < MICROTCP_MUX_HEADER)
+        return 0;
+    memcpy(&header, data, sizeof(header));
+    id = ntohs(header.stream);
+    offset = ntohl(header.offset);
+    if (id >= MICROTCP_MUX_MAX_STREAMS)
+        return 0;
+    stream = &mux->stream[id];
+    data += MICROTCP_MUX_HEADER;
+    len -= MICROTCP_MUX_HEADER;
+
+    if (header.flags & MICROTCP_MUX_FIN) {
+        stream->fin = 1;
+        stream->fin_offset = offset + len;
+    }
+    if (len && mux_distance(stream->recv_offset, offset) >= 0) {
+        for (at = &stream->chunks; *at && mux_distance((*at)->offset, offset) > 0; at = &(*at)->next)
+            ;
+        if (!*at || (*at)->offset != offset) {
+            if (mux->socket->rcv_held + len > mux->socket->recvbuf_len) {
+                fprintf(stderr, "Error: Stream %u overran the receive window.\n", id);
+                mux->failed = 1;
+                return 1;
+            }
+            chunk = malloc(sizeof(microtcp_mux_chunk_t) + len);
+            if (!chunk) {
+                fprintf(stderr, "Error: Could not buffer a frame of stream %u.\n", id);
+                mux->failed = 1;
+                return 1;
+            }
+            chunk->offset = offset;
+            chunk->len = len;
+            memcpy(chunk->data, data, len);
+            chunk->next = *at;
+            *at = chunk;
+            mux->socket->rcv_held += len;
+        }
+    }
+
+    if (mux->wanted == MICROTCP_MUX_ANY)
+        return mux_readable(stream);
+    return mux_readable(&mux->stream[mux->wanted]);
+}
+
+microtcp_mux_t* microtcp_mux_create(microtcp_sock_t* socket)
+{
+    microtcp_mux_t* mux;
+    microtcp_segment_state_t init = MICROTCP_SEGMENT_STATE_INIT;
+    int i;
+
+    /* Frames go out as records, which the compression stage would merge */
+    if (socket->compress_active) {
+        fprintf(stderr, "Error: The mux needs a connection without compression.\n");
+        return NULL;
+    }
+    mux = calloc(1, sizeof(microtcp_mux_t));
+    if (!mux)
+        return NULL;
+    mux->socket = socket;
+    mux->segments = init;
+    for (i = 0; i < MICROTCP_MUX_MAX_STREAMS; i++) {
+        mux->stream[i].urgency = MICROTCP_MUX_URGENCY;
+        mux->stream[i].weight = MICROTCP_MUX_WEIGHT;
+    }
+    return mux;
+}
+
+void microtcp_mux_destroy(microtcp_mux_t* mux)
+{
+    microtcp_mux_frame_t* frame;
+    microtcp_mux_chunk_t* chunk;
+    int i;
+
+    if (!mux)
+        return;
+    for (i = 0; i < MICROTCP_MUX_MAX_STREAMS; i++) {
+        while ((frame = mux->stream[i].head)) {
+            mux->stream[i].head = frame->next;
+            free(frame);
+        }
+        while ((chunk = mux->stream[i].chunks)) {
+            mux->stream[i].chunks = chunk->next;
+            mux->socket->rcv_held -= MIN(chunk->len, mux->socket->rcv_held);
+            free(chunk);
+        }
+    }
+    free_microtcp_header_node(&mux->segments.held);
+    free(mux);
+}
+
+int microtcp_mux_set_priority(microtcp_mux_t* mux, uint16_t stream, int urgency, int weight)
+{
+    if (stream >= MICROTCP_MUX_MAX_STREAMS || urgency < 0 || urgency >= MICROTCP_MUX_URGENCY_LEVELS
+        || weight < 1) {
+        fprintf(stderr, "Error: Invalid priority for stream %u.\n", stream);
+        return -1;
+    }
+    mux->stream[stream].urgency = urgency;
+    mux->stream[stream].weight = weight;
+    return 0;
+}
+
+ssize_t microtcp_mux_send(microtcp_mux_t* mux, uint16_t stream, const void* buffer, size_t length)
+{
+    const uint8_t* data = buffer;
+    size_t queued, len;
+
+    if (stream >= MICROTCP_MUX_MAX_STREAMS || mux->stream[stream].closed) {
+        fprintf(stderr, "Error: Stream %u is not open for sending.\n", stream);
+        return -1;
+    }
+    for (queued = 0; queued < length; queued += len) {
+        len = MIN(length - queued, MICROTCP_MUX_FRAME_DATA);
+        if (mux_queue(mux, stream, 0, data + queued, len) == -1)
+            return -1;
+    }
+    return length;
+}
+
+int microtcp_mux_close_stream(microtcp_mux_t* mux, uint16_t stream)
+{
+    if (stream >= MICROTCP_MUX_MAX_STREAMS || mux->stream[stream].closed) {
+        fprintf(stderr, "Error: Stream %u is not open for sending.\n", stream);
+        return -1;
+    }
+    if (mux_queue(mux, stream, MICROTCP_MUX_FIN, NULL, 0) == -1)
+        return -1;
+    mux->stream[stream].closed = 1;
+    return 0;
+}
+
+/*
+ * The most urgent level with queued frames, -1 if nothing is queued.
+ */
+static int mux_urgency(microtcp_mux_t* mux)
+{
+    int i, urgency = -1;
+
+    for (i = 0; i < MICROTCP_MUX_MAX_STREAMS; i++)
+        if (mux->stream[i].head && (urgency == -1 || mux->stream[i].urgency < urgency))
+            urgency = mux->stream[i].urgency;
+    return urgency;
+}
+
+/*
+ * Fills a batch from the most urgent level, in deficit round robin among
+ * its streams starting where the last batch stopped. The frames taken are
+ * chained to *sent for freeing once the batch is acknowledged.
+ */
+static int mux_schedule(microtcp_mux_t* mux, struct iovec* iov, microtcp_mux_frame_t** sent)
+{
+    microtcp_mux_stream_t* stream;
+    microtcp_mux_frame_t* frame;
+    int urgency = mux_urgency(mux);
+    int n = 0;
+    int id;
+
+    if (urgency == -1)
+        return 0;
+    id = mux->cursor[urgency];
+    while (n < MICROTCP_MUX_BATCH && mux_urgency(mux) == urgency) {
+        stream = &mux->stream[id];
+        if (stream->head && stream->urgency == urgency) {
+            stream->deficit += (size_t)stream->weight * MICROTCP_MUX_QUANTUM;
+            while (n < MICROTCP_MUX_BATCH && (frame = stream->head) && frame->len <= stream->deficit) {
+                stream->deficit -= frame->len;
+                stream->head = frame->next;
+                if (!stream->head)
+                    stream->tail = NULL;
+                iov[n].iov_base = frame->bytes;
+                iov[n].iov_len = frame->len;
+                n++;
+                frame->next = *sent;
+                *sent = frame;
+            }
+            if (!stream->head)
+                stream->deficit = 0;
+            /* A stream cut short by the batch continues first in the next one */
+            if (n == MICROTCP_MUX_BATCH && stream->head)
+                break;
+        }
+        id = (id + 1) % MICROTCP_MUX_MAX_STREAMS;
+    }
+    mux->cursor[urgency] = id;
+    return n;
+}
+
+int microtcp_mux_flush(microtcp_mux_t* mux)
+{
+    struct iovec iov[MICROTCP_MUX_BATCH];
+    microtcp_mux_frame_t* sent;
+    microtcp_mux_frame_t* frame;
+    ssize_t ret;
+    int n;
+
+    for (;;) {
+        sent = NULL;
+        n = mux_schedule(mux, iov, &sent);
+        if (!n)
+            return 0;
+        ret = microtcp_send_records(mux->socket, iov, n, 0);
+        while ((frame = sent)) {
+            sent = frame->next;
+            free(frame);
+        }
+        if (ret == -1)
+            return -1;
+    }
+}
+
+/*
+ * Copies what is in order from the front of a stream.
+ */
+static size_t mux_take(microtcp_mux_stream_t* stream, uint8_t* buffer, size_t length)
+{
+    microtcp_mux_chunk_t* chunk;
+    size_t copied = 0;
+    size_t skip, len;
+
+    while (copied < length && (chunk = stream->chunks)
+        && mux_distance(chunk->offset, stream->recv_offset) >= 0
+        && mux_distance(stream->recv_offset, chunk->offset + chunk->len) > 0) {
+        skip = stream->recv_offset - chunk->offset;
+        len = MIN(chunk->len - skip, length - copied);
+        memcpy(buffer + copied, chunk->data + skip, len);
+        copied += len;
+        stream->recv_offset += len;
+        if (skip + len == chunk->len) {
+            stream->chunks = chunk->next;
+            free(chunk);
+        }
+    }
+    return copied;
+}
+
+static int mux_ready(microtcp_mux_t* mux, uint16_t* stream)
+{
+    int i;
+
+    if (*stream != MICROTCP_MUX_ANY)
+        return mux_readable(&mux->stream[*stream]);
+    for (i = 0; i < MICROTCP_MUX_MAX_STREAMS; i++) {
+        if (mux_readable(&mux->stream[i])) {
+            *stream = i;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+ssize_t microtcp_mux_recv(microtcp_mux_t* mux, uint16_t* stream, void* buffer, size_t length)
+{
+    microtcp_mux_stream_t* ready;
+    size_t copied;
+
+    if (*stream != MICROTCP_MUX_ANY && *stream >= MICROTCP_MUX_MAX_STREAMS) {
+        fprintf(stderr, "Error: There is no stream %u.\n", *stream);
+        return -1;
+    }
+    mux->wanted = *stream;
+    while (!mux_ready(mux, stream)) {
+        if (mux->failed || microtcp_recv_segments(mux->socket, &mux->segments, mux_segment, mux) == -1)
+            return -1;
+    }
+
+    ready = &mux->stream[*stream];
+    copied = mux_take(ready, buffer, length);
+    if (!copied && ready->fin && ready->recv_offset == ready->fin_offset)
+        ready->eof_reported = 1;
+    /* The space opens the window again */
+    if (copied && microtcp_rcv_release(mux->socket, copied) == -1)
+        return -1;
+    return copied;
+}
@@ -0,0 +1,119 @@
+/*
+ * microtcp, a lightweight implementation of TCP for teaching,
+ * and academic purposes.
+ *
+ * Copyright (C) 2015-2017  Manolis Surligas <surligas@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIB_MICROTCP_MUX_H_
+#define LIB_MICROTCP_MUX_H_
+
+#include "microtcp.h"
+
+/*
+ * Independent streams over one connection. Every segment carries one
+ * frame: an 8 byte sub-header with the stream ID, flags and the offset of
+ * the payload in its stream, followed by up to MICROTCP_MUX_FRAME_DATA
+ * bytes. The receiver orders each stream on its own and takes frames as
+ * they arrive, so a segment lost on one stream only holds back that
+ * stream.
+ *
+ * The sender queues frames per stream and microtcp_mux_flush() sends them
+ * in batches: streams of a lower urgency value go first, streams of the
+ * same urgency share the batch by weight in deficit round robin. A batch
+ * is one microtcp_send_records() call, so a frame queued later waits for
+ * at most the batch in flight.
+ *
+ * One thread uses a mux at a time. Received data is buffered until
+ * microtcp_mux_recv() takes it and counts against the receive window of
+ * the connection meanwhile, so all streams together hold at most the
+ * receive buffer. A reader waiting on one stream while the others fill
+ * the window waits for good; read with MICROTCP_MUX_ANY when the peer
+ * sends on several streams.
+ */
+
+#define MICROTCP_MUX_HEADER 8
+#define MICROTCP_MUX_FRAME_DATA (MICROTCP_MSS - MICROTCP_MUX_HEADER)
+#define MICROTCP_MUX_MAX_STREAMS 256
+#define MICROTCP_MUX_ANY 0xffff          /**< microtcp_mux_recv() from whichever stream is ready */
+#define MICROTCP_MUX_BATCH 64            /**< Frames per microtcp_send_records() call */
+#define MICROTCP_MUX_URGENCY 3           /**< Default urgency, 0 is the most urgent */
+#define MICROTCP_MUX_URGENCY_LEVELS 8
+#define MICROTCP_MUX_WEIGHT 16           /**< Default weight */
+#define MICROTCP_MUX_QUANTUM 256         /**< Bytes per round for each unit of weight */
+
+#define MICROTCP_MUX_FIN 0x01            /**< Last frame of the stream */
+
+typedef struct
+{
+    uint16_t stream;
+    uint8_t flags;
+    uint8_t reserved;
+    uint32_t offset;
+} microtcp_mux_header_t;
+
+typedef struct microtcp_mux microtcp_mux_t;
+
+/**
+ * @param socket an established connection without compression (see
+ *        microtcp_set_compress()), used only through the mux until
+ *        microtcp_mux_destroy()
+ * @return the mux, NULL on failure
+ */
+microtcp_mux_t* microtcp_mux_create(microtcp_sock_t* socket);
+
+/**
+ * Frees the mux and everything queued or buffered in it. The connection
+ * stays open.
+ */
+void microtcp_mux_destroy(microtcp_mux_t* mux);
+
+/**
+ * @param urgency 0 to MICROTCP_MUX_URGENCY_LEVELS - 1; queued frames of
+ *        a lower value always go first
+ * @param weight share of the stream among those of the same urgency,
+ *        at least 1
+ */
+int microtcp_mux_set_priority(microtcp_mux_t* mux, uint16_t stream, int urgency, int weight);
+
+/**
+ * Queues length bytes on a stream, sent by the next microtcp_mux_flush().
+ * @return length, -1 on failure or if the stream was closed
+ */
+ssize_t microtcp_mux_send(microtcp_mux_t* mux, uint16_t stream, const void* buffer, size_t length);
+
+/**
+ * Queues the end of a stream; the peer reads 0 from it after its data.
+ */
+int microtcp_mux_close_stream(microtcp_mux_t* mux, uint16_t stream);
+
+/**
+ * Sends every queued frame in priority order.
+ * @return 0 on success, -1 on failure
+ */
+int microtcp_mux_flush(microtcp_mux_t* mux);
+
+/**
+ * Receives from one stream, or with *stream set to MICROTCP_MUX_ANY from
+ * the first stream that has data or has ended, which is stored in
+ * *stream. Blocks until there is something to return.
+ *
+ * @return the bytes received, 0 at the end of the stream, -1 on failure
+ *         and once the peer shut down the connection
+ */
+ssize_t microtcp_mux_recv(microtcp_mux_t* mux, uint16_t* stream, void* buffer, size_t length);
+
+#endif /* LIB_MICROTCP_MUX_H_ */
@@ -0,0 +1,306 @@
+/*
+ * microtcp, a lightweight implementation of TCP for teaching,
+ * and academic purposes.
+ *
+ * Copyright (C) 2015-2017  Manolis Surligas <surligas@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "microtcp_pool.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct
+{
+    struct sockaddr_storage peer;
+    socklen_t peer_len;
+    uint64_t idle_since;
+    microtcp_sock_t socket;
+} microtcp_pool_entry_t;
+
+struct microtcp_pool
+{
+    char lock;
+    size_t max_idle;
+    size_t max_idle_per_peer;
+    uint64_t idle_timeout_us;
+    size_t count;
+    microtcp_pool_entry_t* entry;     /**< Oldest first */
+    microtcp_pool_stats_t stats;
+};
+
+static void pool_lock(microtcp_pool_t* pool)
+{
+    while (__atomic_test_and_set(&pool->lock, __ATOMIC_ACQUIRE))
+        ;
+}
+
+static void pool_unlock(microtcp_pool_t* pool)
+{
+    __atomic_clear(&pool->lock, __ATOMIC_RELEASE);
+}
+
+static int pool_established(const microtcp_sock_t* socket)
+{
+    return socket->state == ESTABLISHED || socket->state == ESTABLISHED_PEER
+        || socket->state == ESTABLISHED_HOST;
+}
+
+static int pool_same_peer(const struct sockaddr* a, socklen_t a_len,
+    const struct sockaddr* b, socklen_t b_len)
+{
+    const struct sockaddr_in* a4 = (const struct sockaddr_in*)a;
+    const struct sockaddr_in* b4 = (const struct sockaddr_in*)b;
+
+    if (a->sa_family != b->sa_family)
+        return 0;
+    /* sin_zero is whatever the caller left there */
+    if (a->sa_family == AF_INET)
+        return a4->sin_port == b4->sin_port && a4->sin_addr.s_addr == b4->sin_addr.s_addr;
+    return a_len == b_len && !memcmp(a, b, a_len);
+}
+
+static void pool_close(microtcp_sock_t* socket)
+{
+    if (pool_established(socket) || socket->state == CLOSING_BY_PEER)
+        microtcp_shutdown(socket, SHUT_RDWR);
+    microtcp_close(socket);
+}
+
+/*
+ * After more than an RTO without sending, the ACK clock that paced the
+ * old cwnd is gone. As RFC 5681 (4.1) asks, the cwnd goes back to the
+ * initial window; ssthresh keeps three quarters of it, as in RFC 2861,
+ * so slow start climbs back quickly.
+ */
+static void pool_restart_cwnd(microtcp_sock_t* socket, uint64_t idle_us)
+{
+    if (idle_us <= socket->rto || socket->cwnd <= MICROTCP_INIT_CWND)
+        return;
+    if (socket->ssthresh < socket->cwnd / 4 * 3)
+        socket->ssthresh = socket->cwnd / 4 * 3;
+    microtcp_set_cwnd(socket, MICROTCP_INIT_CWND);
+}
+
+/*
+ * Drains what arrived while the socket sat in the pool. Retransmissions of
+ * the last response mean our final ACK was lost, so it is sent again;
+ * anything else but a FIN or RST is stale and dropped.
+ */
+static int pool_alive(microtcp_sock_t* socket)
+{
+    uint8_t buffer[sizeof(microtcp_header_t) + MICROTCP_MSS];
+    microtcp_header_t header;
+    char* data;
+    ssize_t len;
+
+    if (!pool_established(socket) || socket->buf_fill_level
+        || socket->inflate_head < socket->inflate_fill)
+        return 0;
+    for (;;) {
+        len = microtcp_sock_recv(socket, buffer, sizeof(buffer), MSG_DONTWAIT);
+        if (len == -1)
+            return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+        if ((size_t)len < sizeof(microtcp_header_t)
+            || (size_t)len != sizeof(microtcp_header_t) + ntohl(((microtcp_header_t*)buffer)->data_len)
+            || !microtcp_unpack(buffer, &header, &data))
+            continue;
+        free(data);
+        if (check_control(&header, 1, 0, 0, 1) && header.seq_number == socket->ack_number) {
+            socket->ack_number++;
+            microtcp_set_state(socket, CLOSING_BY_PEER);
+            return 0;
+        }
+        if (check_control(&header, 0, 1, 0, 0)) {
+            microtcp_set_state(socket, INVALID);
+            return 0;
+        }
+        if (check_control(&header, 0, 0, 0, 0) && send_ack(socket) == -1)
+            return 0;
+    }
+}
+
+microtcp_pool_t* microtcp_pool_create(size_t max_idle, size_t max_idle_per_peer,
+    uint64_t idle_timeout_us)
+{
+    microtcp_pool_t* pool;
+
+    if (!max_idle)
+        return NULL;
+    pool = calloc(1, sizeof(microtcp_pool_t));
+    if (!pool)
+        return NULL;
+    pool->entry = calloc(max_idle, sizeof(microtcp_pool_entry_t));
+    if (!pool->entry) {
+        free(pool);
+        return NULL;
+    }
+    pool->max_idle = max_idle;
+    pool->max_idle_per_peer = max_idle_per_peer ? max_idle_per_peer : max_idle;
+    pool->idle_timeout_us = idle_timeout_us ? idle_timeout_us : MICROTCP_POOL_IDLE_US;
+    return pool;
+}
+
+/*
+ * Moves the expired entries out of the pool, keeping the order of the
+ * rest. Returns how many went to out.
+ */
+static size_t pool_take_expired(microtcp_pool_t* pool, microtcp_sock_t* out, uint64_t now)
+{
+    size_t i, kept = 0, taken = 0;
+
+    for (i = 0; i < pool->count; i++) {
+        if (now - pool->entry[i].idle_since >= pool->idle_timeout_us)
+            out[taken++] = pool->entry[i].socket;
+        else
+            pool->entry[kept++] = pool->entry[i];
+    }
+    pool->count = kept;
+    pool->stats.expired += taken;
+    return taken;
+}
+
+void microtcp_pool_expire(microtcp_pool_t* pool)
+{
+    microtcp_sock_t* expired;
+    size_t i, n;
+
+    expired = malloc(pool->max_idle * sizeof(microtcp_sock_t));
+    if (!expired)
+        return;
+    pool_lock(pool);
+    n = pool_take_expired(pool, expired, microtcp_now_us());
+    for (i = 0; i < pool->count; i++)
+        microtcp_rcvbuf_idle(&pool->entry[i].socket);
+    pool_unlock(pool);
+
+    /* The FIN exchange blocks, so it runs outside the lock */
+    for (i = 0; i < n; i++)
+        pool_close(&expired[i]);
+    free(expired);
+}
+
+int microtcp_pool_get(microtcp_pool_t* pool, microtcp_sock_t* socket,
+    const struct sockaddr* address, socklen_t address_len)
+{
+    microtcp_pool_entry_t* entry;
+    uint64_t idle_since = 0;
+    size_t i;
+    int found, alive;
+
+    microtcp_pool_expire(pool);
+    do {
+        found = 0;
+        pool_lock(pool);
+        /* Newest first, its state is the most recent and the oldest ones get to expire */
+        for (i = pool->count; i-- > 0;) {
+            entry = &pool->entry[i];
+            if (pool_same_peer((struct sockaddr*)&entry->peer, entry->peer_len, address, address_len)) {
+                *socket = entry->socket;
+                idle_since = entry->idle_since;
+                memmove(entry, entry + 1, (pool->count - i - 1) * sizeof(microtcp_pool_entry_t));
+                pool->count--;
+                found = 1;
+                break;
+            }
+        }
+        pool_unlock(pool);
+
+        if (found) {
+            alive = pool_alive(socket);
+            pool_lock(pool);
+            if (alive)
+                pool->stats.hits++;
+            else
+                pool->stats.broken++;
+            pool_unlock(pool);
+            if (alive) {
+                pool_restart_cwnd(socket, microtcp_now_us() - idle_since);
+                return 1;
+            }
+            pool_close(socket);
+        }
+    } while (found);
+
+    pool_lock(pool);
+    pool->stats.misses++;
+    pool_unlock(pool);
+    *socket = microtcp_socket(address->sa_family, SOCK_DGRAM, IPPROTO_UDP);
+    if (socket->state == INVALID)
+        return -1;
+    if (microtcp_connect(socket, address, address_len) == -1) {
+        microtcp_close(socket);
+        return -1;
+    }
+    return 0;
+}
+
+int microtcp_pool_put(microtcp_pool_t* pool, microtcp_sock_t* socket)
+{
+    microtcp_pool_entry_t* entry;
+    struct sockaddr_storage peer;
+    socklen_t peer_len = sizeof(peer);
+    size_t i, same = 0;
+
+    /* Expired sockets would hold places a live one can take */
+    microtcp_pool_expire(pool);
+    if (!pool_established(socket) || socket->buf_fill_level
+        || socket->inflate_head < socket->inflate_fill || socket->inflate_pos < socket->inflate_len
+        || socket->inflate_stored
+        || socket->transport->getpeername(socket->transport->ctx, socket->sd,
+            (struct sockaddr*)&peer, &peer_len) == -1) {
+        pool_close(socket);
+        return 1;
+    }
+
+    pool_lock(pool);
+    for (i = 0; i < pool->count; i++)
+        same += pool_same_peer((struct sockaddr*)&pool->entry[i].peer, pool->entry[i].peer_len,
+            (struct sockaddr*)&peer, peer_len);
+    if (pool->count == pool->max_idle || same >= pool->max_idle_per_peer) {
+        pool->stats.overflow++;
+        pool_unlock(pool);
+        pool_close(socket);
+        return 1;
+    }
+    entry = &pool->entry[pool->count++];
+    entry->peer = peer;
+    entry->peer_len = peer_len;
+    entry->idle_since = microtcp_now_us();
+    entry->socket = *socket;
+    pool_unlock(pool);
+    return 0;
+}
+
+void microtcp_pool_get_stats(microtcp_pool_t* pool, microtcp_pool_stats_t* stats)
+{
+    pool_lock(pool);
+    *stats = pool->stats;
+    stats->idle = pool->count;
+    pool_unlock(pool);
+}
+
+void microtcp_pool_destroy(microtcp_pool_t* pool)
+{
+    size_t i;
+
+    if (!pool)
+        return;
+    for (i = 0; i < pool->count; i++)
+        pool_close(&pool->entry[i].socket);
+    FREE(pool->entry, pool);
+}
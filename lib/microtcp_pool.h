@@ -0,0 +1,100 @@
+/*
+ * microtcp, a lightweight implementation of TCP for teaching,
+ * and academic purposes.
+ *
+ * Copyright (C) 2015-2017  Manolis Surligas <surligas@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIB_MICROTCP_POOL_H_
+#define LIB_MICROTCP_POOL_H_
+
+#include "microtcp.h"
+
+/*
+ * Client side pool of idle connections, keyed by peer address. A socket
+ * taken with microtcp_pool_get() and handed back with microtcp_pool_put()
+ * stays established, so the next request to the same peer skips the
+ * handshake and starts with the cwnd, ssthresh and RTT estimate the last
+ * one left behind. A socket idle for longer than its RTO restarts from
+ * the initial cwnd (RFC 5681, 4.1), the old one no longer fits the path.
+ *
+ * Before a pooled socket is handed out, the datagrams queued on it while
+ * idle are drained without blocking: a FIN or RST from the peer, or an
+ * ICMP error on the UDP socket, retire it. Sockets idle for longer than
+ * the idle timeout are shut down the next time the pool is used.
+ *
+ * A pool may be shared by threads, a socket belongs to one thread at a
+ * time between get and put.
+ */
+
+#define MICROTCP_POOL_IDLE_US 30000000   /**< Default idle timeout */
+
+typedef struct microtcp_pool microtcp_pool_t;
+
+typedef struct
+{
+    uint64_t hits;                /**< microtcp_pool_get() served by an idle socket */
+    uint64_t misses;              /**< microtcp_pool_get() that had to connect */
+    uint64_t expired;             /**< Idle sockets shut down by the timeout */
+    uint64_t broken;              /**< Idle sockets the peer closed or reset */
+    uint64_t overflow;            /**< microtcp_pool_put() that found the pool full */
+    uint32_t idle;                /**< Sockets in the pool right now */
+} microtcp_pool_stats_t;
+
+/**
+ * @param max_idle idle sockets the pool holds at most
+ * @param max_idle_per_peer idle sockets per peer address, 0 for no limit
+ * @param idle_timeout_us idle time after which a socket is shut down,
+ *        0 for MICROTCP_POOL_IDLE_US
+ * @return the pool, NULL on failure
+ */
+microtcp_pool_t* microtcp_pool_create(size_t max_idle, size_t max_idle_per_peer,
+    uint64_t idle_timeout_us);
+
+/**
+ * Hands out an established connection to address: the most recently
+ * returned healthy one, or a new one from microtcp_connect().
+ *
+ * @return 1 if the socket came from the pool, 0 if it was just connected,
+ *         -1 on failure
+ */
+int microtcp_pool_get(microtcp_pool_t* pool, microtcp_sock_t* socket,
+    const struct sockaddr* address, socklen_t address_len);
+
+/**
+ * Returns a socket to the pool after a complete request. Sockets that are
+ * not established, hold unread data, or do not fit in the pool are shut
+ * down and closed instead; either way the caller must not use it again.
+ *
+ * @return 0 if pooled, 1 if closed
+ */
+int microtcp_pool_put(microtcp_pool_t* pool, microtcp_sock_t* socket);
+
+/**
+ * Shuts down the sockets idle for longer than the timeout. Called by
+ * microtcp_pool_get() and microtcp_pool_put(), and by the application if
+ * it wants idle sockets gone while it does not use the pool.
+ */
+void microtcp_pool_expire(microtcp_pool_t* pool);
+
+void microtcp_pool_get_stats(microtcp_pool_t* pool, microtcp_pool_stats_t* stats);
+
+/**
+ * Shuts down all idle sockets and frees the pool.
+ */
+void microtcp_pool_destroy(microtcp_pool_t* pool);
+
+#endif /* LIB_MICROTCP_POOL_H_ */
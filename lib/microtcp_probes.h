@@ -0,0 +1,58 @@
+/*
+ * microtcp, a lightweight implementation of TCP for teaching,
+ * and academic purposes.
+ *
+ * Copyright (C) 2015-2017  Manolis Surligas <surligas@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIB_MICROTCP_PROBES_H_
+#define LIB_MICROTCP_PROBES_H_
+
+/*
+ * USDT (SystemTap/DTrace compatible) static probes of the "microtcp"
+ * provider. A probe compiles to a single nop plus an ELF note, so it
+ * costs nothing until bpftrace, perf or stap attach to it.
+ *
+ * Probe                  Arguments
+ * segment__sent          sd, seq, payload length, cwnd
+ * segment__recv          sd, seq, payload length, ack
+ * ack__processed         sd, ack, window, cwnd
+ * dup__ack               sd, ack, duplicate count
+ * retransmit             sd, seq, ssthresh
+ * cwnd__change           sd, old cwnd, new cwnd, ssthresh
+ * window__zero__enter    sd, seq
+ * window__zero__exit     sd, window, microseconds spent at zero
+ * state__change          sd, old state, new state
+ *
+ * Enabled with the MICROTCP_USDT CMake option, which needs <sys/sdt.h>.
+ */
+
+#ifndef MICROTCP_ENABLE_USDT
+#define MICROTCP_ENABLE_USDT 0
+#endif
+
+#if MICROTCP_ENABLE_USDT
+#include <sys/sdt.h>
+#define MICROTCP_PROBE2(name, a, b) DTRACE_PROBE2(microtcp, name, a, b)
+#define MICROTCP_PROBE3(name, a, b, c) DTRACE_PROBE3(microtcp, name, a, b, c)
+#define MICROTCP_PROBE4(name, a, b, c, d) DTRACE_PROBE4(microtcp, name, a, b, c, d)
+#else
+#define MICROTCP_PROBE2(name, a, b) do { } while (0)
+#define MICROTCP_PROBE3(name, a, b, c) do { } while (0)
+#define MICROTCP_PROBE4(name, a, b, c, d) do { } while (0)
+#endif
+
+#endif /* LIB_MICROTCP_PROBES_H_ */
@@ -0,0 +1,183 @@
+/*
+ * microtcp, a lightweight implementation of TCP for teaching,
+ * and academic purposes.
+ *
+ * Copyright (C) 2015-2017  Manolis Surligas <surligas@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "microtcp_stat.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+static microtcp_stat_region_t* region;
+static int region_tried;
+static char region_lock;
+static char region_name[64];
+
+static void stat_unlink_at_exit(void)
+{
+    shm_unlink(region_name);
+}
+
+static int stat_create(void)
+{
+    microtcp_stat_region_t* mapped;
+    int fd;
+
+    snprintf(region_name, sizeof(region_name), "/" MICROTCP_STAT_PREFIX "%d", (int)getpid());
+    fd = shm_open(region_name, O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if (fd == -1) {
+        fprintf(stderr, "Error: Unable to create the statistics region. %s\n", strerror(errno));
+        return -1;
+    }
+    if (ftruncate(fd, MICROTCP_STAT_REGION_SIZE) == -1
+        || (mapped = mmap(NULL, MICROTCP_STAT_REGION_SIZE, PROT_READ | PROT_WRITE,
+            MAP_SHARED, fd, 0)) == MAP_FAILED) {
+        fprintf(stderr, "Error: Unable to map the statistics region. %s\n", strerror(errno));
+        close(fd);
+        shm_unlink(region_name);
+        return -1;
+    }
+    close(fd);
+    mapped->slot_size = sizeof(microtcp_stat_slot_t);
+    mapped->slots = MICROTCP_STAT_SLOTS;
+    mapped->pid = getpid();
+    memcpy(mapped->magic, MICROTCP_STAT_MAGIC, sizeof(mapped->magic));
+    __atomic_store_n(&region, mapped, __ATOMIC_RELEASE);
+    atexit(stat_unlink_at_exit);
+    return 0;
+}
+
+int microtcp_stat_enable(void)
+{
+    int ret = 0;
+
+    if (__atomic_load_n(&region, __ATOMIC_ACQUIRE))
+        return 0;
+    while (__atomic_test_and_set(&region_lock, __ATOMIC_ACQUIRE))
+        ;
+    if (!region)
+        ret = stat_create();
+    __atomic_clear(&region_lock, __ATOMIC_RELEASE);
+    return ret;
+}
+
+static microtcp_stat_region_t* stat_region(void)
+{
+    if (!__atomic_load_n(&region_tried, __ATOMIC_ACQUIRE)) {
+        if (getenv("MICROTCP_STAT"))
+            microtcp_stat_enable();
+        __atomic_store_n(&region_tried, 1, __ATOMIC_RELEASE);
+    }
+    return __atomic_load_n(&region, __ATOMIC_ACQUIRE);
+}
+
+void microtcp_stat_attach(microtcp_sock_t* socket)
+{
+    microtcp_stat_region_t* r = stat_region();
+    microtcp_stat_slot_t* slot;
+    socklen_t len;
+    uint32_t i;
+
+    if (!r || socket->stat)
+        return;
+    for (i = 0; i < r->slots; i++) {
+        slot = &r->slot[i];
+        if (!__atomic_exchange_n(&slot->in_use, 1, __ATOMIC_ACQUIRE))
+            break;
+    }
+    if (i == r->slots)
+        return;
+
+    __atomic_store_n(&slot->seq, slot->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    slot->sd = socket->sd;
+    len = sizeof(slot->local);
+    if (socket->transport->getsockname(socket->transport->ctx, socket->sd,
+        (struct sockaddr*)&slot->local, &len) == -1)
+        memset(&slot->local, 0, sizeof(slot->local));
+    len = sizeof(slot->peer);
+    if (socket->transport->getpeername(socket->transport->ctx, socket->sd,
+        (struct sockaddr*)&slot->peer, &len) == -1)
+        memset(&slot->peer, 0, sizeof(slot->peer));
+    slot->send_rate = slot->recv_rate = 0;
+    slot->rate_stamp = 0;
+    __atomic_store_n(&slot->seq, slot->seq + 1, __ATOMIC_RELEASE);
+
+    socket->stat = slot;
+    microtcp_stat_publish(socket);
+}
+
+void microtcp_stat_detach(microtcp_sock_t* socket)
+{
+    if (!socket->stat)
+        return;
+    microtcp_stat_publish(socket);
+    __atomic_store_n(&socket->stat->in_use, 0, __ATOMIC_RELEASE);
+    socket->stat = NULL;
+}
+
+void microtcp_stat_publish(microtcp_sock_t* socket)
+{
+    microtcp_stat_slot_t* slot = socket->stat;
+    microtcp_info_t info;
+    uint64_t now;
+
+    if (!slot)
+        return;
+    microtcp_get_info(socket, &info, sizeof(info));
+    now = microtcp_now_us();
+
+    __atomic_store_n(&slot->seq, slot->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    slot->info = info;
+    slot->updated_us = now;
+    if (!slot->rate_stamp) {
+        slot->rate_stamp = now;
+        slot->rate_bytes_sent = info.bytes_sent;
+        slot->rate_bytes_received = info.bytes_received;
+    }
+    else if (now - slot->rate_stamp >= MICROTCP_STAT_RATE_US) {
+        slot->send_rate = (info.bytes_sent - slot->rate_bytes_sent) * 1000000 / (now - slot->rate_stamp);
+        slot->recv_rate = (info.bytes_received - slot->rate_bytes_received) * 1000000 / (now - slot->rate_stamp);
+        slot->rate_stamp = now;
+        slot->rate_bytes_sent = info.bytes_sent;
+        slot->rate_bytes_received = info.bytes_received;
+    }
+    __atomic_store_n(&slot->seq, slot->seq + 1, __ATOMIC_RELEASE);
+}
+
+int microtcp_stat_read(const microtcp_stat_slot_t* slot, microtcp_stat_slot_t* copy)
+{
+    uint32_t seq;
+    int tries;
+
+    for (tries = 0; tries < MICROTCP_STAT_READ_TRIES; tries++) {
+        if ((seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE)) & 1)
+            continue;
+        memcpy(copy, slot, sizeof(*copy));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == seq)
+            return 0;
+    }
+    return -1;
+}
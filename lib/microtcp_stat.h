@@ -0,0 +1,108 @@
+/*
+ * microtcp, a lightweight implementation of TCP for teaching,
+ * and academic purposes.
+ *
+ * Copyright (C) 2015-2017  Manolis Surligas <surligas@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef LIB_MICROTCP_STAT_H_
+#define LIB_MICROTCP_STAT_H_
+
+#include "microtcp.h"
+
+/*
+ * Live connection statistics in shared memory. A process that sets the
+ * MICROTCP_STAT environment variable (or calls microtcp_stat_enable())
+ * publishes every established connection in the POSIX shared memory
+ * object /microtcp-stat.<pid>, where microtcp-stat finds it.
+ *
+ * Each slot is protected by a seqlock: the owning thread bumps seq to an
+ * odd value, writes, and bumps it back to even. Readers retry while seq
+ * is odd or changed under them, so the data path never waits for them.
+ */
+
+#define MICROTCP_STAT_MAGIC "MTCPSTA1"
+#define MICROTCP_STAT_PREFIX "microtcp-stat."   /**< Followed by the pid */
+#define MICROTCP_STAT_SLOTS 256                 /**< Connections per process */
+#define MICROTCP_STAT_RATE_US 250000            /**< Rate measurement interval */
+#define MICROTCP_STAT_READ_TRIES 100000         /**< Reader spins before it gives up on a slot */
+
+typedef struct microtcp_stat_slot
+{
+    uint32_t seq;                 /**< Seqlock sequence, odd while written */
+    uint32_t in_use;
+    int32_t sd;
+    uint32_t pad;
+    struct sockaddr_in local;
+    struct sockaddr_in peer;
+    uint64_t updated_us;          /**< CLOCK_MONOTONIC of the last update */
+    uint64_t send_rate;           /**< Payload bytes per second, last interval */
+    uint64_t recv_rate;
+    microtcp_info_t info;
+
+    /* Private to the writer */
+    uint64_t rate_stamp;
+    uint64_t rate_bytes_sent;
+    uint64_t rate_bytes_received;
+} microtcp_stat_slot_t;
+
+typedef struct
+{
+    char magic[8];
+    uint32_t slot_size;           /**< sizeof(microtcp_stat_slot_t) of the writer */
+    uint32_t slots;
+    int32_t pid;
+    uint32_t pad;
+    microtcp_stat_slot_t slot[];
+} microtcp_stat_region_t;
+
+#define MICROTCP_STAT_REGION_SIZE \
+        (sizeof(microtcp_stat_region_t) + MICROTCP_STAT_SLOTS * sizeof(microtcp_stat_slot_t))
+
+/**
+ * Creates the shared memory region of this process, if not there yet.
+ *
+ * @return 0 on success, -1 on failure
+ */
+int microtcp_stat_enable(void);
+
+/**
+ * Takes a slot for an established connection. Does nothing unless
+ * publishing is enabled.
+ */
+void microtcp_stat_attach(microtcp_sock_t* socket);
+
+/**
+ * Releases the slot of a connection.
+ */
+void microtcp_stat_detach(microtcp_sock_t* socket);
+
+/**
+ * Copies the current statistics of the connection into its slot.
+ */
+void microtcp_stat_publish(microtcp_sock_t* socket);
+
+/**
+ * Consistent copy of a slot, for readers of a mapped region.
+ *
+ * @return 0 on success, -1 if the slot stayed busy for
+ *         MICROTCP_STAT_READ_TRIES attempts, as when its writer died in
+ *         the middle of an update
+ */
+int microtcp_stat_read(const microtcp_stat_slot_t* slot, microtcp_stat_slot_t* copy);
+
+#endif /* LIB_MICROTCP_STAT_H_ */
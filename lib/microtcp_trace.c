@@ -0,0 +1,150 @@
+/*
+ * microtcp, a lightweight implementation of TCP for teaching,
+ * and academic purposes.
+ *
+ * Copyright (C) 2015-2017  Manolis Surligas <surligas@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "microtcp_trace.h"
+#include "microtcp.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+typedef struct microtcp_trace_ring
+{
+    uint64_t head;                /**< Records written so far */
+    uint64_t tid;
+    struct microtcp_trace_ring* next;
+    microtcp_trace_record_t records[MICROTCP_TRACE_RING_LEN];
+} microtcp_trace_ring_t;
+
+int microtcp_trace_level = MICROTCP_TRACE_OFF;
+
+static __thread microtcp_trace_ring_t* thread_ring;
+static microtcp_trace_ring_t* rings;
+
+static const char* event_names[MICROTCP_EV_MAX] = {
+    "SEGMENT_SENT", "SEGMENT_RECV", "ACK_SENT", "ACK_RECV", "FLIGHT_START",
+    "FLIGHT_ACK", "FINAL_ACK", "DUP_ACK", "FAST_RETRANSMIT", "TIMEOUT", "CWND",
+    "BAD_CHECKSUM", "IN_ORDER", "OUT_OF_ORDER", "REASSEMBLED", "WINDOW_PROBE",
+    "WINDOW_UPDATE", "DELIVER", "RCVBUF_RESIZE"
+};
+
+/* MICROTCP_TRACE_FILE may contain %p, replaced by the process id */
+static void trace_dump_at_exit(void)
+{
+    const char* pattern = getenv("MICROTCP_TRACE_FILE");
+    const char* pid_mark = strstr(pattern, "%p");
+    char path[4096];
+
+    if (pid_mark)
+        snprintf(path, sizeof(path), "%.*s%d%s", (int)(pid_mark - pattern),
+            pattern, (int)getpid(), pid_mark + 2);
+    else
+        snprintf(path, sizeof(path), "%s", pattern);
+    microtcp_trace_dump(path);
+}
+
+__attribute__((constructor))
+static void trace_init(void)
+{
+    const char* level = getenv("MICROTCP_TRACE_LEVEL");
+    if (level)
+        microtcp_trace_level = atoi(level);
+    if (getenv("MICROTCP_TRACE_FILE"))
+        atexit(trace_dump_at_exit);
+}
+
+static microtcp_trace_ring_t* trace_ring_create(void)
+{
+    microtcp_trace_ring_t* ring = calloc(1, sizeof(microtcp_trace_ring_t));
+    if (!ring)
+        return NULL;
+    ring->tid = syscall(SYS_gettid);
+    /* Lock-free push, rings live until the process exits */
+    ring->next = __atomic_load_n(&rings, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&rings, &ring->next, ring, 0,
+        __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        ;
+    return ring;
+}
+
+void microtcp_trace_record(int level, int event, int sd, uint32_t seq,
+    uint32_t ack, uint32_t cwnd, uint32_t arg)
+{
+    microtcp_trace_record_t* r;
+
+    if (!thread_ring && !(thread_ring = trace_ring_create()))
+        return;
+    r = &thread_ring->records[thread_ring->head & (MICROTCP_TRACE_RING_LEN - 1)];
+    r->timestamp_ns = microtcp_now_ns();
+    r->sd = sd;
+    r->event = event;
+    r->level = level;
+    r->seq = seq;
+    r->ack = ack;
+    r->cwnd = cwnd;
+    r->arg = arg;
+    __atomic_store_n(&thread_ring->head, thread_ring->head + 1, __ATOMIC_RELEASE);
+}
+
+void microtcp_trace_set_level(int level)
+{
+    microtcp_trace_level = level;
+}
+
+int microtcp_trace_dump(const char* path)
+{
+    FILE* fp;
+    microtcp_trace_ring_t* ring;
+    microtcp_trace_chunk_t chunk;
+    uint32_t record_size = sizeof(microtcp_trace_record_t);
+    uint64_t first;
+    uint64_t i;
+
+    if (!path || !(fp = fopen(path, "w"))) {
+        fprintf(stderr, "Error: Unable to open trace file.\n");
+        return -1;
+    }
+    fwrite(MICROTCP_TRACE_MAGIC, 1, strlen(MICROTCP_TRACE_MAGIC), fp);
+    fwrite(&record_size, sizeof(record_size), 1, fp);
+    for (ring = __atomic_load_n(&rings, __ATOMIC_ACQUIRE); ring; ring = ring->next) {
+        chunk.tid = ring->tid;
+        chunk.count = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        first = chunk.count > MICROTCP_TRACE_RING_LEN ? chunk.count - MICROTCP_TRACE_RING_LEN : 0;
+        chunk.dropped = first;
+        chunk.count -= first;
+        fwrite(&chunk, sizeof(chunk), 1, fp);
+        for (i = first; i < first + chunk.count; i++)
+            fwrite(&ring->records[i & (MICROTCP_TRACE_RING_LEN - 1)], record_size, 1, fp);
+    }
+    if (fclose(fp)) {
+        fprintf(stderr, "Error: Unable to write trace file.\n");
+        return -1;
+    }
+    return 0;
+}
+
+const char* microtcp_trace_event_name(int event)
+{
+    if (event < 0 || event >= MICROTCP_EV_MAX)
+        return "UNKNOWN";
+    return event_names[event];
+}
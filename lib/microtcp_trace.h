@@ -0,0 +1,130 @@
+/*
+ * microtcp, a lightweight implementation of TCP for teaching,
+ * and academic purposes.
+ *
+ * Copyright (C) 2015-2017  Manolis Surligas <surligas@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIB_MICROTCP_TRACE_H_
+#define LIB_MICROTCP_TRACE_H_
+
+#include <stdint.h>
+
+/*
+ * Binary event tracer of the protocol hot paths. Every event is a fixed
+ * size record appended to a ring buffer owned by the calling thread, so
+ * recording takes no lock and no system call. The rings are written to a
+ * file with microtcp_trace_dump() (or at exit, if MICROTCP_TRACE_FILE is
+ * set; a %p in it becomes the process id) and rendered as text by the
+ * microtcp-trace tool.
+ *
+ * Tracing is filtered at runtime by microtcp_trace_level, which starts
+ * from the MICROTCP_TRACE_LEVEL environment variable and defaults to off.
+ */
+
+/* Set to 0 to compile the tracer out of the library */
+#ifndef MICROTCP_ENABLE_TRACE
+#define MICROTCP_ENABLE_TRACE 1
+#endif
+
+#define MICROTCP_TRACE_MAGIC "MTCPTRC1"
+#define MICROTCP_TRACE_RING_LEN 4096     /**< Records per thread, power of two */
+
+typedef enum
+{
+    MICROTCP_TRACE_OFF = 0,
+    MICROTCP_TRACE_ERROR,
+    MICROTCP_TRACE_INFO,
+    MICROTCP_TRACE_DEBUG
+} microtcp_trace_level_t;
+
+typedef enum
+{
+    MICROTCP_EV_SEGMENT_SENT = 0,     /**< arg: payload length */
+    MICROTCP_EV_SEGMENT_RECV,         /**< arg: payload length */
+    MICROTCP_EV_ACK_SENT,             /**< arg: advertised window */
+    MICROTCP_EV_ACK_RECV,             /**< arg: advertised window */
+    MICROTCP_EV_FLIGHT_START,         /**< arg: control limit of the flight */
+    MICROTCP_EV_FLIGHT_ACK,           /**< arg: bytes acknowledged */
+    MICROTCP_EV_FINAL_ACK,            /**< arg: message length */
+    MICROTCP_EV_DUP_ACK,              /**< arg: duplicate count */
+    MICROTCP_EV_FAST_RETRANSMIT,      /**< arg: new ssthresh */
+    MICROTCP_EV_TIMEOUT,              /**< arg: timeout in us */
+    MICROTCP_EV_CWND,                 /**< arg: 1 in slow start */
+    MICROTCP_EV_BAD_CHECKSUM,         /**< arg: datagram length */
+    MICROTCP_EV_IN_ORDER,             /**< arg: payload length */
+    MICROTCP_EV_OUT_OF_ORDER,         /**< arg: data offset */
+    MICROTCP_EV_REASSEMBLED,          /**< arg: payload length */
+    MICROTCP_EV_WINDOW_PROBE,         /**< arg: persist timeout in us */
+    MICROTCP_EV_WINDOW_UPDATE,        /**< arg: advertised window */
+    MICROTCP_EV_DELIVER,              /**< arg: bytes copied to the application */
+    MICROTCP_EV_RCVBUF_RESIZE,        /**< arg: new receive buffer size */
+    MICROTCP_EV_MAX
+} microtcp_trace_event_t;
+
+/**
+ * One trace record, 32 bytes on disk and in memory.
+ */
+typedef struct
+{
+    uint64_t timestamp_ns;        /**< microtcp_now_ns(), CLOCK_MONOTONIC unless replaced */
+    int32_t sd;                   /**< UDP descriptor of the socket */
+    uint16_t event;               /**< microtcp_trace_event_t */
+    uint16_t level;               /**< microtcp_trace_level_t */
+    uint32_t seq;
+    uint32_t ack;
+    uint32_t cwnd;
+    uint32_t arg;                 /**< Event specific, see microtcp_trace_event_t */
+} microtcp_trace_record_t;
+
+/**
+ * Header preceding the records of one thread in a dump file.
+ */
+typedef struct
+{
+    uint64_t tid;
+    uint64_t count;               /**< Records that follow, oldest first */
+    uint64_t dropped;             /**< Records overwritten before the dump */
+} microtcp_trace_chunk_t;
+
+extern int microtcp_trace_level;
+
+void microtcp_trace_record(int level, int event, int sd, uint32_t seq,
+    uint32_t ack, uint32_t cwnd, uint32_t arg);
+
+void microtcp_trace_set_level(int level);
+
+/**
+ * Writes the rings of all threads to path.
+ *
+ * @return 0 on success, -1 on failure
+ */
+int microtcp_trace_dump(const char* path);
+
+const char* microtcp_trace_event_name(int event);
+
+#if MICROTCP_ENABLE_TRACE
+#define MICROTCP_TRACE(level, event, sock, seq, ack, arg)                       \
+        do {                                                                    \
+            if ((level) <= microtcp_trace_level)                                \
+                microtcp_trace_record((level), (event), (sock)->sd, (seq),      \
+                    (ack), (sock)->cwnd, (arg));                                \
+        } while (0)
+#else
+#define MICROTCP_TRACE(level, event, sock, seq, ack, arg) do { } while (0)
+#endif
+
+#endif /* LIB_MICROTCP_TRACE_H_ */
@@ -33,17 +33,34 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <limits.h>
+#include <math.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
 
 #include "../lib/microtcp.h"
+#include "netem.h"
 
 #define CHUNK_SIZE 4096
 
+#define BENCH_MAX_VALUES 16          /* Entries of the -z and -c lists */
+#define BENCH_SERVER_WAIT_US 200000  /* Time given to the server to bind */
+#define BENCH_TIMEOUT_S 120          /* A hung transfer is killed after this */
+
+/* Size of the application reads and writes, 0 for the default of each path */
+static size_t chunk_size;
+/* microTCP moves the file with microtcp_sendfile() and microtcp_recvfile() */
+static int zero_copy;
+/* Duration of the last transfer measured by a server */
+static double last_transfer_time;
+
 static inline void
 print_statistics (ssize_t received, struct timespec start, struct timespec end)
 {
   double elapsed = end.tv_sec - start.tv_sec
       + (end.tv_nsec - start.tv_nsec) * 1e-9;
   double megabytes = received / (1024.0 * 1024.0);
+  last_transfer_time = elapsed;
   printf ("Data received: %f MB\n", megabytes);
   printf ("Transfer time: %f seconds\n", elapsed);
   printf ("Throughput achieved: %f MB/s\n", megabytes / elapsed);
@@ -67,7 +84,9 @@ server_tcp (uint16_t listen_port, const char *file)
   struct timespec end_time;
 
   /* Allocate memory for the application receive buffer */
-  buffer = (uint8_t *) malloc (CHUNK_SIZE);
+  size_t chunk = chunk_size ? chunk_size : CHUNK_SIZE;
+
+  buffer = (uint8_t *) malloc (chunk);
   if (!buffer) {
     perror ("Allocate application receive buffer");
     return -EXIT_FAILURE;
@@ -129,7 +148,7 @@ server_tcp (uint16_t listen_port, const char *file)
    */
 
   clock_gettime (CLOCK_MONOTONIC_RAW, &start_time);
-  while ((received = recv (accepted, buffer, CHUNK_SIZE, 0)) > 0) {
+  while ((received = recv (accepted, buffer, chunk, 0)) > 0) {
     written = fwrite (buffer, sizeof(uint8_t), received, fp);
     total_bytes += received;
     if (written * sizeof(uint8_t) != received) {
@@ -163,13 +182,15 @@ server_microtcp (uint16_t listen_port, const char *file)
   microtcp_sock_t sock;
   struct sockaddr client_addr;
   struct sockaddr server_addr;
-  int data_size;
+  ssize_t data_size;
   FILE *fp;
   void *buffer;
   int written;
   struct timespec start_time;
   struct timespec end_time;
   ssize_t total_bytes = 0;
+  size_t chunk = chunk_size ? chunk_size : MICROTCP_RECVBUF_LEN;
+  microtcp_info_t info;
 
   fp = fopen (file, "w");
   if (!fp) {
@@ -195,12 +216,33 @@ server_microtcp (uint16_t listen_port, const char *file)
   }
   printf("Connection Found and Established\n");
   printf("Receiving data..\n");
-  buffer = malloc(sizeof(uint8_t)*(MICROTCP_RECVBUF_LEN));
+  buffer = malloc(sizeof(uint8_t)*chunk);
 
   clock_gettime (CLOCK_MONOTONIC_RAW, &start_time);
-  while (1) 
+  while (zero_copy) {
+    data_size = microtcp_recvfile (&sock, fileno (fp), total_bytes, SIZE_MAX);
+    if (data_size == -1 && sock.state == INVALID) {
+      free(buffer);
+      fclose(fp);
+      close(sock.sd);
+      return server_microtcp(listen_port, file);
+    }
+    if (data_size == -1) {
+      fprintf(stderr, "Error: Unable to receive data: %s\n", strerror(errno));
+      free(buffer);
+      close(sock.sd);
+      fclose(fp);
+      return EXIT_FAILURE;
+    }
+    if (data_size == 0) {
+      free(buffer);
+      break;
+    }
+    total_bytes += data_size;
+  }
+  while (!zero_copy) 
   {
-    data_size = microtcp_recv (&sock, buffer, MICROTCP_RECVBUF_LEN, 0);
+    data_size = microtcp_recv (&sock, buffer, chunk, 0);
     if(data_size == -1 && sock.state == CLOSING_BY_PEER)
     {
       free(buffer);
@@ -234,6 +276,13 @@ server_microtcp (uint16_t listen_port, const char *file)
   clock_gettime (CLOCK_MONOTONIC_RAW, &end_time);
   print_statistics (total_bytes + 1, start_time, end_time);
   printf("Data pasted successfully\n");
+  microtcp_get_info (&sock, &info, sizeof(info));
+  if (info.decompress_bytes_in)
+    printf ("Compressed: %llu bytes on the wire for %llu (%.2fx)\n",
+            (unsigned long long) info.decompress_bytes_in,
+            (unsigned long long) info.decompress_bytes_out,
+            (double) info.decompress_bytes_out / info.decompress_bytes_in);
+  microtcp_latency_dump (stdout, &sock.latency);
   
 
   printf("Shutting down..\n");
@@ -260,7 +309,9 @@ client_tcp (const char *serverip, uint16_t server_port, const char *file)
   struct sockaddr *client_addr;
 
   /* Allocate memory for the application receive buffer */
-  buffer = (uint8_t *) malloc (CHUNK_SIZE);
+  size_t chunk = chunk_size ? chunk_size : CHUNK_SIZE;
+
+  buffer = (uint8_t *) malloc (chunk);
   if (!buffer) {
     perror ("Allocate application receive buffer");
     return -EXIT_FAILURE;
@@ -298,7 +349,10 @@ client_tcp (const char *serverip, uint16_t server_port, const char *file)
   printf ("Starting sending data...\n");
   /* Start sending the data */
   while (!feof (fp)) {
-    read_items = fread (buffer, sizeof(uint8_t), CHUNK_SIZE, fp);
+    read_items = fread (buffer, sizeof(uint8_t), chunk, fp);
+    /* The file size was a multiple of the chunk size */
+    if (read_items < 1 && feof (fp))
+      break;
     if (read_items < 1) {
       perror ("Failed read from file");
       shutdown (sock, SHUT_RDWR);
@@ -338,6 +392,7 @@ client_microtcp (const char *serverip, uint16_t server_port, const char *file)
   int data_size;
   int read_items;
   FILE *fp;
+  size_t chunk = chunk_size ? chunk_size : MICROTCP_RECVBUF_LEN;
 
   fp = fopen (file, "r");
   if (!fp) {
@@ -362,9 +417,20 @@ client_microtcp (const char *serverip, uint16_t server_port, const char *file)
   printf("Connected!!\n");
   
   printf("Sending data..\n");
-  buffer = malloc(sizeof(uint8_t)*MICROTCP_RECVBUF_LEN);
-  while (!feof (fp)) {
-    read_items = fread (buffer, sizeof(uint8_t), MICROTCP_RECVBUF_LEN, fp);
+  buffer = malloc(sizeof(uint8_t)*chunk);
+  if (zero_copy) {
+    if (microtcp_sendfile (&sock, fileno (fp), 0, SIZE_MAX) == -1) {
+      fprintf(stderr, "Error: Unable to send the file. %s\n", strerror(errno));
+      close (sock.sd);
+      fclose(fp);
+      return EXIT_FAILURE;
+    }
+  }
+  while (!zero_copy && !feof (fp)) {
+    read_items = fread (buffer, sizeof(uint8_t), chunk, fp);
+    /* The file size was a multiple of the chunk size */
+    if (read_items < 1 && feof (fp))
+      break;
     if (read_items < 1) {
       fprintf(stderr, "Error: Unable to read from file: %s\n", strerror(errno));
       close (sock.sd);
@@ -381,6 +447,7 @@ client_microtcp (const char *serverip, uint16_t server_port, const char *file)
     }
   }
   printf("Data has been sent succesfully!\n");
+  microtcp_latency_dump (stdout, &sock.latency);
 
   printf("Shutting down..\n");
   microtcp_shutdown(&sock, 0);
@@ -392,20 +459,392 @@ client_microtcp (const char *serverip, uint16_t server_port, const char *file)
   return 0;
 }
 
+typedef struct
+{
+  int use_microtcp;
+  size_t file_size;
+  size_t chunk;
+  int runs;
+  int failures;
+  double *throughput;        /* MiB/s of every successful run */
+  double cpu_seconds;        /* Client plus server, all runs */
+} bench_result_t;
+
+static size_t
+parse_size (const char *str)
+{
+  char *end;
+  double value = strtod (str, &end);
+  switch (*end)
+    {
+    case 'k':
+    case 'K':
+      value *= 1024;
+      break;
+    case 'm':
+    case 'M':
+      value *= 1024 * 1024;
+      break;
+    case 'g':
+    case 'G':
+      value *= 1024 * 1024 * 1024;
+      break;
+    }
+  return (size_t) value;
+}
+
+/* Parses a comma separated list like "64K,1M,16M" */
+static int
+parse_size_list (const char *str, size_t *values, int max)
+{
+  char *copy = strdup (str);
+  char *saveptr;
+  char *token;
+  int n = 0;
+
+  for (token = strtok_r (copy, ",", &saveptr); token && n < max;
+       token = strtok_r (NULL, ",", &saveptr)) {
+    values[n] = parse_size (token);
+    if (values[n])
+      n++;
+  }
+  free (copy);
+  return n;
+}
+
+static int
+bench_create_file (char *path, size_t size)
+{
+  uint8_t block[CHUNK_SIZE];
+  size_t written = 0;
+  size_t len;
+  size_t i;
+  int fd;
+
+  fd = mkstemp (path);
+  if (fd == -1) {
+    perror ("Create benchmark file");
+    return -1;
+  }
+  srand (size);
+  while (written < size) {
+    len = MIN(size - written, sizeof(block));
+    for (i = 0; i < len; i++)
+      block[i] = rand ();
+    if (write (fd, block, len) != (ssize_t) len) {
+      perror ("Write benchmark file");
+      close (fd);
+      return -1;
+    }
+    written += len;
+  }
+  close (fd);
+  return 0;
+}
+
+static int
+bench_files_equal (const char *a, const char *b)
+{
+  uint8_t buf_a[CHUNK_SIZE];
+  uint8_t buf_b[CHUNK_SIZE];
+  FILE *fa = fopen (a, "r");
+  FILE *fb = fopen (b, "r");
+  size_t na;
+  size_t nb;
+  int equal = fa && fb;
+
+  while (equal) {
+    na = fread (buf_a, 1, sizeof(buf_a), fa);
+    nb = fread (buf_b, 1, sizeof(buf_b), fb);
+    equal = na == nb && !memcmp (buf_a, buf_b, na);
+    if (!na)
+      break;
+  }
+  if (fa)
+    fclose (fa);
+  if (fb)
+    fclose (fb);
+  return equal;
+}
+
+static double
+timeval_seconds (struct timeval tv)
+{
+  return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+/* Children print nothing, so that the report is all that reaches stdout */
+static void
+bench_child_setup (void)
+{
+  if (!freopen ("/dev/null", "w", stdout))
+    perror ("Redirect stdout");
+  alarm (BENCH_TIMEOUT_S);
+}
+
+/*
+ * One transfer over loopback, with the server and the client in their own
+ * processes. Returns 0 and fills the elapsed time and CPU time of both
+ * sides on success, -1 if the transfer failed or the file got corrupted.
+ */
+static int
+bench_run (int use_microtcp, uint16_t port, const char *in, const char *out,
+           const netem_config_t *impair, double *elapsed, double *cpu)
+{
+  int fds[2];
+  int status;
+  int ok = 1;
+  pid_t server;
+  pid_t client;
+  pid_t proxy = -1;
+  uint16_t client_port = port;
+  struct rusage usage;
+  struct sockaddr_in server_addr;
+
+  if (pipe (fds) == -1) {
+    perror ("Benchmark pipe");
+    return -1;
+  }
+  /* Or the children print what is buffered once more */
+  fflush (stdout);
+  server = fork ();
+  if (!server) {
+    close (fds[0]);
+    bench_child_setup ();
+    status = use_microtcp ? server_microtcp (port, out) : server_tcp (port, out);
+    if (!status && write (fds[1], &last_transfer_time, sizeof(double)) != sizeof(double))
+      status = -1;
+    _exit (status ? EXIT_FAILURE : 0);
+  }
+  close (fds[1]);
+  if (server == -1) {
+    perror ("Fork benchmark server");
+    close (fds[0]);
+    return -1;
+  }
+
+  /* The client talks to the server through the impairment proxy */
+  if (impair) {
+    client_port = port + 1;
+    memset (&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons (port);
+    server_addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+    proxy = fork ();
+    if (!proxy) {
+      close (fds[0]);
+      bench_child_setup ();
+      _exit (netem_proxy_run (client_port, &server_addr, impair, impair, 0)
+             ? EXIT_FAILURE : 0);
+    }
+  }
+
+  usleep (BENCH_SERVER_WAIT_US);
+  client = fork ();
+  if (!client) {
+    close (fds[0]);
+    bench_child_setup ();
+    status = use_microtcp ? client_microtcp ("127.0.0.1", client_port, in)
+                          : client_tcp ("127.0.0.1", client_port, in);
+    _exit (status ? EXIT_FAILURE : 0);
+  }
+  if (client == -1)
+    perror ("Fork benchmark client");
+
+  *cpu = 0;
+  if (client != -1) {
+    wait4 (client, &status, 0, &usage);
+    ok &= WIFEXITED (status) && !WEXITSTATUS (status);
+    *cpu += timeval_seconds (usage.ru_utime) + timeval_seconds (usage.ru_stime);
+  }
+  /* The server would wait for a client that gave up */
+  if (!ok || client == -1) {
+    kill (server, SIGKILL);
+    ok = 0;
+  }
+  wait4 (server, &status, 0, &usage);
+  ok &= WIFEXITED (status) && !WEXITSTATUS (status);
+  *cpu += timeval_seconds (usage.ru_utime) + timeval_seconds (usage.ru_stime);
+
+  if (proxy > 0) {
+    kill (proxy, SIGTERM);
+    waitpid (proxy, NULL, 0);
+  }
+
+  ok &= read (fds[0], elapsed, sizeof(double)) == sizeof(double);
+  close (fds[0]);
+  ok &= bench_files_equal (in, out);
+  return ok ? 0 : -1;
+}
+
+static int
+compare_doubles (const void *a, const void *b)
+{
+  double x = *(const double *) a;
+  double y = *(const double *) b;
+  return (x > y) - (x < y);
+}
+
+/* Nearest rank percentile of sorted values */
+static double
+percentile (const double *sorted, int n, double p)
+{
+  int rank = (int) ceil (p / 100 * n);
+  if (!n)
+    return 0;
+  return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+static void
+bench_report (FILE *out, int csv, const bench_result_t *r, int first)
+{
+  int n = r->runs - r->failures;
+  double mean = 0;
+  double stddev = 0;
+  double megabytes = r->file_size / (1024.0 * 1024.0);
+  int i;
+
+  qsort (r->throughput, n, sizeof(double), compare_doubles);
+  for (i = 0; i < n; i++)
+    mean += r->throughput[i];
+  mean = n ? mean / n : 0;
+  for (i = 0; i < n; i++)
+    stddev += (r->throughput[i] - mean) * (r->throughput[i] - mean);
+  stddev = n > 1 ? sqrt (stddev / (n - 1)) : 0;
+
+  if (csv) {
+    if (first)
+      fprintf (out, "protocol,file_size,chunk_size,runs,failures,mean_mib_s,"
+               "stddev_mib_s,min_mib_s,p50_mib_s,p90_mib_s,p99_mib_s,max_mib_s,"
+               "cpu_seconds,bytes_per_cpu_second\n");
+    fprintf (out, "%s,%zu,%zu,%d,%d,%f,%f,%f,%f,%f,%f,%f,%f,%f\n",
+             r->use_microtcp ? "microtcp" : "tcp", r->file_size, r->chunk,
+             r->runs, r->failures, mean, stddev, percentile (r->throughput, n, 0),
+             percentile (r->throughput, n, 50), percentile (r->throughput, n, 90),
+             percentile (r->throughput, n, 99), percentile (r->throughput, n, 100),
+             r->cpu_seconds, r->cpu_seconds > 0 ? n * megabytes * 1024 * 1024 / r->cpu_seconds : 0);
+    return;
+  }
+  fprintf (out, "%s    {\"protocol\": \"%s\", \"file_size\": %zu, \"chunk_size\": %zu, "
+           "\"runs\": %d, \"failures\": %d,\n"
+           "     \"throughput_mib_s\": {\"mean\": %f, \"stddev\": %f, \"min\": %f, "
+           "\"p50\": %f, \"p90\": %f, \"p99\": %f, \"max\": %f},\n"
+           "     \"cpu_seconds\": %f, \"bytes_per_cpu_second\": %f}",
+           first ? "" : ",\n", r->use_microtcp ? "microtcp" : "tcp", r->file_size,
+           r->chunk, r->runs, r->failures, mean, stddev,
+           percentile (r->throughput, n, 0), percentile (r->throughput, n, 50),
+           percentile (r->throughput, n, 90), percentile (r->throughput, n, 99),
+           percentile (r->throughput, n, 100), r->cpu_seconds,
+           r->cpu_seconds > 0 ? n * megabytes * 1024 * 1024 / r->cpu_seconds : 0);
+}
+
+/*
+ * Benchmark mode: every combination of protocol, file size and chunk size
+ * is transferred repetitions times over loopback, and the statistics are
+ * printed on stdout as JSON or CSV. Progress goes to stderr.
+ */
+static int
+bench_matrix (uint16_t base_port, int repetitions, const size_t *sizes,
+              int n_sizes, const size_t *chunks, int n_chunks, int csv,
+              const char *impair_spec)
+{
+  netem_config_t impair;
+  char in[] = "/tmp/bandwidth_test_in.XXXXXX";
+  char out[] = "/tmp/bandwidth_test_out.XXXXXX";
+  bench_result_t result;
+  double elapsed;
+  double cpu;
+  int out_fd;
+  int first = 1;
+  int failed = 0;
+  int proto;
+  int s;
+  int c;
+  int i;
+  uint16_t port = base_port - 2;
+
+  if (impair_spec && netem_parse (&impair, impair_spec) == -1)
+    return -EXIT_FAILURE;
+  out_fd = mkstemp (out);
+  if (out_fd == -1) {
+    perror ("Create benchmark output file");
+    return -EXIT_FAILURE;
+  }
+  close (out_fd);
+  if (!csv)
+    printf ("{\"benchmark\": \"bandwidth_test\", \"repetitions\": %d, "
+            "\"impairment\": \"%s\", \"results\": [\n", repetitions,
+            impair_spec ? impair_spec : "");
+
+  for (s = 0; s < n_sizes; s++) {
+    strcpy (in, "/tmp/bandwidth_test_in.XXXXXX");
+    if (bench_create_file (in, sizes[s]) == -1) {
+      unlink (out);
+      return -EXIT_FAILURE;
+    }
+    for (c = 0; c < n_chunks; c++) {
+      /* Kernel TCP can not go through the UDP impairment proxy */
+      for (proto = impair_spec ? 1 : 0; proto < 2; proto++) {
+        memset (&result, 0, sizeof(result));
+        result.use_microtcp = proto;
+        result.file_size = sizes[s];
+        result.chunk = chunks[c];
+        result.throughput = calloc (repetitions, sizeof(double));
+        chunk_size = chunks[c];
+        for (i = 0; i < repetitions; i++) {
+          fprintf (stderr, "%s size %zu chunk %zu run %d/%d\n",
+                   proto ? "microtcp" : "tcp", sizes[s], chunks[c], i + 1, repetitions);
+          result.runs++;
+          /* Fresh ports every run, TCP ports linger in TIME_WAIT */
+          port += 2;
+          if (impair_spec)
+            impair.seed++;
+          if (bench_run (proto, port, in, out, impair_spec ? &impair : NULL,
+                         &elapsed, &cpu) == -1 || elapsed <= 0) {
+            fprintf (stderr, "Error: Benchmark transfer failed.\n");
+            result.failures++;
+            continue;
+          }
+          result.cpu_seconds += cpu;
+          result.throughput[result.runs - result.failures - 1] =
+              sizes[s] / (1024.0 * 1024.0) / elapsed;
+        }
+        failed |= result.failures;
+        bench_report (stdout, csv, &result, first);
+        first = 0;
+        free (result.throughput);
+      }
+    }
+    unlink (in);
+  }
+  if (!csv)
+    printf ("\n]}\n");
+  unlink (out);
+  return failed ? EXIT_FAILURE : 0;
+}
+
 int
 main (int argc, char **argv)
 {
   int opt;
-  int port;
+  int port = 0;
   int exit_code = 0;
   char *filestr = NULL;
   char *ipstr = NULL;
   char absolute_path[PATH_MAX];
   uint8_t is_server = 0;
   uint8_t use_microtcp = 0;
+  uint8_t bench = 0;
+  int repetitions = 5;
+  int csv = 0;
+  char *impair_spec = NULL;
+  size_t sizes[BENCH_MAX_VALUES] = { 1024 * 1024, 16 * 1024 * 1024 };
+  size_t chunks[BENCH_MAX_VALUES] = { CHUNK_SIZE, MICROTCP_RECVBUF_LEN };
+  int n_sizes = 2;
+  int n_chunks = 2;
 
   /* A very easy way to parse command line arguments */
-  while ((opt = getopt (argc, argv, "hsmf:p:a:")) != -1) {
+  while ((opt = getopt (argc, argv, "hsmbZf:p:a:c:n:z:o:x:")) != -1) {
     switch (opt)
       {
       /* If -s is set, program runs on server mode */
@@ -438,10 +877,33 @@ main (int argc, char **argv)
       case 'a':
         ipstr = strdup (optarg);
         break;
+      case 'b':
+        bench = 1;
+        break;
+      case 'c':
+        n_chunks = parse_size_list (optarg, chunks, BENCH_MAX_VALUES);
+        chunk_size = n_chunks ? chunks[0] : 0;
+        break;
+      case 'n':
+        repetitions = atoi (optarg);
+        break;
+      case 'z':
+        n_sizes = parse_size_list (optarg, sizes, BENCH_MAX_VALUES);
+        break;
+      case 'o':
+        csv = !strcmp (optarg, "csv");
+        break;
+      case 'x':
+        impair_spec = optarg;
+        break;
+      case 'Z':
+        zero_copy = 1;
+        break;
 
       default:
         printf (
-            "Usage: bandwidth_test [-s] [-m] -p port -f file"
+            "Usage: bandwidth_test [-s] [-m] [-Z] [-c chunk] -p port -f file\n"
+            "       bandwidth_test -b [-n runs] [-z sizes] [-c chunks] [-o json|csv] [-p port]\n"
             "Options:\n"
             "   -s                  If set, the program runs as server. Otherwise as client.\n"
             "   -m                  If set, the program uses the microTCP implementation. Otherwise the normal TCP.\n"
@@ -449,6 +911,16 @@ main (int argc, char **argv)
             "                       If not, is the source file at the client side that will be sent to the server.\n"
             "   -p <int>            The listening port of the server\n"
             "   -a <string>         The IP address of the server. This option is ignored if the tool runs in server mode.\n"
+            "   -Z                  microTCP: send the file with microtcp_sendfile() and receive it with\n"
+            "                       microtcp_recvfile() instead of -c byte reads and writes.\n"
+            "   -c <size list>      Size of the application reads and writes, e.g. 4K. In benchmark mode a list, e.g. 1K,4K,8K.\n"
+            "   -b                  Benchmark mode: runs TCP and microTCP transfers over loopback, for every file\n"
+            "                       size and chunk size, and prints statistics as JSON or CSV.\n"
+            "   -n <int>            Benchmark mode: transfers per combination (default 5).\n"
+            "   -z <size list>      Benchmark mode: file sizes, e.g. 1M,16M (the default).\n"
+            "   -o <json|csv>       Benchmark mode: output format (default json).\n"
+            "   -x <spec>           Benchmark mode: microTCP goes through an impairment proxy, e.g.\n"
+            "                       \"delay=10ms,loss=1%%\" (see impairment_proxy -h). TCP runs are skipped.\n"
             "   -h                  prints this help\n");
         exit (EXIT_FAILURE);
       }
@@ -458,10 +930,20 @@ main (int argc, char **argv)
    * TODO: Some error checking here???
    */
 
+  if (bench) {
+    if (!n_sizes || !n_chunks || repetitions < 1) {
+      fprintf (stderr, "Error: Invalid benchmark sizes or repetitions.\n");
+      return -EXIT_FAILURE;
+    }
+    if (!port)
+      port = 20000 + getpid () % 20000;
+    exit_code = bench_matrix (port, repetitions, sizes, n_sizes, chunks,
+                              n_chunks, csv, impair_spec);
+  }
   /*
    * Depending the use arguments execute the appropriate functions
    */
-  if (is_server) {
+  else if (is_server) {
 
     if (use_microtcp) {
       exit_code = server_microtcp (port, filestr);
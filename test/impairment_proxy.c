@@ -0,0 +1,121 @@
+/*
+ * microtcp, a lightweight implementation of TCP for teaching,
+ * and academic purposes.
+ *
+ * Copyright (C) 2015-2017  Manolis Surligas <surligas@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * UDP relay that sits between a microTCP client and server and impairs
+ * the traffic, for loss and delay experiments without tc/netem. Point the
+ * client at the proxy, e.g.
+ *
+ *   bandwidth_test -s -m -p 9000 -f out
+ *   impairment_proxy -l 9001 -a 127.0.0.1 -p 9000 -e "delay=10ms,loss=1%"
+ *   bandwidth_test -m -a 127.0.0.1 -p 9001 -f in
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+#include "netem.h"
+
+int
+main (int argc, char **argv)
+{
+  int opt;
+  int listen_port = 0;
+  int server_port = 0;
+  int verbose = 0;
+  const char *server_ip = "127.0.0.1";
+  const char *both = NULL;
+  const char *up_spec = NULL;
+  const char *down_spec = NULL;
+  long long seed = -1;
+  netem_config_t up;
+  netem_config_t down;
+  struct sockaddr_in server;
+
+  while ((opt = getopt (argc, argv, "hvl:a:p:e:u:d:S:")) != -1) {
+    switch (opt)
+      {
+      case 'l':
+        listen_port = atoi (optarg);
+        break;
+      case 'a':
+        server_ip = optarg;
+        break;
+      case 'p':
+        server_port = atoi (optarg);
+        break;
+      case 'e':
+        both = optarg;
+        break;
+      case 'u':
+        up_spec = optarg;
+        break;
+      case 'd':
+        down_spec = optarg;
+        break;
+      case 'S':
+        seed = strtoll (optarg, NULL, 0);
+        break;
+      case 'v':
+        verbose = 1;
+        break;
+      default:
+        printf (
+            "Usage: impairment_proxy -l port -p server_port [-a server_ip] [-e spec] [-u spec] [-d spec] [-S seed] [-v]\n"
+            "Options:\n"
+            "   -l <int>            Port the client sends to\n"
+            "   -a <string>         IP address of the server (default 127.0.0.1)\n"
+            "   -p <int>            Port of the server\n"
+            "   -e <spec>           Impairments of both directions\n"
+            "   -u <spec>           Impairments from the client to the server, overrides -e\n"
+            "   -d <spec>           Impairments from the server to the client, overrides -e\n"
+            "   -S <int>            Seed of the random generators, overrides seed= of the specs\n"
+            "   -v                  Print packet counters every second\n"
+            "   -h                  prints this help\n"
+            "A spec is a comma separated list of\n"
+            "   delay=<time> jitter=<time> rate=<n>[k|m|g]bit loss=<p> dup=<p>\n"
+            "   reorder=<p> reorder_delay=<time> ge=<p>:<r>[:<bad loss>[:<good loss>]]\n"
+            "   limit=<packets> seed=<int>\n"
+            "Times take us/ms/s (default ms), probabilities a %% or a fraction.\n");
+        exit (EXIT_FAILURE);
+      }
+  }
+  if (!listen_port || !server_port) {
+    fprintf (stderr, "Error: The listening and the server port are required.\n");
+    return EXIT_FAILURE;
+  }
+  if (netem_parse (&up, up_spec ? up_spec : both) == -1
+      || netem_parse (&down, down_spec ? down_spec : both) == -1)
+    return EXIT_FAILURE;
+  if (seed >= 0)
+    up.seed = down.seed = seed;
+
+  memset (&server, 0, sizeof(server));
+  server.sin_family = AF_INET;
+  server.sin_port = htons (server_port);
+  if (inet_pton (AF_INET, server_ip, &server.sin_addr) != 1) {
+    fprintf (stderr, "Error: Invalid server address %s.\n", server_ip);
+    return EXIT_FAILURE;
+  }
+  return netem_proxy_run (listen_port, &server, &up, &down, verbose) ? EXIT_FAILURE : 0;
+}
@@ -0,0 +1,627 @@
+/*
+ * microtcp, a lightweight implementation of TCP for teaching,
+ * and academic purposes.
+ *
+ * Copyright (C) 2015-2017  Manolis Surligas <surligas@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Microbenchmarks of the per packet functions: packet creation and
+ * parsing, the compact header codec, the checksum, control flag
+ * classification, the out of order list and the payload compression
+ * codec. Every benchmark is warmed
+ * up, calibrated to batches of about BATCH_NS and repeated; the median
+ * batch is reported in ns/op, TSC cycles/op and heap allocations/op.
+ *
+ *   microbench [-r repetitions] [-f filter]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <math.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC 1
+#else
+#define HAVE_TSC 0
+#endif
+
+#include "../lib/microtcp.h"
+#include "../lib/microtcp_codec.h"
+#include "../lib/microtcp_lz.h"
+#include "../utils/crc32.h"
+
+#define WARMUP_NS 50000000ULL   /* Warmup time of every benchmark */
+#define BATCH_NS 10000000ULL    /* Target duration of one measured batch */
+#define MAX_REPETITIONS 100
+#define OOO_SEGMENTS 32         /* Segments per out of order list round */
+
+/*
+ * Allocation counting. The definitions below interpose the allocator of
+ * glibc for the whole process, the microtcp library included.
+ */
+extern void *__libc_malloc (size_t size);
+extern void *__libc_calloc (size_t n, size_t size);
+extern void *__libc_realloc (void *ptr, size_t size);
+extern void __libc_free (void *ptr);
+
+static uint64_t allocations;
+
+void *
+malloc (size_t size)
+{
+  allocations++;
+  return __libc_malloc (size);
+}
+
+void *
+calloc (size_t n, size_t size)
+{
+  allocations++;
+  return __libc_calloc (n, size);
+}
+
+void *
+realloc (void *ptr, size_t size)
+{
+  allocations++;
+  return __libc_realloc (ptr, size);
+}
+
+void
+free (void *ptr)
+{
+  __libc_free (ptr);
+}
+
+typedef struct
+{
+  const char *name;
+  void (*run) (void *ctx, uint64_t iterations);
+  void *ctx;
+  size_t bytes;                 /* Bytes processed per op, for MB/s */
+  unsigned ops;                 /* Ops per iteration */
+} bench_t;
+
+typedef struct
+{
+  size_t len;
+  uint8_t *packet;              /* Pristine packet */
+  uint8_t *work;                /* Scratch copy, parsing works in place */
+  uint8_t *payload;
+} packet_ctx_t;
+
+typedef struct
+{
+  microtcp_header_t header;     /* Network order, as on the wire */
+  uint8_t compact[MICROTCP_COMPACT_MAX];
+  size_t compact_len;
+} compact_ctx_t;
+
+typedef struct
+{
+  uint8_t raw[MICROTCP_COMPRESS_BLOCK];
+  uint8_t packed[MICROTCP_LZ_BOUND (MICROTCP_COMPRESS_BLOCK)];
+  size_t packed_len;
+} lz_ctx_t;
+
+/* Keeps the compiler from optimizing results away */
+static volatile uint64_t sink;
+
+static uint64_t
+now_ns (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint64_t
+cycles (void)
+{
+#if HAVE_TSC
+  return __rdtsc ();
+#else
+  return 0;
+#endif
+}
+
+static void
+run_create_header (void *ctx, uint64_t iterations)
+{
+  microtcp_header_t header;
+  uint64_t i;
+  (void) ctx;
+  for (i = 0; i < iterations; i++) {
+    header = microtcp_create_header (i, i + 1, 1, 0, 0, 0, 8192, 1400, 8192, i, 4200);
+    sink += header.seq_number;
+  }
+}
+
+static void
+run_create_packet (void *ctx, uint64_t iterations)
+{
+  packet_ctx_t *p = ctx;
+  uint64_t i;
+  void *packet;
+  for (i = 0; i < iterations; i++) {
+    packet = microtcp_create_packet (i, i + 1, 0, 0, 0, 0, 8192, p->len,
+                                     (char *) p->payload, 8192, 0, 4200);
+    sink += ((microtcp_header_t *) packet)->checksum;
+    free (packet);
+  }
+}
+
+static void
+run_memcpy (void *ctx, uint64_t iterations)
+{
+  packet_ctx_t *p = ctx;
+  uint64_t i;
+  for (i = 0; i < iterations; i++) {
+    memcpy (p->work, p->packet, sizeof(microtcp_header_t) + p->len);
+    sink += p->work[i % (sizeof(microtcp_header_t) + p->len)];
+  }
+}
+
+static void
+run_unpack (void *ctx, uint64_t iterations)
+{
+  packet_ctx_t *p = ctx;
+  microtcp_header_t header;
+  char *data;
+  uint64_t i;
+  for (i = 0; i < iterations; i++) {
+    memcpy (p->work, p->packet, sizeof(microtcp_header_t) + p->len);
+    sink += microtcp_unpack (p->work, &header, &data);
+    free (data);
+  }
+}
+
+static void
+run_unpack_view (void *ctx, uint64_t iterations)
+{
+  packet_ctx_t *p = ctx;
+  microtcp_header_t header;
+  uint8_t *data;
+  uint64_t i;
+  for (i = 0; i < iterations; i++) {
+    memcpy (p->work, p->packet, sizeof(microtcp_header_t) + p->len);
+    sink += microtcp_unpack_view (p->work, sizeof(microtcp_header_t) + p->len, &header, &data);
+  }
+}
+
+static void
+run_checksum_check (void *ctx, uint64_t iterations)
+{
+  packet_ctx_t *p = ctx;
+  microtcp_header_t *h = (microtcp_header_t *) p->work;
+  uint32_t checksum = ntohl (((microtcp_header_t *) p->packet)->checksum);
+  uint64_t i;
+  memcpy (p->work, p->packet, sizeof(microtcp_header_t) + p->len);
+  for (i = 0; i < iterations; i++) {
+    /* The check zeroes the field, microtcp_unpack() stores it in host order */
+    h->checksum = checksum;
+    sink += microtcp_checksum_check (p->work);
+  }
+}
+
+static void
+run_compact_encode (void *ctx, uint64_t iterations)
+{
+  compact_ctx_t *c = ctx;
+  uint8_t out[MICROTCP_COMPACT_MAX];
+  uint64_t i;
+  for (i = 0; i < iterations; i++) {
+    c->header.seq_number = i;
+    sink += microtcp_compact_encode (&c->header, out);
+  }
+}
+
+static void
+run_lz_compress (void *ctx, uint64_t iterations)
+{
+  lz_ctx_t *c = ctx;
+  uint64_t i;
+  for (i = 0; i < iterations; i++)
+    sink += microtcp_lz_compress (c->raw, sizeof(c->raw), c->packed, sizeof(c->packed));
+}
+
+static void
+run_lz_decompress (void *ctx, uint64_t iterations)
+{
+  lz_ctx_t *c = ctx;
+  uint64_t i;
+  for (i = 0; i < iterations; i++)
+    sink += microtcp_lz_decompress (c->packed, c->packed_len, c->raw, sizeof(c->raw));
+}
+
+static void
+run_compact_decode (void *ctx, uint64_t iterations)
+{
+  compact_ctx_t *c = ctx;
+  microtcp_header_t header;
+  uint64_t i;
+  for (i = 0; i < iterations; i++) {
+    sink += microtcp_compact_decode (c->compact, c->compact_len, &header);
+    sink += header.ack_number;
+  }
+}
+
+static void
+run_crc32 (void *ctx, uint64_t iterations)
+{
+  packet_ctx_t *p = ctx;
+  uint64_t i;
+  for (i = 0; i < iterations; i++)
+    sink += crc32 (p->payload, p->len);
+}
+
+static void
+run_check_control (void *ctx, uint64_t iterations)
+{
+  microtcp_header_t *headers = ctx;
+  microtcp_header_t *h;
+  uint64_t i;
+  for (i = 0; i < iterations; i++) {
+    h = &headers[i & 3];
+    /* The classification order of microtcp_recv() */
+    if (check_control (h, 0, 0, 0, 0))
+      sink += 1;
+    else if (check_control (h, 1, 0, 0, 1))
+      sink += 2;
+    else if (check_control (h, 0, 1, 0, 0))
+      sink += 3;
+    else if (check_control (h, 1, 0, 0, 0))
+      sink += 4;
+  }
+}
+
+/* A flight arriving in reverse: every insert walks the whole list */
+static void
+run_ooo_list (void *ctx, uint64_t iterations)
+{
+  packet_ctx_t *p = ctx;
+  microtcp_header_node *list;
+  microtcp_header_t header;
+  uint8_t *payload;
+  uint64_t i;
+  int j;
+  memset (&header, 0, sizeof(header));
+  header.data_len = p->len;
+  for (i = 0; i < iterations; i++) {
+    list = NULL;
+    for (j = OOO_SEGMENTS - 1; j >= 0; j--) {
+      header.data_offset = j * p->len;
+      list = add_microtcp_header_node (list, &header, p->payload);
+    }
+    while (list) {
+      payload = pop_microtcp_header_node (&list);
+      sink += payload[0];
+      free (payload);
+    }
+  }
+}
+
+static int
+compare_doubles (const void *a, const void *b)
+{
+  double x = *(const double *) a;
+  double y = *(const double *) b;
+  return (x > y) - (x < y);
+}
+
+static void
+bench_run (const bench_t *b, int repetitions)
+{
+  double ns[MAX_REPETITIONS];
+  double cyc[MAX_REPETITIONS];
+  double mean = 0;
+  double stddev = 0;
+  uint64_t iterations = 1;
+  uint64_t start;
+  uint64_t elapsed;
+  uint64_t c0;
+  uint64_t allocs;
+  double ops;
+  int r;
+
+  /* Warmup, doubling the batch until it takes BATCH_NS */
+  start = now_ns ();
+  while (1) {
+    uint64_t t0 = now_ns ();
+    b->run (b->ctx, iterations);
+    elapsed = now_ns () - t0;
+    if (elapsed >= BATCH_NS && now_ns () - start >= WARMUP_NS)
+      break;
+    if (elapsed < BATCH_NS)
+      iterations *= 2;
+  }
+
+  ops = (double) iterations * b->ops;
+  allocs = allocations;
+  for (r = 0; r < repetitions; r++) {
+    c0 = cycles ();
+    start = now_ns ();
+    b->run (b->ctx, iterations);
+    elapsed = now_ns () - start;
+    cyc[r] = (cycles () - c0) / ops;
+    ns[r] = elapsed / ops;
+    mean += ns[r];
+  }
+  allocs = allocations - allocs;
+  mean /= repetitions;
+  for (r = 0; r < repetitions; r++)
+    stddev += (ns[r] - mean) * (ns[r] - mean);
+  stddev = repetitions > 1 ? sqrt (stddev / (repetitions - 1)) : 0;
+  qsort (ns, repetitions, sizeof(double), compare_doubles);
+  qsort (cyc, repetitions, sizeof(double), compare_doubles);
+
+  printf ("%-26s %10.2f %8.2f %10.2f %9.2f %10.2f",
+          b->name, ns[repetitions / 2], stddev, ns[0],
+          HAVE_TSC ? cyc[repetitions / 2] : NAN,
+          (double) allocs / (ops * repetitions));
+  if (b->bytes)
+    printf (" %10.1f", b->bytes / ns[repetitions / 2] * 1e3);
+  printf ("\n");
+}
+
+/* A pure ACK, or the header of a full segment in the middle of a message */
+static compact_ctx_t *
+compact_ctx (int ack)
+{
+  compact_ctx_t *c = calloc (1, sizeof(compact_ctx_t));
+  void *packet = ack ? microtcp_create_packet (1000, 2000, 1, 0, 0, 0, 8192, 0, NULL, 0, 0, 0)
+                     : microtcp_create_packet (1000, 2000, 0, 0, 0, 0, 8192, 0, NULL, 65536, 29400, 14000);
+
+  memcpy (&c->header, packet, sizeof(microtcp_header_t));
+  if (!ack)
+    c->header.data_len = htonl (MICROTCP_MSS);
+  c->compact_len = microtcp_compact_encode (&c->header, c->compact);
+  free (packet);
+  return c;
+}
+
+/*
+ * Decoding must give back the header that was encoded, and reject every
+ * truncation of it, a foreign marker, unknown field bits and varints
+ * that are zero or run past 32 bits.
+ */
+static int
+check_compact (const compact_ctx_t *c)
+{
+  static const uint8_t overlong[] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0x01 };
+  uint8_t bad[MICROTCP_COMPACT_MAX + sizeof(overlong)];
+  microtcp_header_t header;
+  size_t len;
+
+  if (microtcp_compact_decode (c->compact, c->compact_len, &header) != c->compact_len
+      || memcmp (&header, &c->header, sizeof(header))) {
+    fprintf (stderr, "Error: The compact header does not decode to the one encoded.\n");
+    return -1;
+  }
+  for (len = 0; len < c->compact_len; len++)
+    if (microtcp_compact_decode (c->compact, len, &header)) {
+      fprintf (stderr, "Error: A compact header truncated to %zu bytes decoded.\n", len);
+      return -1;
+    }
+
+  memcpy (bad, c->compact, c->compact_len);
+  bad[0] ^= 0x40;
+  if (microtcp_compact_decode (bad, c->compact_len, &header)) {
+    fprintf (stderr, "Error: A compact header with a foreign marker decoded.\n");
+    return -1;
+  }
+  bad[0] = c->compact[0];
+  bad[1] |= 0x10;
+  if (microtcp_compact_decode (bad, c->compact_len, &header)) {
+    fprintf (stderr, "Error: A compact header with unknown field bits decoded.\n");
+    return -1;
+  }
+
+  /* The total size as the first varint, after the fixed fields */
+  bad[1] = MICROTCP_COMPACT_HAS_TOTAL;
+  bad[MICROTCP_COMPACT_MIN] = 0;
+  if (microtcp_compact_decode (bad, MICROTCP_COMPACT_MIN + 1, &header)) {
+    fprintf (stderr, "Error: A compact header with a zero varint decoded.\n");
+    return -1;
+  }
+  memcpy (bad + MICROTCP_COMPACT_MIN, overlong, sizeof(overlong));
+  if (microtcp_compact_decode (bad, MICROTCP_COMPACT_MIN + sizeof(overlong), &header)) {
+    fprintf (stderr, "Error: A compact header with a varint past 32 bits decoded.\n");
+    return -1;
+  }
+  return 0;
+}
+
+/* A block of JSON log lines, or of random bytes that the codec gives up on */
+static lz_ctx_t *
+lz_ctx (int text)
+{
+  lz_ctx_t *c = calloc (1, sizeof(lz_ctx_t));
+  size_t len = 0;
+  unsigned int seed = 1;
+  int line;
+
+  if (!c)
+    return NULL;
+  for (line = 0; text && len < sizeof(c->raw); line++)
+    len += snprintf ((char *) c->raw + len, sizeof(c->raw) - len,
+                     "{\"ts\":%d,\"level\":\"info\",\"path\":\"/api/v1/item/%d\",\"status\":%d}\n",
+                     1700000000 + line, rand_r (&seed) % 5000, rand_r (&seed) % 8 ? 200 : 404);
+  for (; len < sizeof(c->raw); len++)
+    c->raw[len] = rand_r (&seed);
+  c->packed_len = microtcp_lz_compress (c->raw, sizeof(c->raw), c->packed, sizeof(c->packed));
+  return c;
+}
+
+/*
+ * Decompressing must give back the block that was compressed, fail when
+ * it does not fit, and never produce more than a prefix of it from a
+ * truncated block. Blocks with lengths past their input, a zero offset
+ * or one reaching before the output must be refused.
+ */
+static int
+check_lz (const lz_ctx_t *c)
+{
+  static const struct
+  {
+    const char *what;
+    uint8_t block[4];
+    size_t len;
+  } malformed[] = {
+    { "literals past the input", { 0x50, 'a' }, 2 },
+    { "a literal length past the input", { 0xf0, 0xff }, 2 },
+    { "a zero offset", { 0x10, 'a', 0x00, 0x00 }, 4 },
+    { "an offset before the output", { 0x10, 'a', 0x02, 0x00 }, 4 },
+  };
+  uint8_t out[MICROTCP_COMPRESS_BLOCK];
+  ssize_t ret;
+  size_t len;
+
+  if (!c->packed_len) {
+    fprintf (stderr, "Error: The block did not compress within its bound.\n");
+    return -1;
+  }
+  if (microtcp_lz_decompress (c->packed, c->packed_len, out, sizeof(out)) != sizeof(c->raw)
+      || memcmp (out, c->raw, sizeof(c->raw))) {
+    fprintf (stderr, "Error: The block does not decompress to the one compressed.\n");
+    return -1;
+  }
+  if (microtcp_lz_decompress (c->packed, c->packed_len, out, sizeof(out) - 1) != -1) {
+    fprintf (stderr, "Error: The block decompressed into a buffer too small for it.\n");
+    return -1;
+  }
+  for (len = 0; len < c->packed_len; len++) {
+    ret = microtcp_lz_decompress (c->packed, len, out, sizeof(out));
+    if (ret >= (ssize_t) sizeof(c->raw) || (ret > 0 && memcmp (out, c->raw, ret))) {
+      fprintf (stderr, "Error: The block truncated to %zu bytes decompressed to other data.\n", len);
+      return -1;
+    }
+  }
+  for (len = 0; len < sizeof(malformed) / sizeof(malformed[0]); len++)
+    if (microtcp_lz_decompress (malformed[len].block, malformed[len].len, out, sizeof(out)) != -1) {
+      fprintf (stderr, "Error: A block with %s decompressed.\n", malformed[len].what);
+      return -1;
+    }
+  return 0;
+}
+
+static packet_ctx_t *
+packet_ctx (size_t len)
+{
+  packet_ctx_t *p = calloc (1, sizeof(packet_ctx_t));
+  void *packet;
+  size_t i;
+
+  p->len = len;
+  p->payload = malloc (len ? len : 1);
+  for (i = 0; i < len; i++)
+    p->payload[i] = i * 31 + 7;
+  packet = microtcp_create_packet (1000, 2000, 0, 0, 0, 0, 8192, len,
+                                   (char *) p->payload, 8192, 0, 4200);
+  p->packet = packet;
+  p->work = malloc (sizeof(microtcp_header_t) + len);
+  return p;
+}
+
+int
+main (int argc, char **argv)
+{
+  static const size_t crc_sizes[] = { 64, 256, 1024, 1400, 4096, 16384, 65536 };
+  bench_t benches[32];
+  microtcp_header_t headers[4];
+  packet_ctx_t *small = packet_ctx (0);
+  packet_ctx_t *mss = packet_ctx (MICROTCP_MSS);
+  const char *filter = NULL;
+  char names[8][32];
+  int repetitions = 15;
+  int n = 0;
+  int opt;
+  size_t i;
+
+  while ((opt = getopt (argc, argv, "hr:f:")) != -1) {
+    switch (opt)
+      {
+      case 'r':
+        repetitions = atoi (optarg);
+        break;
+      case 'f':
+        filter = optarg;
+        break;
+      default:
+        printf (
+            "Usage: microbench [-r repetitions] [-f filter]\n"
+            "Options:\n"
+            "   -r <int>            Measured batches per benchmark (default 15)\n"
+            "   -f <string>         Run only the benchmarks whose name contains this\n"
+            "   -h                  prints this help\n");
+        exit (EXIT_FAILURE);
+      }
+  }
+  if (repetitions < 1 || repetitions > MAX_REPETITIONS) {
+    fprintf (stderr, "Error: Repetitions must be in [1, %d].\n", MAX_REPETITIONS);
+    return EXIT_FAILURE;
+  }
+
+  /* Plain data, ACK, FIN-ACK and SYN, parsed to host order like recv does */
+  for (i = 0; i < 4; i++) {
+    static const int flags[4][2] = { { 0, 0 }, { 1, 0 }, { 1, 1 }, { 0, 0 } };
+    void *packet = microtcp_create_packet (1, 2, flags[i][0], 0, i == 3,
+                                           flags[i][1], 0, 0, NULL, 0, 0, 0);
+    char *data;
+    microtcp_unpack (packet, &headers[i], &data);
+    free (data);
+    free (packet);
+  }
+
+  /* Timing a codec that gives wrong answers is pointless */
+  if (check_compact (compact_ctx (1)) || check_compact (compact_ctx (0))
+      || check_lz (lz_ctx (1)) || check_lz (lz_ctx (0)))
+    return EXIT_FAILURE;
+
+  benches[n++] = (bench_t) { "create_header", run_create_header, NULL, 0, 1 };
+  benches[n++] = (bench_t) { "create_packet/0", run_create_packet, small, 0, 1 };
+  benches[n++] = (bench_t) { "create_packet/1400", run_create_packet, mss, MICROTCP_MSS, 1 };
+  benches[n++] = (bench_t) { "memcpy/1400 (baseline)", run_memcpy, mss, MICROTCP_MSS, 1 };
+  benches[n++] = (bench_t) { "unpack/0", run_unpack, small, 0, 1 };
+  benches[n++] = (bench_t) { "unpack/1400", run_unpack, mss, MICROTCP_MSS, 1 };
+  benches[n++] = (bench_t) { "unpack_view/1400", run_unpack_view, mss, MICROTCP_MSS, 1 };
+  benches[n++] = (bench_t) { "checksum_check/1400", run_checksum_check, mss, MICROTCP_MSS, 1 };
+  for (i = 0; i < sizeof(crc_sizes) / sizeof(crc_sizes[0]); i++) {
+    snprintf (names[i], sizeof(names[i]), "crc32/%zu", crc_sizes[i]);
+    benches[n++] = (bench_t) { names[i], run_crc32, packet_ctx (crc_sizes[i]), crc_sizes[i], 1 };
+  }
+  benches[n++] = (bench_t) { "compact_encode/ack", run_compact_encode, compact_ctx (1), 0, 1 };
+  benches[n++] = (bench_t) { "compact_decode/ack", run_compact_decode, compact_ctx (1), 0, 1 };
+  benches[n++] = (bench_t) { "compact_encode/1400", run_compact_encode, compact_ctx (0), 0, 1 };
+  benches[n++] = (bench_t) { "compact_decode/1400", run_compact_decode, compact_ctx (0), 0, 1 };
+  benches[n++] = (bench_t) { "lz_compress/json", run_lz_compress, lz_ctx (1), MICROTCP_COMPRESS_BLOCK, 1 };
+  benches[n++] = (bench_t) { "lz_decompress/json", run_lz_decompress, lz_ctx (1), MICROTCP_COMPRESS_BLOCK, 1 };
+  benches[n++] = (bench_t) { "lz_compress/random", run_lz_compress, lz_ctx (0), MICROTCP_COMPRESS_BLOCK, 1 };
+  benches[n++] = (bench_t) { "check_control", run_check_control, headers, 0, 1 };
+  benches[n++] = (bench_t) { "ooo_list/add+pop", run_ooo_list, mss, 0, OOO_SEGMENTS };
+
+  printf ("%-26s %10s %8s %10s %9s %10s %10s\n", "benchmark", "ns/op", "stddev",
+          "min ns/op", "cycles/op", "allocs/op", "MB/s");
+  for (i = 0; i < (size_t) n; i++)
+    if (!filter || strstr (benches[i].name, filter))
+      bench_run (&benches[i], repetitions);
+  return 0;
+}
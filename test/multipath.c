@@ -0,0 +1,212 @@
+/*
+ * microtcp, a lightweight implementation of TCP for teaching,
+ * and academic purposes.
+ *
+ * Copyright (C) 2015-2017  Manolis Surligas <surligas@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * A file transfer over several microTCP subflows, one per port. Each
+ * subflow may cross its own impairment proxy, e.g. a fast and a slow
+ * lossy path over loopback:
+ *
+ *   multipath -s -p 7000,7001 -f out
+ *   impairment_proxy -l 8000 -p 7000 -e "delay=5ms,rate=80mbit"
+ *   impairment_proxy -l 8001 -p 7001 -e "delay=40ms,rate=20mbit,loss=1%"
+ *   multipath -a 127.0.0.1 -p 8000,8001 -x wrr -w 4,1 -f in
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+#include "../lib/microtcp_mp.h"
+
+#define MULTIPATH_BUFFER (256 * 1024)
+
+/* Parses a comma separated list of integers like "7000,7001" */
+static int
+parse_list (const char *str, int *values, int max)
+{
+  char *copy = strdup (str);
+  char *saveptr;
+  char *token;
+  int n = 0;
+
+  for (token = strtok_r (copy, ",", &saveptr); token && n < max;
+       token = strtok_r (NULL, ",", &saveptr))
+    values[n++] = atoi (token);
+  free (copy);
+  return n;
+}
+
+static void
+print_subflows (microtcp_mp_t *mp, int count, double elapsed, size_t total)
+{
+  microtcp_mp_subflow_info_t info;
+  int i;
+
+  printf ("%zu bytes in %.3f s, %.2f Mbit/s\n", total, elapsed,
+          elapsed > 0 ? total * 8 / elapsed / 1e6 : 0);
+  for (i = 0; i < count; i++) {
+    if (microtcp_mp_get_info (mp, i, &info) == -1)
+      continue;
+    printf ("subflow %d: %llu chunks, %llu bytes (%.1f%%), srtt %u us, cwnd %u, "
+            "%llu retransmitted, %llu timeouts\n",
+            i, (unsigned long long) info.chunks, (unsigned long long) info.bytes,
+            total ? info.bytes * 100.0 / total : 0, info.info.srtt_us, info.info.cwnd,
+            (unsigned long long) info.info.packets_retransmitted,
+            (unsigned long long) info.info.timeouts);
+  }
+}
+
+static double
+seconds_since (const struct timespec *start)
+{
+  struct timespec now;
+
+  clock_gettime (CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) * 1e-9;
+}
+
+int
+main (int argc, char **argv)
+{
+  int opt;
+  int is_server = 0;
+  int ports[MICROTCP_MP_MAX_SUBFLOWS];
+  int weights[MICROTCP_MP_MAX_SUBFLOWS] = { 0 };
+  int count = 0;
+  const char *address = "127.0.0.1";
+  const char *file = NULL;
+  microtcp_mp_scheduler_t scheduler = MICROTCP_MP_MIN_RTT;
+  struct sockaddr_in sin[MICROTCP_MP_MAX_SUBFLOWS];
+  microtcp_mp_path_t path[MICROTCP_MP_MAX_SUBFLOWS];
+  microtcp_mp_t *mp;
+  struct timespec start;
+  uint8_t *buffer;
+  FILE *fp;
+  size_t total = 0;
+  ssize_t n;
+  int i, failed = 0;
+
+  while ((opt = getopt (argc, argv, "hsp:a:f:x:w:")) != -1) {
+    switch (opt)
+      {
+      case 's':
+        is_server = 1;
+        break;
+      case 'p':
+        count = parse_list (optarg, ports, MICROTCP_MP_MAX_SUBFLOWS);
+        break;
+      case 'a':
+        address = optarg;
+        break;
+      case 'f':
+        file = optarg;
+        break;
+      case 'x':
+        scheduler = strcmp (optarg, "wrr") ? MICROTCP_MP_MIN_RTT : MICROTCP_MP_WEIGHTED;
+        break;
+      case 'w':
+        parse_list (optarg, weights, MICROTCP_MP_MAX_SUBFLOWS);
+        break;
+      default:
+        printf (
+            "Usage: multipath -s -p ports [-f file]\n"
+            "       multipath [-a address] -p ports [-x minrtt|wrr] [-w weights] -f file\n"
+            "Options:\n"
+            "   -s                  Receive, otherwise send\n"
+            "   -p <int list>       One port per subflow, e.g. 7000,7001: the ports the receiver\n"
+            "                       listens on, or the ones the sender connects to\n"
+            "   -a <string>         The IP address of the receiver (default 127.0.0.1)\n"
+            "   -f <string>         The file to send, or where the receiver saves the data\n"
+            "   -x <minrtt|wrr>     Scheduler of the sender (default minrtt)\n"
+            "   -w <int list>       Subflow weights of the wrr scheduler, e.g. 4,1\n"
+            "   -h                  prints this help\n");
+        exit (EXIT_FAILURE);
+      }
+  }
+  if (!count || (!is_server && !file)) {
+    fprintf (stderr, "Error: Give the subflow ports and the file to send.\n");
+    return EXIT_FAILURE;
+  }
+
+  memset (path, 0, sizeof(path));
+  for (i = 0; i < count; i++) {
+    memset (&sin[i], 0, sizeof(sin[i]));
+    sin[i].sin_family = AF_INET;
+    sin[i].sin_port = htons (ports[i]);
+    sin[i].sin_addr.s_addr = is_server ? htonl (INADDR_ANY) : inet_addr (address);
+    if (is_server) {
+      path[i].local = (struct sockaddr *) &sin[i];
+      path[i].local_len = sizeof(sin[i]);
+    }
+    else {
+      path[i].remote = (struct sockaddr *) &sin[i];
+      path[i].remote_len = sizeof(sin[i]);
+    }
+    path[i].weight = weights[i];
+  }
+
+  fp = file ? fopen (file, is_server ? "w" : "r") : NULL;
+  buffer = malloc (MULTIPATH_BUFFER);
+  if ((file && !fp) || !buffer) {
+    fprintf (stderr, "Error: Could not open %s.\n", file);
+    return EXIT_FAILURE;
+  }
+
+  if (is_server) {
+    mp = microtcp_mp_accept (path, count);
+    if (!mp)
+      return EXIT_FAILURE;
+    clock_gettime (CLOCK_MONOTONIC, &start);
+    while ((n = microtcp_mp_recv (mp, buffer, MULTIPATH_BUFFER)) > 0) {
+      if (fp && fwrite (buffer, 1, n, fp) != (size_t) n) {
+        fprintf (stderr, "Error: Could not write the file.\n");
+        n = -1;
+        break;
+      }
+      total += n;
+    }
+    failed = n == -1;
+  }
+  else {
+    mp = microtcp_mp_connect (path, count, scheduler);
+    if (!mp)
+      return EXIT_FAILURE;
+    clock_gettime (CLOCK_MONOTONIC, &start);
+    while ((n = fread (buffer, 1, MULTIPATH_BUFFER, fp)) > 0) {
+      if (microtcp_mp_send (mp, buffer, n) == -1) {
+        failed = 1;
+        break;
+      }
+      total += n;
+    }
+  }
+
+  if (!is_server && !failed)
+    failed = microtcp_mp_flush (mp) == -1;
+  print_subflows (mp, count, seconds_since (&start), total);
+  failed |= microtcp_mp_close (mp) == -1;
+  if (fp)
+    fclose (fp);
+  free (buffer);
+  return failed ? EXIT_FAILURE : 0;
+}
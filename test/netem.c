@@ -0,0 +1,472 @@
+/*
+ * microtcp, a lightweight implementation of TCP for teaching,
+ * and academic purposes.
+ *
+ * Copyright (C) 2015-2017  Manolis Surligas <surligas@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+#include "netem.h"
+
+static volatile sig_atomic_t proxy_stop;
+
+static uint64_t
+now_us (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* splitmix64, uniform in [0, 1) */
+static double
+netem_random (netem_t *em)
+{
+  uint64_t z = (em->rng += 0x9e3779b97f4a7c15ULL);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  z ^= z >> 31;
+  return (z >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static int
+parse_time (const char *str, uint32_t *us)
+{
+  char *end;
+  double value = strtod (str, &end);
+  if (end == str || value < 0)
+    return -1;
+  if (!strcmp (end, "us"))
+    *us = value;
+  else if (!strcmp (end, "ms") || !*end)
+    *us = value * 1e3;
+  else if (!strcmp (end, "s"))
+    *us = value * 1e6;
+  else
+    return -1;
+  return 0;
+}
+
+static int
+parse_rate (const char *str, uint64_t *bps)
+{
+  char *end;
+  double value = strtod (str, &end);
+  if (end == str || value < 0)
+    return -1;
+  if (!strcmp (end, "kbit"))
+    value *= 1e3;
+  else if (!strcmp (end, "mbit"))
+    value *= 1e6;
+  else if (!strcmp (end, "gbit"))
+    value *= 1e9;
+  else if (*end && strcmp (end, "bit"))
+    return -1;
+  *bps = value;
+  return 0;
+}
+
+/* "1.5%" or a fraction like "0.015" */
+static int
+parse_probability (const char *str, double *p)
+{
+  char *end;
+  double value = strtod (str, &end);
+  if (end == str)
+    return -1;
+  if (*end == '%') {
+    value /= 100;
+    end++;
+  }
+  if (*end || value < 0 || value > 1)
+    return -1;
+  *p = value;
+  return 0;
+}
+
+static int
+parse_ge (char *str, netem_config_t *cfg)
+{
+  double *fields[] = { &cfg->ge_p, &cfg->ge_r, &cfg->ge_bad_loss, &cfg->ge_good_loss };
+  char *saveptr;
+  char *token;
+  int n = 0;
+
+  for (token = strtok_r (str, ":", &saveptr); token && n < 4;
+       token = strtok_r (NULL, ":", &saveptr))
+    if (parse_probability (token, fields[n++]) == -1)
+      return -1;
+  if (n < 2)
+    return -1;
+  cfg->ge = 1;
+  return 0;
+}
+
+int
+netem_parse (netem_config_t *cfg, const char *spec)
+{
+  char *copy;
+  char *saveptr;
+  char *token;
+  char *value;
+  int ret = 0;
+
+  memset (cfg, 0, sizeof(*cfg));
+  cfg->ge_bad_loss = 1;
+  cfg->reorder_us = NETEM_DEFAULT_REORDER_US;
+  cfg->limit = NETEM_DEFAULT_LIMIT;
+  cfg->seed = 1;
+  if (!spec)
+    return 0;
+
+  copy = strdup (spec);
+  for (token = strtok_r (copy, ",", &saveptr); token && !ret;
+       token = strtok_r (NULL, ",", &saveptr)) {
+    value = strchr (token, '=');
+    if (!value) {
+      ret = -1;
+      break;
+    }
+    *value++ = '\0';
+    if (!strcmp (token, "delay"))
+      ret = parse_time (value, &cfg->delay_us);
+    else if (!strcmp (token, "jitter"))
+      ret = parse_time (value, &cfg->jitter_us);
+    else if (!strcmp (token, "rate"))
+      ret = parse_rate (value, &cfg->rate_bps);
+    else if (!strcmp (token, "loss"))
+      ret = parse_probability (value, &cfg->loss);
+    else if (!strcmp (token, "ge"))
+      ret = parse_ge (value, cfg);
+    else if (!strcmp (token, "dup"))
+      ret = parse_probability (value, &cfg->dup);
+    else if (!strcmp (token, "reorder"))
+      ret = parse_probability (value, &cfg->reorder);
+    else if (!strcmp (token, "reorder_delay"))
+      ret = parse_time (value, &cfg->reorder_us);
+    else if (!strcmp (token, "limit"))
+      cfg->limit = atoi (value);
+    else if (!strcmp (token, "seed"))
+      cfg->seed = strtoull (value, NULL, 0);
+    else
+      ret = -1;
+  }
+  if (ret)
+    fprintf (stderr, "Error: Bad impairment '%s' in '%s'.\n", token, spec);
+  free (copy);
+  return ret;
+}
+
+void
+netem_init (netem_t *em, const netem_config_t *cfg)
+{
+  memset (em, 0, sizeof(*em));
+  em->cfg = *cfg;
+  em->rng = cfg->seed;
+}
+
+void
+netem_free (netem_t *em)
+{
+  size_t i;
+  for (i = 0; i < em->queued; i++)
+    free (em->heap[i].data);
+  free (em->heap);
+  em->heap = NULL;
+  em->queued = em->capacity = 0;
+}
+
+static int
+packet_before (const netem_packet_t *a, const netem_packet_t *b)
+{
+  return a->due_us < b->due_us || (a->due_us == b->due_us && a->order < b->order);
+}
+
+static int
+heap_push (netem_t *em, netem_packet_t packet)
+{
+  netem_packet_t tmp;
+  size_t i;
+
+  if (em->queued == em->capacity) {
+    size_t capacity = em->capacity ? em->capacity * 2 : 64;
+    netem_packet_t *heap = realloc (em->heap, capacity * sizeof(netem_packet_t));
+    if (!heap)
+      return -1;
+    em->heap = heap;
+    em->capacity = capacity;
+  }
+  i = em->queued++;
+  em->heap[i] = packet;
+  while (i && packet_before (&em->heap[i], &em->heap[(i - 1) / 2])) {
+    tmp = em->heap[i];
+    em->heap[i] = em->heap[(i - 1) / 2];
+    em->heap[(i - 1) / 2] = tmp;
+    i = (i - 1) / 2;
+  }
+  return 0;
+}
+
+static netem_packet_t
+heap_pop (netem_t *em)
+{
+  netem_packet_t top = em->heap[0];
+  netem_packet_t tmp;
+  size_t i = 0;
+  size_t child;
+
+  em->heap[0] = em->heap[--em->queued];
+  while ((child = 2 * i + 1) < em->queued) {
+    if (child + 1 < em->queued && packet_before (&em->heap[child + 1], &em->heap[child]))
+      child++;
+    if (!packet_before (&em->heap[child], &em->heap[i]))
+      break;
+    tmp = em->heap[i];
+    em->heap[i] = em->heap[child];
+    em->heap[child] = tmp;
+    i = child;
+  }
+  return top;
+}
+
+static int
+netem_lost (netem_t *em)
+{
+  if (!em->cfg.ge)
+    return em->cfg.loss > 0 && netem_random (em) < em->cfg.loss;
+  if (em->ge_bad) {
+    if (netem_random (em) < em->cfg.ge_r)
+      em->ge_bad = 0;
+  }
+  else if (netem_random (em) < em->cfg.ge_p)
+    em->ge_bad = 1;
+  return netem_random (em) < (em->ge_bad ? em->cfg.ge_bad_loss : em->cfg.ge_good_loss);
+}
+
+int
+netem_enqueue (netem_t *em, const void *data, size_t len, uint64_t now_us)
+{
+  netem_packet_t packet;
+  int64_t due;
+  int copies = 1;
+  int queued = 0;
+
+  if (netem_lost (em)) {
+    em->dropped++;
+    return 0;
+  }
+  if (em->cfg.dup > 0 && netem_random (em) < em->cfg.dup) {
+    em->duplicated++;
+    copies = 2;
+  }
+  while (copies--) {
+    if (em->queued >= em->cfg.limit) {
+      em->dropped++;
+      continue;
+    }
+    due = now_us;
+    /* Serialization on the rate limited link, then propagation */
+    if (em->cfg.rate_bps) {
+      em->link_free_us = (em->link_free_us > now_us ? em->link_free_us : now_us)
+          + len * 8 * 1000000 / em->cfg.rate_bps;
+      due = em->link_free_us;
+    }
+    due += em->cfg.delay_us;
+    if (em->cfg.jitter_us)
+      due += (int64_t) (netem_random (em) * (2.0 * em->cfg.jitter_us + 1)) - em->cfg.jitter_us;
+    if (em->cfg.reorder > 0 && netem_random (em) < em->cfg.reorder) {
+      due += em->cfg.reorder_us;
+      em->reordered++;
+    }
+    packet.due_us = due < (int64_t) now_us ? now_us : (uint64_t) due;
+    packet.order = em->order++;
+    packet.len = len;
+    packet.data = malloc (len ? len : 1);
+    if (!packet.data || heap_push (em, packet) == -1) {
+      free (packet.data);
+      em->dropped++;
+      continue;
+    }
+    memcpy (packet.data, data, len);
+    queued++;
+  }
+  em->passed += queued > 0;
+  return queued;
+}
+
+int
+netem_next_due (const netem_t *em, uint64_t *due_us)
+{
+  if (!em->queued)
+    return 0;
+  *due_us = em->heap[0].due_us;
+  return 1;
+}
+
+ssize_t
+netem_dequeue (netem_t *em, uint64_t now_us, void *buf, size_t len)
+{
+  netem_packet_t packet;
+
+  if (!em->queued || em->heap[0].due_us > now_us)
+    return -1;
+  packet = heap_pop (em);
+  len = packet.len < len ? packet.len : len;
+  memcpy (buf, packet.data, len);
+  free (packet.data);
+  return len;
+}
+
+static void
+proxy_signal (int sig)
+{
+  (void) sig;
+  proxy_stop = 1;
+}
+
+static void
+proxy_report (const char *name, const netem_t *em)
+{
+  fprintf (stderr, "%-4s passed %llu dropped %llu duplicated %llu reordered %llu queued %zu\n",
+           name, (unsigned long long) em->passed, (unsigned long long) em->dropped,
+           (unsigned long long) em->duplicated, (unsigned long long) em->reordered,
+           em->queued);
+}
+
+int
+netem_proxy_run (uint16_t listen_port, const struct sockaddr_in *server,
+                 const netem_config_t *up_cfg, const netem_config_t *down_cfg,
+                 int verbose)
+{
+  static uint8_t buf[65536];
+  struct sockaddr_in bind_addr;
+  struct sockaddr_in client;
+  socklen_t client_len;
+  struct pollfd fds[2];
+  struct sigaction sa;
+  struct timespec ts;
+  netem_t up;
+  netem_t down;
+  uint64_t now;
+  uint64_t due;
+  uint64_t next;
+  uint64_t last_report = 0;
+  int have_client = 0;
+  int have_due;
+  ssize_t n;
+  int ret = 0;
+
+  fds[0].fd = socket (AF_INET, SOCK_DGRAM, 0);
+  fds[1].fd = socket (AF_INET, SOCK_DGRAM, 0);
+  if (fds[0].fd == -1 || fds[1].fd == -1) {
+    perror ("Proxy socket");
+    return -1;
+  }
+  memset (&bind_addr, 0, sizeof(bind_addr));
+  bind_addr.sin_family = AF_INET;
+  bind_addr.sin_port = htons (listen_port);
+  bind_addr.sin_addr.s_addr = INADDR_ANY;
+  if (bind (fds[0].fd, (struct sockaddr *) &bind_addr, sizeof(bind_addr)) == -1
+      || connect (fds[1].fd, (const struct sockaddr *) server, sizeof(*server)) == -1) {
+    perror ("Proxy bind/connect");
+    close (fds[0].fd);
+    close (fds[1].fd);
+    return -1;
+  }
+  fds[0].events = fds[1].events = POLLIN;
+
+  memset (&sa, 0, sizeof(sa));
+  sa.sa_handler = proxy_signal;
+  sigaction (SIGINT, &sa, NULL);
+  sigaction (SIGTERM, &sa, NULL);
+
+  netem_init (&up, up_cfg);
+  netem_init (&down, down_cfg);
+  /* The two directions must not share a random sequence */
+  down.rng = ~down.rng;
+
+  while (!proxy_stop) {
+    now = now_us ();
+    while ((n = netem_dequeue (&up, now, buf, sizeof(buf))) >= 0)
+      send (fds[1].fd, buf, n, 0);
+    while ((n = netem_dequeue (&down, now, buf, sizeof(buf))) >= 0)
+      if (have_client)
+        sendto (fds[0].fd, buf, n, 0, (struct sockaddr *) &client, sizeof(client));
+
+    if (verbose && now - last_report >= 1000000) {
+      proxy_report ("up", &up);
+      proxy_report ("down", &down);
+      last_report = now;
+    }
+
+    have_due = netem_next_due (&up, &next);
+    if (netem_next_due (&down, &due) && (!have_due || due < next)) {
+      next = due;
+      have_due = 1;
+    }
+    if (verbose && (!have_due || next > last_report + 1000000)) {
+      next = last_report + 1000000;
+      have_due = 1;
+    }
+    if (have_due) {
+      next = next > now ? next - now : 0;
+      ts.tv_sec = next / 1000000;
+      ts.tv_nsec = (next % 1000000) * 1000;
+    }
+    if (ppoll (fds, 2, have_due ? &ts : NULL, NULL) == -1) {
+      if (errno == EINTR)
+        continue;
+      perror ("Proxy poll");
+      ret = -1;
+      break;
+    }
+    if (fds[0].revents & (POLLIN | POLLERR)) {
+      client_len = sizeof(client);
+      /* The latest sender is the client, so consecutive runs can share a proxy */
+      n = recvfrom (fds[0].fd, buf, sizeof(buf), 0, (struct sockaddr *) &client, &client_len);
+      if (n >= 0) {
+        have_client = 1;
+        netem_enqueue (&up, buf, n, now_us ());
+      }
+    }
+    if (fds[1].revents & (POLLIN | POLLERR)) {
+      n = recv (fds[1].fd, buf, sizeof(buf), 0);
+      if (n >= 0)
+        netem_enqueue (&down, buf, n, now_us ());
+    }
+  }
+
+  if (verbose) {
+    proxy_report ("up", &up);
+    proxy_report ("down", &down);
+  }
+  netem_free (&up);
+  netem_free (&down);
+  close (fds[0].fd);
+  close (fds[1].fd);
+  return ret;
+}
@@ -0,0 +1,125 @@
+/*
+ * microtcp, a lightweight implementation of TCP for teaching,
+ * and academic purposes.
+ *
+ * Copyright (C) 2015-2017  Manolis Surligas <surligas@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TEST_NETEM_H_
+#define TEST_NETEM_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <netinet/in.h>
+
+/*
+ * A small userspace netem: datagrams go in with netem_enqueue() and come
+ * out of netem_dequeue() once their departure time has come, after delay,
+ * jitter, a bandwidth limit, random or Gilbert-Elliott loss, duplication
+ * and reordering were applied. All randomness comes from one seeded
+ * generator, so a run can be repeated exactly.
+ *
+ * Impairments are given as a comma separated spec, for example
+ *   "delay=20ms,jitter=5ms,rate=10mbit,loss=1%,dup=0.1%,reorder=2%"
+ *   "ge=1%:30%:100%:0%"   Gilbert-Elliott p:r:bad_loss:good_loss
+ * Times take us/ms/s suffixes, rates kbit/mbit/gbit, probabilities %.
+ */
+
+#define NETEM_DEFAULT_LIMIT 1000      /* Packets queued before tail drop */
+#define NETEM_DEFAULT_REORDER_US 1000 /* Extra delay of a reordered packet */
+
+typedef struct
+{
+  uint32_t delay_us;
+  uint32_t jitter_us;           /* Uniform in [-jitter, +jitter] */
+  uint64_t rate_bps;            /* Bits per second, 0 for unlimited */
+  double loss;                  /* Independent loss probability */
+  int ge;                       /* Gilbert-Elliott loss instead of loss */
+  double ge_p;                  /* Good to bad transition probability */
+  double ge_r;                  /* Bad to good transition probability */
+  double ge_bad_loss;
+  double ge_good_loss;
+  double dup;
+  double reorder;
+  uint32_t reorder_us;
+  uint32_t limit;
+  uint64_t seed;
+} netem_config_t;
+
+typedef struct
+{
+  uint64_t due_us;
+  uint64_t order;               /* Breaks ties in arrival order */
+  size_t len;
+  uint8_t *data;
+} netem_packet_t;
+
+typedef struct
+{
+  netem_config_t cfg;
+  uint64_t rng;
+  int ge_bad;
+  uint64_t link_free_us;        /* When the rate limited link is idle again */
+  netem_packet_t *heap;         /* Min-heap on (due_us, order) */
+  size_t queued;
+  size_t capacity;
+  uint64_t order;
+  uint64_t passed;
+  uint64_t dropped;
+  uint64_t duplicated;
+  uint64_t reordered;
+} netem_t;
+
+/**
+ * Fills cfg from spec, on top of the defaults.
+ * @return 0 on success, -1 on a malformed spec
+ */
+int netem_parse (netem_config_t *cfg, const char *spec);
+
+void netem_init (netem_t *em, const netem_config_t *cfg);
+
+void netem_free (netem_t *em);
+
+/**
+ * Applies the impairments to a datagram that arrived at now_us.
+ * @return the number of copies queued, 0 if it was dropped
+ */
+int netem_enqueue (netem_t *em, const void *data, size_t len, uint64_t now_us);
+
+/**
+ * @return 1 and the departure time of the next packet in due_us, 0 if empty
+ */
+int netem_next_due (const netem_t *em, uint64_t *due_us);
+
+/**
+ * Takes the next packet due at now_us.
+ * @return its length, -1 if none is due. The packet is truncated to len.
+ */
+ssize_t netem_dequeue (netem_t *em, uint64_t now_us, void *buf, size_t len);
+
+/**
+ * UDP relay between a microTCP client and server. Datagrams from the first
+ * peer that sends to listen_port go through up to the server, and the
+ * answers go through down back to it. Runs until a signal kills it.
+ *
+ * @return -1 on a socket error
+ */
+int netem_proxy_run (uint16_t listen_port, const struct sockaddr_in *server,
+                     const netem_config_t *up, const netem_config_t *down,
+                     int verbose);
+
+#endif /* TEST_NETEM_H_ */
@@ -0,0 +1,799 @@
+/*
+ * microtcp, a lightweight implementation of TCP for teaching,
+ * and academic purposes.
+ *
+ * Copyright (C) 2015-2017  Manolis Surligas <surligas@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#include "simnet.h"
+
+#define SIMNET_NEVER UINT64_MAX
+#define SIMNET_SD_BASE 1000           /* Far from the real descriptors */
+#define SIMNET_NET 0x0a000001         /* 10.0.0.1, host 0 */
+#define SIMNET_DATAGRAM_MAX 65536
+
+/* Prefixed to every datagram while it crosses a link */
+typedef struct
+{
+  uint32_t src_ip;
+  uint32_t dst_ip;
+  uint16_t src_port;
+  uint16_t dst_port;
+} simnet_route_t;
+
+typedef struct simnet_datagram
+{
+  struct simnet_datagram *next;
+  struct sockaddr_in src;
+  size_t len;
+  uint8_t data[];
+} simnet_datagram_t;
+
+typedef struct
+{
+  int in_use;
+  int host;
+  uint16_t port;                /* Host order, 0 until bound */
+  int connected;
+  struct sockaddr_in peer;
+  uint32_t timeout_us;
+  simnet_datagram_t *head;
+  simnet_datagram_t *tail;
+} simnet_socket_t;
+
+typedef enum
+{
+  SIMNET_READY,
+  SIMNET_BLOCKED,
+  SIMNET_DONE
+} simnet_state_t;
+
+typedef struct
+{
+  simnet_t *sim;
+  int host;
+  pthread_t thread;
+  pthread_cond_t cond;
+  simnet_state_t state;
+  int wait_sd;                  /* Socket index a blocked endpoint waits on, -1 for none */
+  uint64_t deadline_us;
+  simnet_endpoint_fn fn;
+  void *arg;
+} simnet_endpoint_t;
+
+typedef struct
+{
+  int src;
+  int dst;
+  netem_t em;
+} simnet_link_t;
+
+struct simnet
+{
+  pthread_mutex_t lock;
+  pthread_cond_t done;
+  netem_config_t link_cfg;
+  int shared;
+  uint64_t seed;
+  uint64_t now_us;
+  uint64_t limit_us;
+  simnet_link_t *links;
+  size_t nlinks;
+  simnet_socket_t sockets[SIMNET_MAX_SOCKETS];
+  simnet_endpoint_t endpoints[SIMNET_MAX_HOSTS];
+  int nendpoints;
+  int current;                  /* Endpoint allowed to run, -1 for none */
+  int finished;
+  int failed;
+  uint16_t next_port;
+  simnet_stats_t stats;
+  microtcp_transport_t transport;
+  microtcp_clock_t clock;
+};
+
+static __thread simnet_endpoint_t *sim_self;
+
+static uint64_t
+splitmix64 (uint64_t *state)
+{
+  uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+static void
+fnv1a (uint64_t *hash, const void *data, size_t len)
+{
+  const uint8_t *p = data;
+  size_t i;
+
+  for (i = 0; i < len; i++) {
+    *hash ^= p[i];
+    *hash *= 0x100000001b3ULL;
+  }
+}
+
+struct sockaddr_in
+simnet_address (int host, uint16_t port)
+{
+  struct sockaddr_in addr;
+
+  memset (&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl (SIMNET_NET + host);
+  addr.sin_port = htons (port);
+  return addr;
+}
+
+static int
+sim_host_of (uint32_t ip)
+{
+  uint32_t host = ntohl (ip) - SIMNET_NET;
+  return host < SIMNET_MAX_HOSTS ? (int) host : -1;
+}
+
+static simnet_socket_t *
+sim_socket_get (simnet_t *sim, int sd)
+{
+  int i = sd - SIMNET_SD_BASE;
+
+  if (i < 0 || i >= SIMNET_MAX_SOCKETS || !sim->sockets[i].in_use) {
+    errno = EBADF;
+    return NULL;
+  }
+  return &sim->sockets[i];
+}
+
+static simnet_link_t *
+sim_link (simnet_t *sim, int src, int dst)
+{
+  netem_config_t cfg;
+  simnet_link_t *link;
+  uint64_t state;
+  size_t i;
+
+  if (sim->shared) {
+    dst = src > dst;
+    src = -1;
+  }
+  for (i = 0; i < sim->nlinks; i++)
+    if (sim->links[i].src == src && sim->links[i].dst == dst)
+      return &sim->links[i];
+
+  link = realloc (sim->links, (sim->nlinks + 1) * sizeof(simnet_link_t));
+  if (!link)
+    return NULL;
+  sim->links = link;
+  link = &sim->links[sim->nlinks++];
+  link->src = src;
+  link->dst = dst;
+  cfg = sim->link_cfg;
+  state = sim->seed ^ ((uint64_t) (src + 1) << 32 | (uint32_t) dst);
+  cfg.seed = splitmix64 (&state);
+  netem_init (&link->em, &cfg);
+  return link;
+}
+
+static void
+sim_bind_ephemeral (simnet_t *sim, simnet_socket_t *sock)
+{
+  if (!sock->port)
+    sock->port = SIMNET_EPHEMERAL_PORT + sim->next_port++ % (65536 - SIMNET_EPHEMERAL_PORT);
+}
+
+/* Hands the datagrams due by now from the links to their sockets */
+static void
+sim_deliver (simnet_t *sim)
+{
+  static uint8_t buffer[sizeof(simnet_route_t) + SIMNET_DATAGRAM_MAX];
+  simnet_datagram_t *dgram;
+  simnet_socket_t *sock;
+  simnet_route_t route;
+  uint64_t due;
+  ssize_t len;
+  size_t i;
+  int j, host;
+
+  for (i = 0; i < sim->nlinks; i++) {
+    while (netem_next_due (&sim->links[i].em, &due) && due <= sim->now_us) {
+      len = netem_dequeue (&sim->links[i].em, sim->now_us, buffer, sizeof(buffer));
+      if (len < (ssize_t) sizeof(route))
+        continue;
+      memcpy (&route, buffer, sizeof(route));
+      len -= sizeof(route);
+      host = sim_host_of (route.dst_ip);
+
+      sock = NULL;
+      for (j = 0; j < SIMNET_MAX_SOCKETS; j++) {
+        if (sim->sockets[j].in_use && sim->sockets[j].host == host
+            && sim->sockets[j].port == ntohs (route.dst_port)) {
+          sock = &sim->sockets[j];
+          break;
+        }
+      }
+      /* A connected socket only hears from its peer, as with UDP */
+      if (!sock || (sock->connected && (sock->peer.sin_addr.s_addr != route.src_ip
+                                         || sock->peer.sin_port != route.src_port))) {
+        sim->stats.dropped++;
+        continue;
+      }
+      dgram = malloc (sizeof(simnet_datagram_t) + len);
+      if (!dgram) {
+        sim->stats.dropped++;
+        continue;
+      }
+      dgram->next = NULL;
+      memset (&dgram->src, 0, sizeof(dgram->src));
+      dgram->src.sin_family = AF_INET;
+      dgram->src.sin_addr.s_addr = route.src_ip;
+      dgram->src.sin_port = route.src_port;
+      dgram->len = len;
+      memcpy (dgram->data, buffer + sizeof(route), len);
+      if (sock->tail)
+        sock->tail->next = dgram;
+      else
+        sock->head = dgram;
+      sock->tail = dgram;
+
+      sim->stats.delivered++;
+      fnv1a (&sim->stats.digest, &sim->now_us, sizeof(sim->now_us));
+      fnv1a (&sim->stats.digest, buffer, sizeof(route) + len);
+    }
+  }
+}
+
+static uint64_t
+sim_next_event (simnet_t *sim)
+{
+  uint64_t next = SIMNET_NEVER;
+  uint64_t due;
+  size_t i;
+  int j;
+
+  for (i = 0; i < sim->nlinks; i++)
+    if (netem_next_due (&sim->links[i].em, &due) && due < next)
+      next = due;
+  for (j = 0; j < sim->nendpoints; j++)
+    if (sim->endpoints[j].state == SIMNET_BLOCKED && sim->endpoints[j].deadline_us < next)
+      next = sim->endpoints[j].deadline_us;
+  return next;
+}
+
+/*
+ * Gives the baton to the next ready endpoint, round robin after the
+ * current one, advancing the clock while nobody is ready. Called with the
+ * lock held by the endpoint that stops running.
+ */
+static void
+sim_switch (simnet_t *sim)
+{
+  simnet_endpoint_t *ep;
+  uint64_t next;
+  int i, n, done;
+
+  for (;;) {
+    done = 0;
+    for (i = 1; i <= sim->nendpoints; i++) {
+      n = (sim->current + i + sim->nendpoints) % sim->nendpoints;
+      ep = &sim->endpoints[n];
+      if (ep->state == SIMNET_READY) {
+        sim->current = n;
+        sim->stats.wakeups++;
+        pthread_cond_signal (&ep->cond);
+        return;
+      }
+      done += ep->state == SIMNET_DONE;
+    }
+    if (done == sim->nendpoints) {
+      sim->finished = 1;
+      break;
+    }
+
+    next = sim_next_event (sim);
+    if (next == SIMNET_NEVER || (sim->limit_us && next > sim->limit_us)) {
+      sim->failed = 1;
+      break;
+    }
+    if (next > sim->now_us)
+      sim->now_us = next;
+    sim_deliver (sim);
+    for (i = 0; i < sim->nendpoints; i++) {
+      ep = &sim->endpoints[i];
+      if (ep->state == SIMNET_BLOCKED
+          && ((ep->wait_sd >= 0 && sim->sockets[ep->wait_sd].head) || ep->deadline_us <= sim->now_us))
+        ep->state = SIMNET_READY;
+    }
+  }
+  sim->current = -1;
+  pthread_cond_signal (&sim->done);
+}
+
+static void
+sim_wait_turn (simnet_t *sim, simnet_endpoint_t *ep)
+{
+  while (sim->current != ep - sim->endpoints)
+    pthread_cond_wait (&ep->cond, &sim->lock);
+}
+
+static int
+sim_socket (void *ctx, int domain, int type, int protocol)
+{
+  simnet_t *sim = ctx;
+  int i;
+
+  if (!sim_self) {
+    errno = EPERM;
+    return -1;
+  }
+  if (domain != AF_INET || type != SOCK_DGRAM) {
+    errno = EAFNOSUPPORT;
+    return -1;
+  }
+  pthread_mutex_lock (&sim->lock);
+  for (i = 0; i < SIMNET_MAX_SOCKETS && sim->sockets[i].in_use; i++)
+    ;
+  if (i < SIMNET_MAX_SOCKETS) {
+    memset (&sim->sockets[i], 0, sizeof(simnet_socket_t));
+    sim->sockets[i].in_use = 1;
+    sim->sockets[i].host = sim_self->host;
+  }
+  pthread_mutex_unlock (&sim->lock);
+  if (i == SIMNET_MAX_SOCKETS) {
+    errno = EMFILE;
+    return -1;
+  }
+  return SIMNET_SD_BASE + i;
+}
+
+static int
+sim_bind (void *ctx, int sd, const struct sockaddr *address, socklen_t address_len)
+{
+  const struct sockaddr_in *in = (const struct sockaddr_in *) address;
+  simnet_t *sim = ctx;
+  simnet_socket_t *sock;
+  int i, ret = -1;
+
+  pthread_mutex_lock (&sim->lock);
+  if (!(sock = sim_socket_get (sim, sd)))
+    goto out;
+  if (address_len < sizeof(*in) || in->sin_family != AF_INET
+      || (in->sin_addr.s_addr != htonl (INADDR_ANY)
+          && sim_host_of (in->sin_addr.s_addr) != sock->host)) {
+    errno = EADDRNOTAVAIL;
+    goto out;
+  }
+  for (i = 0; i < SIMNET_MAX_SOCKETS; i++) {
+    if (sim->sockets[i].in_use && &sim->sockets[i] != sock && sim->sockets[i].host == sock->host
+        && sim->sockets[i].port == ntohs (in->sin_port)) {
+      errno = EADDRINUSE;
+      goto out;
+    }
+  }
+  sock->port = ntohs (in->sin_port);
+  sim_bind_ephemeral (sim, sock);
+  ret = 0;
+out:
+  pthread_mutex_unlock (&sim->lock);
+  return ret;
+}
+
+static int
+sim_connect (void *ctx, int sd, const struct sockaddr *address, socklen_t address_len)
+{
+  simnet_t *sim = ctx;
+  simnet_socket_t *sock;
+  int ret = -1;
+
+  pthread_mutex_lock (&sim->lock);
+  if (!(sock = sim_socket_get (sim, sd)))
+    goto out;
+  if (address_len < sizeof(struct sockaddr_in) || address->sa_family != AF_INET) {
+    errno = EAFNOSUPPORT;
+    goto out;
+  }
+  memcpy (&sock->peer, address, sizeof(sock->peer));
+  sock->connected = 1;
+  sim_bind_ephemeral (sim, sock);
+  ret = 0;
+out:
+  pthread_mutex_unlock (&sim->lock);
+  return ret;
+}
+
+static int
+sim_getpeername (void *ctx, int sd, struct sockaddr *address, socklen_t *address_len)
+{
+  simnet_t *sim = ctx;
+  simnet_socket_t *sock;
+  int ret = -1;
+
+  pthread_mutex_lock (&sim->lock);
+  if (!(sock = sim_socket_get (sim, sd)))
+    goto out;
+  if (!sock->connected) {
+    errno = ENOTCONN;
+    goto out;
+  }
+  memcpy (address, &sock->peer, MIN (*address_len, sizeof(sock->peer)));
+  *address_len = sizeof(sock->peer);
+  ret = 0;
+out:
+  pthread_mutex_unlock (&sim->lock);
+  return ret;
+}
+
+static int
+sim_getsockname (void *ctx, int sd, struct sockaddr *address, socklen_t *address_len)
+{
+  simnet_t *sim = ctx;
+  simnet_socket_t *sock;
+  struct sockaddr_in local;
+
+  pthread_mutex_lock (&sim->lock);
+  if (!(sock = sim_socket_get (sim, sd))) {
+    pthread_mutex_unlock (&sim->lock);
+    return -1;
+  }
+  local = simnet_address (sock->host, sock->port);
+  pthread_mutex_unlock (&sim->lock);
+  memcpy (address, &local, MIN (*address_len, sizeof(local)));
+  *address_len = sizeof(local);
+  return 0;
+}
+
+static ssize_t
+sim_sendto (void *ctx, int sd, const void *buffer, size_t length, int flags,
+            const struct sockaddr *address, socklen_t address_len)
+{
+  static uint8_t packet[sizeof(simnet_route_t) + SIMNET_DATAGRAM_MAX];
+  const struct sockaddr_in *dst;
+  simnet_t *sim = ctx;
+  simnet_socket_t *sock;
+  simnet_link_t *link;
+  simnet_route_t route;
+  ssize_t ret = -1;
+  int host;
+
+  pthread_mutex_lock (&sim->lock);
+  if (!(sock = sim_socket_get (sim, sd)))
+    goto out;
+  if (address) {
+    if (address_len < sizeof(struct sockaddr_in) || address->sa_family != AF_INET) {
+      errno = EAFNOSUPPORT;
+      goto out;
+    }
+    dst = (const struct sockaddr_in *) address;
+  }
+  else if (sock->connected)
+    dst = &sock->peer;
+  else {
+    errno = EDESTADDRREQ;
+    goto out;
+  }
+  if (length > SIMNET_DATAGRAM_MAX) {
+    errno = EMSGSIZE;
+    goto out;
+  }
+  sim_bind_ephemeral (sim, sock);
+  ret = length;
+  sim->stats.packets++;
+
+  host = sim_host_of (dst->sin_addr.s_addr);
+  if (host < 0 || !(link = sim_link (sim, sock->host, host))) {
+    sim->stats.dropped++;
+    goto out;
+  }
+  route.src_ip = htonl (SIMNET_NET + sock->host);
+  route.dst_ip = dst->sin_addr.s_addr;
+  route.src_port = htons (sock->port);
+  route.dst_port = dst->sin_port;
+  memcpy (packet, &route, sizeof(route));
+  memcpy (packet + sizeof(route), buffer, length);
+  if (!netem_enqueue (&link->em, packet, sizeof(route) + length, sim->now_us))
+    sim->stats.dropped++;
+out:
+  pthread_mutex_unlock (&sim->lock);
+  return ret;
+}
+
+static ssize_t
+sim_send (void *ctx, int sd, const void *buffer, size_t length, int flags)
+{
+  return sim_sendto (ctx, sd, buffer, length, flags, NULL, 0);
+}
+
+static ssize_t
+sim_sendmsg (void *ctx, int sd, const struct msghdr *message, int flags)
+{
+  static uint8_t datagram[SIMNET_DATAGRAM_MAX];
+  size_t len = 0;
+  size_t i;
+
+  /* Only the running endpoint gets here, so the buffer is not shared */
+  for (i = 0; i < message->msg_iovlen; i++) {
+    if (len + message->msg_iov[i].iov_len > sizeof(datagram)) {
+      errno = EMSGSIZE;
+      return -1;
+    }
+    memcpy (datagram + len, message->msg_iov[i].iov_base, message->msg_iov[i].iov_len);
+    len += message->msg_iov[i].iov_len;
+  }
+  return sim_sendto (ctx, sd, datagram, len, flags, message->msg_name, message->msg_namelen);
+}
+
+static ssize_t
+sim_recvfrom (void *ctx, int sd, void *buffer, size_t length, int flags,
+              struct sockaddr *address, socklen_t *address_len)
+{
+  simnet_t *sim = ctx;
+  simnet_socket_t *sock;
+  simnet_datagram_t *dgram;
+  uint64_t deadline;
+  ssize_t ret = -1;
+
+  pthread_mutex_lock (&sim->lock);
+  if (!(sock = sim_socket_get (sim, sd)))
+    goto out;
+  deadline = sock->timeout_us ? sim->now_us + sock->timeout_us : SIMNET_NEVER;
+  while (!sock->head) {
+    if ((flags & MSG_DONTWAIT) || sim->now_us >= deadline || !sim_self) {
+      errno = EAGAIN;
+      goto out;
+    }
+    sim_self->state = SIMNET_BLOCKED;
+    sim_self->wait_sd = sock - sim->sockets;
+    sim_self->deadline_us = deadline;
+    sim_switch (sim);
+    sim_wait_turn (sim, sim_self);
+  }
+
+  dgram = sock->head;
+  ret = MIN (length, dgram->len);
+  memcpy (buffer, dgram->data, ret);
+  if (address) {
+    memcpy (address, &dgram->src, MIN (*address_len, sizeof(dgram->src)));
+    *address_len = sizeof(dgram->src);
+  }
+  if (!(flags & MSG_PEEK)) {
+    sock->head = dgram->next;
+    if (!sock->head)
+      sock->tail = NULL;
+    free (dgram);
+  }
+out:
+  pthread_mutex_unlock (&sim->lock);
+  return ret;
+}
+
+static ssize_t
+sim_recv (void *ctx, int sd, void *buffer, size_t length, int flags)
+{
+  return sim_recvfrom (ctx, sd, buffer, length, flags, NULL, NULL);
+}
+
+static int
+sim_set_timeout (void *ctx, int sd, uint32_t timeout_us)
+{
+  simnet_t *sim = ctx;
+  simnet_socket_t *sock;
+
+  pthread_mutex_lock (&sim->lock);
+  sock = sim_socket_get (sim, sd);
+  if (sock)
+    sock->timeout_us = timeout_us;
+  pthread_mutex_unlock (&sim->lock);
+  return sock ? 0 : -1;
+}
+
+static void
+sim_socket_flush (simnet_socket_t *sock)
+{
+  simnet_datagram_t *next;
+
+  for (; sock->head; sock->head = next) {
+    next = sock->head->next;
+    free (sock->head);
+  }
+  sock->tail = NULL;
+}
+
+static int
+sim_close (void *ctx, int sd)
+{
+  simnet_t *sim = ctx;
+  simnet_socket_t *sock;
+
+  pthread_mutex_lock (&sim->lock);
+  sock = sim_socket_get (sim, sd);
+  if (sock) {
+    sim_socket_flush (sock);
+    sock->in_use = 0;
+  }
+  pthread_mutex_unlock (&sim->lock);
+  return sock ? 0 : -1;
+}
+
+static uint64_t
+sim_now_ns (void *ctx)
+{
+  simnet_t *sim = ctx;
+  return __atomic_load_n (&sim->now_us, __ATOMIC_RELAXED) * 1000;
+}
+
+simnet_t *
+simnet_create (const netem_config_t *link, int shared, uint64_t seed)
+{
+  simnet_t *sim = calloc (1, sizeof(simnet_t));
+
+  if (!sim)
+    return NULL;
+  pthread_mutex_init (&sim->lock, NULL);
+  pthread_cond_init (&sim->done, NULL);
+  sim->link_cfg = *link;
+  sim->shared = shared;
+  sim->seed = seed;
+  sim->current = -1;
+  sim->stats.digest = 0xcbf29ce484222325ULL;
+  sim->transport = (microtcp_transport_t) {
+    sim_socket, sim_bind, sim_connect, sim_getpeername, sim_getsockname, sim_send, sim_recv,
+    sim_sendto, sim_recvfrom, sim_sendmsg, sim_set_timeout, sim_close, sim
+  };
+  sim->clock.now_ns = sim_now_ns;
+  sim->clock.ctx = sim;
+  return sim;
+}
+
+void
+simnet_destroy (simnet_t *sim)
+{
+  size_t i;
+  int j;
+
+  if (!sim)
+    return;
+  for (i = 0; i < sim->nlinks; i++)
+    netem_free (&sim->links[i].em);
+  for (j = 0; j < SIMNET_MAX_SOCKETS; j++)
+    sim_socket_flush (&sim->sockets[j]);
+  for (j = 0; j < sim->nendpoints; j++)
+    pthread_cond_destroy (&sim->endpoints[j].cond);
+  pthread_cond_destroy (&sim->done);
+  pthread_mutex_destroy (&sim->lock);
+  free (sim->links);
+  free (sim);
+}
+
+void
+simnet_install (simnet_t *sim)
+{
+  uint8_t key[16];
+  uint64_t state = sim->seed;
+  uint64_t word;
+
+  word = splitmix64 (&state);
+  memcpy (key, &word, sizeof(word));
+  word = splitmix64 (&state);
+  memcpy (key + sizeof(word), &word, sizeof(word));
+  microtcp_set_secret (key);
+  microtcp_set_clock (&sim->clock);
+  microtcp_set_transport (&sim->transport);
+}
+
+int
+simnet_spawn (simnet_t *sim, simnet_endpoint_fn fn, void *arg)
+{
+  simnet_endpoint_t *ep;
+
+  if (sim->nendpoints == SIMNET_MAX_HOSTS)
+    return -1;
+  ep = &sim->endpoints[sim->nendpoints];
+  memset (ep, 0, sizeof(*ep));
+  ep->sim = sim;
+  ep->host = sim->nendpoints;
+  ep->state = SIMNET_READY;
+  ep->fn = fn;
+  ep->arg = arg;
+  pthread_cond_init (&ep->cond, NULL);
+  return sim->nendpoints++;
+}
+
+static void *
+sim_endpoint_main (void *arg)
+{
+  simnet_endpoint_t *ep = arg;
+  simnet_t *sim = ep->sim;
+
+  sim_self = ep;
+  pthread_mutex_lock (&sim->lock);
+  sim_wait_turn (sim, ep);
+  pthread_mutex_unlock (&sim->lock);
+
+  ep->fn (ep->arg);
+
+  pthread_mutex_lock (&sim->lock);
+  ep->state = SIMNET_DONE;
+  sim_switch (sim);
+  pthread_mutex_unlock (&sim->lock);
+  return NULL;
+}
+
+int
+simnet_run (simnet_t *sim, uint64_t limit_us)
+{
+  int i;
+
+  if (!sim->nendpoints)
+    return 0;
+  for (i = 0; i < sim->nendpoints; i++) {
+    if (pthread_create (&sim->endpoints[i].thread, NULL, sim_endpoint_main, &sim->endpoints[i])) {
+      fprintf (stderr, "Error: Unable to start endpoint %d.\n", i);
+      return -1;
+    }
+  }
+
+  pthread_mutex_lock (&sim->lock);
+  sim->limit_us = limit_us;
+  sim->current = sim->nendpoints - 1;     /* So that endpoint 0 runs first */
+  sim_switch (sim);
+  while (!sim->finished && !sim->failed)
+    pthread_cond_wait (&sim->done, &sim->lock);
+  pthread_mutex_unlock (&sim->lock);
+
+  if (sim->failed) {
+    for (i = 0; i < sim->nendpoints; i++)
+      pthread_detach (sim->endpoints[i].thread);
+    return -1;
+  }
+  for (i = 0; i < sim->nendpoints; i++)
+    pthread_join (sim->endpoints[i].thread, NULL);
+  return 0;
+}
+
+uint64_t
+simnet_now_us (simnet_t *sim)
+{
+  return sim_now_ns (sim) / 1000;
+}
+
+void
+simnet_sleep (simnet_t *sim, uint64_t us)
+{
+  pthread_mutex_lock (&sim->lock);
+  if (sim_self) {
+    sim_self->state = SIMNET_BLOCKED;
+    sim_self->wait_sd = -1;
+    sim_self->deadline_us = sim->now_us + us;
+    sim_switch (sim);
+    sim_wait_turn (sim, sim_self);
+  }
+  pthread_mutex_unlock (&sim->lock);
+}
+
+void
+simnet_get_stats (simnet_t *sim, simnet_stats_t *stats)
+{
+  pthread_mutex_lock (&sim->lock);
+  *stats = sim->stats;
+  pthread_mutex_unlock (&sim->lock);
+}
@@ -0,0 +1,110 @@
+/*
+ * microtcp, a lightweight implementation of TCP for teaching,
+ * and academic purposes.
+ *
+ * Copyright (C) 2015-2017  Manolis Surligas <surligas@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TEST_SIMNET_H_
+#define TEST_SIMNET_H_
+
+#include <stdint.h>
+#include <netinet/in.h>
+
+#include "../lib/microtcp.h"
+#include "netem.h"
+
+/*
+ * In-process network simulator. Every endpoint is a thread running
+ * ordinary blocking microTCP code on its own host, 10.0.0.<n + 1>, over a
+ * transport that hands datagrams to netem links instead of the kernel.
+ *
+ * Only one endpoint runs at a time. When it blocks in a receive, the next
+ * ready one runs, and when none is ready the virtual clock jumps to the
+ * next packet arrival or receive timeout. Time only passes on the links,
+ * so an hour of transfer takes as long as the protocol code needs to run,
+ * and with the ISN secret and the link generators seeded from one seed a
+ * run repeats exactly.
+ *
+ * Each ordered pair of hosts gets its own link, or with shared set all
+ * traffic crosses one link per direction (lower to higher host number and
+ * back), a dumbbell whose rate= is the bottleneck of every flow.
+ */
+
+#define SIMNET_MAX_HOSTS 64
+#define SIMNET_MAX_SOCKETS 256
+#define SIMNET_EPHEMERAL_PORT 49152
+
+typedef struct simnet simnet_t;
+
+typedef void (*simnet_endpoint_fn) (void *arg);
+
+typedef struct
+{
+  uint64_t packets;             /* Datagrams sent */
+  uint64_t delivered;           /* Datagrams that reached a socket */
+  uint64_t dropped;             /* Lost on a link or to an unbound port */
+  uint64_t wakeups;             /* Context switches between endpoints */
+  uint64_t digest;              /* FNV-1a of every delivery, time included */
+} simnet_stats_t;
+
+/**
+ * @param link impairments of every link, its seed is replaced by one
+ *        derived from seed
+ * @param shared 1 for a single link per direction
+ * @return the simulator, NULL on failure
+ */
+simnet_t *simnet_create (const netem_config_t *link, int shared, uint64_t seed);
+
+void simnet_destroy (simnet_t *sim);
+
+/**
+ * Makes the library use the simulated transport and the virtual clock.
+ * Sockets created with microtcp_socket() from now on, in any thread, live
+ * in the simulator.
+ */
+void simnet_install (simnet_t *sim);
+
+/**
+ * Adds an endpoint on a new host. It starts running in simnet_run().
+ * @return the host number, -1 if there are too many
+ */
+int simnet_spawn (simnet_t *sim, simnet_endpoint_fn fn, void *arg);
+
+/**
+ * Runs the endpoints until all of them return.
+ * @param limit_us virtual time after which the run is abandoned, 0 for none
+ * @return 0 on success, -1 on a deadlock or when the limit is reached. The
+ *         endpoints left blocked stay so until the process exits.
+ */
+int simnet_run (simnet_t *sim, uint64_t limit_us);
+
+uint64_t simnet_now_us (simnet_t *sim);
+
+/**
+ * Blocks the calling endpoint for us of virtual time, like the think time
+ * of an application.
+ */
+void simnet_sleep (simnet_t *sim, uint64_t us);
+
+/**
+ * The address of port on a host.
+ */
+struct sockaddr_in simnet_address (int host, uint16_t port);
+
+void simnet_get_stats (simnet_t *sim, simnet_stats_t *stats);
+
+#endif /* TEST_SIMNET_H_ */
@@ -0,0 +1,707 @@
+/*
+ * microtcp, a lightweight implementation of TCP for teaching,
+ * and academic purposes.
+ *
+ * Copyright (C) 2015-2017  Manolis Surligas <surligas@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Bulk transfers over the in-process network simulator, in virtual time.
+ * Each flow is a client sending a known pattern to its own server, which
+ * checks every byte. Two runs with the same seed print the same digest,
+ * e.g.
+ *
+ *   simulate -n 4 -s 100M -b -e "delay=50ms,rate=100mbit,loss=0.5%" -S 7
+ *
+ * With -v both ends split each chunk into buffers of uneven sizes and use
+ * microtcp_sendv() and microtcp_recvv().
+ *
+ * With -f each client first connects to a second port of its server for a
+ * fast open cookie, then sends its first MSS in the SYN of the connection
+ * that is measured. The time to the server's first byte shows the round
+ * trip saved.
+ *
+ * With -m each flow runs over the stream multiplexer. The flow's bytes go
+ * half on stream 1 and half on stream 2, of the same urgency and weights
+ * 16 and 48, queued a chunk each per flush. Every flush also carries an
+ * 8 byte timestamp on stream 4 behind the bulk data, and the first one an
+ * urgency 0 message on stream 3, queued last. The server reports where
+ * the urgent message landed, how far stream 1 got in each round by the
+ * time stream 2 finished it, and the delay of the timestamps, also of
+ * those that arrived while the connection held segments past a gap.
+ *
+ * With -p each client sends its bytes as that many requests, each
+ * answered with one byte, through a connection pool, idle for -i between
+ * them. All but the first request reuse the pooled connection; an idle
+ * time past the RTO restarts their cwnd.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../lib/microtcp.h"
+#include "../lib/microtcp_mux.h"
+#include "../lib/microtcp_pool.h"
+#include "simnet.h"
+
+#define SIMULATE_PORT 9000
+#define SIMULATE_COOKIE_PORT 9001
+#define SIMULATE_MAX_IOV 1024
+/* Streams of -m */
+#define SIMULATE_MUX_BULK 1
+#define SIMULATE_MUX_HEAVY 2
+#define SIMULATE_MUX_URGENT 3
+#define SIMULATE_MUX_TICK 4
+#define SIMULATE_MUX_HEAVY_WEIGHT (3 * MICROTCP_MUX_WEIGHT)
+
+typedef struct
+{
+  int id;
+  int server_host;
+  size_t size;
+  size_t chunk;
+  /* Filled by the endpoints */
+  size_t received;
+  size_t corrupted;
+  uint64_t start_us;
+  uint64_t first_us;
+  uint64_t end_us;
+  size_t syn_bytes;
+  int client_ok;
+  int server_ok;
+  microtcp_info_t info;
+  /* -m */
+  size_t urgent_after;          /* Bulk bytes received before the urgent message */
+  size_t round_share;           /* Stream 1 bytes of each round when stream 2 completed it */
+  size_t rounds;
+  size_t ticks;
+  size_t ticks_past_gap;
+  uint64_t tick_gap_delay_us;
+  uint64_t tick_delay_us;
+  uint64_t tick_delay_max_us;
+  /* -p */
+  uint64_t first_request_us;
+  uint64_t request_us;          /* All requests after the first */
+  size_t reuse_cwnd;            /* Sum of the cwnd of the reused connections */
+  microtcp_pool_stats_t pool;
+} flow_t;
+
+static simnet_t *sim;
+/* Buffers per vector with -v, 0 for plain microtcp_send() and microtcp_recv() */
+static int vector;
+static int fastopen;
+static int mux;
+/* Requests of -p, 0 for one transfer, and the idle time between them */
+static size_t requests;
+static uint64_t idle_us;
+
+static uint8_t
+pattern (const flow_t *flow, size_t offset)
+{
+  return (uint8_t) (offset * 131 + offset / 4093 + flow->id);
+}
+
+/*
+ * Splits len bytes of buffer in vector pieces of uneven sizes, some of
+ * them empty or shorter than a header. Returns the number of pieces.
+ */
+static int
+split (uint8_t *buffer, size_t len, struct iovec *iov)
+{
+  size_t offset = 0;
+  size_t piece;
+  int n;
+
+  for (n = 0; n < vector && offset < len; n++) {
+    piece = n == vector - 1 ? len - offset : MIN (len - offset, (size_t) (n % 19 ? n % 13 : n * 37 % 101 * 29));
+    iov[n].iov_base = buffer + offset;
+    iov[n].iov_len = piece;
+    offset += piece;
+  }
+  if (offset < len)
+    iov[n - 1].iov_len += len - offset;
+  return n;
+}
+
+/*
+ * Accepts the connection on which a fast open client gets its cookie, and
+ * waits for the client to close it.
+ */
+static int
+serve_cookie (flow_t *flow)
+{
+  struct sockaddr_in any = simnet_address (0, SIMULATE_COOKIE_PORT);
+  struct sockaddr_in client;
+  microtcp_sock_t sock;
+  uint8_t byte;
+
+  any.sin_addr.s_addr = htonl (INADDR_ANY);
+  sock = microtcp_socket (AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  if (sock.state == INVALID)
+    return -1;
+  microtcp_set_fastopen (&sock, 1);
+  if (microtcp_bind (&sock, (struct sockaddr *) &any, sizeof(any)) == -1
+      || microtcp_accept (&sock, (struct sockaddr *) &client, sizeof(client)) == -1) {
+    fprintf (stderr, "flow %d: the server could not accept the cookie connection.\n", flow->id);
+    microtcp_close (&sock);
+    return -1;
+  }
+  while (microtcp_recv (&sock, &byte, 1, 0) > 0)
+    ;
+  if (sock.state == CLOSING_BY_PEER)
+    microtcp_shutdown (&sock, SHUT_RDWR);
+  microtcp_close (&sock);
+  return 0;
+}
+
+/* Asks the server of flow for a fast open cookie, which the library caches */
+static int
+fetch_cookie (flow_t *flow)
+{
+  struct sockaddr_in server = simnet_address (flow->server_host, SIMULATE_COOKIE_PORT);
+  microtcp_sock_t sock;
+
+  sock = microtcp_socket (AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  if (sock.state == INVALID)
+    return -1;
+  if (microtcp_connect_fastopen (&sock, (struct sockaddr *) &server, sizeof(server), NULL, 0) == -1) {
+    fprintf (stderr, "flow %d: the client could not get a cookie.\n", flow->id);
+    microtcp_close (&sock);
+    return -1;
+  }
+  microtcp_shutdown (&sock, SHUT_RDWR);
+  microtcp_close (&sock);
+  return 0;
+}
+
+/*
+ * Reads every stream of a -m flow until the peer shuts down. Stream 1
+ * carries the first half of the flow's pattern, stream 2 the second.
+ */
+static void
+mux_server (flow_t *flow, microtcp_sock_t *sock, uint8_t *buffer)
+{
+  microtcp_mux_t *m = microtcp_mux_create (sock);
+  size_t half = flow->size / 2;
+  size_t got[SIMULATE_MUX_TICK + 1] = { 0 };
+  uint8_t tick[sizeof(uint64_t)];
+  uint64_t stamp, delay;
+  uint16_t stream;
+  size_t base, round, i;
+  ssize_t n;
+
+  if (!m)
+    return;
+  for (;;) {
+    stream = MICROTCP_MUX_ANY;
+    if ((n = microtcp_mux_recv (m, &stream, buffer, flow->chunk)) <= 0) {
+      if (n == -1)
+        break;
+      continue;
+    }
+    switch (stream)
+      {
+      case SIMULATE_MUX_BULK:
+      case SIMULATE_MUX_HEAVY:
+        if (!flow->received)
+          flow->first_us = simnet_now_us (sim);
+        base = stream == SIMULATE_MUX_BULK ? 0 : half;
+        for (i = 0; i < (size_t) n; i++)
+          flow->corrupted += buffer[i] != pattern (flow, base + got[stream] + i);
+        flow->received += n;
+        /* Stream 2 completed a round: how much of it did stream 1 get? */
+        if (stream == SIMULATE_MUX_HEAVY)
+          for (round = got[stream] / flow->chunk; (round + 1) * flow->chunk <= got[stream] + n; round++) {
+            flow->round_share += MIN (got[SIMULATE_MUX_BULK] - MIN (got[SIMULATE_MUX_BULK], round * flow->chunk),
+                                      flow->chunk);
+            flow->rounds++;
+          }
+        break;
+      case SIMULATE_MUX_URGENT:
+        if (!got[stream])
+          flow->urgent_after = got[SIMULATE_MUX_BULK] + got[SIMULATE_MUX_HEAVY];
+        break;
+      case SIMULATE_MUX_TICK:
+        for (i = 0; i < (size_t) n; i++) {
+          tick[(got[stream] + i) % sizeof(tick)] = buffer[i];
+          if ((got[stream] + i) % sizeof(tick) != sizeof(tick) - 1)
+            continue;
+          memcpy (&stamp, tick, sizeof(stamp));
+          delay = simnet_now_us (sim) - stamp;
+          flow->ticks++;
+          /* A single ordered stream would have waited for the gap */
+          if (sock->ooo_depth) {
+            flow->ticks_past_gap++;
+            flow->tick_gap_delay_us += delay;
+          }
+          flow->tick_delay_us += delay;
+          if (delay > flow->tick_delay_max_us)
+            flow->tick_delay_max_us = delay;
+        }
+        break;
+      default:
+        flow->corrupted += n;
+      }
+    got[stream] += n;
+  }
+  microtcp_mux_destroy (m);
+}
+
+/*
+ * Sends a -m flow in rounds of a chunk on each bulk stream, followed by a
+ * timestamp. Returns the bulk bytes sent.
+ */
+static size_t
+mux_client (flow_t *flow, microtcp_sock_t *sock, uint8_t *buffer)
+{
+  microtcp_mux_t *m = microtcp_mux_create (sock);
+  size_t half = flow->size / 2;
+  size_t sent = 0;
+  size_t offset, len, i;
+  uint64_t stamp;
+  int stream;
+
+  if (!m)
+    return 0;
+  microtcp_mux_set_priority (m, SIMULATE_MUX_HEAVY, MICROTCP_MUX_URGENCY, SIMULATE_MUX_HEAVY_WEIGHT);
+  microtcp_mux_set_priority (m, SIMULATE_MUX_URGENT, 0, MICROTCP_MUX_WEIGHT);
+  for (offset = 0; offset < flow->size - half; offset += flow->chunk) {
+    for (stream = SIMULATE_MUX_BULK; stream <= SIMULATE_MUX_HEAVY; stream++) {
+      if (stream == SIMULATE_MUX_BULK && offset >= half)
+        continue;
+      len = MIN (flow->chunk, (stream == SIMULATE_MUX_BULK ? half : flow->size - half) - offset);
+      for (i = 0; i < len; i++)
+        buffer[i] = pattern (flow, (stream == SIMULATE_MUX_BULK ? 0 : half) + offset + i);
+      if (microtcp_mux_send (m, stream, buffer, len) == -1)
+        goto out;
+      sent += len;
+    }
+    stamp = simnet_now_us (sim);
+    if (microtcp_mux_send (m, SIMULATE_MUX_TICK, &stamp, sizeof(stamp)) == -1
+        || (!offset && microtcp_mux_send (m, SIMULATE_MUX_URGENT, &stamp, sizeof(stamp)) == -1)
+        || microtcp_mux_flush (m) == -1)
+      goto out;
+  }
+  for (stream = SIMULATE_MUX_BULK; stream <= SIMULATE_MUX_TICK; stream++)
+    if (microtcp_mux_close_stream (m, stream) == -1)
+      goto out;
+  if (microtcp_mux_flush (m) == -1)
+    goto out;
+  microtcp_mux_destroy (m);
+  return sent;
+
+out:
+  fprintf (stderr, "flow %d: the mux failed after %zu bytes.\n", flow->id, sent);
+  microtcp_mux_destroy (m);
+  return 0;
+}
+
+/* Bytes of request r of a -p flow, the last one takes the remainder */
+static size_t
+request_len (const flow_t *flow, size_t r)
+{
+  return r == requests - 1 ? flow->size - r * (flow->size / requests) : flow->size / requests;
+}
+
+/*
+ * Answers every complete request of a -p flow with one byte, until the
+ * pool shuts the connection down.
+ */
+static void
+pool_server (flow_t *flow, microtcp_sock_t *sock, uint8_t *buffer)
+{
+  size_t r = 0, got = 0;
+  uint8_t byte = 0;
+  ssize_t n, i;
+
+  while (r < requests
+         && (n = microtcp_recv (sock, buffer, MIN (flow->chunk, request_len (flow, r) - got), 0)) > 0) {
+    if (!flow->received)
+      flow->first_us = simnet_now_us (sim);
+    for (i = 0; i < n; i++)
+      flow->corrupted += buffer[i] != pattern (flow, flow->received + i);
+    flow->received += n;
+    got += n;
+    if (got == request_len (flow, r)) {
+      if (microtcp_send (sock, &byte, 1, 0) == -1)
+        return;
+      got = 0;
+      r++;
+    }
+  }
+  /* What is left is the shutdown */
+  while (microtcp_recv (sock, buffer, flow->chunk, 0) > 0)
+    flow->corrupted++;
+}
+
+/*
+ * Sends a -p flow as requests through a pool of one connection and waits
+ * for the answer of each. Returns the bytes sent.
+ */
+static size_t
+pool_client (flow_t *flow, const struct sockaddr_in *server, uint8_t *buffer)
+{
+  microtcp_pool_t *pool = microtcp_pool_create (1, 0, 0);
+  microtcp_sock_t sock;
+  size_t sent = 0;
+  size_t r, len, done, i;
+  uint64_t start;
+  uint8_t byte;
+  int ret;
+
+  if (!pool)
+    return 0;
+  for (r = 0; r < requests; r++) {
+    if (r)
+      simnet_sleep (sim, idle_us);
+    start = simnet_now_us (sim);
+    if ((ret = microtcp_pool_get (pool, &sock, (const struct sockaddr *) server, sizeof(*server))) == -1)
+      break;
+    if (ret == 1)
+      flow->reuse_cwnd += sock.cwnd;
+    for (done = 0; done < request_len (flow, r); done += len) {
+      len = MIN (flow->chunk, request_len (flow, r) - done);
+      for (i = 0; i < len; i++)
+        buffer[i] = pattern (flow, sent + done + i);
+      if (microtcp_send (&sock, buffer, len, 0) == -1)
+        break;
+    }
+    if (done < request_len (flow, r) || microtcp_recv (&sock, &byte, 1, 0) != 1) {
+      fprintf (stderr, "flow %d: request %zu failed.\n", flow->id, r);
+      microtcp_close (&sock);
+      break;
+    }
+    sent += done;
+    if (r)
+      flow->request_us += simnet_now_us (sim) - start;
+    else
+      flow->first_request_us = simnet_now_us (sim) - start;
+    microtcp_get_info (&sock, &flow->info, sizeof(flow->info));
+    microtcp_pool_put (pool, &sock);
+  }
+  microtcp_pool_get_stats (pool, &flow->pool);
+  microtcp_pool_destroy (pool);
+  return sent;
+}
+
+static void
+server_endpoint (void *arg)
+{
+  flow_t *flow = arg;
+  struct sockaddr_in any = simnet_address (0, SIMULATE_PORT);
+  struct sockaddr_in client;
+  microtcp_sock_t sock;
+  struct iovec iov[SIMULATE_MAX_IOV];
+  uint8_t *buffer;
+  ssize_t n, i;
+
+  any.sin_addr.s_addr = htonl (INADDR_ANY);
+  sock = microtcp_socket (AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  if (sock.state == INVALID)
+    return;
+  microtcp_set_fastopen (&sock, fastopen);
+  /* Bound first, so that a SYN arriving during the cookie connection waits */
+  if (microtcp_bind (&sock, (struct sockaddr *) &any, sizeof(any)) == -1
+      || (fastopen && serve_cookie (flow) == -1)
+      || microtcp_accept (&sock, (struct sockaddr *) &client, sizeof(client)) == -1) {
+    fprintf (stderr, "flow %d: the server could not accept.\n", flow->id);
+    microtcp_close (&sock);
+    return;
+  }
+  /* What a fast open SYN carried waits in the receive buffer */
+  flow->syn_bytes = sock.buf_fill_level;
+
+  buffer = malloc (flow->chunk);
+  if (mux)
+    mux_server (flow, &sock, buffer);
+  else if (requests)
+    pool_server (flow, &sock, buffer);
+  else
+    while ((n = vector ? microtcp_recvv (&sock, iov, split (buffer, flow->chunk, iov), 0)
+                       : microtcp_recv (&sock, buffer, flow->chunk, 0)) > 0) {
+      if (!flow->received)
+        flow->first_us = simnet_now_us (sim);
+      for (i = 0; i < n; i++)
+        flow->corrupted += buffer[i] != pattern (flow, flow->received + i);
+      flow->received += n;
+    }
+  flow->end_us = simnet_now_us (sim);
+  free (buffer);
+  if (sock.state == CLOSING_BY_PEER) {
+    flow->server_ok = 1;
+    microtcp_shutdown (&sock, SHUT_RDWR);
+  }
+  else
+    fprintf (stderr, "flow %d: the server stopped receiving in state %d.\n", flow->id, sock.state);
+  microtcp_close (&sock);
+}
+
+static void
+client_endpoint (void *arg)
+{
+  flow_t *flow = arg;
+  struct sockaddr_in server = simnet_address (flow->server_host, SIMULATE_PORT);
+  microtcp_sock_t sock;
+  struct iovec iov[SIMULATE_MAX_IOV];
+  uint8_t *buffer;
+  size_t sent, len, i;
+  ssize_t ret;
+
+  if (fastopen && fetch_cookie (flow) == -1)
+    return;
+  if (requests) {
+    buffer = malloc (flow->chunk);
+    flow->start_us = simnet_now_us (sim);
+    flow->client_ok = pool_client (flow, &server, buffer) == flow->size;
+    free (buffer);
+    return;
+  }
+  sock = microtcp_socket (AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  if (sock.state == INVALID)
+    return;
+  buffer = malloc (flow->chunk);
+  flow->start_us = simnet_now_us (sim);
+  if (fastopen) {
+    /* The first segment rides in the SYN */
+    len = MIN (MIN (flow->chunk, flow->size), MICROTCP_MSS);
+    for (i = 0; i < len; i++)
+      buffer[i] = pattern (flow, i);
+    ret = microtcp_connect_fastopen (&sock, (struct sockaddr *) &server, sizeof(server), buffer, len);
+  }
+  else {
+    len = 0;
+    ret = microtcp_connect (&sock, (struct sockaddr *) &server, sizeof(server));
+  }
+  if (ret == -1) {
+    fprintf (stderr, "flow %d: the client could not connect.\n", flow->id);
+    free (buffer);
+    microtcp_close (&sock);
+    return;
+  }
+
+  if (mux)
+    sent = mux_client (flow, &sock, buffer);
+  else
+    for (sent = len; sent < flow->size; sent += len) {
+      len = MIN (flow->chunk, flow->size - sent);
+      for (i = 0; i < len; i++)
+        buffer[i] = pattern (flow, sent + i);
+      ret = vector ? microtcp_sendv (&sock, iov, split (buffer, len, iov), 0)
+                   : microtcp_send (&sock, buffer, len, 0);
+      if (ret == -1) {
+        fprintf (stderr, "flow %d: send failed at byte %zu.\n", flow->id, sent);
+        break;
+      }
+    }
+  free (buffer);
+  flow->client_ok = sent == flow->size;
+  microtcp_get_info (&sock, &flow->info, sizeof(flow->info));
+  microtcp_shutdown (&sock, SHUT_RDWR);
+  microtcp_close (&sock);
+}
+
+static size_t
+parse_size (const char *str)
+{
+  char *end;
+  double value = strtod (str, &end);
+
+  switch (*end)
+    {
+    case 'k':
+    case 'K':
+      return value * 1024;
+    case 'm':
+    case 'M':
+      return value * 1024 * 1024;
+    case 'g':
+    case 'G':
+      return value * 1024 * 1024 * 1024;
+    default:
+      return value;
+    }
+}
+
+int
+main (int argc, char **argv)
+{
+  int opt;
+  int flows = 1;
+  int shared = 0;
+  size_t size = 10 * 1024 * 1024;
+  size_t chunk = 64 * 1024;
+  double limit_s = 24 * 3600;
+  const char *spec = "delay=10ms";
+  uint64_t seed = 1;
+  netem_config_t link;
+  flow_t *flow;
+  simnet_stats_t stats;
+  struct timespec wall_start;
+  struct timespec wall_end;
+  double wall, virt, mbits;
+  int i, ret, failed = 0;
+
+  while ((opt = getopt (argc, argv, "hbfmn:s:c:e:S:t:v:p:i:")) != -1) {
+    switch (opt)
+      {
+      case 'n':
+        flows = atoi (optarg);
+        break;
+      case 's':
+        size = parse_size (optarg);
+        break;
+      case 'c':
+        chunk = parse_size (optarg);
+        break;
+      case 'e':
+        spec = optarg;
+        break;
+      case 'S':
+        seed = strtoull (optarg, NULL, 0);
+        break;
+      case 't':
+        limit_s = atof (optarg);
+        break;
+      case 'b':
+        shared = 1;
+        break;
+      case 'v':
+        vector = atoi (optarg);
+        break;
+      case 'f':
+        fastopen = 1;
+        break;
+      case 'm':
+        mux = 1;
+        break;
+      case 'p':
+        requests = strtoul (optarg, NULL, 0);
+        break;
+      case 'i':
+        idle_us = atof (optarg) * 1000;
+        break;
+      default:
+        printf (
+            "Usage: simulate [-n flows] [-s size] [-c chunk] [-e spec] [-S seed] [-t seconds] [-b] [-v buffers] [-f] [-m] [-p requests [-i ms]]\n"
+            "Options:\n"
+            "   -n <int>            Concurrent flows, each between its own pair of hosts (default 1)\n"
+            "   -s <size>           Bytes each flow sends, k/M/G suffixes (default 10M)\n"
+            "   -c <size>           Bytes per microtcp_send() call (default 64k)\n"
+            "   -e <spec>           Impairments of every link, as in impairment_proxy (default delay=10ms)\n"
+            "   -S <int>            Seed of the links and the ISNs (default 1)\n"
+            "   -t <seconds>        Virtual time after which the run is abandoned (default 1 day)\n"
+            "   -b                  All flows share one link per direction\n"
+            "   -v <int>            Send and receive each chunk as a vector of this many buffers\n"
+            "   -f                  Fetch a fast open cookie first and send the first MSS in the SYN\n"
+            "   -m                  Send over the stream multiplexer, on two bulk streams of weights 1:3\n"
+            "                       and with an urgent message and a timestamp per chunk on two more\n"
+            "   -p <int>            Send as this many requests through a connection pool, each answered\n"
+            "   -i <ms>             Idle time between the requests of -p (default 0)\n"
+            "   -h                  prints this help\n");
+        exit (EXIT_FAILURE);
+      }
+  }
+  if (flows < 1 || 2 * flows > SIMNET_MAX_HOSTS || !chunk) {
+    fprintf (stderr, "Error: Between 1 and %d flows of a nonzero chunk are supported.\n",
+             SIMNET_MAX_HOSTS / 2);
+    return EXIT_FAILURE;
+  }
+  if (vector < 0 || vector > SIMULATE_MAX_IOV) {
+    fprintf (stderr, "Error: At most %d buffers per vector are supported.\n", SIMULATE_MAX_IOV);
+    return EXIT_FAILURE;
+  }
+  if (mux && (vector || fastopen)) {
+    fprintf (stderr, "Error: -m goes with neither -v nor -f.\n");
+    return EXIT_FAILURE;
+  }
+  if (requests && (vector || fastopen || mux || requests > size || idle_us >= MICROTCP_POOL_IDLE_US)) {
+    fprintf (stderr, "Error: -p takes at most a request per byte, below the idle timeout of the pool, "
+             "and none of -v, -f and -m.\n");
+    return EXIT_FAILURE;
+  }
+  if (netem_parse (&link, spec) == -1)
+    return EXIT_FAILURE;
+
+  sim = simnet_create (&link, shared, seed);
+  flow = calloc (flows, sizeof(flow_t));
+  if (!sim || !flow) {
+    fprintf (stderr, "Error: Out of memory.\n");
+    return EXIT_FAILURE;
+  }
+  simnet_install (sim);
+  for (i = 0; i < flows; i++) {
+    flow[i].id = i;
+    flow[i].size = size;
+    flow[i].chunk = chunk;
+    flow[i].server_host = simnet_spawn (sim, server_endpoint, &flow[i]);
+    simnet_spawn (sim, client_endpoint, &flow[i]);
+  }
+
+  clock_gettime (CLOCK_MONOTONIC, &wall_start);
+  ret = simnet_run (sim, limit_s * 1e6);
+  clock_gettime (CLOCK_MONOTONIC, &wall_end);
+  wall = (wall_end.tv_sec - wall_start.tv_sec) + (wall_end.tv_nsec - wall_start.tv_nsec) * 1e-9;
+  virt = simnet_now_us (sim) * 1e-6;
+
+  for (i = 0; i < flows; i++) {
+    mbits = flow[i].end_us > flow[i].start_us
+        ? flow[i].received * 8.0 / (flow[i].end_us - flow[i].start_us) : 0;
+    printf ("flow %d: %zu of %zu bytes in %.3f s, %.2f Mbit/s, first byte after %.1f ms, "
+            "%zu in the SYN, srtt %u us, %llu retransmitted, %llu timeouts, %s\n",
+            i, flow[i].received, size, (flow[i].end_us - flow[i].start_us) * 1e-6, mbits,
+            flow[i].first_us > flow[i].start_us ? (flow[i].first_us - flow[i].start_us) * 1e-3 : 0,
+            flow[i].syn_bytes,
+            flow[i].info.srtt_us, (unsigned long long) flow[i].info.packets_retransmitted,
+            (unsigned long long) flow[i].info.timeouts,
+            flow[i].corrupted ? "corrupted" : "intact");
+    if (mux)
+      printf ("flow %d mux: urgent message after %zu bulk bytes, stream 1 at %.0f%% of a round when "
+              "stream 2 finished it, %zu timestamps %.1f ms on average, %.1f ms at most, "
+              "%zu of them while segments were held past a gap, in %.1f ms\n",
+              i, flow[i].urgent_after, flow[i].rounds ? 100.0 * flow[i].round_share / (flow[i].rounds * chunk) : 0,
+              flow[i].ticks, flow[i].ticks ? flow[i].tick_delay_us * 1e-3 / flow[i].ticks : 0,
+              flow[i].tick_delay_max_us * 1e-3, flow[i].ticks_past_gap,
+              flow[i].ticks_past_gap ? flow[i].tick_gap_delay_us * 1e-3 / flow[i].ticks_past_gap : 0);
+    if (requests)
+      printf ("flow %d pool: %zu requests, %llu hits, %llu misses, the first in %.1f ms, the rest in "
+              "%.1f ms on average, cwnd %zu on reuse\n",
+              i, requests, (unsigned long long) flow[i].pool.hits, (unsigned long long) flow[i].pool.misses,
+              flow[i].first_request_us * 1e-3,
+              requests > 1 ? flow[i].request_us * 1e-3 / (requests - 1) : 0,
+              flow[i].pool.hits ? flow[i].reuse_cwnd / flow[i].pool.hits : 0);
+    failed |= !flow[i].client_ok || !flow[i].server_ok || flow[i].corrupted
+        || flow[i].received != size;
+  }
+  simnet_get_stats (sim, &stats);
+  printf ("virtual %.3f s, wall %.3f s (%.0fx), %llu datagrams, %llu delivered, "
+          "%llu dropped, %llu switches, digest %016llx\n",
+          virt, wall, wall > 0 ? virt / wall : 0, (unsigned long long) stats.packets,
+          (unsigned long long) stats.delivered, (unsigned long long) stats.dropped,
+          (unsigned long long) stats.wakeups, (unsigned long long) stats.digest);
+
+  if (ret == -1) {
+    fprintf (stderr, "Error: The simulation stopped at %.3f s, deadlocked or past the time limit.\n",
+             virt);
+    /* The blocked endpoints still use the simulator, so it is not freed */
+    return EXIT_FAILURE;
+  }
+  simnet_destroy (sim);
+  free (flow);
+  return failed ? EXIT_FAILURE : 0;
+}
@@ -18,26 +18,363 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+/*
+ * Open loop traffic generator. Every flow listens on its own port (the
+ * base port plus the flow index) and, once a traffic_generator_client
+ * connects, sends messages on a precomputed arrival schedule: the next
+ * intended send time advances by an inter-arrival sample whether or not
+ * the previous send has finished. A flow that falls behind sends back to
+ * back until it catches up, and each message carries its intended time,
+ * so the client sees the queueing delay rather than a slower schedule.
+ *
+ * Inter-arrival times and message sizes are drawn from distributions:
+ *   exp:<mean>             exponential, i.e. Poisson arrivals
+ *   pareto:<mean>[:alpha]  Pareto with shape alpha (default 1.5)
+ *   fixed:<value>          constant
+ *   trace:<file>           values read one per line, replayed in a loop
+ * Times take an ns/us/ms/s suffix (default ms), sizes a K/M suffix. With
+ * -r the inter-arrival distribution is scaled so the flows together
+ * offer the given rate in bits per second.
+ */
+
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <signal.h>
+#include <math.h>
+#include <atomic>
+#include <fstream>
+#include <memory>
 #include <random>
-#include <chrono>
+#include <string>
 #include <thread>
+#include <vector>
+#include <algorithm>
 
 extern "C" {
 #include "../lib/microtcp.h"
 #include "../utils/log.h"
 }
+#include "traffic_generator.h"
+
+#define MAX_MSG_LEN (1024 * 1024)
+#define MAX_SLEEP_NS 100000000ULL      /* Sleep at most this long between stop checks */
+#define LATE_NS 1000000ULL             /* A send this far behind schedule counts as late */
+
+static std::atomic<bool> stop_traffic (false);
+
+/**
+ * A distribution of positive values. Samples and the mean are multiplied
+ * by scale, which lets -r retarget any shape to a given mean.
+ */
+class distribution
+{
+public:
+  double scale = 1.0;
+
+  virtual ~distribution () { }
+  virtual double draw (std::mt19937_64 &gen) = 0;
+  virtual double base_mean () const = 0;
+
+  double sample (std::mt19937_64 &gen) { return scale * draw (gen); }
+  double mean () const { return scale * base_mean (); }
+  void set_mean (double m) { scale = m / base_mean (); }
+};
+
+class exp_distribution : public distribution
+{
+  double m;
+public:
+  exp_distribution (double mean) : m (mean) { }
+  double draw (std::mt19937_64 &gen)
+  {
+    return std::exponential_distribution<double> (1.0 / m) (gen);
+  }
+  double base_mean () const { return m; }
+};
+
+class pareto_distribution : public distribution
+{
+  double m;
+  double alpha;
+public:
+  pareto_distribution (double mean, double shape) : m (mean), alpha (shape) { }
+  double draw (std::mt19937_64 &gen)
+  {
+    /* Inverse transform, with the minimum chosen to give the mean */
+    double xm = m * (alpha - 1) / alpha;
+    double u = std::uniform_real_distribution<double> (0.0, 1.0) (gen);
+    return xm / pow (1.0 - u, 1.0 / alpha);
+  }
+  double base_mean () const { return m; }
+};
+
+class fixed_distribution : public distribution
+{
+  double v;
+public:
+  fixed_distribution (double value) : v (value) { }
+  double draw (std::mt19937_64 &) { return v; }
+  double base_mean () const { return v; }
+};
+
+class trace_distribution : public distribution
+{
+  std::vector<double> values;
+  size_t next = 0;
+  double m = 0;
+public:
+  trace_distribution (const std::vector<double> &v) : values (v)
+  {
+    for (double x : values)
+      m += x;
+    m /= values.size ();
+  }
+  double draw (std::mt19937_64 &)
+  {
+    double v = values[next];
+    next = (next + 1) % values.size ();
+    return v;
+  }
+  double base_mean () const { return m; }
+};
+
+/* Parses "<number>[suffix]" into base units, -1 on error */
+typedef double (*unit_parser_t) (const char *s);
+
+static double
+parse_time_ns (const char *s)
+{
+  char *end;
+  double v = strtod (s, &end);
+  if (end == s || v < 0)
+    return -1;
+  if (!*end || !strcmp (end, "ms"))
+    return v * 1e6;
+  if (!strcmp (end, "us"))
+    return v * 1e3;
+  if (!strcmp (end, "ns"))
+    return v;
+  if (!strcmp (end, "s"))
+    return v * 1e9;
+  return -1;
+}
+
+static double
+parse_size (const char *s)
+{
+  char *end;
+  double v = strtod (s, &end);
+  if (end == s || v < 0)
+    return -1;
+  if (!*end)
+    return v;
+  if (!strcmp (end, "K") || !strcmp (end, "k"))
+    return v * 1024;
+  if (!strcmp (end, "M"))
+    return v * 1024 * 1024;
+  return -1;
+}
+
+static double
+parse_rate (const char *s)
+{
+  char *end;
+  double v = strtod (s, &end);
+  if (end == s || v <= 0)
+    return -1;
+  switch (*end)
+    {
+    case '\0':
+      return v;
+    case 'k':
+    case 'K':
+      return v * 1e3;
+    case 'm':
+    case 'M':
+      return v * 1e6;
+    case 'g':
+    case 'G':
+      return v * 1e9;
+    }
+  return -1;
+}
+
+/**
+ * Creates a distribution from its command line spec, or nullptr.
+ * A bare value is taken as the mean of an exponential, which keeps the
+ * old "-i <ms>" meaning of Poisson arrivals.
+ */
+static std::unique_ptr<distribution>
+make_distribution (const char *spec, unit_parser_t parse)
+{
+  std::string s (spec);
+  size_t colon = s.find (':');
+  std::string kind = colon == std::string::npos ? "exp" : s.substr (0, colon);
+  std::string arg = colon == std::string::npos ? s : s.substr (colon + 1);
+  double v;
+
+  if (kind == "trace") {
+    std::ifstream in (arg);
+    std::vector<double> values;
+    std::string line;
+    while (std::getline (in, line)) {
+      if (line.empty () || line[0] == '#')
+        continue;
+      if ((v = parse (line.c_str ())) < 0) {
+        LOG_ERROR("Invalid value '%s' in %s", line.c_str (), arg.c_str ());
+        return nullptr;
+      }
+      values.push_back (v);
+    }
+    if (values.empty ()) {
+      LOG_ERROR("No values in trace %s", arg.c_str ());
+      return nullptr;
+    }
+    return std::unique_ptr<distribution> (new trace_distribution (values));
+  }
+
+  if (kind == "pareto") {
+    double alpha = 1.5;
+    size_t c = arg.find (':');
+    if (c != std::string::npos) {
+      alpha = atof (arg.c_str () + c + 1);
+      arg = arg.substr (0, c);
+    }
+    if (alpha <= 1 || (v = parse (arg.c_str ())) <= 0) {
+      LOG_ERROR("Invalid pareto spec %s, the shape must be above 1", spec);
+      return nullptr;
+    }
+    return std::unique_ptr<distribution> (new pareto_distribution (v, alpha));
+  }
+
+  if ((v = parse (arg.c_str ())) < 0 || (kind == "exp" && v == 0)) {
+    LOG_ERROR("Invalid distribution value in %s", spec);
+    return nullptr;
+  }
+  if (kind == "exp")
+    return std::unique_ptr<distribution> (new exp_distribution (v));
+  if (kind == "fixed")
+    return std::unique_ptr<distribution> (new fixed_distribution (v));
+  LOG_ERROR("Unknown distribution %s", kind.c_str ());
+  return nullptr;
+}
+
+static uint64_t
+monotonic_ns (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void
+sleep_until_ns (uint64_t deadline)
+{
+  struct timespec ts;
+  uint64_t now;
+  while (!stop_traffic && (now = monotonic_ns ()) < deadline) {
+    uint64_t t = std::min<uint64_t> (deadline, now + MAX_SLEEP_NS);
+    ts.tv_sec = t / 1000000000;
+    ts.tv_nsec = t % 1000000000;
+    clock_nanosleep (CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+  }
+}
 
-#define BUF_LEN 2048
+struct flow_t
+{
+  unsigned id;
+  int port;
+  std::unique_ptr<distribution> inter;
+  std::unique_ptr<distribution> size;
+  std::mt19937_64 gen;
+  std::atomic<bool> connected;
+  std::thread thread;
 
-static bool stop_traffic = false;
+  /* Results, valid once the thread is joined */
+  uint64_t messages = 0;
+  uint64_t bytes = 0;
+  uint64_t late = 0;            /* Sends more than LATE_NS behind schedule */
+  uint64_t max_lag_ns = 0;
+  double sum_lag_ns = 0;
+  double elapsed_s = 0;
 
+  flow_t () : connected (false) { }
+};
+
+static void
+run_flow (flow_t *f)
+{
+  microtcp_sock_t sock;
+  struct sockaddr_in sin;
+  struct sockaddr client_addr;
+  std::vector<char> buffer (MAX_MSG_LEN, 0);
+  uint64_t start, intended, realtime_offset, now, lag;
+  size_t len;
+
+  sock = microtcp_socket (AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  if (sock.sd == -1) {
+    LOG_ERROR("Flow %u: failed to create the socket", f->id);
+    return;
+  }
+  memset (&sin, 0, sizeof(struct sockaddr_in));
+  sin.sin_family = AF_INET;
+  sin.sin_port = htons (f->port);
+  /* Bind to all available network interfaces */
+  sin.sin_addr.s_addr = INADDR_ANY;
+  if (microtcp_bind (&sock, (struct sockaddr *) &sin,
+                     sizeof(struct sockaddr_in)) == -1) {
+    LOG_ERROR("Flow %u: failed to bind port %d", f->id, f->port);
+    return;
+  }
+
+  /* Block waiting for a connection */
+  if (microtcp_accept (&sock, &client_addr, sizeof(struct sockaddr)) != 0) {
+    LOG_ERROR("Flow %u: failed to accept connection", f->id);
+    return;
+  }
+  f->connected = true;
+  LOG_INFO("Flow %u: peer connected on port %d", f->id, f->port);
+
+  /* The schedule runs on the monotonic clock, the wire carries realtime */
+  realtime_offset = traffic_now_ns () - monotonic_ns ();
+  start = intended = monotonic_ns ();
+  while (!stop_traffic) {
+    intended += (uint64_t) f->inter->sample (f->gen);
+    len = (size_t) f->size->sample (f->gen);
+    len = std::max (len, sizeof(traffic_msg_hdr_t));
+    len = std::min (len, (size_t) MAX_MSG_LEN);
+
+    sleep_until_ns (intended);
+    if (stop_traffic)
+      break;
+
+    /* Stamped last, so the delay excludes the sleep */
+    now = monotonic_ns ();
+    lag = now - intended;
+    traffic_msg_hdr_pack (buffer.data (), f->id, len, f->messages,
+                          intended + realtime_offset, now + realtime_offset);
+    if (microtcp_send (&sock, buffer.data (), len, 0) == -1) {
+      LOG_ERROR("Flow %u: failed to send, peer gone?", f->id);
+      break;
+    }
+    f->messages++;
+    f->bytes += len;
+    f->sum_lag_ns += lag;
+    f->max_lag_ns = std::max (f->max_lag_ns, lag);
+    if (lag > LATE_NS)
+      f->late++;
+  }
+  f->elapsed_s = (monotonic_ns () - start) / 1e9;
+
+  LOG_INFO("Flow %u: going to terminate microtcp connection...", f->id);
+  /* SHUT_RDWR can be omitted internally */
+  microtcp_shutdown (&sock, SHUT_RDWR);
+}
 
 void
 sig_handler(int signal)
@@ -52,100 +389,121 @@ int
 main (int argc, char **argv)
 {
   int                   opt;
-  int                   ret;
-  int                   port;
-  int                   mean_inter;
-  microtcp_sock_t       sock;
-  struct sockaddr_in    sin;
-  struct sockaddr       client_addr;
-  socklen_t             client_addr_len;
-  struct sockaddr_in    *addr_in;
-  char                  ip_addr[INET_ADDRSTRLEN];
-  char                  buffer[BUF_LEN];
+  int                   port = 0;
+  unsigned              nflows = 1;
+  double                rate = 0;
+  const char            *inter_spec = nullptr;
+  const char            *size_spec = "fixed:2048";
+  uint64_t              seed;
+  std::vector<std::unique_ptr<flow_t>> flows;
+  double                offered, achieved = 0;
+  uint64_t              total_msgs = 0;
 
   /* Create the random generator */
   std::random_device rd;
-  std::mt19937 gen(rd());
+  seed = ((uint64_t) rd () << 32) | rd ();
 
   /* A very easy way to parse command line arguments */
-  while ((opt = getopt (argc, argv, "hp:i:")) != -1) {
+  while ((opt = getopt (argc, argv, "hp:i:s:f:r:S:")) != -1) {
     switch (opt)
       {
       case 'p':
         port = atoi (optarg);
-        /* To check or not to check? */
         break;
       case 'i':
-        /*
-         * Set the mean of the poisson distribution for the interarrivals
-         * in milliseconds (ms)
-         */
-        mean_inter = atoi (optarg);
+        inter_spec = optarg;
+        break;
+      case 's':
+        size_spec = optarg;
+        break;
+      case 'f':
+        nflows = atoi (optarg);
+        break;
+      case 'r':
+        rate = parse_rate (optarg);
+        break;
+      case 'S':
+        seed = strtoull (optarg, NULL, 0);
         break;
       default:
         printf (
-            "Usage: bandwidth_test -p port -i packet inter-arrival ms"
+            "Usage: traffic_generator -p port [-f flows] [-i inter-arrival] [-s size] [-r rate]\n"
             "Options:\n"
-            "   -p <int>            the port to wait for a peer"
-            "   -i <int>            the mean inter-arrival time in milliseconds of the poisson distribution"
-            "   -h                  prints this help\n");
+            "   -p <int>            the port of the first flow, flow n waits on port + n\n"
+            "   -f <int>            the number of concurrent flows (default 1)\n"
+            "   -i <dist>           the inter-arrival time distribution (default exp:10ms)\n"
+            "   -s <dist>           the message size distribution (default fixed:2048)\n"
+            "   -r <rate>           the aggregate offered load in bit/s, k/M/G suffixes,\n"
+            "                       rescales the mean of the inter-arrival distribution\n"
+            "   -S <int>            the random seed, flow n uses seed + n\n"
+            "   -h                  prints this help\n"
+            "Distributions: exp:<mean> (Poisson), pareto:<mean>[:alpha], fixed:<value>,\n"
+            "trace:<file>. A bare number is exp:<number> in ms.\n");
         exit (EXIT_FAILURE);
       }
   }
-  std::poisson_distribution<int> dpoisson(mean_inter);
-  LOG_INFO("Creating traffic generator on port %d", port);
-  LOG_INFO("Poisson distribution inter-arrivals with mean %u ms", mean_inter);
-
-  /*
-   * Register a signal handler so we can terminate the generator with
-   * Ctrl+C
-   */
-  signal(SIGINT, sig_handler);
-
-  /* Create a microtcp socket */
-  sock = microtcp_socket (AF_INET, 0, 0);
- /* TODO: some error checking here ??? */
-
-  memset (&sin, 0, sizeof(struct sockaddr_in));
-  sin.sin_family = AF_INET;
-  sin.sin_port = htons (port);
-  /* Bind to all available network interfaces */
-  sin.sin_addr.s_addr = INADDR_ANY;
+  if (port <= 0 || nflows < 1 || rate < 0) {
+    LOG_ERROR("A port, at least one flow and a valid rate are required");
+    exit (EXIT_FAILURE);
+  }
+  if (!inter_spec)
+    inter_spec = "exp:10ms";
 
-  if (microtcp_bind (&sock, (struct sockaddr *) &sin,
-                     sizeof(struct sockaddr_in)) == -1) {
-    LOG_ERROR("Failed to bind");
-    return -EXIT_FAILURE;
+  for (unsigned i = 0; i < nflows; i++) {
+    std::unique_ptr<flow_t> f (new flow_t);
+    f->id = i;
+    f->port = port + i;
+    f->gen.seed (seed + i);
+    f->inter = make_distribution (inter_spec, parse_time_ns);
+    f->size = make_distribution (size_spec, parse_size);
+    if (!f->inter || !f->size)
+      exit (EXIT_FAILURE);
+    if (rate)
+      f->inter->set_mean (f->size->mean () * 8 * nflows / rate * 1e9);
+    flows.push_back (std::move (f));
   }
+  offered = flows[0]->size->mean () * 8 * nflows / (flows[0]->inter->mean () / 1e9);
+  LOG_INFO("Creating %u flows on ports %d-%d", nflows, port, port + nflows - 1);
+  LOG_INFO("Inter-arrival %s mean %.3f ms, size %s mean %.0f bytes",
+           inter_spec, flows[0]->inter->mean () / 1e6, size_spec,
+           flows[0]->size->mean ());
+  LOG_INFO("Offered load %.3f Mbit/s, seed %lu", offered / 1e6, seed);
 
   /*
-   * Normally, using the original TCP, we would have to set the socket
-   * in listening mode with listen(). MicroTCP does not provide such function
-   * so we proceed using the equivalent TCP accept()
+   * Block SIGINT in the flow threads, so that it interrupts only the
+   * main thread and never a microtcp call.
    */
+  sigset_t mask, old;
+  sigemptyset (&mask);
+  sigaddset (&mask, SIGINT);
+  pthread_sigmask (SIG_BLOCK, &mask, &old);
+  for (auto &f : flows)
+    f->thread = std::thread (run_flow, f.get ());
+  pthread_sigmask (SIG_SETMASK, &old, NULL);
 
-  /* Block waiting for a connection */
-  client_addr_len = sizeof(struct sockaddr);
-  ret = microtcp_accept(&sock, &client_addr, client_addr_len);
-  if(ret != 0) {
-    LOG_ERROR("Failed to accept connection");
-    return -EXIT_FAILURE;
-  }
-
-  addr_in = (struct sockaddr_in *) &client_addr;
-  inet_ntop(AF_INET, &(addr_in->sin_addr), ip_addr, INET_ADDRSTRLEN);
-  LOG_INFO("Peer %s connected.", ip_addr);
-  std::this_thread::sleep_for (std::chrono::seconds(1));
-  LOG_INFO("Start generating traffic...");
+  signal(SIGINT, sig_handler);
+  while (!stop_traffic)
+    pause ();
 
-  while(stop_traffic == false) {
-    std::this_thread::sleep_for(std::chrono::milliseconds(dpoisson(gen)));
-    microtcp_send(&sock, buffer, BUF_LEN, 0);
+  /* Flows still waiting in accept() cannot be woken, leave them behind */
+  printf ("flow   messages        bytes    Mbit/s  mean lag ms  max lag ms    late\n");
+  for (auto &f : flows) {
+    if (!f->connected) {
+      f->thread.detach ();
+      printf ("%4u   not connected\n", f->id);
+      continue;
+    }
+    f->thread.join ();
+    double mbps = f->elapsed_s > 0 ? f->bytes * 8 / f->elapsed_s / 1e6 : 0;
+    achieved += mbps;
+    total_msgs += f->messages;
+    printf ("%4u %10lu %12lu %9.3f %12.3f %11.3f %7lu\n", f->id, f->messages,
+            f->bytes, mbps, f->messages ? f->sum_lag_ns / f->messages / 1e6 : 0,
+            f->max_lag_ns / 1e6, f->late);
   }
-
-  LOG_INFO("Going to terminate microtcp connection...");
-
-  /* SHUT_RDWR can be omitted internally */
-  microtcp_shutdown(&sock, SHUT_RDWR);
-
+  printf ("total %9lu messages, offered %.3f Mbit/s, achieved %.3f Mbit/s\n",
+          total_msgs, offered / 1e6, achieved);
+  /* Skip the destructors, detached flows may still use their state */
+  fflush (stdout);
+  _exit (0);
 }
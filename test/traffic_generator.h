@@ -0,0 +1,88 @@
+/*
+ * microtcp, a lightweight implementation of TCP for teaching,
+ * and academic purposes.
+ *
+ * Copyright (C) 2017  Manolis Surligas <surligas@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TEST_TRAFFIC_GENERATOR_H_
+#define TEST_TRAFFIC_GENERATOR_H_
+
+#include <stdint.h>
+#include <time.h>
+#include <endian.h>
+
+/*
+ * Every message of traffic_generator starts with this header, in network
+ * byte order, so that traffic_generator_client can measure the one way
+ * delay. The timestamps are CLOCK_REALTIME, so across hosts the clocks
+ * must be synchronized (NTP/PTP) for the absolute delay to be meaningful;
+ * the jitter does not depend on the clock offset.
+ *
+ * The generator is open loop: intended_ns follows the arrival schedule
+ * regardless of how long earlier sends blocked, so delays measured from
+ * it include the time a message waited behind its predecessors and do
+ * not suffer from coordinated omission.
+ */
+#define TRAFFIC_MSG_MAGIC 0x4d544732    /* "MTG2" */
+
+typedef struct
+{
+  uint32_t magic;
+  uint32_t length;              /* Length of the whole message */
+  uint64_t seq;
+  uint64_t sent_ns;             /* Just before microtcp_send() */
+  uint64_t intended_ns;         /* When the open loop schedule wanted it sent */
+  uint32_t flow;
+  uint32_t reserved;
+} traffic_msg_hdr_t;
+
+static inline uint64_t
+traffic_now_ns (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_REALTIME, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static inline void
+traffic_msg_hdr_pack (void *buf, uint32_t flow, uint32_t length, uint64_t seq,
+                      uint64_t intended_ns, uint64_t sent_ns)
+{
+  traffic_msg_hdr_t *h = (traffic_msg_hdr_t *) buf;
+  h->magic = htobe32 (TRAFFIC_MSG_MAGIC);
+  h->length = htobe32 (length);
+  h->seq = htobe64 (seq);
+  h->sent_ns = htobe64 (sent_ns);
+  h->intended_ns = htobe64 (intended_ns);
+  h->flow = htobe32 (flow);
+  h->reserved = 0;
+}
+
+static inline int
+traffic_msg_hdr_unpack (const void *buf, traffic_msg_hdr_t *h)
+{
+  const traffic_msg_hdr_t *n = (const traffic_msg_hdr_t *) buf;
+  h->magic = be32toh (n->magic);
+  h->length = be32toh (n->length);
+  h->seq = be64toh (n->seq);
+  h->sent_ns = be64toh (n->sent_ns);
+  h->intended_ns = be64toh (n->intended_ns);
+  h->flow = be32toh (n->flow);
+  return h->magic == TRAFFIC_MSG_MAGIC && h->length >= sizeof(traffic_msg_hdr_t);
+}
+
+#endif /* TEST_TRAFFIC_GENERATOR_H_ */
@@ -18,8 +18,22 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+/*
+ * Receives the traffic of traffic_generator and measures, for every
+ * message, the one way delay from the send timestamp the generator
+ * embeds to the moment its last byte is returned by microtcp_recv(),
+ * the inter-arrival time and the RFC 3550 interarrival jitter. The delay
+ * from the intended send time of the open loop schedule is kept as well;
+ * it adds the time the message queued behind earlier ones at the sender.
+ *
+ * The samples go to a buffer allocated up front, so the receive loop does
+ * no I/O. On Ctrl+C, or when the generator closes the connection, they
+ * are written as CSV and summarized with percentiles.
+ */
+
 #include <unistd.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -28,37 +42,269 @@
 
 #include "../lib/microtcp.h"
 #include "../utils/log.h"
+#include "traffic_generator.h"
+
+#define RECV_BUF_LEN 2048
+#define DEFAULT_MAX_SAMPLES 1000000
 
-static char running = 1;
+typedef struct
+{
+  uint64_t seq;
+  uint64_t intended_ns;
+  uint64_t sent_ns;
+  uint64_t recv_ns;
+  int64_t latency_ns;
+  int64_t response_ns;
+  int64_t interarrival_ns;
+  double jitter_ns;
+} sample_t;
+
+static volatile sig_atomic_t running = 1;
 
 static void
 sig_handler(int signal)
 {
   if(signal == SIGINT) {
-    LOG_INFO("Stopping traffic generator client...");
     running = 0;
   }
 }
 
+static int
+compare_latency (const void *a, const void *b)
+{
+  int64_t x = *(const int64_t *) a;
+  int64_t y = *(const int64_t *) b;
+  return (x > y) - (x < y);
+}
+
+static int
+dump_csv (const char *file, const sample_t *samples, size_t count)
+{
+  FILE *fp = stdout;
+  size_t i;
+
+  if (file && !(fp = fopen (file, "w"))) {
+    LOG_ERROR("Unable to open %s: %s", file, strerror (errno));
+    return -1;
+  }
+  fprintf (fp, "seq,intended_ns,sent_ns,recv_ns,latency_us,response_us,"
+           "interarrival_us,jitter_us\n");
+  for (i = 0; i < count; i++)
+    fprintf (fp, "%lu,%lu,%lu,%lu,%.3f,%.3f,%.3f,%.3f\n", samples[i].seq,
+             samples[i].intended_ns, samples[i].sent_ns, samples[i].recv_ns,
+             samples[i].latency_ns / 1e3, samples[i].response_ns / 1e3,
+             samples[i].interarrival_ns / 1e3, samples[i].jitter_ns / 1e3);
+  if (fp != stdout)
+    fclose (fp);
+  return 0;
+}
+
+static void
+print_percentiles (const char *what, int64_t *values, size_t count)
+{
+  static const double pct[] = { 50, 90, 99, 99.9, 99.99 };
+  double mean = 0;
+  size_t i;
+
+  for (i = 0; i < count; i++)
+    mean += values[i];
+  qsort (values, count, sizeof(int64_t), compare_latency);
+  fprintf (stderr, "%s (us): min %.1f  mean %.1f", what, values[0] / 1e3,
+           mean / count / 1e3);
+  for (i = 0; i < sizeof(pct) / sizeof(pct[0]); i++)
+    fprintf (stderr, "  p%g %.1f", pct[i],
+             values[(size_t) ((count - 1) * pct[i] / 100)] / 1e3);
+  fprintf (stderr, "  max %.1f\n", values[count - 1] / 1e3);
+}
+
+static void
+print_summary (const sample_t *samples, size_t count, uint32_t flow,
+               uint64_t gaps, uint64_t dropped)
+{
+  int64_t *values;
+  size_t i;
+
+  fprintf (stderr, "flow %u  messages %zu  sequence gaps %lu  not stored %lu\n",
+           flow, count, gaps, dropped);
+  if (!count)
+    return;
+  values = malloc (count * sizeof(int64_t));
+  for (i = 0; i < count; i++)
+    values[i] = samples[i].latency_ns;
+  print_percentiles ("one way delay", values, count);
+  for (i = 0; i < count; i++)
+    values[i] = samples[i].response_ns;
+  print_percentiles ("delay from intended send", values, count);
+  fprintf (stderr, "jitter (us): last %.1f\n", samples[count - 1].jitter_ns / 1e3);
+  free (values);
+}
+
 int
 main(int argc, char **argv) {
-  uint16_t port;
+  int opt;
+  uint16_t port = 0;
+  const char *server_ip = "127.0.0.1";
+  const char *csv_file = NULL;
+  size_t max_samples = DEFAULT_MAX_SAMPLES;
+  microtcp_sock_t sock;
+  struct sockaddr_in sin;
+  struct sigaction sa;
+  sample_t *samples;
+  size_t count = 0;
+  uint64_t dropped = 0;
+  uint64_t gaps = 0;
+  uint64_t next_seq = 0;
+  uint64_t prev_recv_ns = 0;
+  uint64_t prev_sent_ns = 0;
+  double jitter = 0;
+  uint8_t buffer[RECV_BUF_LEN];
+  uint8_t hdr_buf[sizeof(traffic_msg_hdr_t)];
+  traffic_msg_hdr_t hdr = { 0 };
+  size_t hdr_have = 0;
+  size_t msg_left = 0;
+  ssize_t data_size;
+  ssize_t off;
+  size_t n;
+
+  while ((opt = getopt (argc, argv, "ha:p:o:n:")) != -1) {
+    switch (opt)
+      {
+      case 'a':
+        server_ip = optarg;
+        break;
+      case 'p':
+        port = atoi (optarg);
+        break;
+      case 'o':
+        csv_file = optarg;
+        break;
+      case 'n':
+        max_samples = strtoul (optarg, NULL, 10);
+        break;
+      default:
+        printf (
+            "Usage: traffic_generator_client -p port [-a address] [-o file] [-n samples]\n"
+            "Options:\n"
+            "   -a <string>         the address of the traffic generator (default 127.0.0.1)\n"
+            "   -p <int>            the port of the traffic generator\n"
+            "   -o <string>         write the per message CSV here instead of stdout\n"
+            "   -n <int>            messages to keep in memory (default %d)\n"
+            "   -h                  prints this help\n", DEFAULT_MAX_SAMPLES);
+        exit (EXIT_FAILURE);
+      }
+  }
+  if (!port || !max_samples) {
+    LOG_ERROR("A port and a nonzero sample count are required");
+    exit (EXIT_FAILURE);
+  }
+
+  /* Touch every page now, so the loop never faults them in */
+  samples = malloc (max_samples * sizeof(sample_t));
+  if (!samples) {
+    LOG_ERROR("Unable to allocate %zu samples", max_samples);
+    exit (EXIT_FAILURE);
+  }
+  memset (samples, 0, max_samples * sizeof(sample_t));
 
   /*
    * Register a signal handler so we can terminate the client with
-   * Ctrl+C
+   * Ctrl+C. Without SA_RESTART the blocked receive returns.
    */
-  signal(SIGINT, sig_handler);
+  memset (&sa, 0, sizeof(sa));
+  sa.sa_handler = sig_handler;
+  sigaction (SIGINT, &sa, NULL);
+
+  if ((sock = microtcp_socket (AF_INET, SOCK_DGRAM, IPPROTO_UDP)).sd == -1) {
+    LOG_ERROR("Unable to create the socket");
+    exit (EXIT_FAILURE);
+  }
+  memset (&sin, 0, sizeof(struct sockaddr_in));
+  sin.sin_family = AF_INET;
+  sin.sin_port = htons (port);
+  if (inet_pton (AF_INET, server_ip, &sin.sin_addr) != 1) {
+    LOG_ERROR("Invalid address %s", server_ip);
+    exit (EXIT_FAILURE);
+  }
+  if (microtcp_connect (&sock, (struct sockaddr *) &sin, sizeof(sin)) == -1) {
+    LOG_ERROR("Unable to connect to %s:%u", server_ip, port);
+    exit (EXIT_FAILURE);
+  }
 
   LOG_INFO("Start receiving traffic from port %u", port);
-  /*TODO: Connect using microtcp_connect() */
   while(running) {
-    /* TODO: Measure time */
-    /* TODO: Receive using microtcp_recv()*/
-    /* TODO: Measure time */
-    /* TODO: Do other stuff... */
+    data_size = microtcp_recv (&sock, buffer, RECV_BUF_LEN, 0);
+    if (data_size == -1) {
+      if (running && sock.state != CLOSING_BY_PEER)
+        LOG_ERROR("Receive failed");
+      break;
+    }
+
+    /* Messages may span receives, parse the stream byte by byte */
+    off = 0;
+    while (off < data_size) {
+      if (hdr_have < sizeof(hdr_buf)) {
+        n = MIN(sizeof(hdr_buf) - hdr_have, (size_t) (data_size - off));
+        memcpy (hdr_buf + hdr_have, buffer + off, n);
+        hdr_have += n;
+        off += n;
+        if (hdr_have < sizeof(hdr_buf))
+          break;
+        if (!traffic_msg_hdr_unpack (hdr_buf, &hdr)) {
+          LOG_ERROR("Stream out of sync, not a traffic_generator peer?");
+          running = 0;
+          break;
+        }
+        msg_left = hdr.length - sizeof(hdr_buf);
+      }
+      n = MIN(msg_left, (size_t) (data_size - off));
+      msg_left -= n;
+      off += n;
+      if (msg_left)
+        break;
+
+      /* Last byte of the message delivered */
+      uint64_t now = traffic_now_ns ();
+      if (hdr.seq != next_seq)
+        gaps++;
+      next_seq = hdr.seq + 1;
+      if (prev_recv_ns) {
+        /* RFC 3550: J += (|D(i-1,i)| - J) / 16 */
+        int64_t d = (int64_t) (now - prev_recv_ns) - (int64_t) (hdr.sent_ns - prev_sent_ns);
+        jitter += ((d < 0 ? -d : d) - jitter) / 16;
+      }
+      if (count < max_samples) {
+        samples[count].seq = hdr.seq;
+        samples[count].intended_ns = hdr.intended_ns;
+        samples[count].sent_ns = hdr.sent_ns;
+        samples[count].recv_ns = now;
+        samples[count].latency_ns = now - hdr.sent_ns;
+        samples[count].response_ns = now - hdr.intended_ns;
+        samples[count].interarrival_ns = prev_recv_ns ? now - prev_recv_ns : 0;
+        samples[count].jitter_ns = jitter;
+        count++;
+      }
+      else
+        dropped++;
+      prev_recv_ns = now;
+      prev_sent_ns = hdr.sent_ns;
+      hdr_have = 0;
+    }
   }
 
-  /* Ctrl+C pressed! Store properly time measurements for plotting */
-}
+  /* Ctrl+C pressed or the generator left, store the measurements */
+  LOG_INFO("Stopping traffic generator client...");
+  dump_csv (csv_file, samples, count);
+  print_summary (samples, count, hdr.flow, gaps, dropped);
+  free (samples);
 
+  /*
+   * Only a connection the generator closed is shut down gracefully. The
+   * generator does not read while it sends, so it would never answer our
+   * FIN; closing the descriptor makes its next send fail instead.
+   */
+  if (sock.state == CLOSING_BY_PEER)
+    microtcp_shutdown (&sock, SHUT_RDWR);
+  else
+    close (sock.sd);
+  return 0;
+}
@@ -0,0 +1,199 @@
+/*
+ * microtcp, a lightweight implementation of TCP for teaching,
+ * and academic purposes.
+ *
+ * Copyright (C) 2015-2017  Manolis Surligas <surligas@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Lists the connections that processes publish in shared memory (run
+ * them with MICROTCP_STAT set), like ss does for the kernel's TCP.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "../lib/microtcp_stat.h"
+
+static const char *
+state_name (uint32_t state)
+{
+  static const char *names[] = {
+    "ESTABLISHED", "ESTABLISHED", "ESTABLISHED", "UNKNOWN",
+    "CLOSING_BY_PEER", "CLOSING_BY_HOST", "CLOSED", "INVALID"
+  };
+  if (state >= sizeof(names) / sizeof(names[0]))
+    return "?";
+  return names[state];
+}
+
+static void
+format_address (char *out, size_t len, const struct sockaddr_in *addr)
+{
+  char ip[INET_ADDRSTRLEN];
+  if (!inet_ntop (AF_INET, &addr->sin_addr, ip, sizeof(ip)))
+    strcpy (ip, "?");
+  snprintf (out, len, "%s:%u", ip, ntohs (addr->sin_port));
+}
+
+static void
+print_slot (int pid, const microtcp_stat_slot_t *s, uint64_t now)
+{
+  char local[32];
+  char peer[32];
+  char ratio[16] = "-";
+  /* Rates of a connection that went quiet are stale */
+  int idle = now - s->updated_us > 2 * MICROTCP_STAT_RATE_US;
+  /* Payload bytes over wire bytes of the compression stage, both directions */
+  uint64_t payload = s->info.compress_bytes_in + s->info.decompress_bytes_out;
+  uint64_t wire = s->info.compress_bytes_out + s->info.decompress_bytes_in;
+
+  format_address (local, sizeof(local), &s->local);
+  format_address (peer, sizeof(peer), &s->peer);
+  if (wire)
+    snprintf (ratio, sizeof(ratio), "%.2f", (double) payload / wire);
+  printf ("%-7d %-4d %-15s %-21s %-21s %-8u %-8u %-9.3f %-8.1f %-8u %-8" PRIu64
+          " %-10.3f %-10.3f %-6s\n", pid, s->sd, state_name (s->info.state), local,
+          peer, s->info.cwnd, s->info.ssthresh, s->info.srtt_us / 1e3,
+          s->info.rto_us / 1e3, s->info.bytes_in_flight,
+          s->info.packets_retransmitted,
+          idle ? 0.0 : s->send_rate / 1e6, idle ? 0.0 : s->recv_rate / 1e6, ratio);
+}
+
+static int
+list_process (const char *name, int pid_filter, uint64_t now)
+{
+  microtcp_stat_region_t *region;
+  microtcp_stat_slot_t copy;
+  struct stat st;
+  int shown = 0;
+  uint32_t i;
+  int fd;
+
+  fd = shm_open (name, O_RDONLY, 0);
+  if (fd == -1)
+    return 0;
+  if (fstat (fd, &st) == -1 || (size_t) st.st_size < sizeof(microtcp_stat_region_t)) {
+    close (fd);
+    return 0;
+  }
+  region = mmap (NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close (fd);
+  if (region == MAP_FAILED)
+    return 0;
+
+  if (memcmp (region->magic, MICROTCP_STAT_MAGIC, sizeof(region->magic))
+      || region->slot_size != sizeof(microtcp_stat_slot_t)
+      || sizeof(microtcp_stat_region_t) + (size_t) region->slots * region->slot_size
+         > (size_t) st.st_size
+      || (pid_filter && region->pid != pid_filter)
+      || (kill (region->pid, 0) == -1 && errno == ESRCH)) {
+    munmap (region, st.st_size);
+    return 0;
+  }
+  for (i = 0; i < region->slots; i++) {
+    if (!__atomic_load_n (&region->slot[i].in_use, __ATOMIC_ACQUIRE))
+      continue;
+    /* A writer that died in the middle of an update leaves its slot odd */
+    if (microtcp_stat_read (&region->slot[i], &copy) == -1) {
+      fprintf (stderr, "Warning: Slot %u of process %d is stuck in an update, skipped.\n",
+               i, (int) region->pid);
+      continue;
+    }
+    print_slot (region->pid, &copy, now);
+    shown++;
+  }
+  munmap (region, st.st_size);
+  return shown;
+}
+
+static int
+list_all (int pid_filter)
+{
+  DIR *dir;
+  struct dirent *entry;
+  char name[NAME_MAX + 2];
+  uint64_t now = microtcp_now_us ();
+  int shown = 0;
+
+  printf ("%-7s %-4s %-15s %-21s %-21s %-8s %-8s %-9s %-8s %-8s %-8s %-10s %-10s %-6s\n",
+          "PID", "SD", "STATE", "LOCAL", "PEER", "CWND", "SSTHRESH", "SRTT(ms)",
+          "RTO(ms)", "INFLIGHT", "RETX", "SEND(MB/s)", "RECV(MB/s)", "ZRATIO");
+  dir = opendir ("/dev/shm");
+  if (!dir) {
+    perror ("Open /dev/shm");
+    return -1;
+  }
+  while ((entry = readdir (dir))) {
+    if (strncmp (entry->d_name, MICROTCP_STAT_PREFIX, strlen (MICROTCP_STAT_PREFIX)))
+      continue;
+    snprintf (name, sizeof(name), "/%s", entry->d_name);
+    shown += list_process (name, pid_filter, now);
+  }
+  closedir (dir);
+  return shown;
+}
+
+int
+main (int argc, char **argv)
+{
+  int opt;
+  int pid = 0;
+  double interval = 0;
+
+  while ((opt = getopt (argc, argv, "hw:p:")) != -1) {
+    switch (opt)
+      {
+      case 'w':
+        interval = strtod (optarg, NULL);
+        break;
+      case 'p':
+        pid = atoi (optarg);
+        break;
+      default:
+        printf (
+            "Usage: microtcp-stat [-w seconds] [-p pid]\n"
+            "Lists the connections of processes started with MICROTCP_STAT set.\n"
+            "Options:\n"
+            "   -w <double>         watch, refreshing every this many seconds\n"
+            "   -p <int>            show only the connections of this process\n"
+            "   -h                  prints this help\n");
+        exit (EXIT_FAILURE);
+      }
+  }
+
+  if (interval <= 0)
+    return list_all (pid) < 0 ? EXIT_FAILURE : 0;
+  while (1) {
+    /* Clear the terminal and home the cursor */
+    printf ("\033[H\033[2J");
+    if (list_all (pid) < 0)
+      return EXIT_FAILURE;
+    fflush (stdout);
+    usleep (interval * 1e6);
+  }
+  return 0;
+}
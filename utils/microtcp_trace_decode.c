@@ -0,0 +1,140 @@
+/*
+ * microtcp, a lightweight implementation of TCP for teaching,
+ * and academic purposes.
+ *
+ * Copyright (C) 2015-2017  Manolis Surligas <surligas@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Renders a binary trace written by microtcp_trace_dump() as text, one
+ * event per line, merged across threads in timestamp order.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <inttypes.h>
+
+#include "../lib/microtcp_trace.h"
+
+typedef struct
+{
+  uint64_t tid;
+  microtcp_trace_record_t record;
+} decoded_t;
+
+static int
+compare_records (const void *a, const void *b)
+{
+  const decoded_t *x = a;
+  const decoded_t *y = b;
+  if (x->record.timestamp_ns < y->record.timestamp_ns)
+    return -1;
+  return x->record.timestamp_ns > y->record.timestamp_ns;
+}
+
+int
+main (int argc, char **argv)
+{
+  int opt;
+  int absolute = 0;
+  int min_level = MICROTCP_TRACE_DEBUG;
+  FILE *fp;
+  char magic[sizeof(MICROTCP_TRACE_MAGIC) - 1];
+  uint32_t record_size;
+  microtcp_trace_chunk_t chunk;
+  decoded_t *events = NULL;
+  size_t n_events = 0;
+  size_t i;
+  uint64_t j;
+  uint64_t base;
+
+  while ((opt = getopt (argc, argv, "hal:")) != -1) {
+    switch (opt)
+      {
+      case 'a':
+        absolute = 1;
+        break;
+      case 'l':
+        min_level = atoi (optarg);
+        break;
+      default:
+        printf (
+            "Usage: microtcp-trace [-a] [-l level] trace_file\n"
+            "Options:\n"
+            "   -a                  print absolute CLOCK_MONOTONIC timestamps\n"
+            "   -l <int>            print only events up to this level (1 error, 2 info, 3 debug)\n"
+            "   -h                  prints this help\n");
+        exit (EXIT_FAILURE);
+      }
+  }
+  if (optind >= argc) {
+    fprintf (stderr, "Error: No trace file given.\n");
+    return EXIT_FAILURE;
+  }
+
+  fp = fopen (argv[optind], "r");
+  if (!fp) {
+    perror ("Open trace file");
+    return EXIT_FAILURE;
+  }
+  if (fread (magic, sizeof(magic), 1, fp) != 1
+      || memcmp (magic, MICROTCP_TRACE_MAGIC, sizeof(magic))
+      || fread (&record_size, sizeof(record_size), 1, fp) != 1
+      || record_size != sizeof(microtcp_trace_record_t)) {
+    fprintf (stderr, "Error: Not a microTCP trace file.\n");
+    fclose (fp);
+    return EXIT_FAILURE;
+  }
+
+  while (fread (&chunk, sizeof(chunk), 1, fp) == 1) {
+    if (chunk.dropped)
+      fprintf (stderr, "Warning: thread %" PRIu64 " lost %" PRIu64
+               " older events.\n", chunk.tid, chunk.dropped);
+    events = realloc (events, (n_events + chunk.count) * sizeof(decoded_t));
+    if (!events) {
+      perror ("Allocate events");
+      fclose (fp);
+      return EXIT_FAILURE;
+    }
+    for (j = 0; j < chunk.count; j++) {
+      events[n_events].tid = chunk.tid;
+      if (fread (&events[n_events].record, record_size, 1, fp) != 1) {
+        fprintf (stderr, "Error: Truncated trace file.\n");
+        fclose (fp);
+        free (events);
+        return EXIT_FAILURE;
+      }
+      n_events++;
+    }
+  }
+  fclose (fp);
+
+  qsort (events, n_events, sizeof(decoded_t), compare_records);
+  base = (n_events && !absolute) ? events[0].record.timestamp_ns : 0;
+  for (i = 0; i < n_events; i++) {
+    microtcp_trace_record_t *r = &events[i].record;
+    if (r->level > min_level)
+      continue;
+    printf ("%14.3f us tid %-7" PRIu64 " sd %-4d %-16s seq %-10u ack %-10u "
+            "cwnd %-8u arg %u\n", (r->timestamp_ns - base) / 1e3,
+            events[i].tid, r->sd, microtcp_trace_event_name (r->event),
+            r->seq, r->ack, r->cwnd, r->arg);
+  }
+  free (events);
+  return 0;
+}
@@ -0,0 +1,89 @@
+/*
+ * microtcp, a lightweight implementation of TCP for teaching,
+ * and academic purposes.
+ *
+ * Copyright (C) 2015-2017  Manolis Surligas <surligas@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef UTILS_SIPHASH_H_
+#define UTILS_SIPHASH_H_
+
+#include <stdint.h>
+#include <string.h>
+
+#define SIPHASH_ROTL(x, b) (uint64_t) (((x) << (b)) | ((x) >> (64 - (b))))
+
+#define SIPHASH_ROUND(v0, v1, v2, v3)                                          \
+  do {                                                                         \
+    v0 += v1; v1 = SIPHASH_ROTL (v1, 13); v1 ^= v0; v0 = SIPHASH_ROTL (v0, 32); \
+    v2 += v3; v3 = SIPHASH_ROTL (v3, 16); v3 ^= v2;                            \
+    v0 += v3; v3 = SIPHASH_ROTL (v3, 21); v3 ^= v0;                            \
+    v2 += v1; v1 = SIPHASH_ROTL (v1, 17); v1 ^= v2; v2 = SIPHASH_ROTL (v2, 32); \
+  } while (0)
+
+static inline uint64_t
+siphash_load64 (const uint8_t *p)
+{
+  return (uint64_t) p[0] | (uint64_t) p[1] << 8 | (uint64_t) p[2] << 16
+      | (uint64_t) p[3] << 24 | (uint64_t) p[4] << 32 | (uint64_t) p[5] << 40
+      | (uint64_t) p[6] << 48 | (uint64_t) p[7] << 56;
+}
+
+/**
+ * SipHash-2-4, a keyed hash fast enough for short inputs and strong
+ * enough that the output cannot be predicted without the key.
+ *
+ * @param key 16 secret bytes
+ * @param data the buffer containing the data
+ * @param len the length of the buffer
+ * @return the 64 bit MAC
+ */
+static inline uint64_t
+siphash24 (const uint8_t key[16], const uint8_t *data, size_t len)
+{
+  uint64_t k0 = siphash_load64 (key);
+  uint64_t k1 = siphash_load64 (key + 8);
+  uint64_t v0 = 0x736f6d6570736575ULL ^ k0;
+  uint64_t v1 = 0x646f72616e646f6dULL ^ k1;
+  uint64_t v2 = 0x6c7967656e657261ULL ^ k0;
+  uint64_t v3 = 0x7465646279746573ULL ^ k1;
+  uint64_t b = (uint64_t) len << 56;
+  uint8_t tail[8] = { 0 };
+  uint64_t m;
+  size_t i;
+
+  for (i = 0; i + 8 <= len; i += 8) {
+    m = siphash_load64 (data + i);
+    v3 ^= m;
+    SIPHASH_ROUND (v0, v1, v2, v3);
+    SIPHASH_ROUND (v0, v1, v2, v3);
+    v0 ^= m;
+  }
+  memcpy (tail, data + i, len - i);
+  b |= siphash_load64 (tail);
+  v3 ^= b;
+  SIPHASH_ROUND (v0, v1, v2, v3);
+  SIPHASH_ROUND (v0, v1, v2, v3);
+  v0 ^= b;
+  v2 ^= 0xff;
+  SIPHASH_ROUND (v0, v1, v2, v3);
+  SIPHASH_ROUND (v0, v1, v2, v3);
+  SIPHASH_ROUND (v0, v1, v2, v3);
+  SIPHASH_ROUND (v0, v1, v2, v3);
+  return v0 ^ v1 ^ v2 ^ v3;
+}
+
+#endif /* UTILS_SIPHASH_H_ */